@@ -0,0 +1,39 @@
+// The asset bundle, written by tools/bundle_packer.cpp at build time and
+// mapped by the app: a BundleHeader, entry_count BundleEntry, then the data of
+// every entry starting on a BUNDLE_ALIGNMENT boundary.
+#pragma once
+
+#include <cstdint>
+
+#define BUNDLE_MAGIC 0x4c444e42 // "BNDL"
+#define BUNDLE_VERSION 1
+
+// page aligned, so an entry can be used straight from the mapping, and its
+// pages dropped one by one once they are copied to the gpu
+#define BUNDLE_ALIGNMENT 4096
+
+// compressed entries are split into chunks of this many uncompressed bytes,
+// so they can be decompressed into the staging ring a chunk at a time
+#define BUNDLE_CHUNK_SIZE (1024 * 1024)
+
+#define BUNDLE_NAME_SIZE 48
+
+#define BUNDLE_COMPRESSION_NONE 0
+// a uint32_t compressed size per chunk, then the lz4 compressed chunks
+#define BUNDLE_COMPRESSION_LZ4 1
+
+struct BundleHeader {
+  uint32_t magic;
+  uint32_t version;
+  uint32_t entry_count;
+  uint32_t reserved;
+};
+
+struct BundleEntry {
+  char name[BUNDLE_NAME_SIZE]; // zero terminated
+  uint64_t offset;             // of the data, from the start of the file
+  uint64_t size;               // of the data as stored
+  uint64_t raw_size;           // once decompressed, == size if stored as is
+  uint32_t compression;
+  uint32_t reserved;
+};
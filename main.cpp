@@ -1,7 +1,21 @@
 #include <alloca.h>
+#include <algorithm>
+#include <chrono>
+#include <cmath>
 #include <cstddef>
 #include <cstdio>
+#include <cstdlib>
+#include <condition_variable>
+#include <csignal>
 #include <cstring>
+#include <mutex>
+#include <thread>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
 #include <glm/common.hpp>
 #include <vulkan/vulkan_core.h>
 #define GLFW_INCLUDE_VULKAN
@@ -14,64 +28,1128 @@
 
 #include <stdio.h>
 
+// cmake defines HOT_RELOAD when the glslang library is there, shaders are then
+// recompiled from SHADER_SOURCE_DIR when they change
+#ifdef HOT_RELOAD
+#include <glslang/Include/glslang_c_interface.h>
+#include <glslang/Public/resource_limits_c.h>
+#include <poll.h>
+#include <sys/inotify.h>
+#endif
+// cmake defines HAVE_LZ4 when lz4 is there to read compressed bundle entries
+#ifdef HAVE_LZ4
+#include <lz4.h>
+#endif
+
+#include "bundle.h"
+#include "scene.h"
+
 #define APPLICATION_NAME "Vulkan window"
 
+// where the compiled .spv files are, cmake points this at the build dir
+#ifndef SHADER_DIR
+#define SHADER_DIR "shaders"
+#endif
+
+// the packed shaders and meshes, cmake points this at the one it builds
+#ifndef ASSET_BUNDLE
+#define ASSET_BUNDLE "assets.bundle"
+#endif
+
 #define ENABLE_VALIDATION_LAYERS 1
 
-// how many frames we can render at once
-#define MAX_FRAMES_IN_FLIGHT 2
+// upper bound for how many frames we can render at once, per frame resources
+// exist this many times. The count actually used is --frames-in-flight.
+#define MAX_FRAMES_IN_FLIGHT 4
 
 const char *deviceExtensions[] = {
     VK_KHR_SWAPCHAIN_EXTENSION_NAME,
 };
+// enabled where the device has both, --pace needs them
+const char *presentWaitExtensions[] = {
+    VK_KHR_PRESENT_ID_EXTENSION_NAME,
+    VK_KHR_PRESENT_WAIT_EXTENSION_NAME,
+};
+
+// monotonic wall clock in seconds, usable without glfw (headless mode)
+double my_vk_time() {
+  timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (double)ts.tv_sec + (double)ts.tv_nsec * 1e-9;
+}
+
+// nearest-rank percentile, samples must be sorted
+double percentile_sorted(const double *samples, uint32_t count, double p) {
+  if (count == 0) {
+    return 0.0;
+  }
+  uint32_t idx = (uint32_t)ceil(p / 100.0 * count);
+  if (idx > 0) {
+    idx -= 1;
+  }
+  if (idx >= count) {
+    idx = count - 1;
+  }
+  return samples[idx];
+}
+
+double stddev(const double *samples, uint32_t count) {
+  if (count == 0) {
+    return 0.0;
+  }
+  double sum = 0.0, sum_sq = 0.0;
+  for (uint32_t i = 0; i < count; ++i) {
+    sum += samples[i];
+    sum_sq += samples[i] * samples[i];
+  }
+  double mean = sum / count;
+  return sqrt(std::max(sum_sq / count - mean * mean, 0.0));
+}
 
 char *read_whole_file(const char *file_name, long *size_write_to) {
+  *size_write_to = 0;
   FILE *file = fopen(file_name, "r");
-  if (file == NULL)
+  if (file == NULL) {
     printf("ERROR: could not find file %s!\n", file_name);
-  fseek(file, 0L, SEEK_END);
-  long size = ftell(file);
-  *size_write_to = size;
+    return NULL;
+  }
+  long size = -1;
+  if (fseek(file, 0L, SEEK_END) == 0) {
+    size = ftell(file);
+  }
   rewind(file);
-  char *buf = (char *)malloc(size);
-  fread(buf, 1, size, file);
+  // zero terminated so text files can be used as strings
+  char *buf = size >= 0 ? (char *)malloc(size + 1) : NULL;
+  if (buf == NULL || fread(buf, 1, size, file) != (size_t)size) {
+    printf("ERROR: could not read file %s!\n", file_name);
+    free(buf);
+    fclose(file);
+    return NULL;
+  }
+  buf[size] = '\0';
   fclose(file);
+  *size_write_to = size;
   return buf;
 }
 
-VkShaderModule create_shader_module(VkDevice device, const char *file_name) {
-  VkShaderModule shader_module;
-  long size;
-  char *buf = read_whole_file(file_name, &size);
+// a read only mapping of a whole file. Nothing is copied, pages are read in
+// from the page cache when first touched.
+struct MappedFile {
+  const char *data; // page aligned, NULL if the file couldn't be mapped
+  size_t size;
+};
+
+MappedFile map_file(const char *file_name) {
+  MappedFile f{NULL, 0};
+  int fd = open(file_name, O_RDONLY | O_CLOEXEC);
+  if (fd < 0) {
+    printf("ERROR: could not find file %s!\n", file_name);
+    return f;
+  }
+  struct stat st;
+  if (fstat(fd, &st) != 0 || st.st_size == 0) {
+    printf("ERROR: %s is empty or can't be read!\n", file_name);
+    close(fd);
+    return f;
+  }
+  void *data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd); // the mapping keeps the file open
+  if (data == MAP_FAILED) {
+    printf("ERROR: could not map %s!\n", file_name);
+    return f;
+  }
+  f.data = (const char *)data;
+  f.size = st.st_size;
+  return f;
+}
+
+void unmap_file(MappedFile *f) {
+  if (f->data != NULL) {
+    munmap((void *)f->data, f->size);
+  }
+  *f = MappedFile{NULL, 0};
+}
 
+// code has to be 4 byte aligned, mappings and bundle entries are
+VkShaderModule create_shader_module_from(VkDevice device, const char *code,
+                                         size_t size, const char *name) {
+  VkShaderModule shader_module = VK_NULL_HANDLE;
   VkShaderModuleCreateInfo createInfo{};
   createInfo.sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO;
   createInfo.codeSize = size;
-  createInfo.pCode = (uint32_t *)buf; // safe bc of malloc default alignment
+  createInfo.pCode = (const uint32_t *)code;
   if (vkCreateShaderModule(device, &createInfo, nullptr, &shader_module) !=
       VK_SUCCESS) {
-    printf("ERROR: could not create %s shader module!\n", file_name);
+    printf("ERROR: could not create %s shader module!\n", name);
   }
-  free(buf);
   return shader_module;
 }
 
+VkShaderModule create_shader_module(VkDevice device, const char *file_name) {
+  MappedFile file = map_file(file_name);
+  if (file.data == NULL) {
+    return VK_NULL_HANDLE;
+  }
+  VkShaderModule shader_module =
+      create_shader_module_from(device, file.data, file.size, file_name);
+  unmap_file(&file);
+  return shader_module;
+}
+
+#define MAX_TEXTURES 16
+
+// what the instance pre-pass culls
+#define CULL_FRUSTUM 1
+#define CULL_OCCLUSION 2
+// what the present mode is picked for: immediate (tears) else mailbox else
+// fifo, mailbox (no tearing, frames may be dropped) else fifo, or fifo (one
+// frame per vblank, the cpu and gpu idle in between)
+#define PRESENT_LATENCY 0
+#define PRESENT_MAILBOX 1
+#define PRESENT_FIFO 2
+#define PRESENT_POLICY_COUNT 3
+
+// runtime settings, filled from the command line in my_vk_parse_args
+struct MyVkOptions {
+  bool validation = ENABLE_VALIDATION_LAYERS;
+  // render into plain VkImages instead of a swapchain, no window needed
+  bool headless = false;
+  uint32_t width = 800, height = 600;
+  // frames to render before exiting, 0 = until the window is closed
+  uint32_t frames = 0;
+  // run the frame-time benchmark for this many frames
+  uint32_t bench_frames = 0;
+  uint32_t bench_warmup = 60;
+  const char *bench_json_path = "bench.json"; // "-" for stdout
+  // print rolling profiler stats every few seconds
+  bool profile = false;
+  // list extensions, devices, formats and present modes while starting up
+  bool verbose = false;
+  // run the startup stages on this many threads, 1 = one after another, 0 =
+  // all cores up to STARTUP_MAX_THREADS
+  uint32_t startup_threads = 0;
+  // write a chrome://tracing json of cpu and gpu scopes on exit
+  const char *trace_path = NULL;
+  // VkPipelineCache blob loaded at startup and written back on exit
+  const char *pipeline_cache_path = "pipeline_cache.bin"; // NULL = disabled
+  const char *bundle_path = ASSET_BUNDLE; // NULL = loose files only
+  // draw an NxN grid of quads instead of the single triangle, 0 = triangle
+  uint32_t mesh_grid = 0;
+  // load the mesh from this file instead, NULL = generated
+  const char *mesh_path = NULL;
+  // save the generated mesh as a mesh file
+  const char *write_mesh_path = NULL;
+  // ktx2 files or bundle entries, draw i samples texture i % texture_count
+  const char *texture_paths[MAX_TEXTURES];
+  uint32_t texture_count = 0;
+  // device memory the streamed textures may use, in MiB
+  uint32_t texture_budget_mb = 256;
+  // write a generated checkerboard as a ktx2 file
+  const char *write_texture_path = NULL;
+  // index textures and draw data from one bindless set instead of binding
+  // descriptor sets per draw
+  bool bindless = false;
+  // benchmark recording with per draw descriptor sets against bindless
+  bool bench_bindless = false;
+  // draw with a VkRenderPass and framebuffers instead of dynamic rendering,
+  // to compare. Vulkan 1.3 is required either way.
+  bool render_pass = false;
+  // print the compiled render graph and its transient memory once
+  bool dump_graph = false;
+  // depth buffer of the main pass, UNDEFINED = only the one the instances
+  // need, in a format picked for them
+  VkFormat depth_format = VK_FORMAT_UNDEFINED;
+  // samples per pixel of the main pass, resolved into the swapchain image
+  uint32_t msaa = 1;
+  // report what the attachments take at every depth format and sample count
+  bool bench_attachments = false;
+  // a transform hierarchy of this many nodes, updated every frame, 0 = none
+  uint32_t scene_nodes = 0;
+  uint32_t scene_threads = 0; // that update it, 0 = all cores
+  // compare the scene update with naive per node matrix math
+  bool bench_scene = false;
+  uint32_t present_policy = PRESENT_LATENCY;
+  // wait for each present to be shown and start the next frame as late as
+  // it can still make the following vblank, where present wait is supported
+  bool pace = false;
+  // benchmark every present policy with and without pacing
+  bool bench_present = false;
+  // write every rendered frame, as raw pixels, to this file or pipe
+  const char *readback_path = NULL;
+  // report readback throughput and latency, to readback_path if given
+  bool bench_readback = false;
+  // split the mesh into this many draw calls
+  uint32_t draws = 1;
+  // record the draws into secondary command buffers on this many threads,
+  // 0 = record inline into the primary buffer
+  uint32_t record_threads = 0;
+  uint32_t frames_in_flight = 2; // 1..MAX_FRAMES_IN_FLIGHT
+  // benchmark input to present latency at every frames in flight count
+  bool bench_latency = false;
+  // run the instance pre-pass on the compute queue
+  bool async_compute = false;
+  // benchmark the pre-pass on the graphics queue against async compute
+  bool bench_async = false;
+  // benchmark the worst frame time while the window keeps being resized
+  bool bench_resize = false;
+  // record every vulkan object, report live counts and leaks
+  bool track_handles = false;
+  // recompile shaders when their source changes and swap in new pipelines
+  bool hot_reload = false;
+  // benchmark every thread count from 1 to record_threads (or all cores)
+  bool bench_scaling = false;
+  // draw the mesh this many times from an instance buffer, 0 = off
+  uint32_t instances = 0;
+  // one vkCmdDrawIndexed per instance instead of the gpu-driven indirect draw
+  bool naive_instances = false;
+  // benchmark naive against indirect at 1k, 10k and 100k instances
+  bool bench_instances = false;
+  uint32_t cull_flags = CULL_FRUSTUM | CULL_OCCLUSION;
+};
+
+struct Vertex {
+  glm::vec2 pos;
+  glm::vec3 color;
+};
+
+// starts a mesh file, followed by vertex_count Vertex and index_count uint32_t
+#define MESH_FILE_MAGIC 0x4853454d // "MESH"
+struct MeshFileHeader {
+  uint32_t magic;
+  uint32_t vertex_count;
+  uint32_t index_count;
+  uint32_t reserved; // pads the header to 16 bytes
+};
+
+// the mapped asset bundle, entries point into the mapping
+struct MyVkBundle {
+  MappedFile file;
+  const BundleEntry *entries;
+  uint32_t entry_count;
+  char *scratch; // one decompressed chunk
+};
+
+// device memory is sub-allocated from blocks of this size per memory type
+#define ALLOC_BLOCK_SIZE (64ull * 1024 * 1024)
+// smallest buddy, every allocation is rounded up to a power of two >= this
+#define ALLOC_MIN_SIZE 1024
+#define ALLOC_MAX_BLOCKS 128
+// per frame in flight, for data that is only used by one frame
+#define FRAME_ARENA_SIZE (4ull * 1024 * 1024)
+
+struct MyAllocation {
+  VkDeviceMemory memory;
+  VkDeviceSize offset, size;
+  void *mapped; // NULL unless the memory is host visible
+  uint32_t type;
+  uint32_t block; // UINT32_MAX for dedicated allocations
+  uint32_t order; // buddy size is ALLOC_MIN_SIZE << order
+};
+
+struct MemoryBlock {
+  VkDeviceMemory memory;
+  char *mapped;
+  VkDeviceSize size, used;
+  uint32_t type;
+  bool linear;
+  uint32_t levels; // size == ALLOC_MIN_SIZE << levels
+  uint8_t *longest;
+};
+
+struct MyVkAllocator {
+  MemoryBlock blocks[ALLOC_MAX_BLOCKS];
+  uint32_t block_count;
+  VkDeviceSize heap_block_size[VK_MAX_MEMORY_HEAPS];
+  uint32_t dedicated_count;
+  VkDeviceSize dedicated_bytes;
+  VkDeviceSize requested_bytes; // sum of sizes handed out from blocks
+  uint32_t allocation_count;
+  std::mutex mutex; // startup creates resources from several threads
+};
+
+struct MyVkAllocatorStats {
+  uint32_t allocations, blocks, dedicated;
+  VkDeviceSize used_bytes;     // what resources asked for
+  VkDeviceSize buddy_bytes;    // what that rounded up to inside blocks
+  VkDeviceSize reserved_bytes; // all VkDeviceMemory we hold
+  double fragmentation;        // 1 - largest free buddy / free bytes
+};
+
+struct MyBuffer {
+  VkBuffer buffer;
+  MyAllocation alloc;
+  VkDeviceSize size;
+  // queue family that uses it on the gpu, uploads are handed over to it
+  uint32_t owner;
+};
+
+struct FrameArena {
+  MyBuffer buffer;
+  VkDeviceSize head;
+  // a dynamic uniform buffer over the whole arena, written once. Binding it
+  // at another offset is all a frame does to point shaders at its uniforms.
+  VkDescriptorSet set;
+};
+
+// matches Frame in shader.vert and textured.vert, allocated from the frame
+// arena every frame
+struct GpuFrameData {
+  glm::mat4 view_proj; // identity until there is a camera
+  glm::vec4 time;      // x seconds since startup, y since the last frame
+  glm::vec4 clear;     // color the main pass is cleared to
+};
+
+// matches the push constants of shader.vert and textured.vert, pushed once
+// per command buffer for the whole mesh
+struct MeshPush {
+  glm::vec4 transform; // xy offset, z scale
+};
+
+// host visible ring that all uploads to device local memory go through
+#define STAGING_RING_SIZE (64ull * 1024 * 1024)
+// copies are batched until flush or until this many are pending
+#define STAGING_MAX_PENDING_COPIES 256
+// upload submissions whose part of the ring the gpu may still be reading
+#define STAGING_BATCHES 4
+
+struct PendingCopy {
+  VkBuffer dst;
+  uint32_t owner; // queue family of dst
+  VkBufferCopy region;
+};
+
+// Image uploads are recorded as a begin that discards the whole image for the
+// copies, its copies, then an end that leaves every level in
+// SHADER_READ_ONLY_OPTIMAL for the family that samples it. The three can end
+// up in different submits.
+#define IMAGE_UPLOAD_BEGIN 0
+#define IMAGE_UPLOAD_COPY 1
+#define IMAGE_UPLOAD_END 2
+
+struct PendingImageOp {
+  uint32_t op; // IMAGE_UPLOAD_*
+  VkImage image;
+  uint32_t owner;           // queue family that samples the image
+  uint32_t level_count;     // of the image, for begin and end
+  VkBufferImageCopy region; // for copies
+};
+
+struct UploadBatch {
+  VkCommandBuffer cmd;
+  VkFence fence;
+  VkDeviceSize ring_end; // ring head when it was submitted
+  bool in_flight;
+};
+
+struct MyVkStaging {
+  MyBuffer ring;
+  char *mapped;
+  // monotonically increasing byte counters, the ring offset is counter % size
+  VkDeviceSize head; // next free byte
+  VkDeviceSize tail; // oldest byte the gpu may still read
+  PendingCopy copies[STAGING_MAX_PENDING_COPIES];
+  uint32_t copy_count;
+  // uploads are recorded into their own command buffers, on the transfer
+  // queue where the device has a dedicated one
+  VkCommandPool pool;
+  UploadBatch batches[STAGING_BATCHES];
+  uint32_t next_batch;
+  // every upload submit signals the next value, other queues wait for it
+  VkSemaphore timeline;
+  uint64_t timeline_value;
+  // ownership of uploaded buffers that the using queue has yet to take over
+  VkBufferMemoryBarrier2 acquires[STAGING_MAX_PENDING_COPIES];
+  uint32_t acquire_count;
+  PendingImageOp image_ops[STAGING_MAX_PENDING_COPIES];
+  uint32_t image_op_count;
+  // images are only taken over once their upload is done, so streaming one in
+  // never makes a frame wait. Each with the timeline value of its upload.
+  VkImageMemoryBarrier2 image_acquires[STAGING_MAX_PENDING_COPIES];
+  uint64_t image_acquire_values[STAGING_MAX_PENDING_COPIES];
+  uint32_t image_acquire_count;
+};
+
+// hands out the elements of a descriptor array, freed ones are reused first
+struct DescriptorSlots {
+  uint32_t capacity;
+  uint32_t next; // none from here on were handed out yet
+  uint32_t *free;
+  uint32_t free_count;
+};
+
+// destruction of an object the gpu may still use, done once the frame timeline
+// reaches frame_number
+struct DeferredDestroy {
+  uint64_t frame_number;
+  VkObjectType type; // of handle, VK_OBJECT_TYPE_UNKNOWN if there is none
+  uint64_t handle;
+  MyAllocation alloc; // freed after the object if alloc.memory is set
+  void *host;         // free()d last
+  DescriptorSlots *slots; // slot is given back to it if set
+  uint32_t slot;
+};
+
+struct MyVkDeletionQueue {
+  DeferredDestroy *items; // in the order they were queued
+  uint32_t count, capacity;
+};
+
+// --track-handles: every vulkan object the app makes is recorded with the
+// function that made it, so live counts can be printed and whatever is still
+// alive at shutdown reported as leaked. Short lived shader modules aren't.
+struct TrackedHandle {
+  uint64_t handle;
+  VkObjectType type;
+  const char *creator;
+};
+
+struct MyVkHandleTracker {
+  bool enabled;
+  TrackedHandle *handles;
+  uint32_t count, capacity;
+  std::mutex mutex;
+};
+
+#define MY_VK_TRACK(m, type, handle)                                          \
+  my_vk_track(m, type, (uint64_t)(handle), __func__)
+
+// resizes are only acted on once no new one came for this long, dragging a
+// window edge would otherwise recreate the swapchain every frame
+#define RESIZE_DEBOUNCE_SECONDS 0.05
+#define MAX_RECORD_THREADS 64
+
+// each worker owns its pools, so recording needs no locking. Resetting the
+// whole pool of a frame slot is cheaper than resetting buffers one by one.
+struct RecordWorker {
+  VkCommandPool pools[MAX_FRAMES_IN_FLIGHT];
+  VkCommandBuffer cmds[MAX_FRAMES_IN_FLIGHT]; // secondary
+  std::thread thread; // worker 0 is the main thread
+};
+
+struct MyVkJobs {
+  RecordWorker workers[MAX_RECORD_THREADS];
+  uint32_t worker_count; // created
+  uint32_t active;       // recording this frame, <= worker_count
+
+  std::mutex mutex;
+  std::condition_variable start_cv, done_cv;
+  uint64_t generation; // bumped to hand the workers a new frame
+  uint32_t remaining;  // workers that haven't finished the current frame
+  bool quit;
+
+  // what the current frame records into
+  uint32_t frame;
+  VkFramebuffer framebuffer;
+};
+
+#define MAX_RELOAD_PIPELINES 4
+
+// a pipeline that is rebuilt when the source of one of its shaders changes
+struct ReloadPipeline {
+  const char *shaders[2]; // source file names, a compute pipeline has one
+  VkPipelineLayout layout;
+  bool instanced;
+  VkPipeline *live;   // what frames are recorded with
+  VkPipeline pending; // built, swapped in at the next frame boundary
+};
+
+// shaders are compiled and pipelines built on the reload thread, the render
+// loop only ever swaps in finished pipelines
+struct MyVkHotReload {
+  bool enabled;
+  int inotify_fd;
+  std::thread thread;
+  std::mutex mutex; // guards pending and quit
+  bool quit;
+  ReloadPipeline pipelines[MAX_RELOAD_PIPELINES];
+  uint32_t pipeline_count;
+  uint32_t reloads; // pipelines swapped in so far
+};
+
+// matches struct Instance in instanced.vert and instance_prepass.comp
+struct GpuInstance {
+  glm::vec4 sphere; // xyz center, w radius
+  glm::vec4 color;
+};
+
+// written by the pre-pass, read by vkCmdDrawIndexedIndirect(Count)
+struct DrawArgs {
+  VkDrawIndexedIndirectCommand draw;
+  uint32_t draw_count;
+};
+
+// matches the push constants of instance_prepass.comp
+struct CullPush {
+  glm::vec4 view;      // xy offset, z zoom
+  glm::vec4 prev_view; // the view the hi-z pyramid was rendered with
+  glm::vec2 depth_size; // texels of the depth the pyramid was built from
+  uint32_t count;
+  uint32_t flags; // CULL_*
+};
+
+// per frame counters written by the pre-pass
+struct CullStats {
+  uint32_t frustum_culled, occlusion_culled, visible;
+};
+
+#define HIZ_MAX_LEVELS 16
+
+// Instances are culled against the view and against a max-depth pyramid
+// (hi-z) of the previous frame's depth buffer, built after the main pass.
+struct MyVkCulling {
+  glm::vec4 view, prev_view;
+  MyBuffer stats[MAX_FRAMES_IN_FLIGHT]; // CullStats, host visible
+  bool stats_pending[MAX_FRAMES_IN_FLIGHT];
+  CullStats last; // of the last finished frame
+
+  // vertex and fragment shader invocations of the main pass, to see what the
+  // culling saves. Needs pipelineStatisticsQuery.
+  VkQueryPool invocation_pools[MAX_FRAMES_IN_FLIGHT];
+  bool invocations_pending[MAX_FRAMES_IN_FLIGHT];
+  uint64_t last_invocations[2]; // vertex, fragment
+
+  // a transient of the render graph, which owns them
+  VkImage depth;
+  VkImageView depth_view;
+
+  VkImage hiz; // r32f, max depth of each 2x2 of the level above
+  MyAllocation hiz_alloc;
+  VkImageView hiz_view; // all levels, for culling
+  VkImageView hiz_level_views[HIZ_MAX_LEVELS];
+  VkExtent2D hiz_extent; // of level 0, half the depth buffer
+  uint32_t hiz_levels;
+  bool hiz_valid; // built at least once since it was (re)created
+  bool hiz_undefined; // (re)created, not moved to GENERAL yet
+
+  VkSampler sampler;
+  VkDescriptorSetLayout hiz_set_layout;
+  VkPipelineLayout hiz_layout;
+  VkPipeline hiz_pipeline;
+  VkDescriptorPool descriptor_pool;
+  VkDescriptorSet hiz_sets[HIZ_MAX_LEVELS]; // level - 1 (or depth) -> level
+};
+
+// GPU-driven instancing. Each frame a compute pre-pass copies the instances it
+// keeps into that frame's visible buffer and counts them into the indirect
+// draw, so the cpu records the same few commands whatever the instance count.
+struct MyVkInstancing {
+  uint32_t capacity; // instances the buffers have room for
+  uint32_t count;    // instances drawn
+  bool naive;        // one vkCmdDrawIndexed per instance, no pre-pass
+
+  MyBuffer instances; // GpuInstance[capacity]
+  MyBuffer visible[MAX_FRAMES_IN_FLIGHT];
+  MyBuffer args[MAX_FRAMES_IN_FLIGHT]; // DrawArgs
+
+  VkDescriptorSetLayout draw_set_layout, prepass_set_layout;
+  VkPipelineLayout draw_layout, prepass_layout;
+  VkPipeline draw_pipeline, prepass_pipeline;
+  VkDescriptorPool descriptor_pool;
+  VkDescriptorSet naive_set; // draws read instances directly
+  VkDescriptorSet draw_sets[MAX_FRAMES_IN_FLIGHT];    // read visible[frame]
+  VkDescriptorSet prepass_sets[MAX_FRAMES_IN_FLIGHT]; // instances -> visible
+};
+
+// the instance pre-pass on the dedicated compute queue. A frame's pre-pass only
+// waits for the slot to be free, so it runs while the gpu is still drawing the
+// previous frame; occlusion culling needs that frame's hi-z and waits for it.
+struct MyVkAsyncCompute {
+  bool enabled; // only if the device has a compute family without graphics
+  VkCommandPool pool;
+  VkCommandBuffer cmds[MAX_FRAMES_IN_FLIGHT];
+  // signaled with the frame number once that frame's pre-pass is done
+  VkSemaphore timeline;
+};
+
+// queues a render graph pass can run on
+#define GRAPH_GRAPHICS 0
+#define GRAPH_ASYNC_COMPUTE 1
+#define GRAPH_QUEUE_NONE 2 // owned by no queue, its contents don't matter
+
+#define GRAPH_MAX_PASSES 16
+#define GRAPH_MAX_RESOURCES 16
+#define GRAPH_MAX_USES 8
+#define GRAPH_MAX_BARRIERS 64
+#define GRAPH_MAX_TRANSIENTS 8
+
+// the accesses a later one may have to wait for, a state keeps only these
+#define GRAPH_WRITE_ACCESS                                                    \
+  (VK_ACCESS_2_SHADER_WRITE_BIT | VK_ACCESS_2_COLOR_ATTACHMENT_WRITE_BIT |     \
+   VK_ACCESS_2_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT |                            \
+   VK_ACCESS_2_TRANSFER_WRITE_BIT | VK_ACCESS_2_HOST_WRITE_BIT)
+
+// what a pass does to a resource, or the state it is in between passes
+struct GraphState {
+  VkPipelineStageFlags2 stage;
+  VkAccessFlags2 access;
+  VkImageLayout layout; // images only
+};
+
+struct GraphUse {
+  uint32_t resource;
+  GraphState state;
+  bool write;
+};
+
+struct MyVk;
+
+struct GraphPass {
+  const char *name;
+  uint32_t queue; // GRAPH_*
+  // a render pass whose attachment descriptions and subpass dependencies do
+  // the transitions of its image uses, the graph only tracks them
+  bool own_layouts;
+  void (*record)(MyVk *m, VkCommandBuffer cmd);
+  GraphUse uses[GRAPH_MAX_USES];
+  uint32_t use_count;
+  bool culled; // nothing live reads what it writes
+};
+
+struct GraphResource {
+  const char *name;
+  VkImage image; // either an image
+  VkImageAspectFlags aspect;
+  uint32_t levels;
+  VkBuffer buffer; // or a whole buffer
+  uint32_t transient; // index into the graph's transients, UINT32_MAX if not
+  bool concurrent;    // shared by the queue families, never transferred
+  // read after the frame's passes, which are never culled if they write it
+  bool output;
+  GraphState initial;
+  // outputs end up in it, layout UNDEFINED leaves them as they are
+  GraphState final;
+  uint32_t owner; // queue that has it before the first pass, GRAPH_*
+  // positions in the compiled order, UINT32_MAX if no live pass uses it
+  uint32_t first_use, last_use;
+};
+
+// src -> dst of one resource, before or after a pass
+struct GraphBarrier {
+  uint32_t resource;
+  uint32_t pass;
+  bool after;
+  GraphState src, dst;
+  uint32_t src_queue, dst_queue; // differ for queue ownership transfers
+};
+
+// An image the graph creates for passes that need it only during the frame,
+// sized like the swapchain. Transients whose lifetimes don't overlap share
+// memory. Attachments that live within one pass get lazily allocated memory
+// of their own where the device has it, on tilers they never leave tile
+// memory.
+struct GraphTransient {
+  const char *name;
+  VkFormat format;
+  VkImageUsageFlags usage;
+  VkImageAspectFlags aspect;
+  VkSampleCountFlagBits samples;
+  VkImage image;
+  VkImageView view;
+  // depth only for sampling a depth stencil format, else the same as view
+  VkImageView sampled_view;
+  VkDeviceSize size, offset; // in the graph's transient allocation
+  uint32_t first_use, last_use; // it was placed for
+  MyAllocation lazy_alloc; // instead, if it is lazily allocated
+};
+
+// The frame as passes that declare what they read and write. It is declared
+// again every frame, then compiled: unused passes are culled, async compute
+// passes are moved as early as they can go, and the barriers between passes
+// are derived from the uses, merged into one vkCmdPipelineBarrier2 per pass.
+// Passes record their work and only the barriers inside themselves.
+struct MyVkRenderGraph {
+  GraphPass passes[GRAPH_MAX_PASSES];
+  uint32_t pass_count;
+  GraphResource resources[GRAPH_MAX_RESOURCES];
+  uint32_t resource_count;
+  uint32_t image_index; // of the swapchain image the frame renders to
+
+  uint32_t order[GRAPH_MAX_PASSES]; // live passes, in execution order
+  uint32_t order_count;
+  GraphBarrier barriers[GRAPH_MAX_BARRIERS];
+  uint32_t barrier_count;
+  bool dumped;
+
+  // kept across frames, recreated with the swapchain
+  GraphTransient transients[GRAPH_MAX_TRANSIENTS];
+  uint32_t transient_count;
+  MyAllocation transient_alloc; // all of them
+  VkDeviceSize transient_peak;  // size of the allocation
+  VkDeviceSize transient_total; // what they would take unaliased
+};
+
+// What the main pass renders into besides the swapchain image. With
+// multisampling it renders into multisampled targets that are resolved at
+// the end of the pass, into the swapchain image and, when the hi-z build
+// samples it, a single sampled depth. The targets themselves are never
+// stored. All of them are transients of the render graph.
+struct MyVkAttachments {
+  VkFormat depth_format; // UNDEFINED without depth
+  VkSampleCountFlagBits samples;
+  VkResolveModeFlagBits depth_resolve; // NONE unless it is resolved
+  bool lazy_memory; // the device has a lazily allocated memory type
+  VkImageView color_view; // multisampled, NULL at one sample
+  VkImageView depth_view; // what the pass tests against
+  VkImageView depth_resolve_view; // the sampled depth it resolves to
+  // of the transients above, and how much of that is lazily allocated
+  VkDeviceSize bytes, lazy_bytes;
+};
+
+// A transform hierarchy updated on the cpu every frame. The update writes
+// the world matrices it changes into the frame's upload buffer, and one copy
+// moves that range into transforms, where node i is at index i.
+struct MyVkScene {
+  Scene nodes;
+  MyBuffer transforms;                   // device local
+  MyBuffer upload[MAX_FRAMES_IN_FLIGHT]; // host visible, like transforms
+  uint32_t copy_begin, copy_end;         // nodes this frame copies
+};
+
+// slack left before the vblank a paced frame aims for, in ms
+#define PACE_MARGIN_MS 1.0
+
+// Presents carry increasing ids. A paced frame first waits until the one
+// before it is on screen, which is right after a vblank, then sleeps until
+// the work of a frame just fits before the next one. Only paced frames wait,
+// so only they measure when frames are shown.
+struct MyVkPacing {
+  bool available; // present id and present wait are enabled
+  bool enabled;   // --pace
+  PFN_vkWaitForPresentKHR wait_for_present;
+  uint64_t present_id;   // of the last present, 0 before the first
+  uint64_t shown_id;     // of the last present waited for
+  double shown_s;        // when that was shown, on my_vk_time
+  double input_us;       // when the cpu started the last presented frame
+  double period_ms;      // between vblanks, -1 until measured
+  double work_ms;        // frame start to gpu done, -1 until measured
+  double sleep_ms;       // how long the last frame start was put off
+  // of the frame last shown, -1 once the benchmark took them
+  double display_latency_ms; // from its cpu start to being shown
+  double interval_ms;        // since the frame shown before it
+};
+
+#define READBACK_SLOTS 4
+
+// a rendered frame in host memory: tightly packed rows of 4 byte pixels in
+// the swapchain format
+struct ReadbackFrame {
+  const void *pixels;
+  uint32_t width, height;
+  VkFormat format;
+  uint64_t number; // frame timeline value of the frame that rendered it
+};
+
+enum ReadbackState {
+  READBACK_FREE,
+  READBACK_COPYING,   // recorded, the gpu may not have copied it yet
+  READBACK_CONSUMING, // handed to the consumer thread
+};
+
+struct ReadbackSlot {
+  MyBuffer buffer; // host visible, host cached where the device has it
+  ReadbackState state;
+  uint32_t width, height;
+  uint64_t number;
+  double record_s;        // when the frame was recorded
+  double latency_frames;  // frames submitted after it when it was copied
+};
+
+// Frames are copied into the slots in turn and handed to the consumer
+// thread in the same order once the frame timeline has passed them. The
+// render loop never waits on either: when the next slot is still being
+// copied or consumed the frame isn't read back and counts as dropped.
+struct MyVkReadback {
+  bool enabled;
+  ReadbackSlot slots[READBACK_SLOTS];
+  uint32_t next;    // slot the next frame is copied into
+  uint32_t current; // of the frame being recorded, UINT32_MAX = none
+  uint32_t copied;  // oldest slot that may still be copying
+  // runs on the consumer thread, the pixels are valid until it returns
+  void (*consume)(MyVk *m, const ReadbackFrame *frame);
+  FILE *out; // what the default consumer writes to
+  uint64_t checksum; // of what the benchmark consumer read
+
+  std::thread thread;
+  std::mutex mutex; // guards the slot states, quit and the stats
+  std::condition_variable cv;
+  bool quit;
+
+  // since the last reset
+  double reset_s, last_s; // when reset and when a frame was last consumed
+  uint64_t frames, dropped, bytes;
+  double latency_frames_sum, latency_ms_sum;
+  // one per consumed frame while a benchmark collects them
+  double *latency_frames, *latency_ms;
+  uint32_t sample_count, sample_capacity;
+};
+
+#define MAX_PHYS_DEVICES 8
+#define STARTUP_MAX_STAGES 32
+#define STARTUP_MAX_THREADS 4
+
+struct MyVk;
+
+// one step of startup, run once every stage in deps has finished
+struct StartupStage {
+  const char *name;
+  void (*run)(MyVk *m);
+  uint32_t deps;    // bit i = stage i
+  bool main_thread; // glfw wants its window calls on the main thread
+  // if set and true once run, the stages that need this one are skipped
+  bool (*failed)(MyVk *m);
+  bool started;
+  uint32_t thread;         // that ran it, 0 = the main thread
+  double begin_ms, end_ms; // since startup began
+};
+
+// Startup as a dependency graph. The main thread and the helpers take any
+// stage whose dependencies are done, so e.g. shaders load and pipelines
+// compile while the window is still being made. Stages that upload through
+// the staging ring depend on each other, it is not shared between threads.
+struct MyVkStartup {
+  StartupStage stages[STARTUP_MAX_STAGES];
+  uint32_t count;
+  uint32_t thread_count;
+  double begin;
+  std::mutex mutex;
+  std::condition_variable cv; // a stage finished
+  uint32_t done;              // bit i = stage i
+  uint32_t failed;            // bit i = stage i, failed or skipped
+};
+
+// everything that differs between the samplers we create
+struct SamplerKey {
+  VkFilter filter;
+  VkSamplerMipmapMode mipmap_mode;
+  VkSamplerAddressMode address_mode;
+  float max_anisotropy; // 0 = off
+};
+
+#define MAX_SAMPLERS 8
+
+// samplers are immutable and a device may only have so many, so everything
+// with the same settings shares one
+struct MyVkSamplerCache {
+  SamplerKey keys[MAX_SAMPLERS];
+  VkSampler samplers[MAX_SAMPLERS];
+  uint32_t count;
+};
+
+// the start of a ktx2 file, followed by levelCount Ktx2Level
+struct Ktx2Header {
+  uint8_t identifier[12];
+  uint32_t vkFormat;
+  uint32_t typeSize;
+  uint32_t pixelWidth, pixelHeight, pixelDepth;
+  uint32_t layerCount, faceCount, levelCount;
+  uint32_t supercompressionScheme;
+  uint32_t dfdByteOffset, dfdByteLength;
+  uint32_t kvdByteOffset, kvdByteLength;
+  uint64_t sgdByteOffset, sgdByteLength;
+};
+
+static_assert(sizeof(Ktx2Header) == 80, "ktx2 header layout");
+
+struct Ktx2Level {
+  uint64_t byteOffset, byteLength, uncompressedByteLength;
+};
+
+// how the texels of a format are stored, in blocks of block_size^2 texels
+struct TextureFormat {
+  VkFormat format;
+  uint32_t block_bytes;
+  uint32_t block_size;
+};
+
+#define TEXTURE_MAX_LEVELS 16
+// levels no bigger than this either way are the mip tail, always resident
+#define TEXTURE_TAIL_SIZE 64
+// bytes of texture data streaming puts into the staging ring per frame. At
+// least one rebuild is started whatever its size.
+#define TEXTURE_STREAM_BYTES_PER_FRAME (16ull * 1024 * 1024)
+
+// A texture keeps an image with its levels from top_level down. Streaming a
+// level in or out builds a new image with the levels it should have, uploads
+// all of them from the file and swaps it in once the upload is done, so
+// nothing ever waits on it and the old image stays usable meanwhile.
+struct MyTexture {
+  const char *name;
+  // where the ktx2 data is, a loose file is a stored entry covering all of it
+  const MappedFile *file;
+  const BundleEntry *entry;
+  MappedFile loose;
+  BundleEntry loose_entry;
+  const TextureFormat *format;
+  VkExtent2D extent; // of level 0
+  uint32_t level_count;
+  uint32_t tail_level; // first level of the mip tail
+  uint64_t level_offsets[TEXTURE_MAX_LEVELS]; // in the entry's contents
+  uint64_t level_sizes[TEXTURE_MAX_LEVELS];
+
+  VkImage image; // levels top_level.. of the texture
+  MyAllocation alloc;
+  VkImageView view;
+  uint32_t top_level;
+  VkImage pending_image; // being uploaded with levels pending_level..
+  MyAllocation pending_alloc;
+  VkImageView pending_view;
+  uint32_t pending_level;
+  uint64_t pending_value; // upload timeline value it is done at
+
+  // the descriptor set of a frame slot is rewritten before the slot is next
+  // used if the view changed since
+  VkDescriptorSet sets[MAX_FRAMES_IN_FLIGHT];
+  uint32_t generation; // of the view
+  uint32_t set_generation[MAX_FRAMES_IN_FLIGHT];
+  // the view's element of the bindless texture array, every view gets a new
+  // one so frames in flight keep theirs. UINT32_MAX if none.
+  uint32_t slot;
+
+  uint64_t last_used;    // frame number it was last drawn in
+  uint32_t wanted_level; // whose texels are about a pixel on screen
+  double priority;       // screen coverage per byte of the next level
+};
+
+struct MyVkTextures {
+  MyTexture textures[MAX_TEXTURES];
+  uint32_t count;
+  VkDescriptorSetLayout set_layout;
+  VkDescriptorPool descriptor_pool;
+  VkSampler sampler; // from the cache
+  VkDeviceSize budget;
+  VkDeviceSize resident_bytes; // of all images, pending ones included
+  uint32_t streamed_in, evicted; // rebuilds to a higher or lower top level
+  VkDeviceSize streamed_bytes;
+};
+
+// matches DrawData in textured.frag and bindless.frag
+struct GpuDrawData {
+  glm::vec4 tint;
+};
+
+// the textured draws share this many objects, draw i uses object i % count
+#define MAX_DRAW_OBJECTS 1024
+
+// what a draw needs besides its texture, in one storage buffer
+struct MyVkDrawObjects {
+  uint32_t count;
+  VkDeviceSize stride; // of GpuDrawData, aligned for a storage buffer offset
+  MyBuffer buffer;
+  // set 1 of the textured pipeline, one per object, bound per draw
+  VkDescriptorSetLayout set_layout;
+  VkDescriptorPool descriptor_pool;
+  VkDescriptorSet sets[MAX_DRAW_OBJECTS];
+  uint32_t slots[MAX_DRAW_OBJECTS]; // in the bindless buffer array
+};
+
+// sizes of the bindless arrays, lowered to what the device allows
+#define BINDLESS_MAX_TEXTURES 4096
+#define BINDLESS_MAX_BUFFERS 4096
+
+// matches the push constants in bindless.frag, after MeshPush
+struct BindlessPush {
+  uint32_t texture;
+  uint32_t draw_data;
+};
+
+// --bindless: every texture and every object's data are in two big arrays of
+// one update-after-bind set. It is bound once per command buffer, draws only
+// push their indices, and elements are written whenever something changes
+// without waiting for the frames that use the others.
+struct MyVkBindless {
+  bool enabled; // record with it
+  VkDescriptorSetLayout set_layout;
+  VkDescriptorPool descriptor_pool;
+  VkDescriptorSet set;
+  VkPipelineLayout layout;
+  VkPipeline pipeline;
+  DescriptorSlots textures, buffers;
+};
+
+// gpu timestamp scopes that can be recorded into one frame's command buffer
+#define PROFILER_MAX_GPU_SCOPES_PER_FRAME 16
+#define PROFILER_MAX_SCOPES 32
+// rolling window of samples kept per scope for the stats
+#define PROFILER_WINDOW 256
+#define PROFILER_MAX_TRACE_EVENTS (1 << 18)
+
+struct ProfilerScope {
+  const char *name;
+  bool gpu;
+  double samples[PROFILER_WINDOW]; // in ms
+  uint32_t sample_count;           // saturates at PROFILER_WINDOW
+  uint32_t next_sample;
+};
+
+struct ProfilerStats {
+  double mean, p95, p99; // in ms
+  uint32_t samples;
+};
+
+struct TraceEvent {
+  const char *name;
+  double start_us, dur_us;
+  bool gpu;
+};
+
+struct MyVkProfiler {
+  bool gpu_supported;
+  uint64_t timestamp_mask; // timestampValidBits of the graphics queue
+  double ns_per_tick;
+
+  // one pool per frame in flight, read back once that frame's fence signals
+  VkQueryPool pools[MAX_FRAMES_IN_FLIGHT];
+  uint32_t query_count[MAX_FRAMES_IN_FLIGHT];
+  uint32_t query_scope[MAX_FRAMES_IN_FLIGHT][PROFILER_MAX_GPU_SCOPES_PER_FRAME];
+  double submit_time_us[MAX_FRAMES_IN_FLIGHT];
+  // open gpu scopes of the frame being recorded, for nesting
+  uint32_t open_queries[PROFILER_MAX_GPU_SCOPES_PER_FRAME];
+  uint32_t open_count;
+
+  ProfilerScope scopes[PROFILER_MAX_SCOPES];
+  uint32_t scope_count;
+
+  // gpu ticks have no relation to the cpu clock, so shift them to the cpu
+  // timeline by the smallest offset that keeps every gpu frame after its submit
+  bool gpu_offset_set;
+  double gpu_offset_us;
+
+  // chrome trace events, only recorded when --trace is given
+  TraceEvent *trace;
+  uint32_t trace_count;
+};
+
 struct MyVk {
+  MyVkOptions opts;
+
   GLFWwindow *window;
   VkInstance instance; // info about my computer and the application and stuff
 
+  // devices with every extension we need, before the surface is asked
+  VkPhysicalDevice phys_candidates[MAX_PHYS_DEVICES];
+  VkPhysicalDeviceProperties phys_candidate_props[MAX_PHYS_DEVICES];
+  uint32_t phys_candidate_count;
   VkPhysicalDevice phys_device;
+  VkPhysicalDeviceProperties phys_props; // of the chosen device
+  VkPhysicalDeviceMemoryProperties mem_props;
   VkSurfaceFormatKHR format;
   VkPresentModeKHR present_mode;
 
   VkDevice device;
+  // optional features that were enabled because the device has them
+  VkPhysicalDeviceFeatures features;
+  // 1.2 and 1.3 features that were enabled because the device has them
+  VkPhysicalDeviceVulkan12Features features12;
+  VkPhysicalDeviceVulkan13Features features13;
 
   VkSurfaceKHR surface;
 
   VkSurfaceCapabilitiesKHR capabilites;
 
   int64_t queue_graphics_idx, queue_present_idx;
-  VkQueue graphicsQueue, presentQueue;
+  // dedicated families where the device has them, else the graphics family
+  int64_t queue_compute_idx, queue_transfer_idx;
+  VkQueue graphicsQueue, presentQueue, computeQueue, transferQueue;
 
   VkExtent2D extent;
 
@@ -81,7 +1159,9 @@ struct MyVk {
 
   VkImageView *image_views; // views into the swapchain images
 
-  VkPipelineShaderStageCreateInfo shaderStages[2];
+  // headless: swapchain_images are our own and live in these
+  MyAllocation offscreen_allocs[MAX_FRAMES_IN_FLIGHT];
+
   VkShaderModule vert_shader_module, frag_shader_module;
 
   VkPipelineDynamicStateCreateInfo dstate{};
@@ -92,27 +1172,263 @@ struct MyVk {
   VkPipelineViewportStateCreateInfo viewportState{};
   VkDynamicState dynamicStates[dynamicStateCount];
 
+  // vkCmdBeginRendering with our own layout transitions, no render pass or
+  // framebuffers. Else renderPass and swapchainFramebuffers are used.
+  bool dynamic_rendering;
   VkRenderPass renderPass;
-  VkFramebuffer *swapchainFramebuffers;
+  VkFramebuffer *swapchainFramebuffers; // NULL with dynamic rendering
 
   VkPipelineLayout pipelineLayout{};
 
   VkPipeline graphicsPipeline;
 
+  VkPipelineCache pipelineCache;
+  bool pipeline_cache_warm; // started from valid data on disk
+  double pipeline_create_ms;
+  double startup_ms; // from main() until the first frame can be drawn
+  long startup_rss_kb; // peak resident memory by then
+  MyVkStartup startup;
+
   VkCommandPool commandPool;
   VkCommandBuffer *commandBuffers;
 
-  VkSemaphore *imageAvailableSemaphores;
-  VkSemaphore *renderFinishedSemaphores;
-  VkFence *inFlightFences;
+  MyVkAllocator allocator;
+  FrameArena frame_arenas[MAX_FRAMES_IN_FLIGHT];
+  // set 0 of the main and bindless pipelines, the arena sets' layout
+  VkDescriptorSetLayout frame_set_layout;
+  VkDescriptorPool frame_pool;
+  GpuFrameData frame_data; // what this frame's uniforms were set to
+  uint32_t frame_data_offset; // of them in the current arena
+  MyVkStaging staging;
+  MyBuffer vertexBuffer, indexBuffer;
+  uint32_t index_count;
+  MyVkInstancing inst;
+  MyVkCulling cull;
+  MyVkAsyncCompute async;
+  MyVkSamplerCache samplers;
+  MyVkTextures tex;
+  MyVkDrawObjects objects;
+  MyVkBindless bindless;
+  MyVkRenderGraph graph;
+  MyVkAttachments attach;
+  MyVkScene scene;
+  MyVkReadback readback;
+
+  // binary, only for acquire and present
+  VkSemaphore imageAvailableSemaphores[MAX_FRAMES_IN_FLIGHT];
+  VkSemaphore renderFinishedSemaphores[MAX_FRAMES_IN_FLIGHT];
+  // every submit signals the next frame number on it when its work is done
+  VkSemaphore frameTimeline;
+  uint64_t frame_number = 0; // last value signaled by a submit
+  // timeline value the slot's previous frame signals, wait before reusing it
+  uint64_t slot_frame_number[MAX_FRAMES_IN_FLIGHT];
+  uint32_t frames_in_flight = 2;
+
+  // when the input of a slot's frame was sampled, for the latency
+  double input_time_us[MAX_FRAMES_IN_FLIGHT];
+  double last_gpu_end_us = -1.0; // on the cpu clock, -1 if unknown
+  double last_latency_ms = -1.0; // input to present, -1 if unknown
+  MyVkPacing pace;
+
+  MyVkProfiler profiler;
+  double last_gpu_ms = -1.0; // gpu time of the last finished frame, -1 if none
+  double last_record_ms = 0.0; // cpu time spent recording the last frame
+
+  MyVkJobs jobs;
+  MyVkHotReload reload;
+  MyVkBundle bundle;
+  std::mutex bundle_mutex; // compressed entries share bundle.scratch
 
   uint32_t currentFrame = 0; // what frame we are rendering
   bool framebuffer_resized = false;
+  double resize_time = 0.0; // of the last resize event
+  uint32_t swapchain_recreations = 0;
+
+  MyVkDeletionQueue deletions;
+  MyVkHandleTracker tracker;
 };
 
 void framebuffer_resize_callback(GLFWwindow *window, int width, int height) {
   MyVk *m = (MyVk *)glfwGetWindowUserPointer(window);
   m->framebuffer_resized = true;
+  m->resize_time = my_vk_time();
+}
+
+const char *my_vk_object_type_name(VkObjectType type) {
+  switch (type) {
+  case VK_OBJECT_TYPE_BUFFER:
+    return "buffer";
+  case VK_OBJECT_TYPE_IMAGE:
+    return "image";
+  case VK_OBJECT_TYPE_IMAGE_VIEW:
+    return "image view";
+  case VK_OBJECT_TYPE_FRAMEBUFFER:
+    return "framebuffer";
+  case VK_OBJECT_TYPE_SWAPCHAIN_KHR:
+    return "swapchain";
+  case VK_OBJECT_TYPE_DEVICE_MEMORY:
+    return "device memory";
+  case VK_OBJECT_TYPE_SAMPLER:
+    return "sampler";
+  case VK_OBJECT_TYPE_PIPELINE:
+    return "pipeline";
+  case VK_OBJECT_TYPE_PIPELINE_LAYOUT:
+    return "pipeline layout";
+  case VK_OBJECT_TYPE_PIPELINE_CACHE:
+    return "pipeline cache";
+  case VK_OBJECT_TYPE_RENDER_PASS:
+    return "render pass";
+  case VK_OBJECT_TYPE_DESCRIPTOR_SET_LAYOUT:
+    return "descriptor set layout";
+  case VK_OBJECT_TYPE_DESCRIPTOR_POOL:
+    return "descriptor pool";
+  case VK_OBJECT_TYPE_COMMAND_POOL:
+    return "command pool";
+  case VK_OBJECT_TYPE_QUERY_POOL:
+    return "query pool";
+  case VK_OBJECT_TYPE_SEMAPHORE:
+    return "semaphore";
+  case VK_OBJECT_TYPE_FENCE:
+    return "fence";
+  default:
+    return "object";
+  }
+}
+
+void my_vk_track(MyVk *m, VkObjectType type, uint64_t handle,
+                 const char *creator) {
+  MyVkHandleTracker *t = &m->tracker;
+  if (!t->enabled || handle == 0) {
+    return;
+  }
+  std::lock_guard<std::mutex> lock(t->mutex);
+  if (t->count == t->capacity) {
+    t->capacity = t->capacity ? t->capacity * 2 : 256;
+    t->handles = (TrackedHandle *)realloc(t->handles,
+                                          sizeof(TrackedHandle) * t->capacity);
+  }
+  t->handles[t->count++] = TrackedHandle{handle, type, creator};
+}
+
+void my_vk_untrack(MyVk *m, VkObjectType type, uint64_t handle) {
+  MyVkHandleTracker *t = &m->tracker;
+  if (!t->enabled || handle == 0) {
+    return;
+  }
+  std::lock_guard<std::mutex> lock(t->mutex);
+  // newest first, short lived objects are found quickly
+  for (uint32_t i = t->count; i-- > 0;) {
+    if (t->handles[i].handle == handle && t->handles[i].type == type) {
+      t->handles[i] = t->handles[--t->count];
+      return;
+    }
+  }
+  printf("ERROR: destroying a %s that was never created or already gone!\n",
+         my_vk_object_type_name(type));
+}
+
+// live objects per type, and with leaks every one of them with its creator
+void my_vk_print_handles(MyVk *m, bool leaks) {
+  MyVkHandleTracker *t = &m->tracker;
+  if (!t->enabled) {
+    return;
+  }
+  if (leaks) {
+    if (t->count == 0) {
+      printf("no vulkan objects leaked\n");
+      return;
+    }
+    printf("ERROR: %u vulkan objects leaked:\n", t->count);
+    for (uint32_t i = 0; i < t->count; ++i) {
+      printf("  %s 0x%llx from %s\n",
+             my_vk_object_type_name(t->handles[i].type),
+             (unsigned long long)t->handles[i].handle, t->handles[i].creator);
+    }
+    return;
+  }
+  // object types are small enums apart from the swapchain
+  uint32_t counts[64] = {};
+  uint32_t swapchains = 0;
+  for (uint32_t i = 0; i < t->count; ++i) {
+    if (t->handles[i].type == VK_OBJECT_TYPE_SWAPCHAIN_KHR) {
+      ++swapchains;
+    } else if ((uint32_t)t->handles[i].type < 64) {
+      ++counts[t->handles[i].type];
+    }
+  }
+  printf("%u live vulkan objects:", t->count);
+  for (uint32_t i = 0; i < 64; ++i) {
+    if (counts[i] > 0) {
+      printf(" %u %s,", counts[i], my_vk_object_type_name((VkObjectType)i));
+    }
+  }
+  printf(" %u swapchain\n", swapchains);
+}
+
+// the vkDestroy* for type, objects are destroyed through here so the tracker
+// sees them go
+void my_vk_destroy_object(MyVk *m, VkObjectType type, uint64_t handle) {
+  if (handle == 0) {
+    return;
+  }
+  my_vk_untrack(m, type, handle);
+  VkDevice d = m->device;
+  switch (type) {
+  case VK_OBJECT_TYPE_BUFFER:
+    vkDestroyBuffer(d, (VkBuffer)handle, nullptr);
+    break;
+  case VK_OBJECT_TYPE_IMAGE:
+    vkDestroyImage(d, (VkImage)handle, nullptr);
+    break;
+  case VK_OBJECT_TYPE_IMAGE_VIEW:
+    vkDestroyImageView(d, (VkImageView)handle, nullptr);
+    break;
+  case VK_OBJECT_TYPE_FRAMEBUFFER:
+    vkDestroyFramebuffer(d, (VkFramebuffer)handle, nullptr);
+    break;
+  case VK_OBJECT_TYPE_SWAPCHAIN_KHR:
+    vkDestroySwapchainKHR(d, (VkSwapchainKHR)handle, nullptr);
+    break;
+  case VK_OBJECT_TYPE_DEVICE_MEMORY:
+    vkFreeMemory(d, (VkDeviceMemory)handle, nullptr);
+    break;
+  case VK_OBJECT_TYPE_SAMPLER:
+    vkDestroySampler(d, (VkSampler)handle, nullptr);
+    break;
+  case VK_OBJECT_TYPE_PIPELINE:
+    vkDestroyPipeline(d, (VkPipeline)handle, nullptr);
+    break;
+  case VK_OBJECT_TYPE_PIPELINE_LAYOUT:
+    vkDestroyPipelineLayout(d, (VkPipelineLayout)handle, nullptr);
+    break;
+  case VK_OBJECT_TYPE_PIPELINE_CACHE:
+    vkDestroyPipelineCache(d, (VkPipelineCache)handle, nullptr);
+    break;
+  case VK_OBJECT_TYPE_RENDER_PASS:
+    vkDestroyRenderPass(d, (VkRenderPass)handle, nullptr);
+    break;
+  case VK_OBJECT_TYPE_DESCRIPTOR_SET_LAYOUT:
+    vkDestroyDescriptorSetLayout(d, (VkDescriptorSetLayout)handle, nullptr);
+    break;
+  case VK_OBJECT_TYPE_DESCRIPTOR_POOL:
+    vkDestroyDescriptorPool(d, (VkDescriptorPool)handle, nullptr);
+    break;
+  case VK_OBJECT_TYPE_COMMAND_POOL:
+    vkDestroyCommandPool(d, (VkCommandPool)handle, nullptr);
+    break;
+  case VK_OBJECT_TYPE_QUERY_POOL:
+    vkDestroyQueryPool(d, (VkQueryPool)handle, nullptr);
+    break;
+  case VK_OBJECT_TYPE_SEMAPHORE:
+    vkDestroySemaphore(d, (VkSemaphore)handle, nullptr);
+    break;
+  case VK_OBJECT_TYPE_FENCE:
+    vkDestroyFence(d, (VkFence)handle, nullptr);
+    break;
+  default:
+    printf("ERROR: can't destroy a %s!\n", my_vk_object_type_name(type));
+    break;
+  }
 }
 
 void my_vk_create_window(MyVk *m) {
@@ -126,7 +1442,25 @@ void my_vk_create_window(MyVk *m) {
 }
 
 void my_vk_create_instance(MyVk *m) {
+  if (m->opts.verbose) {
+    uint32_t extensionCount = 0;
+    vkEnumerateInstanceExtensionProperties(nullptr, &extensionCount, nullptr);
+
+    printf("%d extensions supported\n", extensionCount);
+    VkExtensionProperties *extensions = (VkExtensionProperties *)malloc(
+        sizeof(VkExtensionProperties) * extensionCount);
+    vkEnumerateInstanceExtensionProperties(nullptr, &extensionCount,
+                                           extensions);
+
+    for (unsigned int i = 0; i < extensionCount; ++i) {
+      printf("extension: `%s` with ver: `%d`\n", extensions[i].extensionName,
+             extensions[i].specVersion);
+    }
+    free(extensions);
+  }
+
   const char *wanted_layers[] = {"VK_LAYER_KHRONOS_validation"};
+  bool all_layers_available = true;
   uint32_t layerCount;
   vkEnumerateInstanceLayerProperties(&layerCount, nullptr);
   VkLayerProperties *availableLayers =
@@ -145,6 +1479,7 @@ void my_vk_create_instance(MyVk *m) {
     if (!available) {
       printf("ERROR: `%s` validation layer is not supported!\n",
              wanted_layers[want_idx]);
+      all_layers_available = false;
     }
   }
 
@@ -161,20 +1496,24 @@ void my_vk_create_instance(MyVk *m) {
   createInfo.pApplicationInfo = &appInfo;
 
   uint32_t glfwExtensionCount = 0;
-  const char **glfwExtensions;
-  glfwExtensions = glfwGetRequiredInstanceExtensions(&glfwExtensionCount);
+  const char **glfwExtensions = nullptr;
+  // offscreen rendering needs no surface extensions at all
+  if (!m->opts.headless) {
+    glfwExtensions = glfwGetRequiredInstanceExtensions(&glfwExtensionCount);
+  }
 
   createInfo.enabledExtensionCount = glfwExtensionCount;
   createInfo.ppEnabledExtensionNames = glfwExtensions;
 
-  if (ENABLE_VALIDATION_LAYERS) {
+  // missing layers would make vkCreateInstance fail, e.g. on CI machines
+  if (m->opts.validation && all_layers_available) {
     createInfo.enabledLayerCount = sizeof(wanted_layers) / sizeof(char *);
     createInfo.ppEnabledLayerNames = wanted_layers;
   } else {
     createInfo.enabledLayerCount = 0;
   }
 
-  for (uint32_t i = 0; i < glfwExtensionCount; ++i) {
+  for (uint32_t i = 0; m->opts.verbose && i < glfwExtensionCount; ++i) {
     printf("ext: %s\n", glfwExtensions[i]);
   }
 
@@ -194,69 +1533,271 @@ void my_vk_create_surface(MyVk *m) {
   }
 }
 
-void my_vk_create_phys_device(MyVk *m) {
+// only the instances cull against a hi-z pyramid of the depth buffer
+bool my_vk_has_hiz(MyVk *m) { return m->opts.instances > 0; }
 
-  // look at physical devices
-  m->phys_device = VK_NULL_HANDLE;
-  uint32_t devices;
-  vkEnumeratePhysicalDevices(m->instance, &devices, nullptr);
-  VkPhysicalDevice *devs =
-      (VkPhysicalDevice *)alloca(sizeof(VkPhysicalDevice) * devices);
-  vkEnumeratePhysicalDevices(m->instance, &devices, devs);
-  printf("found %d devices\n", devices);
-  for (uint32_t i = 0; i < devices; ++i) {
-    VkPhysicalDeviceProperties props;
-    vkGetPhysicalDeviceProperties(devs[i], &props);
-    VkPhysicalDeviceFeatures devFeatures;
-    vkGetPhysicalDeviceFeatures(devs[i], &devFeatures);
+// the main pass has depth when the instances need it for hi-z, or when a
+// depth format was asked for on the command line
+bool my_vk_has_depth(MyVk *m) {
+  return m->attach.depth_format != VK_FORMAT_UNDEFINED;
+}
 
-    uint32_t extensionCount;
-    vkEnumerateDeviceExtensionProperties(devs[i], nullptr, &extensionCount,
-                                         nullptr);
-    VkExtensionProperties *extProps = (VkExtensionProperties *)alloca(
-        sizeof(VkExtensionProperties) * extensionCount);
-    vkEnumerateDeviceExtensionProperties(devs[i], nullptr, &extensionCount,
-                                         extProps);
-    bool has_all_extensions = true;
-    for (uint32_t want_idx = 0;
-         want_idx < sizeof(deviceExtensions) / sizeof(char *); ++want_idx) {
-      bool has = false;
-      for (uint32_t actual_idx = 0; actual_idx < extensionCount; ++actual_idx) {
-        if (strcmp(deviceExtensions[want_idx],
-                   extProps[actual_idx].extensionName) == 0) {
-          has = true;
-          break;
-        }
-      }
-      if (!has) {
-        printf("device below doesn't have ext: %s\n",
-               deviceExtensions[want_idx]);
+bool my_vk_has_stencil(VkFormat format) {
+  return format == VK_FORMAT_D16_UNORM_S8_UINT ||
+         format == VK_FORMAT_D24_UNORM_S8_UINT ||
+         format == VK_FORMAT_D32_SFLOAT_S8_UINT;
+}
+
+// barriers on a depth stencil image have to name both aspects
+VkImageAspectFlags my_vk_depth_aspect(VkFormat format) {
+  return my_vk_has_stencil(format)
+             ? VK_IMAGE_ASPECT_DEPTH_BIT | VK_IMAGE_ASPECT_STENCIL_BIT
+             : VK_IMAGE_ASPECT_DEPTH_BIT;
+}
+
+const char *my_vk_depth_format_name(VkFormat format) {
+  switch (format) {
+  case VK_FORMAT_UNDEFINED:
+    return "none";
+  case VK_FORMAT_D32_SFLOAT:
+    return "d32";
+  case VK_FORMAT_D24_UNORM_S8_UINT:
+    return "d24s8";
+  case VK_FORMAT_X8_D24_UNORM_PACK32:
+    return "x8d24";
+  case VK_FORMAT_D16_UNORM:
+    return "d16";
+  default:
+    return "other";
+  }
+}
+
+const char *my_vk_present_mode_name(VkPresentModeKHR mode) {
+  switch (mode) {
+  case VK_PRESENT_MODE_IMMEDIATE_KHR:
+    return "immediate";
+  case VK_PRESENT_MODE_MAILBOX_KHR:
+    return "mailbox";
+  case VK_PRESENT_MODE_FIFO_KHR:
+    return "fifo";
+  case VK_PRESENT_MODE_FIFO_RELAXED_KHR:
+    return "fifo relaxed";
+  default:
+    return "other";
+  }
+}
+
+const char *my_vk_present_policy_name(uint32_t policy) {
+  switch (policy) {
+  case PRESENT_LATENCY:
+    return "latency";
+  case PRESENT_MAILBOX:
+    return "mailbox";
+  default:
+    return "fifo";
+  }
+}
+
+// the first mode of the policy's preference list the surface supports,
+// fifo always is
+VkPresentModeKHR my_vk_pick_present_mode(MyVk *m, uint32_t policy) {
+  const VkPresentModeKHR latency[] = {VK_PRESENT_MODE_IMMEDIATE_KHR,
+                                      VK_PRESENT_MODE_MAILBOX_KHR};
+  const VkPresentModeKHR mailbox[] = {VK_PRESENT_MODE_MAILBOX_KHR};
+  const VkPresentModeKHR *wanted = NULL;
+  uint32_t wanted_count = 0;
+  if (policy == PRESENT_LATENCY) {
+    wanted = latency;
+    wanted_count = 2;
+  } else if (policy == PRESENT_MAILBOX) {
+    wanted = mailbox;
+    wanted_count = 1;
+  }
+  uint32_t count = 0;
+  vkGetPhysicalDeviceSurfacePresentModesKHR(m->phys_device, m->surface,
+                                            &count, nullptr);
+  VkPresentModeKHR *modes =
+      (VkPresentModeKHR *)alloca(sizeof(VkPresentModeKHR) * count);
+  vkGetPhysicalDeviceSurfacePresentModesKHR(m->phys_device, m->surface,
+                                            &count, modes);
+  for (uint32_t w = 0; w < wanted_count; ++w) {
+    for (uint32_t i = 0; i < count; ++i) {
+      if (modes[i] == wanted[w]) {
+        return wanted[w];
+      }
+    }
+  }
+  return VK_PRESENT_MODE_FIFO_KHR;
+}
+
+bool my_vk_device_has_extension(VkPhysicalDevice dev, const char *name) {
+  uint32_t count = 0;
+  vkEnumerateDeviceExtensionProperties(dev, nullptr, &count, nullptr);
+  VkExtensionProperties *props =
+      (VkExtensionProperties *)malloc(sizeof(VkExtensionProperties) * count);
+  vkEnumerateDeviceExtensionProperties(dev, nullptr, &count, props);
+  bool has = false;
+  for (uint32_t i = 0; i < count && !has; ++i) {
+    has = strcmp(props[i].extensionName, name) == 0;
+  }
+  free(props);
+  return has;
+}
+
+// the swapchain extension is only needed when we present to a window
+uint32_t my_vk_device_extension_count(MyVk *m) {
+  return m->opts.headless ? 0 : sizeof(deviceExtensions) / sizeof(char *);
+}
+
+// headless has no surface to ask, so pick a format we can render into
+bool my_vk_pick_offscreen_format(VkPhysicalDevice dev,
+                                 VkSurfaceFormatKHR *format) {
+  const VkFormat candidates[] = {VK_FORMAT_B8G8R8A8_SRGB,
+                                 VK_FORMAT_R8G8B8A8_SRGB};
+  for (uint32_t i = 0; i < sizeof(candidates) / sizeof(VkFormat); ++i) {
+    VkFormatProperties props;
+    vkGetPhysicalDeviceFormatProperties(dev, candidates[i], &props);
+    if (props.optimalTilingFeatures & VK_FORMAT_FEATURE_COLOR_ATTACHMENT_BIT) {
+      format->format = candidates[i];
+      format->colorSpace = VK_COLOR_SPACE_SRGB_NONLINEAR_KHR;
+      return true;
+    }
+  }
+  return false;
+}
+
+// every submit uses synchronization2 and every frame waits on a timeline
+// semaphore, a device without them can't run anything
+bool my_vk_device_has_required_features(
+    VkPhysicalDevice dev, const VkPhysicalDeviceProperties *props) {
+  if (props->apiVersion < VK_API_VERSION_1_3) {
+    return false;
+  }
+  VkPhysicalDeviceVulkan13Features supported13{};
+  supported13.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_3_FEATURES;
+  VkPhysicalDeviceVulkan12Features supported12{};
+  supported12.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_2_FEATURES;
+  supported12.pNext = &supported13;
+  VkPhysicalDeviceFeatures2 supported{};
+  supported.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2;
+  supported.pNext = &supported12;
+  vkGetPhysicalDeviceFeatures2(dev, &supported);
+  return supported12.timelineSemaphore && supported13.synchronization2;
+}
+
+// keeps the devices that have every extension we need. That only takes the
+// instance, so it runs while the window and its surface are still being
+// made. Headless needs no surface and picks its device here.
+void my_vk_enumerate_phys_devices(MyVk *m) {
+  m->phys_device = VK_NULL_HANDLE;
+  m->phys_candidate_count = 0;
+  uint32_t devices;
+  vkEnumeratePhysicalDevices(m->instance, &devices, nullptr);
+  VkPhysicalDevice *devs =
+      (VkPhysicalDevice *)alloca(sizeof(VkPhysicalDevice) * devices);
+  vkEnumeratePhysicalDevices(m->instance, &devices, devs);
+  if (m->opts.verbose) {
+    printf("found %d devices\n", devices);
+  }
+  for (uint32_t i = 0; i < devices; ++i) {
+    VkPhysicalDeviceProperties props;
+    vkGetPhysicalDeviceProperties(devs[i], &props);
+    VkPhysicalDeviceFeatures devFeatures;
+    vkGetPhysicalDeviceFeatures(devs[i], &devFeatures);
+
+    uint32_t extensionCount;
+    vkEnumerateDeviceExtensionProperties(devs[i], nullptr, &extensionCount,
+                                         nullptr);
+    VkExtensionProperties *extProps = (VkExtensionProperties *)alloca(
+        sizeof(VkExtensionProperties) * extensionCount);
+    vkEnumerateDeviceExtensionProperties(devs[i], nullptr, &extensionCount,
+                                         extProps);
+    bool has_all_extensions = true;
+    for (uint32_t want_idx = 0; want_idx < my_vk_device_extension_count(m);
+         ++want_idx) {
+      bool has = false;
+      for (uint32_t actual_idx = 0; actual_idx < extensionCount; ++actual_idx) {
+        if (strcmp(deviceExtensions[want_idx],
+                   extProps[actual_idx].extensionName) == 0) {
+          has = true;
+          break;
+        }
+      }
+      if (!has) {
+        if (m->opts.verbose) {
+          printf("device below doesn't have ext: %s\n",
+                 deviceExtensions[want_idx]);
+        }
         has_all_extensions = false;
       }
     }
-    printf("device::: name: %s, vulkan minor version: %d, tessellation "
-           "shader: %d, \n",
-           props.deviceName, VK_API_VERSION_MINOR(props.apiVersion),
-           devFeatures.tessellationShader);
-    if (!has_all_extensions) {
+    if (m->opts.verbose) {
+      printf("device::: name: %s, vulkan minor version: %d, tessellation "
+             "shader: %d, \n",
+             props.deviceName, VK_API_VERSION_MINOR(props.apiVersion),
+             devFeatures.tessellationShader);
+    }
+    if (!my_vk_device_has_required_features(devs[i], &props)) {
+      if (m->opts.verbose) {
+        printf("device below lacks vulkan 1.3, timeline semaphores or "
+               "synchronization2\n");
+      }
+      continue;
+    }
+    if (!has_all_extensions || m->phys_candidate_count == MAX_PHYS_DEVICES) {
+      continue;
+    }
+
+    if (m->opts.headless) {
+      VkSurfaceFormatKHR offscreen_format;
+      if (my_vk_pick_offscreen_format(devs[i], &offscreen_format) &&
+          (m->phys_device == VK_NULL_HANDLE ||
+           props.deviceType == VK_PHYSICAL_DEVICE_TYPE_DISCRETE_GPU)) {
+        m->phys_device = devs[i];
+        m->phys_props = props;
+        m->format = offscreen_format;
+        m->present_mode = VK_PRESENT_MODE_FIFO_KHR; // never presented
+        if (m->opts.verbose) {
+          printf("chose this one above me!\n");
+        }
+      }
       continue;
     }
+    m->phys_candidates[m->phys_candidate_count] = devs[i];
+    m->phys_candidate_props[m->phys_candidate_count++] = props;
+  }
+}
+
+// picks one of the candidates that can present to the surface, a discrete
+// one if there is one
+void my_vk_create_phys_device(MyVk *m) {
+  for (uint32_t c = 0; !m->opts.headless && c < m->phys_candidate_count;
+       ++c) {
+    VkPhysicalDevice dev = m->phys_candidates[c];
+    const VkPhysicalDeviceProperties *props = &m->phys_candidate_props[c];
+    if (m->opts.verbose) {
+      printf("device %s:\n", props->deviceName);
+    }
 
     // check formats
     uint32_t formatCount;
-    vkGetPhysicalDeviceSurfaceFormatsKHR(devs[i], m->surface, &formatCount,
+    vkGetPhysicalDeviceSurfaceFormatsKHR(dev, m->surface, &formatCount,
                                          nullptr);
-    printf("Supported formats: %d\n", formatCount);
+    if (m->opts.verbose) {
+      printf("Supported formats: %d\n", formatCount);
+    }
     VkSurfaceFormatKHR best_format;
     bool set_the_format = false;
     if (formatCount != 0) {
       VkSurfaceFormatKHR *formats = (VkSurfaceFormatKHR *)alloca(
           sizeof(VkSurfaceFormatKHR) * formatCount);
-      vkGetPhysicalDeviceSurfaceFormatsKHR(devs[i], m->surface, &formatCount,
+      vkGetPhysicalDeviceSurfaceFormatsKHR(dev, m->surface, &formatCount,
                                            formats);
       for (uint32_t i = 0; i < formatCount; ++i) {
-        printf("format: %d, colorspace: %d\n", formats[i].format,
-               formats[i].colorSpace);
+        if (m->opts.verbose) {
+          printf("format: %d, colorspace: %d\n", formats[i].format,
+                 formats[i].colorSpace);
+        }
         if (formats[i].format == VK_FORMAT_B8G8R8A8_SRGB &&
             formats[i].colorSpace == VK_COLOR_SPACE_SRGB_NONLINEAR_KHR &&
             !set_the_format) {
@@ -269,42 +1810,45 @@ void my_vk_create_phys_device(MyVk *m) {
       }
     }
 
-    // check for presentModes
+    // check for presentModes, which one is used is up to the policy
     uint32_t presentModeCount;
-    VkPresentModeKHR best_present;
     {
-      bool set_present_Mode = false;
-      vkGetPhysicalDeviceSurfacePresentModesKHR(devs[i], m->surface,
+      vkGetPhysicalDeviceSurfacePresentModesKHR(dev, m->surface,
                                                 &presentModeCount, nullptr);
-      printf("Supported present modes: %d\n", presentModeCount);
-      if (presentModeCount != 0) {
+      if (m->opts.verbose && presentModeCount != 0) {
+        printf("Supported present modes: %d\n", presentModeCount);
         VkPresentModeKHR *presentModes = (VkPresentModeKHR *)alloca(
             sizeof(VkPresentModeKHR) * presentModeCount);
         vkGetPhysicalDeviceSurfacePresentModesKHR(
-            devs[i], m->surface, &presentModeCount, presentModes);
+            dev, m->surface, &presentModeCount, presentModes);
         for (uint32_t i = 0; i < presentModeCount; ++i) {
-          printf("present mode: %d\n", presentModes[i]);
-          if (presentModes[i] == VK_PRESENT_MODE_IMMEDIATE_KHR) {
-            // prefer immediate
-            best_present = presentModes[i];
-            set_present_Mode = true;
-          }
-        }
-        if (!set_present_Mode) {
-          best_present = VK_PRESENT_MODE_FIFO_KHR; // always available
+          printf("present mode: %s\n",
+                 my_vk_present_mode_name(presentModes[i]));
         }
       }
     }
 
-    if (has_all_extensions && formatCount != 0 && presentModeCount != 0 &&
+    if (formatCount != 0 && presentModeCount != 0 &&
         (m->phys_device == VK_NULL_HANDLE ||
-         props.deviceType == VK_PHYSICAL_DEVICE_TYPE_DISCRETE_GPU)) {
-      m->phys_device = devs[i];
+         props->deviceType == VK_PHYSICAL_DEVICE_TYPE_DISCRETE_GPU)) {
+      m->phys_device = dev;
+      m->phys_props = *props;
       m->format = best_format;
-      m->present_mode = best_present;
-      printf("chose this one above me!\n");
     }
   }
+  if (m->phys_device == VK_NULL_HANDLE) {
+    printf("ERROR: no device with vulkan 1.3, timeline semaphores, "
+           "synchronization2 and the extensions needed!\n");
+    return;
+  }
+  printf("using %s\n", m->phys_props.deviceName);
+  vkGetPhysicalDeviceMemoryProperties(m->phys_device, &m->mem_props);
+  if (!m->opts.headless) {
+    m->present_mode = my_vk_pick_present_mode(m, m->opts.present_policy);
+    printf("presenting with %s for %s\n",
+           my_vk_present_mode_name(m->present_mode),
+           my_vk_present_policy_name(m->opts.present_policy));
+  }
 }
 
 void my_vk_get_queue_indices(MyVk *m) {
@@ -312,6 +1856,8 @@ void my_vk_get_queue_indices(MyVk *m) {
   // look for available queues in physical device
   m->queue_graphics_idx = -1;
   m->queue_present_idx = -1;
+  m->queue_compute_idx = -1;
+  m->queue_transfer_idx = -1;
   uint32_t queueFamilyCount = 0;
   vkGetPhysicalDeviceQueueFamilyProperties(m->phys_device, &queueFamilyCount,
                                            nullptr);
@@ -319,37 +1865,77 @@ void my_vk_get_queue_indices(MyVk *m) {
       sizeof(VkQueueFamilyProperties) * queueFamilyCount);
   vkGetPhysicalDeviceQueueFamilyProperties(m->phys_device, &queueFamilyCount,
                                            queueFamilies);
-  printf("found %d queue families!\n", queueFamilyCount);
+  if (m->opts.verbose) {
+    printf("found %d queue families!\n", queueFamilyCount);
+  }
   for (uint32_t i = 0; i < queueFamilyCount; ++i) {
     VkQueueFamilyProperties q = queueFamilies[i];
     VkBool32 presentSupport = false;
-    vkGetPhysicalDeviceSurfaceSupportKHR(m->phys_device, i, m->surface,
-                                         &presentSupport);
-    printf("count: %d, graphics: %d, compute: %d, transfer: %d, present: %d\n",
-           q.queueCount, q.queueFlags & VK_QUEUE_GRAPHICS_BIT,
-           0 != (q.queueFlags & VK_QUEUE_COMPUTE_BIT),
-           0 != (q.queueFlags & VK_QUEUE_TRANSFER_BIT), presentSupport);
+    if (!m->opts.headless) {
+      vkGetPhysicalDeviceSurfaceSupportKHR(m->phys_device, i, m->surface,
+                                           &presentSupport);
+    }
+    if (m->opts.verbose) {
+      printf("count: %d, graphics: %d, compute: %d, transfer: %d, present: "
+             "%d\n",
+             q.queueCount, q.queueFlags & VK_QUEUE_GRAPHICS_BIT,
+             0 != (q.queueFlags & VK_QUEUE_COMPUTE_BIT),
+             0 != (q.queueFlags & VK_QUEUE_TRANSFER_BIT), presentSupport);
+    }
     if (q.queueFlags & VK_QUEUE_GRAPHICS_BIT && m->queue_graphics_idx == -1) {
       m->queue_graphics_idx = i;
     }
+    // compute without graphics runs beside the graphics queue
+    if ((q.queueFlags & VK_QUEUE_COMPUTE_BIT) &&
+        !(q.queueFlags & VK_QUEUE_GRAPHICS_BIT) && m->queue_compute_idx == -1) {
+      m->queue_compute_idx = i;
+    }
+    // transfer only families are usually the copy engines
+    if ((q.queueFlags & VK_QUEUE_TRANSFER_BIT) &&
+        !(q.queueFlags & (VK_QUEUE_GRAPHICS_BIT | VK_QUEUE_COMPUTE_BIT)) &&
+        m->queue_transfer_idx == -1) {
+      m->queue_transfer_idx = i;
+    }
     // pick the first one
     if (presentSupport && m->queue_present_idx == -1) {
       m->queue_present_idx = i;
     }
   }
-  printf("graphics queue idx: %ld, present queue idx: %ld\n",
-         m->queue_graphics_idx, m->queue_present_idx);
+  if (m->opts.headless) {
+    // nothing is presented, keep everything on the graphics queue
+    m->queue_present_idx = m->queue_graphics_idx;
+  }
+  // without dedicated families that work stays on the graphics queue
+  if (m->queue_compute_idx == -1) {
+    m->queue_compute_idx = m->queue_graphics_idx;
+  }
+  if (m->queue_transfer_idx == -1) {
+    m->queue_transfer_idx = m->queue_graphics_idx;
+  }
+  printf("graphics queue idx: %ld, present queue idx: %ld, compute queue idx: "
+         "%ld, transfer queue idx: %ld\n",
+         m->queue_graphics_idx, m->queue_present_idx, m->queue_compute_idx,
+         m->queue_transfer_idx);
 }
 
 void my_vk_create_device(MyVk *m) {
 
   // create logical device
-  int number_of_queues = 2;
-  int64_t queue_idxs[] = {m->queue_graphics_idx, m->queue_present_idx};
-  if (m->queue_graphics_idx == m->queue_present_idx) {
-    number_of_queues = 1;
+  // one queue from every distinct family
+  int number_of_queues = 0;
+  int64_t queue_idxs[4];
+  int64_t wanted[] = {m->queue_graphics_idx, m->queue_present_idx,
+                      m->queue_compute_idx, m->queue_transfer_idx};
+  for (int i = 0; i < 4; ++i) {
+    bool seen = false;
+    for (int j = 0; j < number_of_queues; ++j) {
+      seen |= queue_idxs[j] == wanted[i];
+    }
+    if (!seen) {
+      queue_idxs[number_of_queues++] = wanted[i];
+    }
   }
-  VkDeviceQueueCreateInfo queueCreateInfos[2]{};
+  VkDeviceQueueCreateInfo queueCreateInfos[4]{};
   VkPhysicalDeviceFeatures deviceFeatures[2]{};
   float queuePriority = 1.0f;
   for (int queue_idx = 0; queue_idx < number_of_queues; ++queue_idx) {
@@ -365,15 +1951,102 @@ void my_vk_create_device(MyVk *m) {
   createInfo.pQueueCreateInfos = queueCreateInfos;
   createInfo.queueCreateInfoCount = number_of_queues;
 
+  VkPhysicalDeviceFeatures supportedFeatures;
+  vkGetPhysicalDeviceFeatures(m->phys_device, &supportedFeatures);
+  deviceFeatures[0].pipelineStatisticsQuery =
+      supportedFeatures.pipelineStatisticsQuery;
+  deviceFeatures[0].samplerAnisotropy = supportedFeatures.samplerAnisotropy;
+  deviceFeatures[0].textureCompressionBC =
+      supportedFeatures.textureCompressionBC;
+  // bindless.frag indexes its arrays with push constants
+  deviceFeatures[0].shaderSampledImageArrayDynamicIndexing =
+      supportedFeatures.shaderSampledImageArrayDynamicIndexing;
+  deviceFeatures[0].shaderStorageBufferArrayDynamicIndexing =
+      supportedFeatures.shaderStorageBufferArrayDynamicIndexing;
+  m->features = deviceFeatures[0];
   createInfo.pEnabledFeatures = deviceFeatures;
 
-  createInfo.enabledExtensionCount = sizeof(deviceExtensions) / sizeof(char *);
-  createInfo.ppEnabledExtensionNames = deviceExtensions;
+  // 1.2 and 1.3 features: timeline semaphores and synchronization2 are
+  // there, device selection made sure, the rest is optional
+  m->features12 = VkPhysicalDeviceVulkan12Features{};
+  m->features12.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_2_FEATURES;
+  m->features13 = VkPhysicalDeviceVulkan13Features{};
+  m->features13.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_3_FEATURES;
+  VkPhysicalDeviceVulkan13Features supported13{};
+  supported13.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_3_FEATURES;
+  VkPhysicalDeviceVulkan12Features supported12{};
+  supported12.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_2_FEATURES;
+  supported12.pNext = &supported13;
+  VkPhysicalDeviceFeatures2 supported{};
+  supported.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2;
+  supported.pNext = &supported12;
+  vkGetPhysicalDeviceFeatures2(m->phys_device, &supported);
+  m->features12.drawIndirectCount = supported12.drawIndirectCount;
+  // descriptor indexing, for --bindless
+  m->features12.runtimeDescriptorArray = supported12.runtimeDescriptorArray;
+  m->features12.descriptorBindingPartiallyBound =
+      supported12.descriptorBindingPartiallyBound;
+  m->features12.descriptorBindingSampledImageUpdateAfterBind =
+      supported12.descriptorBindingSampledImageUpdateAfterBind;
+  m->features12.descriptorBindingStorageBufferUpdateAfterBind =
+      supported12.descriptorBindingStorageBufferUpdateAfterBind;
+  m->features12.descriptorBindingUpdateUnusedWhilePending =
+      supported12.descriptorBindingUpdateUnusedWhilePending;
+  m->features12.timelineSemaphore = supported12.timelineSemaphore;
+  m->features13.synchronization2 = supported13.synchronization2;
+  m->features13.dynamicRendering = supported13.dynamicRendering;
+  m->features12.pNext = &m->features13;
+  createInfo.pNext = &m->features12;
+  // 1.3 requires dynamic rendering, only --render-pass does without
+  m->dynamic_rendering = !m->opts.render_pass;
+  printf("drawing with %s\n", m->dynamic_rendering ? "dynamic rendering"
+                                                    : "a render pass");
+
+  const char *extensions[4];
+  uint32_t extension_count = my_vk_device_extension_count(m);
+  memcpy(extensions, deviceExtensions, sizeof(char *) * extension_count);
+  // present id and present wait, for pacing
+  VkPhysicalDevicePresentIdFeaturesKHR present_id{};
+  present_id.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PRESENT_ID_FEATURES_KHR;
+  VkPhysicalDevicePresentWaitFeaturesKHR present_wait{};
+  present_wait.sType =
+      VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PRESENT_WAIT_FEATURES_KHR;
+  if (!m->opts.headless &&
+      my_vk_device_has_extension(m->phys_device, presentWaitExtensions[0]) &&
+      my_vk_device_has_extension(m->phys_device, presentWaitExtensions[1])) {
+    present_id.pNext = &present_wait;
+    VkPhysicalDeviceFeatures2 supported{};
+    supported.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2;
+    supported.pNext = &present_id;
+    vkGetPhysicalDeviceFeatures2(m->phys_device, &supported);
+    if (present_id.presentId && present_wait.presentWait) {
+      present_wait.pNext = (void *)createInfo.pNext;
+      createInfo.pNext = &present_id;
+      extensions[extension_count++] = presentWaitExtensions[0];
+      extensions[extension_count++] = presentWaitExtensions[1];
+      m->pace.available = true;
+    }
+  }
+  createInfo.enabledExtensionCount = extension_count;
+  createInfo.ppEnabledExtensionNames = extensions;
 
   if (vkCreateDevice(m->phys_device, &createInfo, nullptr, &m->device) !=
       VK_SUCCESS) {
     printf("ERROR: Could not create logical device!");
   }
+  if (m->pace.available) {
+    m->pace.wait_for_present = (PFN_vkWaitForPresentKHR)vkGetDeviceProcAddr(
+        m->device, "vkWaitForPresentKHR");
+    m->pace.available = m->pace.wait_for_present != NULL;
+  }
+  m->pace.enabled = m->opts.pace && m->pace.available;
+  if (m->opts.pace && !m->pace.available) {
+    printf("no present wait on this device, frames aren't paced\n");
+  }
+  m->pace.period_ms = -1.0;
+  m->pace.work_ms = -1.0;
+  m->pace.display_latency_ms = -1.0;
+  m->pace.interval_ms = -1.0;
 }
 
 void my_vk_get_capabilites(MyVk *m) {
@@ -385,13 +2058,15 @@ void my_vk_get_capabilites(MyVk *m) {
 
 void my_vk_create_extent(MyVk *m) {
   // choose swap extent (resolution in pixels of swap buffer)
-  printf(
-      "Range of swap extent: min wh: %d, %d, cur wh: %d, %d, max wh: %d "
-      "%d\n. minImageCount: %d, maxImageCount: %d\n",
-      m->capabilites.minImageExtent.width, m->capabilites.minImageExtent.height,
-      m->capabilites.currentExtent.width, m->capabilites.currentExtent.height,
-      m->capabilites.maxImageExtent.width, m->capabilites.maxImageExtent.height,
-      m->capabilites.minImageCount, m->capabilites.maxImageCount);
+  const VkSurfaceCapabilitiesKHR *caps = &m->capabilites;
+  if (m->opts.verbose) {
+    printf("Range of swap extent: min wh: %d, %d, cur wh: %d, %d, max wh: %d "
+           "%d\n. minImageCount: %d, maxImageCount: %d\n",
+           caps->minImageExtent.width, caps->minImageExtent.height,
+           caps->currentExtent.width, caps->currentExtent.height,
+           caps->maxImageExtent.width, caps->maxImageExtent.height,
+           caps->minImageCount, caps->maxImageCount);
+  }
   if (m->capabilites.currentExtent.width != UINT32_MAX) {
     m->extent = m->capabilites.currentExtent;
   } else {
@@ -414,12 +2089,427 @@ void my_vk_create_extent(MyVk *m) {
   }
 }
 
+// first memory type allowed by type_bits that has all the required
+// properties, preferring one that also has the preferred ones
+uint32_t my_vk_find_memory_type(MyVk *m, uint32_t type_bits,
+                                VkMemoryPropertyFlags required,
+                                VkMemoryPropertyFlags preferred = 0) {
+  VkMemoryPropertyFlags wanted[2] = {required | preferred, required};
+  for (uint32_t w = 0; w < 2; ++w) {
+    for (uint32_t i = 0; i < m->mem_props.memoryTypeCount; ++i) {
+      if ((type_bits & (1u << i)) &&
+          (m->mem_props.memoryTypes[i].propertyFlags & wanted[w]) ==
+              wanted[w]) {
+        return i;
+      }
+    }
+  }
+  printf("ERROR: no memory type with properties %x!\n", required);
+  return UINT32_MAX;
+}
+
+// Sub-allocates from large VkDeviceMemory blocks with a buddy allocator.
+// Buddy blocks are aligned to their own (power of two) size, which covers any
+// alignment a resource can ask for. Buffers and optimal tiling images never
+// share a block, so bufferImageGranularity can't be violated.
+uint32_t my_vk_block_levels(VkDeviceSize block_size) {
+  uint32_t levels = 0;
+  while (((VkDeviceSize)ALLOC_MIN_SIZE << levels) < block_size) {
+    ++levels;
+  }
+  return levels;
+}
+
+void my_vk_allocator_init(MyVk *m) {
+  MyVkAllocator *a = &m->allocator;
+  a->block_count = 0;
+  a->dedicated_count = 0;
+  a->dedicated_bytes = 0;
+  a->requested_bytes = 0;
+  a->allocation_count = 0;
+  // small heaps (e.g. the 256 MiB bar heap) get proportionally smaller blocks
+  for (uint32_t i = 0; i < m->mem_props.memoryHeapCount; ++i) {
+    VkDeviceSize size = ALLOC_BLOCK_SIZE;
+    while (size > ALLOC_MIN_SIZE &&
+           size > m->mem_props.memoryHeaps[i].size / 8) {
+      size /= 2;
+    }
+    a->heap_block_size[i] = size;
+  }
+}
+
+void my_vk_allocator_destroy(MyVk *m) {
+  MyVkAllocator *a = &m->allocator;
+  for (uint32_t i = 0; i < a->block_count; ++i) {
+    MemoryBlock *b = &a->blocks[i];
+    if (b->used != 0) {
+      printf("ERROR: memory block %u freed with %llu bytes still in use!\n", i,
+             (unsigned long long)b->used);
+    }
+    my_vk_destroy_object(m, VK_OBJECT_TYPE_DEVICE_MEMORY, (uint64_t)b->memory);
+    free(b->longest);
+  }
+  if (a->dedicated_count != 0) {
+    printf("ERROR: %u dedicated allocations leaked!\n", a->dedicated_count);
+  }
+  a->block_count = 0;
+}
+
+bool my_vk_allocate_device_memory(MyVk *m, uint32_t type, VkDeviceSize size,
+                                  VkDeviceMemory *memory, char **mapped) {
+  MyVkAllocator *a = &m->allocator;
+  if (a->block_count + a->dedicated_count >=
+      m->phys_props.limits.maxMemoryAllocationCount) {
+    printf("ERROR: reached maxMemoryAllocationCount (%u)!\n",
+           m->phys_props.limits.maxMemoryAllocationCount);
+    return false;
+  }
+  VkMemoryAllocateInfo allocInfo{};
+  allocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+  allocInfo.allocationSize = size;
+  allocInfo.memoryTypeIndex = type;
+  if (vkAllocateMemory(m->device, &allocInfo, nullptr, memory) != VK_SUCCESS) {
+    printf("ERROR: could not allocate %llu bytes of memory type %u!\n",
+           (unsigned long long)size, type);
+    return false;
+  }
+  MY_VK_TRACK(m, VK_OBJECT_TYPE_DEVICE_MEMORY, *memory);
+  *mapped = NULL;
+  // host visible memory stays mapped, a VkDeviceMemory can only be mapped once
+  if (m->mem_props.memoryTypes[type].propertyFlags &
+      VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT) {
+    vkMapMemory(m->device, *memory, 0, VK_WHOLE_SIZE, 0, (void **)mapped);
+  }
+  return true;
+}
+
+MemoryBlock *my_vk_create_block(MyVk *m, uint32_t type, bool linear) {
+  MyVkAllocator *a = &m->allocator;
+  if (a->block_count == ALLOC_MAX_BLOCKS) {
+    printf("ERROR: out of memory blocks!\n");
+    return NULL;
+  }
+  MemoryBlock *b = &a->blocks[a->block_count];
+  b->type = type;
+  b->linear = linear;
+  b->size = a->heap_block_size[m->mem_props.memoryTypes[type].heapIndex];
+  b->levels = my_vk_block_levels(b->size);
+  b->used = 0;
+  if (!my_vk_allocate_device_memory(m, type, b->size, &b->memory,
+                                    &b->mapped)) {
+    return NULL;
+  }
+  // longest[node] = order + 1 of the biggest free buddy below node, 0 = full.
+  // Node 1 is the whole block, children of n are 2n and 2n + 1.
+  uint32_t node_count = 2u << b->levels;
+  b->longest = (uint8_t *)malloc(node_count);
+  b->longest[0] = 0;
+  for (uint32_t depth = 0; depth <= b->levels; ++depth) {
+    for (uint32_t n = 1u << depth; n < 2u << depth; ++n) {
+      b->longest[n] = (uint8_t)(b->levels - depth + 1);
+    }
+  }
+  ++a->block_count;
+  return b;
+}
+
+// returns the offset of a free buddy of 2^order min sizes, or UINT64_MAX
+VkDeviceSize my_vk_block_alloc(MemoryBlock *b, uint32_t order) {
+  if (b->longest[1] < order + 1) {
+    return UINT64_MAX;
+  }
+  uint32_t n = 1;
+  for (uint32_t depth = 0; depth < b->levels - order; ++depth) {
+    n = b->longest[2 * n] >= order + 1 ? 2 * n : 2 * n + 1;
+  }
+  b->longest[n] = 0;
+  VkDeviceSize offset = (VkDeviceSize)(n - (1u << (b->levels - order)))
+                        << order;
+  for (n /= 2; n >= 1; n /= 2) {
+    b->longest[n] = std::max(b->longest[2 * n], b->longest[2 * n + 1]);
+  }
+  b->used += (VkDeviceSize)ALLOC_MIN_SIZE << order;
+  return offset * ALLOC_MIN_SIZE;
+}
+
+void my_vk_block_free(MemoryBlock *b, VkDeviceSize offset, uint32_t order) {
+  uint32_t n = (uint32_t)(offset / ALLOC_MIN_SIZE >> order) +
+               (1u << (b->levels - order));
+  b->longest[n] = (uint8_t)(order + 1);
+  b->used -= (VkDeviceSize)ALLOC_MIN_SIZE << order;
+  // merge with the buddy for as long as both halves are free
+  for (uint32_t child_order = order; n > 1; ++child_order) {
+    n /= 2;
+    uint8_t left = b->longest[2 * n], right = b->longest[2 * n + 1];
+    if (left == child_order + 1 && right == child_order + 1) {
+      b->longest[n] = (uint8_t)(child_order + 2);
+    } else {
+      b->longest[n] = std::max(left, right);
+    }
+  }
+}
+
+// linear: buffers and linear images, otherwise optimal tiling images
+MyAllocation my_vk_alloc(MyVk *m, VkMemoryRequirements reqs, bool linear,
+                         VkMemoryPropertyFlags required,
+                         VkMemoryPropertyFlags preferred = 0) {
+  MyVkAllocator *a = &m->allocator;
+  std::lock_guard<std::mutex> lock(a->mutex);
+  MyAllocation alloc{};
+  alloc.size = reqs.size;
+  alloc.type =
+      my_vk_find_memory_type(m, reqs.memoryTypeBits, required, preferred);
+  if (alloc.type == UINT32_MAX) {
+    return alloc;
+  }
+  VkDeviceSize block_size =
+      a->heap_block_size[m->mem_props.memoryTypes[alloc.type].heapIndex];
+  VkDeviceSize needed = std::max(reqs.size, reqs.alignment);
+
+  if (needed > block_size / 2) {
+    // too big to share a block with anything, give it its own memory
+    alloc.block = UINT32_MAX;
+    char *mapped;
+    if (my_vk_allocate_device_memory(m, alloc.type, reqs.size, &alloc.memory,
+                                     &mapped)) {
+      alloc.mapped = mapped;
+      ++a->dedicated_count;
+      a->dedicated_bytes += reqs.size;
+      ++a->allocation_count;
+    }
+    return alloc;
+  }
+
+  uint32_t order = 0;
+  while (((VkDeviceSize)ALLOC_MIN_SIZE << order) < needed) {
+    ++order;
+  }
+  for (uint32_t i = 0; i <= a->block_count; ++i) {
+    MemoryBlock *b = &a->blocks[i];
+    if (i == a->block_count) {
+      b = my_vk_create_block(m, alloc.type, linear);
+      if (b == NULL) {
+        break;
+      }
+    } else if (b->type != alloc.type || b->linear != linear) {
+      continue;
+    }
+    VkDeviceSize offset = my_vk_block_alloc(b, order);
+    if (offset != UINT64_MAX) {
+      alloc.memory = b->memory;
+      alloc.offset = offset;
+      alloc.block = i;
+      alloc.order = order;
+      alloc.mapped = b->mapped ? b->mapped + offset : NULL;
+      a->requested_bytes += reqs.size;
+      ++a->allocation_count;
+      return alloc;
+    }
+  }
+  alloc.memory = VK_NULL_HANDLE;
+  return alloc;
+}
+
+void my_vk_free(MyVk *m, MyAllocation *alloc) {
+  MyVkAllocator *a = &m->allocator;
+  if (alloc->memory == VK_NULL_HANDLE) {
+    return;
+  }
+  std::lock_guard<std::mutex> lock(a->mutex);
+  if (alloc->block == UINT32_MAX) {
+    my_vk_destroy_object(m, VK_OBJECT_TYPE_DEVICE_MEMORY,
+                         (uint64_t)alloc->memory);
+    --a->dedicated_count;
+    a->dedicated_bytes -= alloc->size;
+  } else {
+    my_vk_block_free(&a->blocks[alloc->block], alloc->offset, alloc->order);
+    a->requested_bytes -= alloc->size;
+  }
+  --a->allocation_count;
+  *alloc = MyAllocation{};
+}
+
+// capacity slots, none handed out
+void my_vk_slots_init(DescriptorSlots *s, uint32_t capacity) {
+  s->capacity = capacity;
+  s->next = 0;
+  s->free = (uint32_t *)malloc(sizeof(uint32_t) * capacity);
+  s->free_count = 0;
+}
+
+// UINT32_MAX once all of them are in use
+uint32_t my_vk_slot_alloc(DescriptorSlots *s) {
+  if (s->free_count > 0) {
+    return s->free[--s->free_count];
+  }
+  if (s->next == s->capacity) {
+    return UINT32_MAX;
+  }
+  return s->next++;
+}
+
+void my_vk_slot_free(DescriptorSlots *s, uint32_t slot) {
+  s->free[s->free_count++] = slot;
+}
+
+// queues the destruction of an object, its memory and a host array (each one
+// optional) until every frame submitted so far has finished on the gpu. The
+// allocation is taken over, alloc is cleared.
+void my_vk_defer_destroy(MyVk *m, VkObjectType type, uint64_t handle,
+                         MyAllocation *alloc, void *host) {
+  MyVkDeletionQueue *q = &m->deletions;
+  if (q->count == q->capacity) {
+    q->capacity = q->capacity ? q->capacity * 2 : 64;
+    q->items = (DeferredDestroy *)realloc(
+        q->items, sizeof(DeferredDestroy) * q->capacity);
+  }
+  DeferredDestroy *d = &q->items[q->count++];
+  d->frame_number = m->frame_number;
+  d->type = type;
+  d->handle = handle;
+  d->alloc = MyAllocation{};
+  if (alloc != NULL) {
+    d->alloc = *alloc;
+    *alloc = MyAllocation{};
+  }
+  d->host = host;
+  d->slots = NULL;
+}
+
+// frees a descriptor array element once the frames that may read it are done
+void my_vk_defer_free_slot(MyVk *m, DescriptorSlots *slots, uint32_t slot) {
+  my_vk_defer_destroy(m, VK_OBJECT_TYPE_UNKNOWN, 0, NULL, NULL);
+  DeferredDestroy *d = &m->deletions.items[m->deletions.count - 1];
+  d->slots = slots;
+  d->slot = slot;
+}
+
+// runs the queued destructions whose frames have finished, or all of them
+// once the device is idle. Presentation has no completion signal, so the frame
+// that rendered a swapchain image finishing is taken as its present being done.
+void my_vk_run_deletions(MyVk *m, bool all) {
+  MyVkDeletionQueue *q = &m->deletions;
+  uint64_t done = UINT64_MAX;
+  if (!all) {
+    vkGetSemaphoreCounterValue(m->device, m->frameTimeline, &done);
+  }
+  // queued in frame order, the first unfinished one ends the run
+  uint32_t i = 0;
+  for (; i < q->count && q->items[i].frame_number <= done; ++i) {
+    DeferredDestroy *d = &q->items[i];
+    if (d->type != VK_OBJECT_TYPE_UNKNOWN) {
+      my_vk_destroy_object(m, d->type, d->handle);
+    }
+    my_vk_free(m, &d->alloc);
+    free(d->host);
+    if (d->slots != NULL) {
+      my_vk_slot_free(d->slots, d->slot);
+    }
+  }
+  memmove(q->items, q->items + i, sizeof(DeferredDestroy) * (q->count - i));
+  q->count -= i;
+  if (all) {
+    free(q->items);
+    *q = MyVkDeletionQueue{};
+  }
+}
+
+MyVkAllocatorStats my_vk_allocator_stats(MyVk *m) {
+  MyVkAllocator *a = &m->allocator;
+  MyVkAllocatorStats st{};
+  st.blocks = a->block_count;
+  st.dedicated = a->dedicated_count;
+  st.allocations = a->allocation_count;
+  st.used_bytes = a->requested_bytes + a->dedicated_bytes;
+  st.reserved_bytes = a->dedicated_bytes;
+  VkDeviceSize free_bytes = 0, largest_free = 0;
+  for (uint32_t i = 0; i < a->block_count; ++i) {
+    MemoryBlock *b = &a->blocks[i];
+    st.reserved_bytes += b->size;
+    st.buddy_bytes += b->used;
+    free_bytes += b->size - b->used;
+    if (b->longest[1] > 0) {
+      VkDeviceSize largest = (VkDeviceSize)ALLOC_MIN_SIZE
+                             << (b->longest[1] - 1);
+      largest_free = std::max(largest_free, largest);
+    }
+  }
+  // how much of the free space can't be handed out as one piece
+  st.fragmentation =
+      free_bytes ? 1.0 - (double)largest_free / (double)free_bytes : 0.0;
+  return st;
+}
+
+void my_vk_allocator_print(MyVk *m) {
+  MyVkAllocatorStats st = my_vk_allocator_stats(m);
+  printf("gpu memory: %u allocations in %u blocks + %u dedicated, %.2f MiB "
+         "used, %.2f MiB reserved, %.2f MiB rounding waste, fragmentation "
+         "%.3f\n",
+         st.allocations, st.blocks, st.dedicated,
+         st.used_bytes / (1024.0 * 1024.0),
+         st.reserved_bytes / (1024.0 * 1024.0),
+         (st.buddy_bytes + m->allocator.dedicated_bytes - st.used_bytes) /
+             (1024.0 * 1024.0),
+         st.fragmentation);
+}
+
+// headless replacement for the swapchain: plain images we render into
+void my_vk_create_offscreen_images(MyVk *m) {
+  m->extent = VkExtent2D{m->opts.width, m->opts.height};
+  // one image per frame in flight, so that frame's fence also guards the image
+  m->swapchain_images_count = MAX_FRAMES_IN_FLIGHT;
+  m->swapchain_images =
+      (VkImage *)malloc(sizeof(VkImage) * m->swapchain_images_count);
+
+  VkImageCreateInfo imageInfo{};
+  imageInfo.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
+  imageInfo.imageType = VK_IMAGE_TYPE_2D;
+  imageInfo.format = m->format.format;
+  imageInfo.extent = VkExtent3D{m->extent.width, m->extent.height, 1};
+  imageInfo.mipLevels = 1;
+  imageInfo.arrayLayers = 1;
+  imageInfo.samples = VK_SAMPLE_COUNT_1_BIT;
+  imageInfo.tiling = VK_IMAGE_TILING_OPTIMAL;
+  imageInfo.usage =
+      VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT;
+  imageInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+  imageInfo.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+
+  for (uint32_t i = 0; i < m->swapchain_images_count; ++i) {
+    if (vkCreateImage(m->device, &imageInfo, nullptr,
+                      &m->swapchain_images[i]) != VK_SUCCESS) {
+      printf("ERROR: could not create offscreen image!\n");
+    }
+    MY_VK_TRACK(m, VK_OBJECT_TYPE_IMAGE, m->swapchain_images[i]);
+    VkMemoryRequirements reqs;
+    vkGetImageMemoryRequirements(m->device, m->swapchain_images[i], &reqs);
+    m->offscreen_allocs[i] =
+        my_vk_alloc(m, reqs, false, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+    vkBindImageMemory(m->device, m->swapchain_images[i],
+                      m->offscreen_allocs[i].memory,
+                      m->offscreen_allocs[i].offset);
+  }
+  printf("created %d offscreen images (%dx%d)\n", m->swapchain_images_count,
+         m->extent.width, m->extent.height);
+}
+
 void my_vk_create_swapchain(MyVk *m) {
+  if (m->opts.headless) {
+    my_vk_create_offscreen_images(m);
+    return;
+  }
   my_vk_get_capabilites(m);
   my_vk_create_extent(m);
 
-  // create actual swap chain
-  m->swapchain_images_count = m->capabilites.minImageCount + 1;
+  // create actual swap chain. Immediate replaces nothing, so the fewest
+  // images queue the least; mailbox needs one spare to keep replacing and
+  // fifo one to render into while the others wait for their vblank.
+  m->swapchain_images_count = m->capabilites.minImageCount;
+  if (m->present_mode == VK_PRESENT_MODE_MAILBOX_KHR) {
+    m->swapchain_images_count = std::max(m->swapchain_images_count + 1, 3u);
+  } else if (m->present_mode != VK_PRESENT_MODE_IMMEDIATE_KHR) {
+    m->swapchain_images_count += 1;
+  }
   // select image count for swapchain buffering
   // if 0, can have infinite, otherwise check that we don't have too many imgs
   if (m->capabilites.maxImageCount > 0 &&
@@ -436,6 +2526,12 @@ void my_vk_create_swapchain(MyVk *m) {
   createInfo.imageExtent = m->extent;
   createInfo.imageArrayLayers = 1;
   createInfo.imageUsage = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT; // render to
+  // and copy out of, for the readback
+  VkImageUsageFlags supported = m->capabilites.supportedUsageFlags;
+  if ((m->opts.readback_path != NULL || m->opts.bench_readback) &&
+      (supported & VK_IMAGE_USAGE_TRANSFER_SRC_BIT)) {
+    createInfo.imageUsage |= VK_IMAGE_USAGE_TRANSFER_SRC_BIT;
+  }
   uint32_t queue_idxs[] = {(uint32_t)m->queue_graphics_idx,
                            (uint32_t)m->queue_present_idx};
   if (m->queue_graphics_idx == m->queue_present_idx) {
@@ -452,16 +2548,17 @@ void my_vk_create_swapchain(MyVk *m) {
   createInfo.presentMode = m->present_mode;
   // allow other windows to be in front
   createInfo.clipped = VK_TRUE;
-  createInfo.oldSwapchain = VK_NULL_HANDLE;
+  // lets the driver reuse what it can, the old one is retired by the caller
+  createInfo.oldSwapchain = m->swapchain;
   if (vkCreateSwapchainKHR(m->device, &createInfo, nullptr, &m->swapchain) !=
       VK_SUCCESS) {
     printf("ERROR: failed to create swap chain!\n");
   }
+  MY_VK_TRACK(m, VK_OBJECT_TYPE_SWAPCHAIN_KHR, m->swapchain);
 
   // get swapchain images (could be dif amount of images now)
   vkGetSwapchainImagesKHR(m->device, m->swapchain, &m->swapchain_images_count,
                           nullptr);
-  // TODO free this malloc later somehow
   m->swapchain_images =
       (VkImage *)malloc(sizeof(VkImage) * m->swapchain_images_count);
   vkGetSwapchainImagesKHR(m->device, m->swapchain, &m->swapchain_images_count,
@@ -473,6 +2570,8 @@ void my_vk_create_queues(MyVk *m) {
   // get queue
   vkGetDeviceQueue(m->device, m->queue_graphics_idx, 0, &m->graphicsQueue);
   vkGetDeviceQueue(m->device, m->queue_present_idx, 0, &m->presentQueue);
+  vkGetDeviceQueue(m->device, m->queue_compute_idx, 0, &m->computeQueue);
+  vkGetDeviceQueue(m->device, m->queue_transfer_idx, 0, &m->transferQueue);
 }
 
 void my_vk_create_image_views(MyVk *m) {
@@ -498,33 +2597,184 @@ void my_vk_create_image_views(MyVk *m) {
                           &m->image_views[i]) != VK_SUCCESS) {
       printf("ERROR: could'nt create image view!");
     }
+    MY_VK_TRACK(m, VK_OBJECT_TYPE_IMAGE_VIEW, m->image_views[i]);
   }
 }
 
-void my_vk_create_shader_modules(MyVk *m) {
-  // load spirv .spv files
-  m->vert_shader_module = create_shader_module(m->device, "shaders/vert.spv");
-  m->frag_shader_module = create_shader_module(m->device, "shaders/frag.spv");
+// everything reading the entry may rely on: it lies inside the file, in a
+// known compression, and a compressed one's chunk table and chunks do too
+bool my_vk_bundle_entry_valid(const MappedFile *file, const BundleEntry *e) {
+  if (e->name[BUNDLE_NAME_SIZE - 1] != '\0' ||
+      e->offset % BUNDLE_ALIGNMENT != 0 || e->offset > file->size ||
+      e->size > file->size - e->offset) {
+    return false;
+  }
+  if (e->compression == BUNDLE_COMPRESSION_NONE) {
+    return e->raw_size == e->size;
+  }
+  if (e->compression != BUNDLE_COMPRESSION_LZ4) {
+    return false;
+  }
+  uint64_t chunk_count =
+      (e->raw_size + BUNDLE_CHUNK_SIZE - 1) / BUNDLE_CHUNK_SIZE;
+  if (chunk_count > e->size / sizeof(uint32_t)) {
+    return false;
+  }
+  const uint32_t *chunk_sizes = (const uint32_t *)(file->data + e->offset);
+  uint64_t packed = sizeof(uint32_t) * chunk_count;
+  for (uint64_t i = 0; i < chunk_count; ++i) {
+    packed += chunk_sizes[i];
+  }
+  return packed <= e->size;
+}
 
-  // shader stage creation
-  VkPipelineShaderStageCreateInfo vertShaderStageInfo{};
-  vertShaderStageInfo.sType =
-      VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
-  vertShaderStageInfo.stage = VK_SHADER_STAGE_VERTEX_BIT; // vert shader
-  vertShaderStageInfo.module = m->vert_shader_module;
-  vertShaderStageInfo.pName = "main";
-  vertShaderStageInfo.pSpecializationInfo = nullptr; // special constants
-                                                     //
-  VkPipelineShaderStageCreateInfo fragShaderStageInfo{};
-  fragShaderStageInfo.sType =
-      VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
-  fragShaderStageInfo.stage = VK_SHADER_STAGE_FRAGMENT_BIT; // vert shader
-  fragShaderStageInfo.module = m->frag_shader_module;
-  fragShaderStageInfo.pName = "main";
-  fragShaderStageInfo.pSpecializationInfo = nullptr; // special constants
+// maps the asset bundle and checks that its table of contents fits the file.
+// Without a bundle everything is loaded from loose files.
+void my_vk_open_bundle(MyVk *m, const char *path) {
+  MyVkBundle *b = &m->bundle;
+  *b = MyVkBundle{};
+  if (path == NULL) {
+    return;
+  }
+  if (access(path, R_OK) != 0) {
+    printf("no asset bundle at %s, loading loose files\n", path);
+    return;
+  }
+  b->file = map_file(path);
+  BundleHeader header{};
+  bool valid = b->file.size >= sizeof(header);
+  if (valid) {
+    memcpy(&header, b->file.data, sizeof(header));
+    valid = header.magic == BUNDLE_MAGIC && header.version == BUNDLE_VERSION &&
+            sizeof(header) + sizeof(BundleEntry) * (size_t)header.entry_count <=
+                b->file.size;
+  }
+  const BundleEntry *entries =
+      (const BundleEntry *)(b->file.data + sizeof(header));
+  for (uint32_t i = 0; valid && i < header.entry_count; ++i) {
+    valid = my_vk_bundle_entry_valid(&b->file, &entries[i]);
+  }
+  if (!valid) {
+    printf("ERROR: %s is not a valid asset bundle, loading loose files!\n",
+           path);
+    unmap_file(&b->file);
+    return;
+  }
+  b->entries = entries;
+  b->entry_count = header.entry_count;
+  printf("mapped asset bundle %s, %u entries\n", path, b->entry_count);
+}
+
+void my_vk_close_bundle(MyVk *m) {
+  unmap_file(&m->bundle.file);
+  free(m->bundle.scratch);
+  m->bundle = MyVkBundle{};
+}
+
+// NULL if there is no bundle or it doesn't have name
+const BundleEntry *my_vk_bundle_find(MyVk *m, const char *name) {
+  for (uint32_t i = 0; i < m->bundle.entry_count; ++i) {
+    if (strcmp(m->bundle.entries[i].name, name) == 0) {
+      return &m->bundle.entries[i];
+    }
+  }
+  return NULL;
+}
+
+// decompresses chunk i of a compressed entry into the bundle's scratch
+// buffer, its size goes to *raw. NULL if it is corrupt or can't be read.
+const char *my_vk_bundle_chunk(MyVk *m, const MappedFile *file,
+                               const BundleEntry *e, uint32_t i, size_t *raw) {
+  uint64_t left = e->raw_size - (uint64_t)i * BUNDLE_CHUNK_SIZE;
+  *raw = (size_t)std::min<uint64_t>(left, BUNDLE_CHUNK_SIZE);
+#ifdef HAVE_LZ4
+  MyVkBundle *b = &m->bundle;
+  uint32_t chunk_count =
+      (uint32_t)((e->raw_size + BUNDLE_CHUNK_SIZE - 1) / BUNDLE_CHUNK_SIZE);
+  const char *data = file->data + e->offset;
+  const uint32_t *chunk_sizes = (const uint32_t *)data;
+  uint64_t packed_offset = sizeof(uint32_t) * (uint64_t)chunk_count;
+  for (uint32_t j = 0; j < i; ++j) {
+    packed_offset += chunk_sizes[j];
+  }
+  if (b->scratch == NULL) {
+    b->scratch = (char *)malloc(BUNDLE_CHUNK_SIZE);
+  }
+  if (packed_offset + chunk_sizes[i] > e->size ||
+      LZ4_decompress_safe(data + packed_offset, b->scratch, chunk_sizes[i],
+                          (int)*raw) != (int)*raw) {
+    printf("ERROR: bundle entry %s is corrupt!\n", e->name);
+    return NULL;
+  }
+  return b->scratch;
+#else
+  (void)m;
+  (void)file;
+  printf("ERROR: %s is lz4 compressed, but this was built without lz4!\n",
+         e->name);
+  return NULL;
+#endif
+}
+
+// copies size bytes at offset of the entry's contents to out
+bool my_vk_bundle_read(MyVk *m, const MappedFile *file, const BundleEntry *e,
+                       size_t offset, size_t size, void *out) {
+  if (offset + size > e->raw_size) {
+    return false;
+  }
+  if (e->compression == BUNDLE_COMPRESSION_NONE) {
+    memcpy(out, file->data + e->offset + offset, size);
+    return true;
+  }
+  // chunks are decompressed into the one scratch buffer
+  std::lock_guard<std::mutex> lock(m->bundle_mutex);
+  char *dst = (char *)out;
+  while (size > 0) {
+    uint32_t i = (uint32_t)(offset / BUNDLE_CHUNK_SIZE);
+    size_t from = offset - (size_t)i * BUNDLE_CHUNK_SIZE;
+    size_t raw;
+    const char *chunk = my_vk_bundle_chunk(m, file, e, i, &raw);
+    if (chunk == NULL) {
+      return false;
+    }
+    size_t n = std::min(size, raw - from);
+    memcpy(dst, chunk + from, n);
+    dst += n;
+    offset += n;
+    size -= n;
+  }
+  return true;
+}
+
+// from the bundle if it has the shader, from SHADER_DIR otherwise
+VkShaderModule my_vk_load_shader(MyVk *m, const char *name) {
+  const BundleEntry *e = my_vk_bundle_find(m, name);
+  if (e == NULL) {
+    char path[4096];
+    snprintf(path, sizeof(path), "%s/%s", SHADER_DIR, name);
+    return create_shader_module(m->device, path);
+  }
+  if (e->compression == BUNDLE_COMPRESSION_NONE) {
+    return create_shader_module_from(
+        m->device, m->bundle.file.data + e->offset, e->size, name);
+  }
+  // malloc'd memory is aligned enough for the code
+  char *code = (char *)malloc(e->raw_size);
+  VkShaderModule module = VK_NULL_HANDLE;
+  if (my_vk_bundle_read(m, &m->bundle.file, e, 0, e->raw_size, code)) {
+    module = create_shader_module_from(m->device, code, e->raw_size, name);
+  }
+  free(code);
+  return module;
+}
 
-  m->shaderStages[0] = vertShaderStageInfo;
-  m->shaderStages[1] = fragShaderStageInfo;
+void my_vk_create_shader_modules(MyVk *m) {
+  // load spirv .spv files
+  bool textured = m->tex.count > 0;
+  m->vert_shader_module = my_vk_load_shader(
+      m, textured ? "textured.vert.spv" : "shader.vert.spv");
+  m->frag_shader_module = my_vk_load_shader(
+      m, textured ? "textured.frag.spv" : "shader.frag.spv");
 }
 
 void my_vk_create_dynamic_state(MyVk *m) {
@@ -536,6 +2786,16 @@ void my_vk_create_dynamic_state(MyVk *m) {
   m->dstate.dynamicStateCount = m->dynamicStateCount;
   m->dstate.pDynamicStates = m->dynamicStates;
 
+  m->viewportState.sType =
+      VK_STRUCTURE_TYPE_PIPELINE_VIEWPORT_STATE_CREATE_INFO;
+  m->viewportState.viewportCount = 1;
+  m->viewportState.pViewports = &m->viewport;
+  m->viewportState.scissorCount = 1;
+  m->viewportState.pScissors = &m->scissor;
+}
+
+// the viewport and scissor are dynamic, pipelines don't need the extent
+void my_vk_set_viewport(MyVk *m) {
   m->viewport.x = 0.f;
   m->viewport.y = 0.f;
   m->viewport.width = static_cast<float>(m->extent.width);
@@ -545,25 +2805,148 @@ void my_vk_create_dynamic_state(MyVk *m) {
 
   m->scissor.offset = {0, 0};
   m->scissor.extent = m->extent;
+}
 
-  m->viewportState.sType =
-      VK_STRUCTURE_TYPE_PIPELINE_VIEWPORT_STATE_CREATE_INFO;
-  m->viewportState.viewportCount = 1;
-  m->viewportState.pViewports = &m->viewport;
-  m->viewportState.scissorCount = 1;
-  m->viewportState.pScissors = &m->scissor;
+// a cache blob is only usable by the exact device and driver that wrote it
+bool my_vk_pipeline_cache_valid(MyVk *m, const char *data, long size) {
+  VkPipelineCacheHeaderVersionOne header;
+  if (data == NULL || size < (long)sizeof(header)) {
+    return false;
+  }
+  memcpy(&header, data, sizeof(header));
+  return header.headerSize >= sizeof(header) &&
+         header.headerVersion == VK_PIPELINE_CACHE_HEADER_VERSION_ONE &&
+         header.vendorID == m->phys_props.vendorID &&
+         header.deviceID == m->phys_props.deviceID &&
+         memcmp(header.pipelineCacheUUID, m->phys_props.pipelineCacheUUID,
+                VK_UUID_SIZE) == 0;
 }
 
-void my_vk_create_render_pipeline(MyVk *m) {
-  // vertex input
+// loads the cache from disk if it is there and was written by this device
+VkPipelineCache my_vk_load_pipeline_cache(MyVk *m, const char *path,
+                                          bool *warm) {
+  MappedFile file{NULL, 0};
+  if (access(path, R_OK) == 0) {
+    file = map_file(path);
+  }
+  *warm = my_vk_pipeline_cache_valid(m, file.data, file.size);
+  if (file.data != NULL && !*warm) {
+    printf("pipeline cache %s is from another device or driver, ignoring\n",
+           path);
+  }
+
+  VkPipelineCacheCreateInfo cacheInfo{};
+  cacheInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_CACHE_CREATE_INFO;
+  cacheInfo.initialDataSize = *warm ? file.size : 0;
+  cacheInfo.pInitialData = *warm ? file.data : NULL;
+  VkPipelineCache cache = VK_NULL_HANDLE;
+  if (vkCreatePipelineCache(m->device, &cacheInfo, nullptr, &cache) !=
+      VK_SUCCESS) {
+    printf("ERROR: could not create pipeline cache!\n");
+  }
+  MY_VK_TRACK(m, VK_OBJECT_TYPE_PIPELINE_CACHE, cache);
+  unmap_file(&file);
+  return cache;
+}
+
+void my_vk_create_pipeline_cache(MyVk *m) {
+  m->pipelineCache = VK_NULL_HANDLE;
+  m->pipeline_cache_warm = false;
+  if (m->opts.pipeline_cache_path == NULL) {
+    return;
+  }
+  m->pipelineCache = my_vk_load_pipeline_cache(
+      m, m->opts.pipeline_cache_path, &m->pipeline_cache_warm);
+}
+
+// Writes the cache back to disk. Whatever another process stored there since
+// we loaded it is merged in first, and the file is replaced atomically so a
+// crash or a concurrent reader never sees half a cache.
+void my_vk_save_pipeline_cache(MyVk *m) {
+  const char *path = m->opts.pipeline_cache_path;
+  if (path == NULL || m->pipelineCache == VK_NULL_HANDLE) {
+    return;
+  }
+  bool disk_valid;
+  VkPipelineCache disk = my_vk_load_pipeline_cache(m, path, &disk_valid);
+  if (disk != VK_NULL_HANDLE) {
+    if (disk_valid) {
+      vkMergePipelineCaches(m->device, m->pipelineCache, 1, &disk);
+    }
+    my_vk_destroy_object(m, VK_OBJECT_TYPE_PIPELINE_CACHE, (uint64_t)disk);
+  }
+
+  size_t size = 0;
+  vkGetPipelineCacheData(m->device, m->pipelineCache, &size, nullptr);
+  char *data = (char *)malloc(size);
+  if (vkGetPipelineCacheData(m->device, m->pipelineCache, &size, data) !=
+      VK_SUCCESS) {
+    printf("ERROR: could not get pipeline cache data!\n");
+    free(data);
+    return;
+  }
+
+  char tmp_path[4096];
+  snprintf(tmp_path, sizeof(tmp_path), "%s.%d.tmp", path, (int)getpid());
+  FILE *file = fopen(tmp_path, "wb");
+  if (file == NULL) {
+    printf("ERROR: could not open %s for writing!\n", tmp_path);
+    free(data);
+    return;
+  }
+  bool ok = fwrite(data, 1, size, file) == size;
+  ok = fflush(file) == 0 && ok;
+  ok = fsync(fileno(file)) == 0 && ok;
+  ok = fclose(file) == 0 && ok;
+  if (ok && rename(tmp_path, path) == 0) {
+    printf("saved %zu bytes of pipeline cache to %s\n", size, path);
+  } else {
+    printf("ERROR: could not write pipeline cache to %s!\n", path);
+    remove(tmp_path);
+  }
+  free(data);
+}
+
+// the render pass and layouts have to exist already. Only reads state that
+// stays the same after startup, so shader reloads call it from their thread.
+VkPipeline my_vk_build_graphics_pipeline(MyVk *m, VkShaderModule vert,
+                                         VkShaderModule frag,
+                                         VkPipelineLayout layout,
+                                         bool instanced) {
+  VkPipelineShaderStageCreateInfo stages[2]{};
+  stages[0].sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+  stages[0].stage = VK_SHADER_STAGE_VERTEX_BIT;
+  stages[0].module = vert;
+  stages[0].pName = "main";
+  stages[1].sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+  stages[1].stage = VK_SHADER_STAGE_FRAGMENT_BIT;
+  stages[1].module = frag;
+  stages[1].pName = "main";
+
+  // vertex input
   VkPipelineVertexInputStateCreateInfo vertexInputInfo{};
+  VkVertexInputBindingDescription bindingDescription{};
+  VkVertexInputAttributeDescription attributeDescriptions[2]{};
   {
+    bindingDescription.binding = 0;
+    bindingDescription.stride = sizeof(Vertex);
+    bindingDescription.inputRate = VK_VERTEX_INPUT_RATE_VERTEX;
+
+    attributeDescriptions[0].binding = 0;
+    attributeDescriptions[0].location = 0; // inPosition
+    attributeDescriptions[0].format = VK_FORMAT_R32G32_SFLOAT;
+    attributeDescriptions[0].offset = offsetof(Vertex, pos);
+    attributeDescriptions[1].binding = 0;
+    attributeDescriptions[1].location = 1; // inColor
+    attributeDescriptions[1].format = VK_FORMAT_R32G32B32_SFLOAT;
+    attributeDescriptions[1].offset = offsetof(Vertex, color);
+
     vertexInputInfo.sType =
         VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO;
-    vertexInputInfo.vertexBindingDescriptionCount = 0;
-    vertexInputInfo.pVertexBindingDescriptions = NULL;
-    vertexInputInfo.vertexAttributeDescriptionCount = 0;
-    vertexInputInfo.pVertexAttributeDescriptions = NULL;
+    vertexInputInfo.vertexBindingDescriptionCount = 1;
+    vertexInputInfo.pVertexBindingDescriptions = &bindingDescription;
+    vertexInputInfo.vertexAttributeDescriptionCount = 2;
+    vertexInputInfo.pVertexAttributeDescriptions = attributeDescriptions;
   }
 
   // Pipeline input assembly state
@@ -589,13 +2972,13 @@ void my_vk_create_render_pipeline(MyVk *m) {
 
     rasterizer.depthBiasEnable = VK_FALSE;
   }
-  // Multisampling disable
+  // as many samples as the attachments, shaded once per pixel
   VkPipelineMultisampleStateCreateInfo multisampling{};
   {
     multisampling.sType =
         VK_STRUCTURE_TYPE_PIPELINE_MULTISAMPLE_STATE_CREATE_INFO;
     multisampling.sampleShadingEnable = VK_FALSE;
-    multisampling.rasterizationSamples = VK_SAMPLE_COUNT_1_BIT;
+    multisampling.rasterizationSamples = m->attach.samples;
   }
 
   // color blending
@@ -624,98 +3007,283 @@ void my_vk_create_render_pipeline(MyVk *m) {
     colorBlending.pAttachments = &colorBlendAttachment;
   }
 
+  VkGraphicsPipelineCreateInfo pipelineInfo{};
+  pipelineInfo.sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO;
+  pipelineInfo.stageCount = 2; // vert and frag
+  pipelineInfo.pStages = stages;
+
+  pipelineInfo.pVertexInputState = &vertexInputInfo;
+  pipelineInfo.pInputAssemblyState = &inputAssembly;
+  pipelineInfo.pViewportState = &m->viewportState;
+  pipelineInfo.pRasterizationState = &rasterizer;
+  pipelineInfo.pMultisampleState = &multisampling;
+  // everything tests and writes depth when there is a depth buffer. No
+  // fragment shader discards or writes gl_FragDepth, so the test can run
+  // before shading. The flat meshes all lie at 0 and keep their draw order
+  // with LESS_OR_EQUAL.
+  VkPipelineDepthStencilStateCreateInfo depthStencil{};
+  depthStencil.sType =
+      VK_STRUCTURE_TYPE_PIPELINE_DEPTH_STENCIL_STATE_CREATE_INFO;
+  depthStencil.depthCompareOp =
+      instanced ? VK_COMPARE_OP_LESS : VK_COMPARE_OP_LESS_OR_EQUAL;
+  depthStencil.depthTestEnable = VK_TRUE;
+  depthStencil.depthWriteEnable = VK_TRUE;
+  pipelineInfo.pDepthStencilState =
+      my_vk_has_depth(m) ? &depthStencil : nullptr;
+  pipelineInfo.pColorBlendState = &colorBlending;
+  pipelineInfo.pDynamicState = &m->dstate;
+
+  // lives longer
+  pipelineInfo.layout = layout;
+  // with dynamic rendering only the attachment formats have to match
+  VkPipelineRenderingCreateInfo renderingInfo{};
+  renderingInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_RENDERING_CREATE_INFO;
+  renderingInfo.colorAttachmentCount = 1;
+  renderingInfo.pColorAttachmentFormats = &m->format.format;
+  renderingInfo.depthAttachmentFormat =
+      m->attach.depth_format;
+  if (m->dynamic_rendering) {
+    pipelineInfo.pNext = &renderingInfo;
+  } else {
+    pipelineInfo.renderPass = m->renderPass;
+    pipelineInfo.subpass = 0; // idx of subpass that renders
+  }
+  pipelineInfo.basePipelineHandle = VK_NULL_HANDLE; // derive from
+  pipelineInfo.basePipelineIndex = -1;
+
+  VkPipeline pipeline = VK_NULL_HANDLE;
+  if (vkCreateGraphicsPipelines(m->device, m->pipelineCache, 1, &pipelineInfo,
+                                nullptr, &pipeline) != VK_SUCCESS) {
+    printf("ERROR: could not create %s pipeline!\n",
+           instanced ? "instanced" : "graphics");
+  }
+  return pipeline;
+}
+
+// like my_vk_build_graphics_pipeline, safe to call from the reload thread
+VkPipeline my_vk_build_compute_pipeline(MyVk *m, VkShaderModule module,
+                                        VkPipelineLayout layout) {
+  VkComputePipelineCreateInfo pipelineInfo{};
+  pipelineInfo.sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO;
+  pipelineInfo.stage.sType =
+      VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+  pipelineInfo.stage.stage = VK_SHADER_STAGE_COMPUTE_BIT;
+  pipelineInfo.stage.module = module;
+  pipelineInfo.stage.pName = "main";
+  pipelineInfo.layout = layout;
+  VkPipeline pipeline = VK_NULL_HANDLE;
+  if (vkCreateComputePipelines(m->device, m->pipelineCache, 1, &pipelineInfo,
+                               nullptr, &pipeline) != VK_SUCCESS) {
+    printf("ERROR: could not create compute pipeline!\n");
+  }
+  return pipeline;
+}
+
+void my_vk_create_render_pipeline(MyVk *m) {
   // pipeline layout, for uniforms
   {
     VkPipelineLayoutCreateInfo pipeInfo{};
     pipeInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
-    pipeInfo.setLayoutCount = 0;
-    pipeInfo.pSetLayouts = nullptr;
-    pipeInfo.pushConstantRangeCount = 0;
-    pipeInfo.pPushConstantRanges = nullptr;
+    // set 0 is the frame's uniforms, set 1 the texture and set 2 the draw's
+    // object, if there are any
+    VkDescriptorSetLayout setLayouts[3] = {
+        m->frame_set_layout, m->tex.set_layout, m->objects.set_layout};
+    pipeInfo.setLayoutCount = m->tex.count > 0 ? 3 : 1;
+    pipeInfo.pSetLayouts = setLayouts;
+    VkPushConstantRange push{VK_SHADER_STAGE_VERTEX_BIT, 0, sizeof(MeshPush)};
+    pipeInfo.pushConstantRangeCount = 1;
+    pipeInfo.pPushConstantRanges = &push;
 
     if (vkCreatePipelineLayout(m->device, &pipeInfo, nullptr,
                                &m->pipelineLayout) != VK_SUCCESS) {
       printf("ERROR: failed to create pipeline layout!\n");
     }
+    MY_VK_TRACK(m, VK_OBJECT_TYPE_PIPELINE_LAYOUT, m->pipelineLayout);
   }
 
-  // render passes
-  {
-    VkAttachmentDescription colorAttachment{};
-    colorAttachment.format = m->format.format;
-    colorAttachment.samples = VK_SAMPLE_COUNT_1_BIT;
-    colorAttachment.loadOp =
-        VK_ATTACHMENT_LOAD_OP_CLEAR; // clear buffer to black after drawing it
-    colorAttachment.storeOp = VK_ATTACHMENT_STORE_OP_STORE;
-
-    colorAttachment.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
-    colorAttachment.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
-
-    colorAttachment.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
-    colorAttachment.finalLayout = VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;
+  // render passes, only for the legacy path. Its attachments are the color
+  // target and the depth the pass tests against, then with multisampling
+  // the swapchain image and the sampled depth they resolve into.
+  if (!m->dynamic_rendering) {
+    const MyVkAttachments *at = &m->attach;
+    bool msaa = at->samples > VK_SAMPLE_COUNT_1_BIT;
+    // PRESENT_SRC needs the swapchain extension, which headless doesn't enable
+    VkImageLayout present = m->opts.headless
+                                ? VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL
+                                : VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;
+    VkAttachmentDescription2 attachments[4]{};
+    VkAttachmentReference2 refs[4]{};
+    for (uint32_t i = 0; i < 4; ++i) {
+      attachments[i].sType = VK_STRUCTURE_TYPE_ATTACHMENT_DESCRIPTION_2;
+      attachments[i].samples = VK_SAMPLE_COUNT_1_BIT;
+      attachments[i].loadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
+      attachments[i].storeOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+      attachments[i].stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
+      attachments[i].stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+      attachments[i].initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+      refs[i].sType = VK_STRUCTURE_TYPE_ATTACHMENT_REFERENCE_2;
+      refs[i].attachment = i;
+    }
+    uint32_t count = 0;
+
+    // clear buffer to black after drawing it, a multisampled one is only
+    // resolved and never written out
+    VkAttachmentDescription2 *color = &attachments[count];
+    color->format = m->format.format;
+    color->samples = at->samples;
+    color->loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
+    color->storeOp =
+        msaa ? VK_ATTACHMENT_STORE_OP_DONT_CARE : VK_ATTACHMENT_STORE_OP_STORE;
+    color->finalLayout =
+        msaa ? VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL : present;
+    VkAttachmentReference2 *colorRef = &refs[count++];
+    colorRef->layout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
+
+    // ends up sampled by the hi-z build, unless that samples its resolve
+    VkAttachmentReference2 *depthRef = NULL;
+    if (my_vk_has_depth(m)) {
+      bool sampled = my_vk_has_hiz(m) && !msaa;
+      VkAttachmentDescription2 *depth = &attachments[count];
+      depth->format = at->depth_format;
+      depth->samples = at->samples;
+      depth->loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
+      depth->storeOp = sampled ? VK_ATTACHMENT_STORE_OP_STORE
+                               : VK_ATTACHMENT_STORE_OP_DONT_CARE;
+      depth->finalLayout =
+          sampled ? VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL
+                  : VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
+      depthRef = &refs[count++];
+      depthRef->layout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
+    }
 
-    VkAttachmentReference colorAttachmentRef{};
-    colorAttachmentRef.attachment = 0; // idx
-    colorAttachmentRef.layout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
+    VkAttachmentReference2 *resolveRef = NULL;
+    if (msaa) {
+      VkAttachmentDescription2 *resolve = &attachments[count];
+      resolve->format = m->format.format;
+      resolve->storeOp = VK_ATTACHMENT_STORE_OP_STORE;
+      resolve->finalLayout = present;
+      resolveRef = &refs[count++];
+      resolveRef->layout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
+    }
+    VkSubpassDescriptionDepthStencilResolve depthResolve{};
+    depthResolve.sType =
+        VK_STRUCTURE_TYPE_SUBPASS_DESCRIPTION_DEPTH_STENCIL_RESOLVE;
+    if (at->depth_resolve != VK_RESOLVE_MODE_NONE) {
+      VkAttachmentDescription2 *resolve = &attachments[count];
+      resolve->format = at->depth_format;
+      resolve->storeOp = VK_ATTACHMENT_STORE_OP_STORE;
+      resolve->finalLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+      refs[count].layout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
+      depthResolve.depthResolveMode = at->depth_resolve;
+      depthResolve.stencilResolveMode =
+          my_vk_has_stencil(at->depth_format) ? VK_RESOLVE_MODE_SAMPLE_ZERO_BIT
+                                              : VK_RESOLVE_MODE_NONE;
+      depthResolve.pDepthStencilResolveAttachment = &refs[count++];
+    }
 
-    VkSubpassDescription subpass{};
+    VkSubpassDescription2 subpass{};
+    subpass.sType = VK_STRUCTURE_TYPE_SUBPASS_DESCRIPTION_2;
+    subpass.pNext = depthResolve.pDepthStencilResolveAttachment != NULL
+                        ? &depthResolve
+                        : nullptr;
     subpass.pipelineBindPoint = VK_PIPELINE_BIND_POINT_GRAPHICS;
     subpass.colorAttachmentCount = 1;
-    subpass.pColorAttachments = &colorAttachmentRef;
-
-    VkRenderPassCreateInfo renderPassInfo{};
-    renderPassInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_CREATE_INFO;
-    renderPassInfo.attachmentCount = 1;
-    renderPassInfo.pAttachments = &colorAttachment;
+    subpass.pColorAttachments = colorRef;
+    subpass.pResolveAttachments = resolveRef;
+    subpass.pDepthStencilAttachment = depthRef;
+
+    VkRenderPassCreateInfo2 renderPassInfo{};
+    renderPassInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_CREATE_INFO_2;
+    renderPassInfo.attachmentCount = count;
+    renderPassInfo.pAttachments = attachments;
     renderPassInfo.subpassCount = 1;
     renderPassInfo.pSubpasses = &subpass;
 
-    VkSubpassDependency dependency{};
+    // the submit waits for the acquire at color attachment output, so the
+    // layout transition of the image has to wait for that stage too
+    VkSubpassDependency2 dependencies[3]{};
+    for (uint32_t i = 0; i < 3; ++i) {
+      dependencies[i].sType = VK_STRUCTURE_TYPE_SUBPASS_DEPENDENCY_2;
+    }
     {
-      dependency.srcSubpass = VK_SUBPASS_EXTERNAL; // before
-      dependency.dstSubpass = 0;                   // this one
-      dependency.srcStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
-      dependency.srcAccessMask = 0;
-      dependency.dstStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
-      dependency.dstAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
-    }
-    renderPassInfo.dependencyCount = 0;
-    renderPassInfo.pDependencies = &dependency;
-
-    if (vkCreateRenderPass(m->device, &renderPassInfo, nullptr,
-                           &m->renderPass) != VK_SUCCESS) {
+      dependencies[0].srcSubpass = VK_SUBPASS_EXTERNAL; // before
+      dependencies[0].dstSubpass = 0;                   // this one
+      dependencies[0].srcStageMask =
+          VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
+      dependencies[0].srcAccessMask = 0;
+      dependencies[0].dstStageMask =
+          VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
+      dependencies[0].dstAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
+    }
+    renderPassInfo.dependencyCount = 1;
+    renderPassInfo.pDependencies = dependencies;
+
+    // resolves count as color attachment output, depth resolves included
+    VkPipelineStageFlags depthStages =
+        VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT |
+        VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT |
+        VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
+    VkAccessFlags depthWrites = VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT |
+                                VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
+    if (my_vk_has_depth(m)) {
+      // the last frame's pass, and its hi-z build sampling it, have to be
+      // done with the depth before the clear
+      dependencies[1].srcSubpass = VK_SUBPASS_EXTERNAL;
+      dependencies[1].dstSubpass = 0;
+      dependencies[1].srcStageMask =
+          depthStages | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT;
+      dependencies[1].srcAccessMask = depthWrites;
+      dependencies[1].dstStageMask = depthStages;
+      dependencies[1].dstAccessMask =
+          depthWrites | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_READ_BIT;
+      renderPassInfo.dependencyCount = 2;
+    }
+    if (my_vk_has_hiz(m)) {
+      // and this frame's build reads the depth after the pass
+      dependencies[2].srcSubpass = 0;
+      dependencies[2].dstSubpass = VK_SUBPASS_EXTERNAL;
+      dependencies[2].srcStageMask = depthStages;
+      dependencies[2].srcAccessMask = depthWrites;
+      dependencies[2].dstStageMask = VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT;
+      dependencies[2].dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+      renderPassInfo.dependencyCount = 3;
+    }
+
+    if (vkCreateRenderPass2(m->device, &renderPassInfo, nullptr,
+                            &m->renderPass) != VK_SUCCESS) {
       printf("ERROR: could not create render pass!\n");
     }
+    MY_VK_TRACK(m, VK_OBJECT_TYPE_RENDER_PASS, m->renderPass);
   }
 
   // create graphics pipeline
   {
-    VkGraphicsPipelineCreateInfo pipelineInfo{};
-    pipelineInfo.sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO;
-    pipelineInfo.stageCount = 2; // vert and frag
-    pipelineInfo.pStages = m->shaderStages;
-
-    pipelineInfo.pVertexInputState = &vertexInputInfo;
-    pipelineInfo.pInputAssemblyState = &inputAssembly;
-    pipelineInfo.pViewportState = &m->viewportState;
-    pipelineInfo.pRasterizationState = &rasterizer;
-    pipelineInfo.pMultisampleState = &multisampling;
-    pipelineInfo.pDepthStencilState = nullptr;
-    pipelineInfo.pColorBlendState = &colorBlending;
-    pipelineInfo.pDynamicState = &m->dstate;
-
-    pipelineInfo.layout = m->pipelineLayout; // lives longer
-    pipelineInfo.renderPass = m->renderPass;
-    pipelineInfo.subpass = 0; // idx of subpass that renders
-                              //
-    pipelineInfo.basePipelineHandle = VK_NULL_HANDLE; // derive from
-    pipelineInfo.basePipelineIndex = -1;
-
-    if (vkCreateGraphicsPipelines(m->device, VK_NULL_HANDLE, 1, &pipelineInfo,
-                                  nullptr,
-                                  &m->graphicsPipeline) != VK_SUCCESS) {
-      printf("ERROR: could not create graphics pipeline!\n");
+    double t = my_vk_time();
+    m->graphicsPipeline =
+        my_vk_build_graphics_pipeline(m, m->vert_shader_module,
+                                      m->frag_shader_module,
+                                      m->pipelineLayout, false);
+    MY_VK_TRACK(m, VK_OBJECT_TYPE_PIPELINE, m->graphicsPipeline);
+    if (m->bindless.layout != VK_NULL_HANDLE) {
+      // same vertex shader, the fragment shader indexes the bindless arrays
+      VkShaderModule frag = my_vk_load_shader(m, "bindless.frag.spv");
+      m->bindless.pipeline = my_vk_build_graphics_pipeline(
+          m, m->vert_shader_module, frag, m->bindless.layout, false);
+      MY_VK_TRACK(m, VK_OBJECT_TYPE_PIPELINE, m->bindless.pipeline);
+      vkDestroyShaderModule(m->device, frag, nullptr);
+    }
+    if (m->opts.instances > 0) {
+      // same state, but the vertex shader places the mesh per instance
+      VkShaderModule vert =
+          my_vk_load_shader(m, "instanced.vert.spv");
+      m->inst.draw_pipeline = my_vk_build_graphics_pipeline(
+          m, vert, m->frag_shader_module, m->inst.draw_layout, true);
+      MY_VK_TRACK(m, VK_OBJECT_TYPE_PIPELINE, m->inst.draw_pipeline);
+      vkDestroyShaderModule(m->device, vert, nullptr);
     }
+    m->pipeline_create_ms = (my_vk_time() - t) * 1000.0;
+    printf("graphics pipeline created in %.3f ms (%s pipeline cache)\n",
+           m->pipeline_create_ms, m->pipeline_cache_warm ? "warm" : "cold");
     // destroy shader modules
     vkDestroyShaderModule(m->device, m->frag_shader_module, nullptr);
     vkDestroyShaderModule(m->device, m->vert_shader_module, nullptr);
@@ -723,17 +3291,37 @@ void my_vk_create_render_pipeline(MyVk *m) {
 }
 
 void my_vk_create_swapchain_framebuffers(MyVk *m) {
+  if (m->dynamic_rendering) {
+    m->swapchainFramebuffers = NULL;
+    return;
+  }
   // create VkFramebuffer objects
   m->swapchainFramebuffers = (VkFramebuffer *)malloc(sizeof(VkFramebuffer) *
                                                      m->swapchain_images_count);
 
   for (uint32_t i = 0; i < m->swapchain_images_count; ++i) {
 
+    // in the order of the render pass, all framebuffers share everything
+    // but the swapchain image
+    const MyVkAttachments *at = &m->attach;
+    bool msaa = at->samples > VK_SAMPLE_COUNT_1_BIT;
+    VkImageView attachments[4];
+    uint32_t count = 0;
+    attachments[count++] = msaa ? at->color_view : m->image_views[i];
+    if (my_vk_has_depth(m)) {
+      attachments[count++] = at->depth_view;
+    }
+    if (msaa) {
+      attachments[count++] = m->image_views[i];
+    }
+    if (at->depth_resolve != VK_RESOLVE_MODE_NONE) {
+      attachments[count++] = at->depth_resolve_view;
+    }
     VkFramebufferCreateInfo framebufferInfo{};
     framebufferInfo.sType = VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO;
     framebufferInfo.renderPass = m->renderPass;
-    framebufferInfo.attachmentCount = 1;
-    framebufferInfo.pAttachments = &m->image_views[i];
+    framebufferInfo.attachmentCount = count;
+    framebufferInfo.pAttachments = attachments;
     framebufferInfo.width = m->extent.width;
     framebufferInfo.height = m->extent.height;
     framebufferInfo.layers = 1;
@@ -742,6 +3330,7 @@ void my_vk_create_swapchain_framebuffers(MyVk *m) {
                             &m->swapchainFramebuffers[i]) != VK_SUCCESS) {
       printf("ERROR: failed to create nbr %i framebuffer!\n", i);
     }
+    MY_VK_TRACK(m, VK_OBJECT_TYPE_FRAMEBUFFER, m->swapchainFramebuffers[i]);
   }
 }
 
@@ -757,6 +3346,7 @@ void my_vk_create_command_pool(MyVk *m) {
       VK_SUCCESS) {
     printf("ERROR: could not create command pool for graphics\n");
   }
+  MY_VK_TRACK(m, VK_OBJECT_TYPE_COMMAND_POOL, m->commandPool);
 }
 
 void my_vk_create_command_buffers(MyVk *m) {
@@ -775,250 +3365,6837 @@ void my_vk_create_command_buffers(MyVk *m) {
   }
 }
 
-void my_vk_create_semaphores(MyVk *m) {
-  // create semaphores
-  m->imageAvailableSemaphores =
-      (VkSemaphore *)malloc(sizeof(VkSemaphore) * MAX_FRAMES_IN_FLIGHT);
-  m->renderFinishedSemaphores =
-      (VkSemaphore *)malloc(sizeof(VkSemaphore) * MAX_FRAMES_IN_FLIGHT);
-  m->inFlightFences = (VkFence *)malloc(sizeof(VkFence) * MAX_FRAMES_IN_FLIGHT);
+MyBuffer my_vk_create_buffer(MyVk *m, VkDeviceSize size,
+                             VkBufferUsageFlags usage,
+                             VkMemoryPropertyFlags required,
+                             VkMemoryPropertyFlags preferred = 0) {
+  MyBuffer b{};
+  b.size = size;
+  b.owner = (uint32_t)m->queue_graphics_idx;
+  VkBufferCreateInfo bufferInfo{};
+  bufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+  bufferInfo.size = size;
+  bufferInfo.usage = usage;
+  bufferInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+  if (vkCreateBuffer(m->device, &bufferInfo, nullptr, &b.buffer) !=
+      VK_SUCCESS) {
+    printf("ERROR: could not create buffer of %llu bytes!\n",
+           (unsigned long long)size);
+  }
+  MY_VK_TRACK(m, VK_OBJECT_TYPE_BUFFER, b.buffer);
 
-  // reuse these create info structs
-  VkSemaphoreCreateInfo semaphoreInfo{};
-  semaphoreInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
+  VkMemoryRequirements reqs;
+  vkGetBufferMemoryRequirements(m->device, b.buffer, &reqs);
+  b.alloc = my_vk_alloc(m, reqs, true, required, preferred);
+  if (b.alloc.memory == VK_NULL_HANDLE) {
+    printf("ERROR: could not allocate buffer memory!\n");
+  }
+  vkBindBufferMemory(m->device, b.buffer, b.alloc.memory, b.alloc.offset);
+  return b;
+}
 
-  VkFenceCreateInfo fenceInfo{};
-  fenceInfo.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
-  fenceInfo.flags = VK_FENCE_CREATE_SIGNALED_BIT;
-  for (uint32_t i = 0; i < MAX_FRAMES_IN_FLIGHT; ++i) {
+void my_vk_destroy_buffer(MyVk *m, MyBuffer *b) {
+  my_vk_destroy_object(m, VK_OBJECT_TYPE_BUFFER, (uint64_t)b->buffer);
+  my_vk_free(m, &b->alloc);
+  *b = MyBuffer{};
+}
 
-    if (vkCreateSemaphore(m->device, &semaphoreInfo, nullptr,
-                          &m->imageAvailableSemaphores[i]) != VK_SUCCESS ||
-        vkCreateSemaphore(m->device, &semaphoreInfo, nullptr,
-                          &m->renderFinishedSemaphores[i]) != VK_SUCCESS ||
-        vkCreateFence(m->device, &fenceInfo, nullptr, &m->inFlightFences[i]) !=
-            VK_SUCCESS) {
-      printf("ERROR: could not create semaphores!\n");
-    }
-  }
+// destroys the buffer once the frames submitted so far are done with it
+void my_vk_retire_buffer(MyVk *m, MyBuffer *b) {
+  my_vk_defer_destroy(m, VK_OBJECT_TYPE_BUFFER, (uint64_t)b->buffer, &b->alloc,
+                      NULL);
+  *b = MyBuffer{};
 }
 
-void my_vk_deinit_swapchain(MyVk *m) {
-  for (uint32_t i = 0; i < m->swapchain_images_count; ++i) {
-    vkDestroyFramebuffer(m->device, m->swapchainFramebuffers[i], nullptr);
+// per frame bump allocator for data that lives for one frame only. It is
+// rewound once the frame's fence has signaled, so nothing is ever freed. The
+// arenas stay mapped and are host coherent, uniforms are written in place.
+void my_vk_create_frame_arenas(MyVk *m) {
+  VkDescriptorSetLayoutBinding binding{};
+  binding.binding = 0;
+  binding.descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC;
+  binding.descriptorCount = 1;
+  binding.stageFlags =
+      VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT;
+  VkDescriptorSetLayoutCreateInfo setInfo{};
+  setInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+  setInfo.bindingCount = 1;
+  setInfo.pBindings = &binding;
+  if (vkCreateDescriptorSetLayout(m->device, &setInfo, nullptr,
+                                  &m->frame_set_layout) != VK_SUCCESS) {
+    printf("ERROR: could not create frame descriptor set layout!\n");
+  }
+  MY_VK_TRACK(m, VK_OBJECT_TYPE_DESCRIPTOR_SET_LAYOUT, m->frame_set_layout);
+  VkDescriptorPoolSize poolSize{VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC,
+                                MAX_FRAMES_IN_FLIGHT};
+  VkDescriptorPoolCreateInfo poolInfo{};
+  poolInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+  poolInfo.maxSets = MAX_FRAMES_IN_FLIGHT;
+  poolInfo.poolSizeCount = 1;
+  poolInfo.pPoolSizes = &poolSize;
+  if (vkCreateDescriptorPool(m->device, &poolInfo, nullptr, &m->frame_pool) !=
+      VK_SUCCESS) {
+    printf("ERROR: could not create frame descriptor pool!\n");
+  }
+  MY_VK_TRACK(m, VK_OBJECT_TYPE_DESCRIPTOR_POOL, m->frame_pool);
+  VkDescriptorSetLayout layouts[MAX_FRAMES_IN_FLIGHT];
+  VkDescriptorSet sets[MAX_FRAMES_IN_FLIGHT];
+  for (uint32_t i = 0; i < MAX_FRAMES_IN_FLIGHT; ++i) {
+    layouts[i] = m->frame_set_layout;
+  }
+  VkDescriptorSetAllocateInfo allocInfo{};
+  allocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+  allocInfo.descriptorPool = m->frame_pool;
+  allocInfo.descriptorSetCount = MAX_FRAMES_IN_FLIGHT;
+  allocInfo.pSetLayouts = layouts;
+  if (vkAllocateDescriptorSets(m->device, &allocInfo, sets) != VK_SUCCESS) {
+    printf("ERROR: could not allocate frame descriptor sets!\n");
   }
 
-  for (uint32_t i = 0; i < m->swapchain_images_count; ++i) {
-    vkDestroyImageView(m->device, m->image_views[i], nullptr);
+  VkDescriptorBufferInfo bufferInfos[MAX_FRAMES_IN_FLIGHT];
+  VkWriteDescriptorSet writes[MAX_FRAMES_IN_FLIGHT]{};
+  for (uint32_t i = 0; i < MAX_FRAMES_IN_FLIGHT; ++i) {
+    m->frame_arenas[i].buffer = my_vk_create_buffer(
+        m, FRAME_ARENA_SIZE,
+        VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | VK_BUFFER_USAGE_INDEX_BUFFER_BIT |
+            VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT |
+            VK_BUFFER_USAGE_STORAGE_BUFFER_BIT |
+            VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
+        VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
+            VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+        VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+    m->frame_arenas[i].head = 0;
+    m->frame_arenas[i].set = sets[i];
+    // the dynamic offset picks the uniforms, the range covers one of them
+    bufferInfos[i] = VkDescriptorBufferInfo{m->frame_arenas[i].buffer.buffer,
+                                            0, sizeof(GpuFrameData)};
+    writes[i].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+    writes[i].dstSet = sets[i];
+    writes[i].dstBinding = 0;
+    writes[i].descriptorCount = 1;
+    writes[i].descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC;
+    writes[i].pBufferInfo = &bufferInfos[i];
   }
-  vkDestroySwapchainKHR(m->device, m->swapchain, nullptr);
-  free(m->swapchainFramebuffers);
-  free(m->image_views);
+  vkUpdateDescriptorSets(m->device, MAX_FRAMES_IN_FLIGHT, writes, 0, nullptr);
 }
 
-void my_vk_recreate_swapchain(MyVk *m) {
-
-  int width = 0, height = 0;
-  glfwGetFramebufferSize(m->window, &width, &height);
-  while (width == 0 || height == 0) { // handle minimization
-    glfwGetFramebufferSize(m->window, &width, &height);
-    glfwWaitEvents();
+void my_vk_destroy_frame_arenas(MyVk *m) {
+  for (uint32_t i = 0; i < MAX_FRAMES_IN_FLIGHT; ++i) {
+    my_vk_destroy_buffer(m, &m->frame_arenas[i].buffer);
   }
+  my_vk_destroy_object(m, VK_OBJECT_TYPE_DESCRIPTOR_POOL,
+                       (uint64_t)m->frame_pool);
+  my_vk_destroy_object(m, VK_OBJECT_TYPE_DESCRIPTOR_SET_LAYOUT,
+                       (uint64_t)m->frame_set_layout);
+}
 
-  vkDeviceWaitIdle(m->device);
-
-  my_vk_deinit_swapchain(m);
-
-  my_vk_create_swapchain(m);
-  my_vk_create_image_views(m);
-  my_vk_create_swapchain_framebuffers(m);
+// returns a host pointer into the current frame's arena, its offset in the
+// arena buffer goes to *offset. NULL when the arena is full.
+void *my_vk_frame_alloc(MyVk *m, VkDeviceSize size, VkDeviceSize alignment,
+                        VkDeviceSize *offset) {
+  FrameArena *arena = &m->frame_arenas[m->currentFrame];
+  VkDeviceSize start = (arena->head + alignment - 1) / alignment * alignment;
+  if (start + size > arena->buffer.size) {
+    printf("ERROR: frame arena full, %llu bytes requested!\n",
+           (unsigned long long)size);
+    return NULL;
+  }
+  arena->head = start + size;
+  *offset = start;
+  return (char *)arena->buffer.alloc.mapped + start;
 }
 
-void my_vk_draw(MyVk *m) {
-  // draw
-  // wait for the previous frame to be rendered
-  vkWaitForFences(m->device, 1, &m->inFlightFences[m->currentFrame], VK_TRUE,
-                  UINT64_MAX);
+// copies size bytes of uniforms into the current frame's arena and returns
+// their dynamic offset for the arena's set, UINT32_MAX if it is full
+uint32_t my_vk_frame_uniforms(MyVk *m, const void *data, VkDeviceSize size) {
+  VkDeviceSize offset;
+  void *dst = my_vk_frame_alloc(
+      m, size, m->phys_props.limits.minUniformBufferOffsetAlignment, &offset);
+  if (dst == NULL) {
+    return UINT32_MAX;
+  }
+  memcpy(dst, data, size);
+  return (uint32_t)offset;
+}
 
-  // get image from swapchain
-  uint32_t imageIndex;
-  {
+void my_vk_create_staging(MyVk *m) {
+  MyVkStaging *st = &m->staging;
+  st->ring = my_vk_create_buffer(m, STAGING_RING_SIZE,
+                                 VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
+                                 VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
+                                     VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
+  // host visible allocations stay mapped for their lifetime
+  st->mapped = (char *)st->ring.alloc.mapped;
+  st->head = 0;
+  st->tail = 0;
+  st->copy_count = 0;
+  st->next_batch = 0;
 
-    VkResult res =
-        vkAcquireNextImageKHR(m->device, m->swapchain, UINT64_MAX,
-                              m->imageAvailableSemaphores[m->currentFrame],
-                              VK_NULL_HANDLE, &imageIndex);
-    if (res == VK_ERROR_OUT_OF_DATE_KHR) {
-      // recreate the swapchain
-      m->framebuffer_resized = false;
-      my_vk_recreate_swapchain(m);
-      return;
-    } else if (res != VK_SUCCESS && res != VK_SUBOPTIMAL_KHR) {
-      printf("ERROR: Failed to acquire swap chain image!\n");
-    }
+  VkCommandPoolCreateInfo poolInfo{};
+  poolInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+  poolInfo.flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT |
+                   VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT;
+  poolInfo.queueFamilyIndex = m->queue_transfer_idx;
+  if (vkCreateCommandPool(m->device, &poolInfo, nullptr, &st->pool) !=
+      VK_SUCCESS) {
+    printf("ERROR: could not create command pool for uploads\n");
   }
-  vkResetFences(m->device, 1, &m->inFlightFences[m->currentFrame]);
+  MY_VK_TRACK(m, VK_OBJECT_TYPE_COMMAND_POOL, st->pool);
 
-  // record command buffer
-  vkResetCommandBuffer(m->commandBuffers[m->currentFrame], 0);
-  // record to command buffer
-  uint32_t cur_frame_buffer = imageIndex;
-  {
-    VkCommandBufferBeginInfo beginInfo{};
-    beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
-    beginInfo.flags = 0;
-    beginInfo.pInheritanceInfo = NULL;
-    if (vkBeginCommandBuffer(m->commandBuffers[m->currentFrame], &beginInfo) !=
+  VkCommandBuffer cmds[STAGING_BATCHES];
+  VkCommandBufferAllocateInfo allocInfo{};
+  allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+  allocInfo.commandPool = st->pool;
+  allocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+  allocInfo.commandBufferCount = STAGING_BATCHES;
+  if (vkAllocateCommandBuffers(m->device, &allocInfo, cmds) != VK_SUCCESS) {
+    printf("ERROR: failed to allocate upload command buffers\n");
+  }
+  VkFenceCreateInfo fenceInfo{};
+  fenceInfo.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
+  for (uint32_t i = 0; i < STAGING_BATCHES; ++i) {
+    st->batches[i].cmd = cmds[i];
+    st->batches[i].in_flight = false;
+    if (vkCreateFence(m->device, &fenceInfo, nullptr, &st->batches[i].fence) !=
         VK_SUCCESS) {
-      printf("ERROR: could not begin command buffer\n");
+      printf("ERROR: could not create upload fence!\n");
     }
+    MY_VK_TRACK(m, VK_OBJECT_TYPE_FENCE, st->batches[i].fence);
+  }
 
-    // begin render pass
-    VkRenderPassBeginInfo renderPassInfo{};
-    renderPassInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
-    renderPassInfo.renderPass = m->renderPass;
-    renderPassInfo.framebuffer = m->swapchainFramebuffers[cur_frame_buffer];
-    renderPassInfo.renderArea.offset = {0, 0};
-    renderPassInfo.renderArea.extent = m->extent;
+  VkSemaphoreTypeCreateInfo typeInfo{};
+  typeInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_TYPE_CREATE_INFO;
+  typeInfo.semaphoreType = VK_SEMAPHORE_TYPE_TIMELINE;
+  typeInfo.initialValue = 0;
+  VkSemaphoreCreateInfo semaphoreInfo{};
+  semaphoreInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
+  semaphoreInfo.pNext = &typeInfo;
+  if (vkCreateSemaphore(m->device, &semaphoreInfo, nullptr, &st->timeline) !=
+      VK_SUCCESS) {
+    printf("ERROR: could not create upload timeline semaphore!\n");
+  }
+  MY_VK_TRACK(m, VK_OBJECT_TYPE_SEMAPHORE, st->timeline);
+  st->timeline_value = 0;
+  st->acquire_count = 0;
+  st->image_op_count = 0;
+  st->image_acquire_count = 0;
+}
 
-    VkClearValue clearColor = {
-        {{(float)fabs(sin(glfwGetTime())), 0.0f, 0.0f, 1.0f}}};
-    renderPassInfo.clearValueCount = 1;
-    renderPassInfo.pClearValues = &clearColor;
+void my_vk_destroy_staging(MyVk *m) {
+  MyVkStaging *st = &m->staging;
+  for (uint32_t i = 0; i < STAGING_BATCHES; ++i) {
+    my_vk_destroy_object(m, VK_OBJECT_TYPE_FENCE,
+                         (uint64_t)st->batches[i].fence);
+  }
+  my_vk_destroy_object(m, VK_OBJECT_TYPE_SEMAPHORE, (uint64_t)st->timeline);
+  my_vk_destroy_object(m, VK_OBJECT_TYPE_COMMAND_POOL, (uint64_t)st->pool);
+  my_vk_destroy_buffer(m, &st->ring);
+}
 
-    vkCmdBeginRenderPass(m->commandBuffers[m->currentFrame], &renderPassInfo,
-                         VK_SUBPASS_CONTENTS_INLINE);
+// hand the ring space of a finished batch back, waits for it if asked to
+void my_vk_retire_upload_batch(MyVk *m, UploadBatch *batch, bool wait) {
+  if (!batch->in_flight) {
+    return;
+  }
+  if (wait) {
+    vkWaitForFences(m->device, 1, &batch->fence, VK_TRUE, UINT64_MAX);
+  } else if (vkGetFenceStatus(m->device, batch->fence) != VK_SUCCESS) {
+    return;
+  }
+  vkResetFences(m->device, 1, &batch->fence);
+  batch->in_flight = false;
+  // batches finish in submission order, so this only moves forward
+  if (batch->ring_end > m->staging.tail) {
+    m->staging.tail = batch->ring_end;
+  }
+}
 
-    vkCmdBindPipeline(m->commandBuffers[m->currentFrame],
-                      VK_PIPELINE_BIND_POINT_GRAPHICS, m->graphicsPipeline);
+// where uploaded data is first read on a queue family
+VkPipelineStageFlags2 my_vk_upload_stages(MyVk *m, uint32_t family) {
+  if (family == (uint32_t)m->queue_graphics_idx) {
+    return VK_PIPELINE_STAGE_2_VERTEX_INPUT_BIT |
+           VK_PIPELINE_STAGE_2_VERTEX_SHADER_BIT |
+           VK_PIPELINE_STAGE_2_FRAGMENT_SHADER_BIT |
+           VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT;
+  }
+  return VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT;
+}
 
-    vkCmdSetViewport(m->commandBuffers[m->currentFrame], 0, 1, &m->viewport);
-    vkCmdSetScissor(m->commandBuffers[m->currentFrame], 0, 1, &m->scissor);
+VkAccessFlags2 my_vk_upload_access(MyVk *m, uint32_t family) {
+  if (family == (uint32_t)m->queue_graphics_idx) {
+    return VK_ACCESS_2_VERTEX_ATTRIBUTE_READ_BIT | VK_ACCESS_2_INDEX_READ_BIT |
+           VK_ACCESS_2_SHADER_READ_BIT;
+  }
+  return VK_ACCESS_2_SHADER_READ_BIT;
+}
 
-    vkCmdDraw(m->commandBuffers[m->currentFrame], 3, 1, 0, 0);
+// records every pending copy into one command buffer and submits it
+void my_vk_flush_uploads(MyVk *m) {
+  MyVkStaging *st = &m->staging;
+  if (st->copy_count == 0 && st->image_op_count == 0) {
+    return;
+  }
+  UploadBatch *batch = &st->batches[st->next_batch];
+  st->next_batch = (st->next_batch + 1) % STAGING_BATCHES;
+  my_vk_retire_upload_batch(m, batch, true);
+
+  vkResetCommandBuffer(batch->cmd, 0);
+  VkCommandBufferBeginInfo beginInfo{};
+  beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+  beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+  vkBeginCommandBuffer(batch->cmd, &beginInfo);
+
+  // images that begin uploading here go to TRANSFER_DST before any copy
+  VkImageMemoryBarrier2 *image_barriers = (VkImageMemoryBarrier2 *)alloca(
+      sizeof(VkImageMemoryBarrier2) * (st->image_op_count + 1));
+  uint32_t image_barrier_count = 0;
+  for (uint32_t i = 0; i < st->image_op_count; ++i) {
+    PendingImageOp *op = &st->image_ops[i];
+    if (op->op != IMAGE_UPLOAD_BEGIN) {
+      continue;
+    }
+    VkImageMemoryBarrier2 *b = &image_barriers[image_barrier_count++];
+    *b = VkImageMemoryBarrier2{};
+    b->sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER_2;
+    b->srcStageMask = VK_PIPELINE_STAGE_2_NONE;
+    b->srcAccessMask = VK_ACCESS_2_NONE;
+    b->dstStageMask = VK_PIPELINE_STAGE_2_COPY_BIT;
+    b->dstAccessMask = VK_ACCESS_2_TRANSFER_WRITE_BIT;
+    b->oldLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+    b->newLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+    b->srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    b->dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    b->image = op->image;
+    b->subresourceRange = VkImageSubresourceRange{VK_IMAGE_ASPECT_COLOR_BIT, 0,
+                                                  op->level_count, 0, 1};
+  }
+  if (image_barrier_count > 0) {
+    VkDependencyInfo dependency{};
+    dependency.sType = VK_STRUCTURE_TYPE_DEPENDENCY_INFO;
+    dependency.imageMemoryBarrierCount = image_barrier_count;
+    dependency.pImageMemoryBarriers = image_barriers;
+    vkCmdPipelineBarrier2(batch->cmd, &dependency);
+  }
 
-    vkCmdEndRenderPass(m->commandBuffers[m->currentFrame]);
+  // one vkCmdCopyBuffer per run of copies into the same buffer
+  VkBufferCopy *regions =
+      (VkBufferCopy *)alloca(sizeof(VkBufferCopy) * (st->copy_count + 1));
+  uint32_t run_start = 0;
+  for (uint32_t i = 0; i < st->copy_count; ++i) {
+    regions[i] = st->copies[i].region;
+    if (i + 1 == st->copy_count ||
+        st->copies[i + 1].dst != st->copies[run_start].dst) {
+      vkCmdCopyBuffer(batch->cmd, st->ring.buffer, st->copies[run_start].dst,
+                      i + 1 - run_start, regions + run_start);
+      run_start = i + 1;
+    }
+  }
+  // and one vkCmdCopyBufferToImage per run into the same image
+  VkBufferImageCopy *image_regions = (VkBufferImageCopy *)alloca(
+      sizeof(VkBufferImageCopy) * (st->image_op_count + 1));
+  uint32_t image_region_count = 0;
+  for (uint32_t i = 0; i < st->image_op_count; ++i) {
+    PendingImageOp *op = &st->image_ops[i];
+    if (op->op != IMAGE_UPLOAD_COPY) {
+      continue;
+    }
+    image_regions[image_region_count++] = op->region;
+    if (i + 1 == st->image_op_count ||
+        st->image_ops[i + 1].op != IMAGE_UPLOAD_COPY ||
+        st->image_ops[i + 1].image != op->image) {
+      vkCmdCopyBufferToImage(batch->cmd, st->ring.buffer, op->image,
+                             VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+                             image_region_count, image_regions);
+      image_region_count = 0;
+    }
+  }
 
-    if (vkEndCommandBuffer(m->commandBuffers[m->currentFrame]) != VK_SUCCESS) {
-      printf("ERROR: failed to end comman buffer!\n");
+  // make the copies visible to everything submitted after this. Buffers used
+  // by another queue family are released to it here, and acquired by the next
+  // command buffer of that family (the transfer queue doesn't acquire them
+  // first, so uploads must cover whatever part of a buffer is still needed).
+  VkBufferMemoryBarrier2 *barriers = (VkBufferMemoryBarrier2 *)alloca(
+      sizeof(VkBufferMemoryBarrier2) * (st->copy_count + 1));
+  uint32_t barrier_count = 0;
+  uint32_t family = (uint32_t)m->queue_transfer_idx;
+  for (uint32_t i = 0; i < st->copy_count; ++i) {
+    PendingCopy *copy = &st->copies[i];
+    bool seen = false;
+    for (uint32_t j = 0; j < barrier_count; ++j) {
+      seen |= barriers[j].buffer == copy->dst;
+    }
+    if (seen) {
+      continue;
+    }
+    VkBufferMemoryBarrier2 *b = &barriers[barrier_count++];
+    *b = VkBufferMemoryBarrier2{};
+    b->sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER_2;
+    b->srcStageMask = VK_PIPELINE_STAGE_2_COPY_BIT;
+    b->srcAccessMask = VK_ACCESS_2_TRANSFER_WRITE_BIT;
+    b->buffer = copy->dst;
+    b->offset = 0;
+    b->size = VK_WHOLE_SIZE;
+    if (copy->owner == family) {
+      b->srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+      b->dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+      b->dstStageMask = my_vk_upload_stages(m, family);
+      b->dstAccessMask = my_vk_upload_access(m, family);
+      continue;
+    }
+    // release here, the destination stages belong to the acquire
+    b->srcQueueFamilyIndex = family;
+    b->dstQueueFamilyIndex = copy->owner;
+    // released by an earlier batch and not acquired yet: a second release
+    // would have no acquire to match it. The pending one waits for this
+    // batch's timeline value too, whose signal makes these copies visible.
+    bool pending = false;
+    for (uint32_t j = 0; j < st->acquire_count; ++j) {
+      if (st->acquires[j].buffer == copy->dst) {
+        pending = true;
+        if (st->acquires[j].dstQueueFamilyIndex != copy->owner) {
+          printf("ERROR: buffer handed to another queue family before the "
+                 "last one took it over!\n");
+        }
+      }
     }
+    if (pending) {
+      --barrier_count;
+      continue;
+    }
+    if (st->acquire_count == STAGING_MAX_PENDING_COPIES) {
+      printf("ERROR: too many buffers waiting to be acquired!\n");
+      continue;
+    }
+    VkBufferMemoryBarrier2 *acquire = &st->acquires[st->acquire_count++];
+    *acquire = *b;
+    acquire->srcStageMask = VK_PIPELINE_STAGE_2_NONE;
+    acquire->srcAccessMask = VK_ACCESS_2_NONE;
+    acquire->dstStageMask = my_vk_upload_stages(m, copy->owner);
+    acquire->dstAccessMask = my_vk_upload_access(m, copy->owner);
   }
-  // submit command buffer
-  VkSubmitInfo submitInfo{};
-  {
-    submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
-    VkPipelineStageFlags waitFlag =
-        VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
-    submitInfo.waitSemaphoreCount = 1;
-    submitInfo.pWaitSemaphores = &m->imageAvailableSemaphores[m->currentFrame];
-    submitInfo.pWaitDstStageMask = &waitFlag;
-    submitInfo.commandBufferCount = 1;
-    submitInfo.pCommandBuffers = &m->commandBuffers[m->currentFrame];
-    // make the render signal when it's done rendering
-    submitInfo.signalSemaphoreCount = 1;
-    submitInfo.pSignalSemaphores =
-        &m->renderFinishedSemaphores[m->currentFrame];
-    if (vkQueueSubmit(m->graphicsQueue, 1, &submitInfo,
-                      m->inFlightFences[m->currentFrame]) != VK_SUCCESS) {
-      printf("ERROR: Could not submit command buffer to command graphics "
-             "queue!\n");
+  // finished images become sampled textures, that is all they are used for
+  image_barrier_count = 0;
+  for (uint32_t i = 0; i < st->image_op_count; ++i) {
+    PendingImageOp *op = &st->image_ops[i];
+    if (op->op != IMAGE_UPLOAD_END) {
+      continue;
+    }
+    VkImageMemoryBarrier2 *b = &image_barriers[image_barrier_count++];
+    *b = VkImageMemoryBarrier2{};
+    b->sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER_2;
+    b->srcStageMask = VK_PIPELINE_STAGE_2_COPY_BIT;
+    b->srcAccessMask = VK_ACCESS_2_TRANSFER_WRITE_BIT;
+    b->oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+    b->newLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+    b->image = op->image;
+    b->subresourceRange = VkImageSubresourceRange{VK_IMAGE_ASPECT_COLOR_BIT, 0,
+                                                  op->level_count, 0, 1};
+    if (op->owner == family) {
+      b->srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+      b->dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+      b->dstStageMask = VK_PIPELINE_STAGE_2_FRAGMENT_SHADER_BIT;
+      b->dstAccessMask = VK_ACCESS_2_SHADER_SAMPLED_READ_BIT;
+      continue;
     }
+    b->srcQueueFamilyIndex = family;
+    b->dstQueueFamilyIndex = op->owner;
+    if (st->image_acquire_count == STAGING_MAX_PENDING_COPIES) {
+      printf("ERROR: too many images waiting to be acquired!\n");
+      continue;
+    }
+    VkImageMemoryBarrier2 *acquire =
+        &st->image_acquires[st->image_acquire_count];
+    *acquire = *b;
+    acquire->srcStageMask = VK_PIPELINE_STAGE_2_NONE;
+    acquire->srcAccessMask = VK_ACCESS_2_NONE;
+    acquire->dstStageMask = VK_PIPELINE_STAGE_2_FRAGMENT_SHADER_BIT;
+    acquire->dstAccessMask = VK_ACCESS_2_SHADER_SAMPLED_READ_BIT;
+    st->image_acquire_values[st->image_acquire_count++] =
+        st->timeline_value + 1;
   }
-  VkPresentInfoKHR presentInfo{};
-  {
-    presentInfo.sType = VK_STRUCTURE_TYPE_PRESENT_INFO_KHR;
-    presentInfo.waitSemaphoreCount = 1;
-    presentInfo.pWaitSemaphores = &m->renderFinishedSemaphores[m->currentFrame];
-    presentInfo.swapchainCount = 1;
-    presentInfo.pSwapchains = &m->swapchain;
-    presentInfo.pImageIndices = &imageIndex;
+  VkDependencyInfo dependency{};
+  dependency.sType = VK_STRUCTURE_TYPE_DEPENDENCY_INFO;
+  dependency.bufferMemoryBarrierCount = barrier_count;
+  dependency.pBufferMemoryBarriers = barriers;
+  dependency.imageMemoryBarrierCount = image_barrier_count;
+  dependency.pImageMemoryBarriers = image_barriers;
+  vkCmdPipelineBarrier2(batch->cmd, &dependency);
+  vkEndCommandBuffer(batch->cmd);
+
+  VkCommandBufferSubmitInfo cmdInfo{};
+  cmdInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_SUBMIT_INFO;
+  cmdInfo.commandBuffer = batch->cmd;
+  VkSemaphoreSubmitInfo signalInfo{};
+  signalInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_SUBMIT_INFO;
+  signalInfo.semaphore = st->timeline;
+  signalInfo.value = st->timeline_value + 1;
+  signalInfo.stageMask = VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT;
+  VkSubmitInfo2 submitInfo{};
+  submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO_2;
+  submitInfo.commandBufferInfoCount = 1;
+  submitInfo.pCommandBufferInfos = &cmdInfo;
+  submitInfo.signalSemaphoreInfoCount = 1;
+  submitInfo.pSignalSemaphoreInfos = &signalInfo;
+  if (vkQueueSubmit2(m->transferQueue, 1, &submitInfo, batch->fence) !=
+      VK_SUCCESS) {
+    printf("ERROR: could not submit uploads!\n");
   }
+  ++st->timeline_value;
+  batch->in_flight = true;
+  batch->ring_end = st->head;
+  st->copy_count = 0;
+  st->image_op_count = 0;
+}
 
-  VkResult res = vkQueuePresentKHR(m->presentQueue, &presentInfo);
-  // TODO : adding the out commented check made it change swapchain twice for
-  // every resize, fix somehow? this solution will possibly not work on all
-  // devices
-  if (res == VK_ERROR_OUT_OF_DATE_KHR ||
-      res == VK_SUBOPTIMAL_KHR /* || m->framebuffer_resized  */) {
-    // recreate the swapchain
-    m->framebuffer_resized = false;
-    my_vk_recreate_swapchain(m);
-    return;
-  } else if (res != VK_SUCCESS) {
-    printf("ERROR: failed to queue present KHR!\n");
+// the last upload the gpu has finished
+uint64_t my_vk_uploads_done(MyVk *m) {
+  uint64_t value = 0;
+  if (vkGetSemaphoreCounterValue(m->device, m->staging.timeline, &value) !=
+      VK_SUCCESS) {
+    printf("ERROR: could not read the upload timeline!\n");
   }
+  return value;
+}
 
-  m->currentFrame = (m->currentFrame + 1) % MAX_FRAMES_IN_FLIGHT;
+// Takes over the uploaded buffers that were released to family, and the
+// images whose upload has finished. Returns the upload timeline value the
+// submit has to wait for, 0 if it recorded nothing.
+uint64_t my_vk_acquire_uploads(MyVk *m, VkCommandBuffer cmd,
+                               uint32_t family) {
+  MyVkStaging *st = &m->staging;
+  VkBufferMemoryBarrier2 *barriers = (VkBufferMemoryBarrier2 *)alloca(
+      sizeof(VkBufferMemoryBarrier2) * (st->acquire_count + 1));
+  uint32_t count = 0, kept = 0;
+  uint64_t wait = 0;
+  for (uint32_t i = 0; i < st->acquire_count; ++i) {
+    if (st->acquires[i].dstQueueFamilyIndex == family) {
+      barriers[count++] = st->acquires[i];
+      wait = st->timeline_value;
+    } else {
+      st->acquires[kept++] = st->acquires[i];
+    }
+  }
+  st->acquire_count = kept;
+
+  VkImageMemoryBarrier2 *image_barriers = (VkImageMemoryBarrier2 *)alloca(
+      sizeof(VkImageMemoryBarrier2) * (st->image_acquire_count + 1));
+  uint32_t image_count = 0;
+  uint64_t done = st->image_acquire_count > 0 ? my_vk_uploads_done(m) : 0;
+  kept = 0;
+  for (uint32_t i = 0; i < st->image_acquire_count; ++i) {
+    uint64_t value = st->image_acquire_values[i];
+    if (st->image_acquires[i].dstQueueFamilyIndex == family && value <= done) {
+      image_barriers[image_count++] = st->image_acquires[i];
+      wait = std::max(wait, value);
+    } else {
+      st->image_acquires[kept] = st->image_acquires[i];
+      st->image_acquire_values[kept++] = value;
+    }
+  }
+  st->image_acquire_count = kept;
+  if (count == 0 && image_count == 0) {
+    return 0;
+  }
+  VkDependencyInfo dependency{};
+  dependency.sType = VK_STRUCTURE_TYPE_DEPENDENCY_INFO;
+  dependency.bufferMemoryBarrierCount = count;
+  dependency.pBufferMemoryBarriers = barriers;
+  dependency.imageMemoryBarrierCount = image_count;
+  dependency.pImageMemoryBarriers = image_barriers;
+  vkCmdPipelineBarrier2(cmd, &dependency);
+  return wait;
 }
 
-int main() {
-  glfwInit();
+// wait info for a submit that acquired uploads, value from
+// my_vk_acquire_uploads
+VkSemaphoreSubmitInfo my_vk_upload_wait(MyVk *m, uint32_t family,
+                                        uint64_t value) {
+  VkSemaphoreSubmitInfo waitInfo{};
+  waitInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_SUBMIT_INFO;
+  waitInfo.semaphore = m->staging.timeline;
+  waitInfo.value = value;
+  waitInfo.stageMask = my_vk_upload_stages(m, family);
+  return waitInfo;
+}
 
-  {
-    uint32_t extensionCount = 0;
-    vkEnumerateInstanceExtensionProperties(nullptr, &extensionCount, nullptr);
+// takes over what was released to family and not acquired yet, on queue
+// with cmd, and waits until it is done. Only while the queue is idle, before
+// buffers are handed on to another family.
+void my_vk_submit_acquires(MyVk *m, VkQueue queue, VkCommandBuffer cmd,
+                           uint32_t family) {
+  vkResetCommandBuffer(cmd, 0);
+  VkCommandBufferBeginInfo beginInfo{};
+  beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+  beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+  vkBeginCommandBuffer(cmd, &beginInfo);
+  uint64_t uploads = my_vk_acquire_uploads(m, cmd, family);
+  vkEndCommandBuffer(cmd);
+  if (uploads == 0) {
+    return;
+  }
+  VkSemaphoreSubmitInfo waitInfo = my_vk_upload_wait(m, family, uploads);
+  VkCommandBufferSubmitInfo cmdInfo{};
+  cmdInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_SUBMIT_INFO;
+  cmdInfo.commandBuffer = cmd;
+  VkSubmitInfo2 submitInfo{};
+  submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO_2;
+  submitInfo.waitSemaphoreInfoCount = 1;
+  submitInfo.pWaitSemaphoreInfos = &waitInfo;
+  submitInfo.commandBufferInfoCount = 1;
+  submitInfo.pCommandBufferInfos = &cmdInfo;
+  if (vkQueueSubmit2(queue, 1, &submitInfo, VK_NULL_HANDLE) != VK_SUCCESS) {
+    printf("ERROR: could not submit queue ownership acquires!\n");
+  }
+  vkQueueWaitIdle(queue);
+}
 
-    printf("%d extensions supported\n", extensionCount);
-    VkExtensionProperties *extensions = (VkExtensionProperties *)malloc(
-        sizeof(VkExtensionProperties) * extensionCount);
-    vkEnumerateInstanceExtensionProperties(nullptr, &extensionCount,
-                                           extensions);
+// reserve size bytes of contiguous ring space, flushing and waiting on old
+// uploads when the ring is full. size must be at most STAGING_RING_SIZE.
+VkDeviceSize my_vk_staging_alloc(MyVk *m, VkDeviceSize size) {
+  MyVkStaging *st = &m->staging;
+  st->head = (st->head + 15) & ~(VkDeviceSize)15;
+  // never wrap inside an allocation, skip the rest of the ring instead
+  VkDeviceSize offset = st->head % STAGING_RING_SIZE;
+  if (offset + size > STAGING_RING_SIZE) {
+    st->head += STAGING_RING_SIZE - offset;
+  }
+  while (st->head + size - st->tail > STAGING_RING_SIZE) {
+    // the space we need is still being read, free up the oldest batch
+    bool any_in_flight = false;
+    for (uint32_t i = 0; i < STAGING_BATCHES; ++i) {
+      any_in_flight |= st->batches[i].in_flight;
+    }
+    if (!any_in_flight) {
+      // only unsubmitted copies use the ring, submit them
+      my_vk_flush_uploads(m);
+    }
+    UploadBatch *oldest = NULL;
+    for (uint32_t i = 0; i < STAGING_BATCHES; ++i) {
+      UploadBatch *b = &st->batches[i];
+      if (b->in_flight && (oldest == NULL || b->ring_end < oldest->ring_end)) {
+        oldest = b;
+      }
+    }
+    if (oldest == NULL) {
+      st->tail = st->head; // nothing uses the ring anymore
+      break;
+    }
+    my_vk_retire_upload_batch(m, oldest, true);
+  }
+  VkDeviceSize ring_offset = st->head % STAGING_RING_SIZE;
+  st->head += size;
+  return ring_offset;
+}
 
-    for (unsigned int i = 0; i < extensionCount; ++i) {
-      printf("extension: `%s` with ver: `%d`\n", extensions[i].extensionName,
-             extensions[i].specVersion);
+// Copies data into dst at dst_offset through the staging ring. The copy is
+// only recorded; it reaches the gpu on the next my_vk_flush_uploads.
+void my_vk_upload(MyVk *m, MyBuffer *dst, VkDeviceSize dst_offset,
+                  const void *data, VkDeviceSize size) {
+  MyVkStaging *st = &m->staging;
+  const char *src = (const char *)data;
+  // big uploads go through in pieces so they never need the whole ring
+  const VkDeviceSize max_chunk = STAGING_RING_SIZE / 4;
+  while (size > 0) {
+    VkDeviceSize chunk = size < max_chunk ? size : max_chunk;
+    if (st->copy_count == STAGING_MAX_PENDING_COPIES) {
+      my_vk_flush_uploads(m);
     }
-    free(extensions);
+    VkDeviceSize ring_offset = my_vk_staging_alloc(m, chunk);
+    memcpy(st->mapped + ring_offset, src, chunk);
+    PendingCopy *copy = &st->copies[st->copy_count++];
+    copy->dst = dst->buffer;
+    copy->owner = dst->owner;
+    copy->region.srcOffset = ring_offset;
+    copy->region.dstOffset = dst_offset;
+    copy->region.size = chunk;
+    src += chunk;
+    dst_offset += chunk;
+    size -= chunk;
   }
+}
 
-  MyVk my_vk{};
-  MyVk *m = &my_vk;
+// Streams size bytes at offset of a mapped file into dst through the staging
+// ring. Pages are dropped again once they are in the ring, so however big the
+// file is, only about a chunk of it is resident at a time.
+void my_vk_upload_mapped(MyVk *m, MyBuffer *dst, VkDeviceSize dst_offset,
+                         const MappedFile *file, size_t offset, size_t size) {
+  const size_t page = (size_t)sysconf(_SC_PAGESIZE);
+  const size_t max_chunk = STAGING_RING_SIZE / 4;
+  madvise((void *)(file->data + offset / page * page),
+          offset + size - offset / page * page, MADV_SEQUENTIAL);
+  while (size > 0) {
+    size_t chunk = size < max_chunk ? size : max_chunk;
+    my_vk_upload(m, dst, dst_offset, file->data + offset, chunk);
+    // only whole pages, the last one may still be needed. The mapping is
+    // private and read only, so a dropped page just reads in again.
+    size_t begin = offset / page * page;
+    size_t end = (offset + chunk) / page * page;
+    if (end > begin) {
+      madvise((void *)(file->data + begin), end - begin, MADV_DONTNEED);
+    }
+    offset += chunk;
+    dst_offset += chunk;
+    size -= chunk;
+  }
+}
+
+// begins or ends the upload of all levels of an image that family samples
+void my_vk_image_upload_op(MyVk *m, uint32_t op, VkImage image,
+                           uint32_t level_count, uint32_t family) {
+  MyVkStaging *st = &m->staging;
+  if (st->image_op_count == STAGING_MAX_PENDING_COPIES) {
+    my_vk_flush_uploads(m);
+  }
+  PendingImageOp *pending = &st->image_ops[st->image_op_count++];
+  *pending = PendingImageOp{};
+  pending->op = op;
+  pending->image = image;
+  pending->owner = family;
+  pending->level_count = level_count;
+}
+
+// Copies a level of an image through the staging ring, a band of block rows
+// at a time when it is bigger than a ring chunk. Goes between the begin and
+// the end of the image's upload.
+void my_vk_upload_image_level(MyVk *m, VkImage image, uint32_t level,
+                              VkExtent2D extent, const TextureFormat *f,
+                              const char *data) {
+  MyVkStaging *st = &m->staging;
+  uint32_t blocks_x = (extent.width + f->block_size - 1) / f->block_size;
+  uint32_t blocks_y = (extent.height + f->block_size - 1) / f->block_size;
+  VkDeviceSize row_bytes = (VkDeviceSize)blocks_x * f->block_bytes;
+  // the ring is 16 byte aligned, enough for any block size
+  uint32_t band = (uint32_t)std::max<VkDeviceSize>(
+      STAGING_RING_SIZE / 4 / row_bytes, 1);
+  for (uint32_t row = 0; row < blocks_y; row += band) {
+    uint32_t rows = std::min(band, blocks_y - row);
+    if (st->image_op_count == STAGING_MAX_PENDING_COPIES) {
+      my_vk_flush_uploads(m);
+    }
+    VkDeviceSize ring_offset = my_vk_staging_alloc(m, row_bytes * rows);
+    memcpy(st->mapped + ring_offset, data + row_bytes * row, row_bytes * rows);
+    PendingImageOp *op = &st->image_ops[st->image_op_count++];
+    *op = PendingImageOp{};
+    op->op = IMAGE_UPLOAD_COPY;
+    op->image = image;
+    op->region.bufferOffset = ring_offset;
+    op->region.imageSubresource =
+        VkImageSubresourceLayers{VK_IMAGE_ASPECT_COLOR_BIT, level, 0, 1};
+    uint32_t y = row * f->block_size;
+    op->region.imageOffset = VkOffset3D{0, (int32_t)y, 0};
+    op->region.imageExtent = VkExtent3D{
+        extent.width, std::min(rows * f->block_size, extent.height - y), 1};
+  }
+}
+
+void my_vk_create_mesh_buffers(MyVk *m, uint32_t vertex_count,
+                               uint32_t index_count) {
+  m->vertexBuffer = my_vk_create_buffer(
+      m, sizeof(Vertex) * vertex_count,
+      VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+      VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+  m->indexBuffer = my_vk_create_buffer(
+      m, sizeof(uint32_t) * index_count,
+      VK_BUFFER_USAGE_INDEX_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+      VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+  m->index_count = index_count;
+}
+
+// the generated meshes as a mesh file, for the bundle
+void my_vk_write_mesh(const char *path, const Vertex *vertices,
+                      uint32_t vertex_count, const uint32_t *indices,
+                      uint32_t index_count) {
+  MeshFileHeader header{MESH_FILE_MAGIC, vertex_count, index_count, 0};
+  FILE *file = fopen(path, "wb");
+  if (file == NULL) {
+    printf("ERROR: could not open %s for writing!\n", path);
+    return;
+  }
+  bool ok = fwrite(&header, sizeof(header), 1, file) == 1;
+  ok = ok && fwrite(vertices, sizeof(Vertex), vertex_count, file) ==
+                 vertex_count;
+  ok = ok && fwrite(indices, sizeof(uint32_t), index_count, file) ==
+                 index_count;
+  ok = fclose(file) == 0 && ok;
+  if (ok) {
+    printf("wrote the mesh to %s\n", path);
+  } else {
+    printf("ERROR: could not write the mesh to %s!\n", path);
+  }
+}
+
+// device local vertex and index buffers, filled through the staging ring
+void my_vk_create_mesh(MyVk *m, const Vertex *vertices, uint32_t vertex_count,
+                       const uint32_t *indices, uint32_t index_count) {
+  if (m->opts.write_mesh_path != NULL) {
+    my_vk_write_mesh(m->opts.write_mesh_path, vertices, vertex_count, indices,
+                     index_count);
+  }
+  my_vk_create_mesh_buffers(m, vertex_count, index_count);
+  my_vk_upload(m, &m->vertexBuffer, 0, vertices,
+               sizeof(Vertex) * vertex_count);
+  my_vk_upload(m, &m->indexBuffer, 0, indices, sizeof(uint32_t) * index_count);
+  my_vk_flush_uploads(m);
+}
+
+// uploads size bytes at offset of the entry's contents to dst. Stored entries
+// are streamed straight from the mapping, compressed ones are decompressed a
+// chunk at a time, so neither needs more memory than a chunk.
+bool my_vk_upload_bundle_entry(MyVk *m, const MappedFile *file,
+                               const BundleEntry *e, size_t offset,
+                               size_t size, MyBuffer *dst) {
+  if (offset + size > e->raw_size) {
+    return false;
+  }
+  if (e->compression == BUNDLE_COMPRESSION_NONE) {
+    my_vk_upload_mapped(m, dst, 0, file, e->offset + offset, size);
+    return true;
+  }
+  std::lock_guard<std::mutex> lock(m->bundle_mutex);
+  VkDeviceSize dst_offset = 0;
+  while (size > 0) {
+    uint32_t i = (uint32_t)(offset / BUNDLE_CHUNK_SIZE);
+    size_t from = offset - (size_t)i * BUNDLE_CHUNK_SIZE;
+    size_t raw;
+    const char *chunk = my_vk_bundle_chunk(m, file, e, i, &raw);
+    if (chunk == NULL) {
+      return false;
+    }
+    size_t n = std::min(size, raw - from);
+    my_vk_upload(m, dst, dst_offset, chunk + from, n);
+    dst_offset += n;
+    offset += n;
+    size -= n;
+  }
+  return true;
+}
+
+// loads a mesh: a MeshFileHeader, the vertices, then the indices. It is taken
+// from the bundle if that has an entry called path, from the file otherwise,
+// and streamed into the buffers without a copy on the heap.
+bool my_vk_load_mesh(MyVk *m, const char *path) {
+  const MappedFile *file = &m->bundle.file;
+  const BundleEntry *e = my_vk_bundle_find(m, path);
+  MappedFile loose{NULL, 0};
+  BundleEntry loose_entry{};
+  if (e == NULL) {
+    loose = map_file(path);
+    if (loose.data == NULL) {
+      return false;
+    }
+    // a loose file is one stored entry covering all of it
+    loose_entry.size = loose_entry.raw_size = loose.size;
+    loose_entry.compression = BUNDLE_COMPRESSION_NONE;
+    file = &loose;
+    e = &loose_entry;
+  }
+  MeshFileHeader header;
+  size_t vertex_bytes = 0, index_bytes = 0;
+  bool valid = my_vk_bundle_read(m, file, e, 0, sizeof(header), &header);
+  if (valid) {
+    vertex_bytes = sizeof(Vertex) * (size_t)header.vertex_count;
+    index_bytes = sizeof(uint32_t) * (size_t)header.index_count;
+    valid = header.magic == MESH_FILE_MAGIC && header.vertex_count > 0 &&
+            header.index_count > 0 &&
+            e->raw_size == sizeof(header) + vertex_bytes + index_bytes;
+  }
+  // the indices are read first, every one has to name a vertex
+  uint32_t *indices = NULL;
+  if (valid) {
+    indices = (uint32_t *)malloc(index_bytes);
+    valid = my_vk_bundle_read(m, file, e, sizeof(header) + vertex_bytes,
+                              index_bytes, indices);
+    for (uint32_t i = 0; valid && i < header.index_count; ++i) {
+      valid = indices[i] < header.vertex_count;
+    }
+  }
+  if (!valid) {
+    printf("ERROR: %s is not a mesh file!\n", path);
+    free(indices);
+    unmap_file(&loose);
+    return false;
+  }
+  my_vk_create_mesh_buffers(m, header.vertex_count, header.index_count);
+  my_vk_upload(m, &m->indexBuffer, 0, indices, index_bytes);
+  free(indices);
+  // uploads may already be in flight when a corrupt chunk turns up, so the
+  // buffers stay and the mesh is just incomplete
+  if (!my_vk_upload_bundle_entry(m, file, e, sizeof(header), vertex_bytes,
+                                 &m->vertexBuffer)) {
+    printf("ERROR: could not read all of %s!\n", path);
+  }
+  my_vk_flush_uploads(m);
+  unmap_file(&loose);
+  printf("loaded %s, %u triangles\n", path, header.index_count / 3);
+  return true;
+}
+
+void my_vk_create_default_mesh(MyVk *m) {
+  if (m->opts.mesh_path != NULL && my_vk_load_mesh(m, m->opts.mesh_path)) {
+    return;
+  }
+  uint32_t n = m->opts.mesh_grid;
+  if (n == 0) {
+    // the triangle that used to be hard coded in shader.vert
+    const Vertex vertices[] = {
+        {glm::vec2(0.0f, -0.5f), glm::vec3(1.0f, 0.0f, 0.0f)},
+        {glm::vec2(0.5f, 0.5f), glm::vec3(0.0f, 1.0f, 0.0f)},
+        {glm::vec2(-0.5f, 0.5f), glm::vec3(0.0f, 0.0f, 1.0f)},
+    };
+    const uint32_t indices[] = {0, 1, 2};
+    my_vk_create_mesh(m, vertices, 3, indices, 3);
+    return;
+  }
+
+  // n*n quads covering most of the screen, 2*n*n triangles
+  uint32_t vertex_count = (n + 1) * (n + 1);
+  uint32_t index_count = 6 * n * n;
+  Vertex *vertices = (Vertex *)malloc(sizeof(Vertex) * vertex_count);
+  uint32_t *indices = (uint32_t *)malloc(sizeof(uint32_t) * index_count);
+  for (uint32_t y = 0; y <= n; ++y) {
+    for (uint32_t x = 0; x <= n; ++x) {
+      float fx = (float)x / n, fy = (float)y / n;
+      vertices[y * (n + 1) + x] = Vertex{
+          glm::vec2(-0.9f + 1.8f * fx, -0.9f + 1.8f * fy),
+          glm::vec3(fx, fy, 1.0f - fx)};
+    }
+  }
+  uint32_t *idx = indices;
+  for (uint32_t y = 0; y < n; ++y) {
+    for (uint32_t x = 0; x < n; ++x) {
+      uint32_t tl = y * (n + 1) + x, tr = tl + 1;
+      uint32_t bl = tl + n + 1, br = bl + 1;
+      // clockwise on screen, matching the rasterizer's front face
+      const uint32_t quad[6] = {tl, tr, br, tl, br, bl};
+      memcpy(idx, quad, sizeof(quad));
+      idx += 6;
+    }
+  }
+  my_vk_create_mesh(m, vertices, vertex_count, indices, index_count);
+  printf("created %ux%u grid mesh, %u triangles\n", n, n, 2 * n * n);
+  free(vertices);
+  free(indices);
+}
+
+VkSampler my_vk_get_sampler(MyVk *m, SamplerKey key) {
+  MyVkSamplerCache *c = &m->samplers;
+  for (uint32_t i = 0; i < c->count; ++i) {
+    const SamplerKey *k = &c->keys[i];
+    if (k->filter == key.filter && k->mipmap_mode == key.mipmap_mode &&
+        k->address_mode == key.address_mode &&
+        k->max_anisotropy == key.max_anisotropy) {
+      return c->samplers[i];
+    }
+  }
+  if (c->count == MAX_SAMPLERS) {
+    printf("ERROR: too many different samplers!\n");
+    return VK_NULL_HANDLE;
+  }
+  VkSamplerCreateInfo samplerInfo{};
+  samplerInfo.sType = VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO;
+  samplerInfo.magFilter = key.filter;
+  samplerInfo.minFilter = key.filter;
+  samplerInfo.mipmapMode = key.mipmap_mode;
+  samplerInfo.addressModeU = key.address_mode;
+  samplerInfo.addressModeV = key.address_mode;
+  samplerInfo.addressModeW = key.address_mode;
+  samplerInfo.anisotropyEnable = key.max_anisotropy > 0.f ? VK_TRUE : VK_FALSE;
+  samplerInfo.maxAnisotropy = key.max_anisotropy;
+  samplerInfo.minLod = 0.f;
+  samplerInfo.maxLod = VK_LOD_CLAMP_NONE;
+  VkSampler sampler = VK_NULL_HANDLE;
+  if (vkCreateSampler(m->device, &samplerInfo, nullptr, &sampler) !=
+      VK_SUCCESS) {
+    printf("ERROR: could not create sampler!\n");
+    return VK_NULL_HANDLE;
+  }
+  MY_VK_TRACK(m, VK_OBJECT_TYPE_SAMPLER, sampler);
+  c->keys[c->count] = key;
+  c->samplers[c->count++] = sampler;
+  return sampler;
+}
+
+void my_vk_destroy_samplers(MyVk *m) {
+  MyVkSamplerCache *c = &m->samplers;
+  for (uint32_t i = 0; i < c->count; ++i) {
+    my_vk_destroy_object(m, VK_OBJECT_TYPE_SAMPLER, (uint64_t)c->samplers[i]);
+  }
+  c->count = 0;
+}
+
+// what ktx2 textures can be in: bc for real content, rgba8 for the generated
+// one. The device has to support sampling it too.
+const TextureFormat texture_formats[] = {
+    {VK_FORMAT_R8G8B8A8_UNORM, 4, 1},   {VK_FORMAT_R8G8B8A8_SRGB, 4, 1},
+    {VK_FORMAT_BC1_RGB_UNORM_BLOCK, 8, 4},
+    {VK_FORMAT_BC1_RGB_SRGB_BLOCK, 8, 4},
+    {VK_FORMAT_BC1_RGBA_UNORM_BLOCK, 8, 4},
+    {VK_FORMAT_BC1_RGBA_SRGB_BLOCK, 8, 4},
+    {VK_FORMAT_BC3_UNORM_BLOCK, 16, 4}, {VK_FORMAT_BC3_SRGB_BLOCK, 16, 4},
+    {VK_FORMAT_BC4_UNORM_BLOCK, 8, 4},  {VK_FORMAT_BC5_UNORM_BLOCK, 16, 4},
+    {VK_FORMAT_BC7_UNORM_BLOCK, 16, 4}, {VK_FORMAT_BC7_SRGB_BLOCK, 16, 4},
+};
+
+const TextureFormat *my_vk_texture_format(MyVk *m, uint32_t vk_format) {
+  for (const TextureFormat &f : texture_formats) {
+    if ((uint32_t)f.format != vk_format) {
+      continue;
+    }
+    VkFormatProperties props;
+    vkGetPhysicalDeviceFormatProperties(m->phys_device, f.format, &props);
+    if (props.optimalTilingFeatures & VK_FORMAT_FEATURE_SAMPLED_IMAGE_BIT) {
+      return &f;
+    }
+  }
+  return NULL;
+}
+
+VkExtent2D my_vk_level_extent(VkExtent2D extent, uint32_t level) {
+  return VkExtent2D{std::max(extent.width >> level, 1u),
+                    std::max(extent.height >> level, 1u)};
+}
+
+VkDeviceSize my_vk_level_size(const TextureFormat *f, VkExtent2D extent) {
+  return (VkDeviceSize)((extent.width + f->block_size - 1) / f->block_size) *
+         ((extent.height + f->block_size - 1) / f->block_size) *
+         f->block_bytes;
+}
+
+// Reads the header and level index of a ktx2 file from the bundle, or from
+// the file at path. Only 2d textures with one layer and face and no
+// supercompression, the levels are uploaded as they are stored.
+bool my_vk_open_texture(MyVk *m, MyTexture *t, const char *path) {
+  static const uint8_t ktx2_identifier[12] = {0xab, 0x4b, 0x54, 0x58,
+                                              0x20, 0x32, 0x30, 0xbb,
+                                              0x0d, 0x0a, 0x1a, 0x0a};
+  *t = MyTexture{};
+  t->name = path;
+  t->file = &m->bundle.file;
+  t->entry = my_vk_bundle_find(m, path);
+  if (t->entry == NULL) {
+    t->loose = map_file(path);
+    if (t->loose.data == NULL) {
+      return false;
+    }
+    t->loose_entry.size = t->loose_entry.raw_size = t->loose.size;
+    t->loose_entry.compression = BUNDLE_COMPRESSION_NONE;
+    t->file = &t->loose;
+    t->entry = &t->loose_entry;
+  }
+  Ktx2Header header;
+  Ktx2Level levels[TEXTURE_MAX_LEVELS];
+  bool valid =
+      my_vk_bundle_read(m, t->file, t->entry, 0, sizeof(header), &header) &&
+      memcmp(header.identifier, ktx2_identifier, 12) == 0 &&
+      header.pixelWidth > 0 && header.pixelHeight > 0 &&
+      header.pixelDepth == 0 && header.layerCount <= 1 &&
+      header.faceCount == 1 && header.supercompressionScheme == 0 &&
+      header.levelCount > 0 && header.levelCount <= TEXTURE_MAX_LEVELS &&
+      my_vk_bundle_read(m, t->file, t->entry, sizeof(header),
+                        sizeof(Ktx2Level) * header.levelCount, levels);
+  if (valid) {
+    t->format = my_vk_texture_format(m, header.vkFormat);
+    t->extent = VkExtent2D{header.pixelWidth, header.pixelHeight};
+    t->level_count = header.levelCount;
+    if (t->format == NULL) {
+      printf("ERROR: %s is in format %u, which can't be sampled here!\n",
+             path, header.vkFormat);
+      valid = false;
+    }
+  }
+  for (uint32_t i = 0; valid && i < t->level_count; ++i) {
+    VkDeviceSize size =
+        my_vk_level_size(t->format, my_vk_level_extent(t->extent, i));
+    valid = levels[i].byteLength == size &&
+            levels[i].byteOffset <= t->entry->raw_size &&
+            size <= t->entry->raw_size - levels[i].byteOffset;
+    t->level_offsets[i] = levels[i].byteOffset;
+    t->level_sizes[i] = size;
+  }
+  if (!valid) {
+    printf("ERROR: %s is not a ktx2 texture this can load!\n", path);
+    unmap_file(&t->loose);
+    return false;
+  }
+  t->tail_level = t->level_count - 1;
+  for (uint32_t i = 0; i < t->level_count; ++i) {
+    VkExtent2D e = my_vk_level_extent(t->extent, i);
+    if (std::max(e.width, e.height) <= TEXTURE_TAIL_SIZE) {
+      t->tail_level = i;
+      break;
+    }
+  }
+  t->top_level = t->tail_level;
+  t->slot = UINT32_MAX;
+  return true;
+}
+
+// the image holding levels top.. of t
+VkImageCreateInfo my_vk_texture_image_info(const MyTexture *t, uint32_t top) {
+  VkImageCreateInfo imageInfo{};
+  imageInfo.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
+  imageInfo.imageType = VK_IMAGE_TYPE_2D;
+  imageInfo.format = t->format->format;
+  VkExtent2D extent = my_vk_level_extent(t->extent, top);
+  imageInfo.extent = VkExtent3D{extent.width, extent.height, 1};
+  imageInfo.mipLevels = t->level_count - top;
+  imageInfo.arrayLayers = 1;
+  imageInfo.samples = VK_SAMPLE_COUNT_1_BIT;
+  imageInfo.tiling = VK_IMAGE_TILING_OPTIMAL;
+  imageInfo.usage =
+      VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_SAMPLED_BIT;
+  imageInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+  imageInfo.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+  return imageInfo;
+}
+
+// the memory that image takes, in the same bytes as resident_bytes, which
+// are more than the raw levels once the driver pads and aligns them
+VkDeviceSize my_vk_texture_memory(MyVk *m, const MyTexture *t, uint32_t top) {
+  VkImageCreateInfo imageInfo = my_vk_texture_image_info(t, top);
+  VkDeviceImageMemoryRequirements info{};
+  info.sType = VK_STRUCTURE_TYPE_DEVICE_IMAGE_MEMORY_REQUIREMENTS;
+  info.pCreateInfo = &imageInfo;
+  VkMemoryRequirements2 reqs{};
+  reqs.sType = VK_STRUCTURE_TYPE_MEMORY_REQUIREMENTS_2;
+  vkGetDeviceImageMemoryRequirements(m->device, &info, &reqs);
+  return reqs.memoryRequirements.size;
+}
+
+// Starts uploading levels top.. of t from its file into a new image. It
+// replaces the resident image once the upload is done. Returns the bytes put
+// into the staging ring.
+VkDeviceSize my_vk_texture_rebuild(MyVk *m, MyTexture *t, uint32_t top) {
+  VkImageCreateInfo imageInfo = my_vk_texture_image_info(t, top);
+  VkImage image;
+  if (vkCreateImage(m->device, &imageInfo, nullptr, &image) != VK_SUCCESS) {
+    printf("ERROR: could not create image for %s!\n", t->name);
+    return 0;
+  }
+  MY_VK_TRACK(m, VK_OBJECT_TYPE_IMAGE, image);
+  VkMemoryRequirements reqs;
+  vkGetImageMemoryRequirements(m->device, image, &reqs);
+  MyAllocation alloc =
+      my_vk_alloc(m, reqs, false, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+  if (alloc.memory == VK_NULL_HANDLE) {
+    printf("ERROR: out of memory for %s!\n", t->name);
+    my_vk_destroy_object(m, VK_OBJECT_TYPE_IMAGE, (uint64_t)image);
+    return 0;
+  }
+  vkBindImageMemory(m->device, image, alloc.memory, alloc.offset);
+
+  VkImageViewCreateInfo viewInfo{};
+  viewInfo.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
+  viewInfo.image = image;
+  viewInfo.viewType = VK_IMAGE_VIEW_TYPE_2D;
+  viewInfo.format = imageInfo.format;
+  viewInfo.subresourceRange = VkImageSubresourceRange{
+      VK_IMAGE_ASPECT_COLOR_BIT, 0, imageInfo.mipLevels, 0, 1};
+  VkImageView view;
+  if (vkCreateImageView(m->device, &viewInfo, nullptr, &view) != VK_SUCCESS) {
+    printf("ERROR: could not create image view for %s!\n", t->name);
+  }
+  MY_VK_TRACK(m, VK_OBJECT_TYPE_IMAGE_VIEW, view);
+
+  uint32_t family = (uint32_t)m->queue_graphics_idx;
+  my_vk_image_upload_op(m, IMAGE_UPLOAD_BEGIN, image, imageInfo.mipLevels,
+                        family);
+  VkDeviceSize bytes = 0;
+  const size_t page = (size_t)sysconf(_SC_PAGESIZE);
+  for (uint32_t level = top; level < t->level_count; ++level) {
+    size_t offset = t->level_offsets[level];
+    size_t size = t->level_sizes[level];
+    char *tmp = NULL;
+    const char *data;
+    if (t->entry->compression == BUNDLE_COMPRESSION_NONE) {
+      data = t->file->data + t->entry->offset + offset;
+    } else {
+      tmp = (char *)malloc(size);
+      if (!my_vk_bundle_read(m, t->file, t->entry, offset, size, tmp)) {
+        // the upload is already begun, the level just stays garbage
+        printf("ERROR: could not read level %u of %s!\n", level, t->name);
+        free(tmp);
+        continue;
+      }
+      data = tmp;
+    }
+    my_vk_upload_image_level(m, image, level - top,
+                             my_vk_level_extent(t->extent, level), t->format,
+                             data);
+    if (tmp != NULL) {
+      free(tmp);
+    } else {
+      // in the ring now, the pages read in again if the level is needed again
+      size_t begin = (t->entry->offset + offset + page - 1) / page * page;
+      size_t end = (t->entry->offset + offset + size) / page * page;
+      if (end > begin) {
+        madvise((void *)(t->file->data + begin), end - begin, MADV_DONTNEED);
+      }
+    }
+    bytes += size;
+  }
+  my_vk_image_upload_op(m, IMAGE_UPLOAD_END, image, imageInfo.mipLevels,
+                        family);
+
+  t->pending_image = image;
+  t->pending_alloc = alloc;
+  t->pending_view = view;
+  t->pending_level = top;
+  t->pending_value = 0; // known once flushed
+  m->tex.resident_bytes += alloc.size;
+  m->tex.streamed_bytes += bytes;
+  return bytes;
+}
+
+// the submit value of rebuilds started since the last flush
+void my_vk_flush_texture_uploads(MyVk *m) {
+  my_vk_flush_uploads(m);
+  for (uint32_t i = 0; i < m->tex.count; ++i) {
+    MyTexture *t = &m->tex.textures[i];
+    if (t->pending_image != VK_NULL_HANDLE && t->pending_value == 0) {
+      t->pending_value = m->staging.timeline_value;
+    }
+  }
+}
+
+// swaps in the rebuilt image, frames in flight finish with the old one
+void my_vk_texture_publish(MyVk *m, MyTexture *t) {
+  if (t->image != VK_NULL_HANDLE) {
+    m->tex.resident_bytes -= t->alloc.size;
+    my_vk_defer_destroy(m, VK_OBJECT_TYPE_IMAGE_VIEW, (uint64_t)t->view, NULL,
+                        NULL);
+    my_vk_defer_destroy(m, VK_OBJECT_TYPE_IMAGE, (uint64_t)t->image,
+                        &t->alloc, NULL);
+  }
+  t->image = t->pending_image;
+  t->alloc = t->pending_alloc;
+  t->view = t->pending_view;
+  t->top_level = t->pending_level;
+  t->pending_image = VK_NULL_HANDLE;
+  t->pending_alloc = MyAllocation{};
+  t->pending_view = VK_NULL_HANDLE;
+  ++t->generation;
+
+  MyVkBindless *b = &m->bindless;
+  if (b->set == VK_NULL_HANDLE) {
+    return;
+  }
+  if (t->slot != UINT32_MAX) {
+    my_vk_defer_free_slot(m, &b->textures, t->slot);
+  }
+  // a new element nothing in flight reads, so it can be written right away
+  t->slot = my_vk_slot_alloc(&b->textures);
+  if (t->slot == UINT32_MAX) {
+    printf("ERROR: out of bindless texture slots!\n");
+    return;
+  }
+  VkDescriptorImageInfo imageInfo{m->tex.sampler, t->view,
+                                  VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL};
+  VkWriteDescriptorSet write{};
+  write.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+  write.dstSet = b->set;
+  write.dstBinding = 0;
+  write.dstArrayElement = t->slot;
+  write.descriptorCount = 1;
+  write.descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+  write.pImageInfo = &imageInfo;
+  vkUpdateDescriptorSets(m->device, 1, &write, 0, nullptr);
+}
+
+// a 2048x2048 rgba8 checkerboard with all its mips as a ktx2 file, something
+// to stream without a texture tool at hand
+void my_vk_write_texture(const char *path) {
+  const uint32_t size = 2048, level_count = 12;
+  uint32_t *levels[level_count];
+  levels[0] = (uint32_t *)malloc(sizeof(uint32_t) * size * size);
+  for (uint32_t y = 0; y < size; ++y) {
+    for (uint32_t x = 0; x < size; ++x) {
+      bool light = ((x / 64) ^ (y / 64)) & 1;
+      // one texel wide lines, they only show once the top levels are in
+      bool line = x % 16 == 0 || y % 16 == 0;
+      levels[0][y * size + x] =
+          line ? 0xffff8040 : light ? 0xffe0e0e0 : 0xff404040;
+    }
+  }
+  // every level is the 2x2 average of the one above
+  for (uint32_t l = 1; l < level_count; ++l) {
+    uint32_t w = size >> l;
+    levels[l] = (uint32_t *)malloc(sizeof(uint32_t) * w * w);
+    const uint8_t *src = (const uint8_t *)levels[l - 1];
+    uint8_t *dst = (uint8_t *)levels[l];
+    for (uint32_t y = 0; y < w; ++y) {
+      for (uint32_t x = 0; x < w; ++x) {
+        for (uint32_t c = 0; c < 4; ++c) {
+          uint32_t sum = 0;
+          for (uint32_t i = 0; i < 4; ++i) {
+            uint32_t sx = 2 * x + i % 2, sy = 2 * y + i / 2;
+            sum += src[(sy * 2 * w + sx) * 4 + c];
+          }
+          dst[(y * w + x) * 4 + c] = (uint8_t)(sum / 4);
+        }
+      }
+    }
+  }
+
+  // basic data format descriptor of r8g8b8a8 unorm: the total size, the block
+  // header, then a sample per channel
+  uint32_t dfd[1 + 6 + 4 * 4] = {};
+  dfd[0] = sizeof(dfd);
+  dfd[2] = 2 | (uint32_t)(sizeof(dfd) - 4) << 16; // version 2, block size
+  dfd[3] = 1 | 1 << 8 | 1 << 16; // rgbsda, bt709 primaries, linear
+  dfd[5] = 4;                    // bytes per texel
+  for (uint32_t c = 0; c < 4; ++c) {
+    uint32_t channel = c == 3 ? 15 : c; // alpha is 15
+    dfd[7 + 4 * c] = 8 * c | 7 << 16 | channel << 24; // offset, length - 1
+    dfd[7 + 4 * c + 3] = 255;                         // upper
+  }
+
+  Ktx2Header header{};
+  const uint8_t identifier[12] = {0xab, 0x4b, 0x54, 0x58, 0x20, 0x32,
+                                  0x30, 0xbb, 0x0d, 0x0a, 0x1a, 0x0a};
+  memcpy(header.identifier, identifier, sizeof(identifier));
+  header.vkFormat = VK_FORMAT_R8G8B8A8_UNORM;
+  header.typeSize = 1;
+  header.pixelWidth = header.pixelHeight = size;
+  header.faceCount = 1;
+  header.levelCount = level_count;
+  header.dfdByteOffset = sizeof(header) + sizeof(Ktx2Level) * level_count;
+  header.dfdByteLength = sizeof(dfd);
+  // the levels follow, smallest first as the format wants
+  Ktx2Level index[level_count];
+  uint64_t offset = header.dfdByteOffset + sizeof(dfd);
+  for (uint32_t l = level_count; l-- > 0;) {
+    uint64_t w = size >> l;
+    index[l] = Ktx2Level{offset, 4 * w * w, 4 * w * w};
+    offset += 4 * w * w;
+  }
+
+  FILE *file = fopen(path, "wb");
+  if (file == NULL) {
+    printf("ERROR: could not open %s for writing!\n", path);
+  } else {
+    bool ok = fwrite(&header, sizeof(header), 1, file) == 1;
+    ok = ok && fwrite(index, sizeof(index), 1, file) == 1;
+    ok = ok && fwrite(dfd, sizeof(dfd), 1, file) == 1;
+    for (uint32_t l = level_count; ok && l-- > 0;) {
+      ok = fwrite(levels[l], index[l].byteLength, 1, file) == 1;
+    }
+    ok = fclose(file) == 0 && ok;
+    if (ok) {
+      printf("wrote a %ux%u texture to %s\n", size, size, path);
+    } else {
+      printf("ERROR: could not write the texture to %s!\n", path);
+    }
+  }
+  for (uint32_t l = 0; l < level_count; ++l) {
+    free(levels[l]);
+  }
+}
+
+// descriptor set layout, sampler and sets, before the pipeline layout is made
+void my_vk_open_textures(MyVk *m) {
+  MyVkTextures *tx = &m->tex;
+  if (m->opts.write_texture_path != NULL) {
+    my_vk_write_texture(m->opts.write_texture_path);
+  }
+  tx->count = 0;
+  tx->budget = (VkDeviceSize)m->opts.texture_budget_mb * 1024 * 1024;
+  for (uint32_t i = 0; i < m->opts.texture_count; ++i) {
+    if (my_vk_open_texture(m, &tx->textures[tx->count],
+                           m->opts.texture_paths[i])) {
+      ++tx->count;
+    }
+  }
+  if (tx->count == 0) {
+    return;
+  }
+
+  VkDescriptorSetLayoutBinding binding{};
+  binding.binding = 0;
+  binding.descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+  binding.descriptorCount = 1;
+  binding.stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT;
+  VkDescriptorSetLayoutCreateInfo setInfo{};
+  setInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+  setInfo.bindingCount = 1;
+  setInfo.pBindings = &binding;
+  if (vkCreateDescriptorSetLayout(m->device, &setInfo, nullptr,
+                                  &tx->set_layout) != VK_SUCCESS) {
+    printf("ERROR: could not create texture descriptor set layout!\n");
+  }
+  MY_VK_TRACK(m, VK_OBJECT_TYPE_DESCRIPTOR_SET_LAYOUT, tx->set_layout);
+  // set 1, the draw's object
+  binding.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+  if (vkCreateDescriptorSetLayout(m->device, &setInfo, nullptr,
+                                  &m->objects.set_layout) != VK_SUCCESS) {
+    printf("ERROR: could not create object descriptor set layout!\n");
+  }
+  MY_VK_TRACK(m, VK_OBJECT_TYPE_DESCRIPTOR_SET_LAYOUT, m->objects.set_layout);
+
+  uint32_t set_count = tx->count * MAX_FRAMES_IN_FLIGHT;
+  VkDescriptorPoolSize poolSize{VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,
+                                set_count};
+  VkDescriptorPoolCreateInfo poolInfo{};
+  poolInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+  poolInfo.maxSets = set_count;
+  poolInfo.poolSizeCount = 1;
+  poolInfo.pPoolSizes = &poolSize;
+  if (vkCreateDescriptorPool(m->device, &poolInfo, nullptr,
+                             &tx->descriptor_pool) != VK_SUCCESS) {
+    printf("ERROR: could not create texture descriptor pool!\n");
+  }
+  MY_VK_TRACK(m, VK_OBJECT_TYPE_DESCRIPTOR_POOL, tx->descriptor_pool);
+  VkDescriptorSetLayout layouts[MAX_FRAMES_IN_FLIGHT];
+  for (uint32_t i = 0; i < MAX_FRAMES_IN_FLIGHT; ++i) {
+    layouts[i] = tx->set_layout;
+  }
+  VkDescriptorSetAllocateInfo allocInfo{};
+  allocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+  allocInfo.descriptorPool = tx->descriptor_pool;
+  allocInfo.descriptorSetCount = MAX_FRAMES_IN_FLIGHT;
+  allocInfo.pSetLayouts = layouts;
+  for (uint32_t i = 0; i < tx->count; ++i) {
+    if (vkAllocateDescriptorSets(m->device, &allocInfo,
+                                 tx->textures[i].sets) != VK_SUCCESS) {
+      printf("ERROR: could not allocate texture descriptor sets!\n");
+    }
+  }
+
+  SamplerKey key{VK_FILTER_LINEAR, VK_SAMPLER_MIPMAP_MODE_LINEAR,
+                 VK_SAMPLER_ADDRESS_MODE_REPEAT, 0.f};
+  if (m->features.samplerAnisotropy) {
+    key.max_anisotropy =
+        std::min(8.f, m->phys_props.limits.maxSamplerAnisotropy);
+  }
+  tx->sampler = my_vk_get_sampler(m, key);
+}
+
+// only the mip tails to start with, waited for so every texture has an image
+// by the first frame
+void my_vk_create_textures(MyVk *m) {
+  MyVkTextures *tx = &m->tex;
+  if (tx->count == 0) {
+    return;
+  }
+  VkDeviceSize bytes = 0;
+  for (uint32_t i = 0; i < tx->count; ++i) {
+    MyTexture *t = &tx->textures[i];
+    bytes += my_vk_texture_rebuild(m, t, t->tail_level);
+  }
+  my_vk_flush_texture_uploads(m);
+  VkSemaphoreWaitInfo waitInfo{};
+  waitInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_WAIT_INFO;
+  waitInfo.semaphoreCount = 1;
+  waitInfo.pSemaphores = &m->staging.timeline;
+  waitInfo.pValues = &m->staging.timeline_value;
+  if (vkWaitSemaphores(m->device, &waitInfo, UINT64_MAX) != VK_SUCCESS) {
+    printf("ERROR: failed waiting for the texture uploads!\n");
+  }
+  for (uint32_t i = 0; i < tx->count; ++i) {
+    MyTexture *t = &tx->textures[i];
+    if (t->pending_image != VK_NULL_HANDLE) {
+      my_vk_texture_publish(m, t);
+    }
+  }
+  printf("loaded the mip tails of %u textures, %llu KiB\n", tx->count,
+         (unsigned long long)(bytes / 1024));
+}
+
+// the level whose texels come closest to a pixel each without being fewer.
+// The uvs stretch every texture over the whole framebuffer.
+uint32_t my_vk_texture_wanted_level(MyVk *m, MyTexture *t) {
+  uint32_t level = 0;
+  while (level < t->tail_level &&
+         (t->extent.width >> (level + 1)) >= m->extent.width &&
+         (t->extent.height >> (level + 1)) >= m->extent.height) {
+    ++level;
+  }
+  return level;
+}
+
+// The first of a and b to give up memory: the one drawn least recently, then
+// the one that shows the least for its memory.
+bool my_vk_evict_before(const MyTexture *a, const MyTexture *b) {
+  if (a->last_used != b->last_used) {
+    return a->last_used < b->last_used;
+  }
+  return a->priority < b->priority;
+}
+
+// Called at a frame boundary, never waits. Swaps in finished rebuilds, drops
+// levels that are no longer needed, then streams in the next level of the
+// textures that show the most per byte while the budget allows, evicting the
+// least recently used ones down to their tail when it doesn't. Last it points
+// the frame's descriptor sets at the current views.
+void my_vk_stream_textures(MyVk *m) {
+  MyVkTextures *tx = &m->tex;
+  if (tx->count == 0) {
+    return;
+  }
+  uint64_t done = my_vk_uploads_done(m);
+  for (uint32_t i = 0; i < tx->count; ++i) {
+    MyTexture *t = &tx->textures[i];
+    if (t->pending_image != VK_NULL_HANDLE && t->pending_value != 0 &&
+        t->pending_value <= done) {
+      my_vk_texture_publish(m, t);
+    }
+  }
+
+  // draw i samples texture i % count, its share of the draws is its share of
+  // the screen
+  uint32_t draws = m->opts.draws;
+  for (uint32_t i = 0; i < tx->count; ++i) {
+    MyTexture *t = &tx->textures[i];
+    uint32_t uses = draws / tx->count + (i < draws % tx->count ? 1 : 0);
+    // one no longer drawn keeps its levels until the memory is needed
+    t->wanted_level = t->top_level;
+    t->priority = 0.0;
+    if (uses == 0) {
+      continue;
+    }
+    t->last_used = m->frame_number + 1;
+    t->wanted_level = my_vk_texture_wanted_level(m, t);
+    if (t->top_level > 0) {
+      t->priority = (double)uses / draws * m->extent.width *
+                    m->extent.height / t->level_sizes[t->top_level - 1];
+    }
+  }
+
+  VkDeviceSize bytes = 0;
+  // levels above what the screen needs free their memory first
+  for (uint32_t i = 0; i < tx->count; ++i) {
+    MyTexture *t = &tx->textures[i];
+    if (t->pending_image == VK_NULL_HANDLE &&
+        t->top_level < t->wanted_level) {
+      bytes += my_vk_texture_rebuild(m, t, t->wanted_level);
+      ++tx->evicted;
+    }
+  }
+  while (bytes < TEXTURE_STREAM_BYTES_PER_FRAME) {
+    MyTexture *best = NULL;
+    for (uint32_t i = 0; i < tx->count; ++i) {
+      MyTexture *t = &tx->textures[i];
+      if (t->pending_image == VK_NULL_HANDLE &&
+          t->wanted_level < t->top_level &&
+          (best == NULL || t->priority > best->priority)) {
+        best = t;
+      }
+    }
+    if (best == NULL) {
+      break;
+    }
+    // the new image holds the next level and everything below it
+    VkDeviceSize need = my_vk_texture_memory(m, best, best->top_level - 1);
+    if (tx->resident_bytes + need > tx->budget) {
+      // a victim's memory only frees once its tail is swapped in, until then
+      // nothing more streams in
+      MyTexture *victim = NULL;
+      for (uint32_t i = 0; i < tx->count; ++i) {
+        MyTexture *t = &tx->textures[i];
+        if (t != best && t->pending_image == VK_NULL_HANDLE &&
+            t->top_level < t->tail_level && my_vk_evict_before(t, best) &&
+            (victim == NULL || my_vk_evict_before(t, victim))) {
+          victim = t;
+        }
+      }
+      if (victim != NULL) {
+        bytes += my_vk_texture_rebuild(m, victim, victim->tail_level);
+        ++tx->evicted;
+      }
+      break;
+    }
+    bytes += my_vk_texture_rebuild(m, best, best->top_level - 1);
+    if (best->pending_image == VK_NULL_HANDLE) {
+      break; // out of memory, try again next frame
+    }
+    ++tx->streamed_in;
+  }
+  my_vk_flush_texture_uploads(m);
+
+  // the slot's previous frame is done, nothing reads its sets anymore
+  uint32_t frame = m->currentFrame;
+  for (uint32_t i = 0; i < tx->count; ++i) {
+    MyTexture *t = &tx->textures[i];
+    if (t->set_generation[frame] == t->generation) {
+      continue;
+    }
+    VkDescriptorImageInfo imageInfo{tx->sampler, t->view,
+                                    VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL};
+    VkWriteDescriptorSet write{};
+    write.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+    write.dstSet = t->sets[frame];
+    write.dstBinding = 0;
+    write.descriptorCount = 1;
+    write.descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+    write.pImageInfo = &imageInfo;
+    vkUpdateDescriptorSets(m->device, 1, &write, 0, nullptr);
+    t->set_generation[frame] = t->generation;
+  }
+}
+
+void my_vk_print_textures(MyVk *m) {
+  MyVkTextures *tx = &m->tex;
+  if (tx->count == 0) {
+    return;
+  }
+  printf("textures: %.1f of %.1f MiB, %u streamed in, %u evicted, "
+         "%.1f MiB uploaded\n",
+         tx->resident_bytes / (1024.0 * 1024.0), tx->budget / (1024.0 * 1024.0),
+         tx->streamed_in, tx->evicted, tx->streamed_bytes / (1024.0 * 1024.0));
+  for (uint32_t i = 0; i < tx->count; ++i) {
+    MyTexture *t = &tx->textures[i];
+    VkExtent2D e = my_vk_level_extent(t->extent, t->top_level);
+    printf("  %-32s level %u (%ux%u) of %u, wants %u%s\n", t->name,
+           t->top_level, e.width, e.height, t->level_count, t->wanted_level,
+           t->pending_image != VK_NULL_HANDLE ? ", uploading" : "");
+  }
+}
+
+// at exit, once the device is idle
+void my_vk_destroy_textures(MyVk *m) {
+  MyVkTextures *tx = &m->tex;
+  for (uint32_t i = 0; i < tx->count; ++i) {
+    MyTexture *t = &tx->textures[i];
+    if (t->pending_image != VK_NULL_HANDLE) {
+      my_vk_destroy_object(m, VK_OBJECT_TYPE_IMAGE_VIEW,
+                           (uint64_t)t->pending_view);
+      my_vk_destroy_object(m, VK_OBJECT_TYPE_IMAGE,
+                           (uint64_t)t->pending_image);
+      my_vk_free(m, &t->pending_alloc);
+    }
+    if (t->image != VK_NULL_HANDLE) {
+      my_vk_destroy_object(m, VK_OBJECT_TYPE_IMAGE_VIEW, (uint64_t)t->view);
+      my_vk_destroy_object(m, VK_OBJECT_TYPE_IMAGE, (uint64_t)t->image);
+      my_vk_free(m, &t->alloc);
+    }
+    unmap_file(&t->loose);
+  }
+  if (tx->count > 0) {
+    my_vk_destroy_object(m, VK_OBJECT_TYPE_DESCRIPTOR_POOL,
+                         (uint64_t)tx->descriptor_pool);
+    my_vk_destroy_object(m, VK_OBJECT_TYPE_DESCRIPTOR_SET_LAYOUT,
+                         (uint64_t)tx->set_layout);
+  }
+  tx->count = 0;
+}
+
+// the set of --bindless and its pipeline layout, before the pipelines are made
+void my_vk_create_bindless(MyVk *m) {
+  MyVkBindless *b = &m->bindless;
+  b->enabled = false;
+  if ((!m->opts.bindless && !m->opts.bench_bindless) || m->tex.count == 0) {
+    return;
+  }
+  const VkPhysicalDeviceVulkan12Features *f = &m->features12;
+  if (!f->runtimeDescriptorArray || !f->descriptorBindingPartiallyBound ||
+      !f->descriptorBindingSampledImageUpdateAfterBind ||
+      !f->descriptorBindingStorageBufferUpdateAfterBind ||
+      !f->descriptorBindingUpdateUnusedWhilePending ||
+      !m->features.shaderSampledImageArrayDynamicIndexing ||
+      !m->features.shaderStorageBufferArrayDynamicIndexing) {
+    printf("ERROR: device lacks descriptor indexing, no bindless\n");
+    return;
+  }
+  VkPhysicalDeviceVulkan12Properties props12{};
+  props12.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_2_PROPERTIES;
+  VkPhysicalDeviceProperties2 props{};
+  props.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PROPERTIES_2;
+  props.pNext = &props12;
+  vkGetPhysicalDeviceProperties2(m->phys_device, &props);
+  // a combined image sampler counts as a sampler and as an image
+  uint32_t texture_count = std::min(
+      {(uint32_t)BINDLESS_MAX_TEXTURES,
+       props12.maxPerStageDescriptorUpdateAfterBindSampledImages,
+       props12.maxPerStageDescriptorUpdateAfterBindSamplers,
+       props12.maxDescriptorSetUpdateAfterBindSampledImages,
+       props12.maxDescriptorSetUpdateAfterBindSamplers,
+       props12.maxPerStageUpdateAfterBindResources / 2});
+  uint32_t buffer_count = std::min(
+      {(uint32_t)BINDLESS_MAX_BUFFERS,
+       props12.maxPerStageDescriptorUpdateAfterBindStorageBuffers,
+       props12.maxDescriptorSetUpdateAfterBindStorageBuffers,
+       props12.maxPerStageUpdateAfterBindResources - texture_count});
+
+  VkDescriptorSetLayoutBinding bindings[2]{};
+  bindings[0].binding = 0;
+  bindings[0].descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+  bindings[0].descriptorCount = texture_count;
+  bindings[0].stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT;
+  bindings[1].binding = 1;
+  bindings[1].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+  bindings[1].descriptorCount = buffer_count;
+  bindings[1].stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT;
+  // most elements are never written, and those that are aren't read by any
+  // frame in flight yet
+  const VkDescriptorBindingFlags flags =
+      VK_DESCRIPTOR_BINDING_UPDATE_AFTER_BIND_BIT |
+      VK_DESCRIPTOR_BINDING_UPDATE_UNUSED_WHILE_PENDING_BIT |
+      VK_DESCRIPTOR_BINDING_PARTIALLY_BOUND_BIT;
+  VkDescriptorBindingFlags bindingFlags[2] = {flags, flags};
+  VkDescriptorSetLayoutBindingFlagsCreateInfo flagsInfo{};
+  flagsInfo.sType =
+      VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_BINDING_FLAGS_CREATE_INFO;
+  flagsInfo.bindingCount = 2;
+  flagsInfo.pBindingFlags = bindingFlags;
+  VkDescriptorSetLayoutCreateInfo setInfo{};
+  setInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+  setInfo.pNext = &flagsInfo;
+  setInfo.flags = VK_DESCRIPTOR_SET_LAYOUT_CREATE_UPDATE_AFTER_BIND_POOL_BIT;
+  setInfo.bindingCount = 2;
+  setInfo.pBindings = bindings;
+  if (vkCreateDescriptorSetLayout(m->device, &setInfo, nullptr,
+                                  &b->set_layout) != VK_SUCCESS) {
+    printf("ERROR: could not create bindless descriptor set layout!\n");
+  }
+  MY_VK_TRACK(m, VK_OBJECT_TYPE_DESCRIPTOR_SET_LAYOUT, b->set_layout);
+
+  VkDescriptorPoolSize poolSizes[2] = {
+      {VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, texture_count},
+      {VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, buffer_count}};
+  VkDescriptorPoolCreateInfo poolInfo{};
+  poolInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+  poolInfo.flags = VK_DESCRIPTOR_POOL_CREATE_UPDATE_AFTER_BIND_BIT;
+  poolInfo.maxSets = 1;
+  poolInfo.poolSizeCount = 2;
+  poolInfo.pPoolSizes = poolSizes;
+  if (vkCreateDescriptorPool(m->device, &poolInfo, nullptr,
+                             &b->descriptor_pool) != VK_SUCCESS) {
+    printf("ERROR: could not create bindless descriptor pool!\n");
+  }
+  MY_VK_TRACK(m, VK_OBJECT_TYPE_DESCRIPTOR_POOL, b->descriptor_pool);
+  VkDescriptorSetAllocateInfo allocInfo{};
+  allocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+  allocInfo.descriptorPool = b->descriptor_pool;
+  allocInfo.descriptorSetCount = 1;
+  allocInfo.pSetLayouts = &b->set_layout;
+  if (vkAllocateDescriptorSets(m->device, &allocInfo, &b->set) !=
+      VK_SUCCESS) {
+    printf("ERROR: could not allocate the bindless descriptor set!\n");
+  }
+  my_vk_slots_init(&b->textures, texture_count);
+  my_vk_slots_init(&b->buffers, buffer_count);
+
+  // the vertex shader is the textured pipeline's, with its frame uniforms
+  // and mesh push constants in front
+  VkPushConstantRange push[2] = {
+      {VK_SHADER_STAGE_VERTEX_BIT, 0, sizeof(MeshPush)},
+      {VK_SHADER_STAGE_FRAGMENT_BIT, sizeof(MeshPush), sizeof(BindlessPush)}};
+  VkDescriptorSetLayout setLayouts[2] = {m->frame_set_layout, b->set_layout};
+  VkPipelineLayoutCreateInfo layoutInfo{};
+  layoutInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+  layoutInfo.setLayoutCount = 2;
+  layoutInfo.pSetLayouts = setLayouts;
+  layoutInfo.pushConstantRangeCount = 2;
+  layoutInfo.pPushConstantRanges = push;
+  if (vkCreatePipelineLayout(m->device, &layoutInfo, nullptr, &b->layout) !=
+      VK_SUCCESS) {
+    printf("ERROR: could not create bindless pipeline layout!\n");
+  }
+  MY_VK_TRACK(m, VK_OBJECT_TYPE_PIPELINE_LAYOUT, b->layout);
+  b->enabled = m->opts.bindless;
+  printf("bindless: %u texture and %u buffer descriptors\n", texture_count,
+         buffer_count);
+}
+
+void my_vk_destroy_bindless(MyVk *m) {
+  MyVkBindless *b = &m->bindless;
+  if (b->set_layout == VK_NULL_HANDLE) {
+    return;
+  }
+  my_vk_destroy_object(m, VK_OBJECT_TYPE_PIPELINE, (uint64_t)b->pipeline);
+  my_vk_destroy_object(m, VK_OBJECT_TYPE_PIPELINE_LAYOUT, (uint64_t)b->layout);
+  my_vk_destroy_object(m, VK_OBJECT_TYPE_DESCRIPTOR_POOL,
+                       (uint64_t)b->descriptor_pool);
+  my_vk_destroy_object(m, VK_OBJECT_TYPE_DESCRIPTOR_SET_LAYOUT,
+                       (uint64_t)b->set_layout);
+  free(b->textures.free);
+  free(b->buffers.free);
+  *b = MyVkBindless{};
+}
+
+// what the textured draws read besides their texture, a tint per object so
+// they can be told apart. Both the per draw sets and the bindless array
+// point into the one buffer.
+void my_vk_create_draw_objects(MyVk *m) {
+  MyVkDrawObjects *o = &m->objects;
+  if (m->tex.count == 0) {
+    return;
+  }
+  o->count = std::min(m->opts.draws, (uint32_t)MAX_DRAW_OBJECTS);
+  VkDeviceSize align = m->phys_props.limits.minStorageBufferOffsetAlignment;
+  o->stride = (sizeof(GpuDrawData) + align - 1) / align * align;
+  o->buffer = my_vk_create_buffer(
+      m, o->stride * o->count,
+      VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+      VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+  char *data = (char *)calloc(o->count, o->stride);
+  for (uint32_t i = 0; i < o->count; ++i) {
+    // hues spread by the golden ratio, neighbours never look alike
+    float h = i * 0.618034f;
+    h = 6.2831853f * (h - floorf(h));
+    GpuDrawData d{glm::vec4(0.7f + 0.3f * cosf(h), 0.7f + 0.3f * cosf(h + 2.1f),
+                            0.7f + 0.3f * cosf(h + 4.2f), 1.f)};
+    memcpy(data + i * o->stride, &d, sizeof(d));
+  }
+  my_vk_upload(m, &o->buffer, 0, data, o->stride * o->count);
+  my_vk_flush_uploads(m);
+  free(data);
+
+  VkDescriptorPoolSize poolSize{VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, o->count};
+  VkDescriptorPoolCreateInfo poolInfo{};
+  poolInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+  poolInfo.maxSets = o->count;
+  poolInfo.poolSizeCount = 1;
+  poolInfo.pPoolSizes = &poolSize;
+  if (vkCreateDescriptorPool(m->device, &poolInfo, nullptr,
+                             &o->descriptor_pool) != VK_SUCCESS) {
+    printf("ERROR: could not create object descriptor pool!\n");
+  }
+  MY_VK_TRACK(m, VK_OBJECT_TYPE_DESCRIPTOR_POOL, o->descriptor_pool);
+  VkDescriptorSetLayout layouts[MAX_DRAW_OBJECTS];
+  for (uint32_t i = 0; i < o->count; ++i) {
+    layouts[i] = o->set_layout;
+  }
+  VkDescriptorSetAllocateInfo allocInfo{};
+  allocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+  allocInfo.descriptorPool = o->descriptor_pool;
+  allocInfo.descriptorSetCount = o->count;
+  allocInfo.pSetLayouts = layouts;
+  if (vkAllocateDescriptorSets(m->device, &allocInfo, o->sets) !=
+      VK_SUCCESS) {
+    printf("ERROR: could not allocate object descriptor sets!\n");
+  }
+
+  MyVkBindless *b = &m->bindless;
+  for (uint32_t i = 0; i < o->count; ++i) {
+    VkDescriptorBufferInfo bufferInfo{o->buffer.buffer, i * o->stride,
+                                      sizeof(GpuDrawData)};
+    VkWriteDescriptorSet write{};
+    write.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+    write.dstSet = o->sets[i];
+    write.dstBinding = 0;
+    write.descriptorCount = 1;
+    write.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+    write.pBufferInfo = &bufferInfo;
+    vkUpdateDescriptorSets(m->device, 1, &write, 0, nullptr);
+    o->slots[i] = UINT32_MAX;
+    if (b->set == VK_NULL_HANDLE) {
+      continue;
+    }
+    o->slots[i] = my_vk_slot_alloc(&b->buffers);
+    if (o->slots[i] == UINT32_MAX) {
+      printf("ERROR: out of bindless buffer slots!\n");
+      continue;
+    }
+    write.dstSet = b->set;
+    write.dstBinding = 1;
+    write.dstArrayElement = o->slots[i];
+    vkUpdateDescriptorSets(m->device, 1, &write, 0, nullptr);
+  }
+}
+
+// at exit, once the device is idle
+void my_vk_destroy_draw_objects(MyVk *m) {
+  MyVkDrawObjects *o = &m->objects;
+  if (o->set_layout == VK_NULL_HANDLE) {
+    return;
+  }
+  if (o->count > 0) {
+    my_vk_destroy_object(m, VK_OBJECT_TYPE_DESCRIPTOR_POOL,
+                         (uint64_t)o->descriptor_pool);
+    my_vk_destroy_buffer(m, &o->buffer);
+  }
+  my_vk_destroy_object(m, VK_OBJECT_TYPE_DESCRIPTOR_SET_LAYOUT,
+                       (uint64_t)o->set_layout);
+  o->set_layout = VK_NULL_HANDLE;
+  o->count = 0;
+}
+
+// the one asked for if the device can use it, else the first that works.
+// When the hi-z build samples it, it has to be a sampled image too.
+VkFormat my_vk_pick_depth_format(MyVk *m) {
+  const VkFormat candidates[] = {m->opts.depth_format, VK_FORMAT_D32_SFLOAT,
+                                 VK_FORMAT_X8_D24_UNORM_PACK32,
+                                 VK_FORMAT_D16_UNORM};
+  VkFormatFeatureFlags wanted = VK_FORMAT_FEATURE_DEPTH_STENCIL_ATTACHMENT_BIT;
+  if (my_vk_has_hiz(m)) {
+    wanted |= VK_FORMAT_FEATURE_SAMPLED_IMAGE_BIT;
+  }
+  for (VkFormat format : candidates) {
+    if (format == VK_FORMAT_UNDEFINED) {
+      continue;
+    }
+    VkFormatProperties props;
+    vkGetPhysicalDeviceFormatProperties(m->phys_device, format, &props);
+    if ((props.optimalTilingFeatures & wanted) == wanted) {
+      return format;
+    }
+    if (format == m->opts.depth_format) {
+      printf("depth format %s can't be used here, picking another\n",
+             my_vk_depth_format_name(format));
+    }
+  }
+  printf("ERROR: no usable depth format!\n");
+  return VK_FORMAT_D32_SFLOAT;
+}
+
+// depth format and sample count of the main pass, before the pipelines and
+// render pass are made with them
+void my_vk_pick_attachments(MyVk *m) {
+  MyVkAttachments *a = &m->attach;
+  a->depth_format = VK_FORMAT_UNDEFINED;
+  if (my_vk_has_hiz(m) || m->opts.depth_format != VK_FORMAT_UNDEFINED) {
+    a->depth_format = my_vk_pick_depth_format(m);
+  }
+
+  // the most samples up to the ones asked for that every attachment has
+  const VkPhysicalDeviceLimits *limits = &m->phys_props.limits;
+  VkSampleCountFlags counts = limits->framebufferColorSampleCounts;
+  if (my_vk_has_depth(m)) {
+    counts &= limits->framebufferDepthSampleCounts;
+  }
+  if (my_vk_has_stencil(a->depth_format)) {
+    counts &= limits->framebufferStencilSampleCounts;
+  }
+  a->samples = VK_SAMPLE_COUNT_1_BIT;
+  for (uint32_t n = m->opts.msaa; n > 1; n /= 2) {
+    if (counts & n) {
+      a->samples = (VkSampleCountFlagBits)n;
+      break;
+    }
+  }
+  if ((uint32_t)a->samples != m->opts.msaa) {
+    printf("%ux msaa is not supported, using %ux\n", m->opts.msaa,
+           (uint32_t)a->samples);
+  }
+
+  // the hi-z pyramid keeps the farthest depth, so the farthest sample keeps
+  // the culling conservative. Every 1.2 device can resolve sample 0.
+  a->depth_resolve = VK_RESOLVE_MODE_NONE;
+  if (a->samples > 1 && my_vk_has_hiz(m)) {
+    VkPhysicalDeviceVulkan12Properties props12{};
+    props12.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_2_PROPERTIES;
+    VkPhysicalDeviceProperties2 props{};
+    props.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PROPERTIES_2;
+    props.pNext = &props12;
+    vkGetPhysicalDeviceProperties2(m->phys_device, &props);
+    a->depth_resolve =
+        (props12.supportedDepthResolveModes & VK_RESOLVE_MODE_MAX_BIT)
+            ? VK_RESOLVE_MODE_MAX_BIT
+            : VK_RESOLVE_MODE_SAMPLE_ZERO_BIT;
+    // stencil is resolved from sample 0, depth may differ only if allowed
+    if (my_vk_has_stencil(a->depth_format) && !props12.independentResolve) {
+      a->depth_resolve = VK_RESOLVE_MODE_SAMPLE_ZERO_BIT;
+    }
+  }
+
+  a->lazy_memory = false;
+  for (uint32_t i = 0; i < m->mem_props.memoryTypeCount; ++i) {
+    if (m->mem_props.memoryTypes[i].propertyFlags &
+        VK_MEMORY_PROPERTY_LAZILY_ALLOCATED_BIT) {
+      a->lazy_memory = true;
+    }
+  }
+}
+
+// everything of the culling that doesn't depend on the swapchain size
+void my_vk_create_culling_pipelines(MyVk *m) {
+  MyVkCulling *c = &m->cull;
+
+  VkSamplerCreateInfo samplerInfo{};
+  samplerInfo.sType = VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO;
+  samplerInfo.magFilter = VK_FILTER_NEAREST;
+  samplerInfo.minFilter = VK_FILTER_NEAREST;
+  samplerInfo.mipmapMode = VK_SAMPLER_MIPMAP_MODE_NEAREST;
+  samplerInfo.addressModeU = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+  samplerInfo.addressModeV = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+  samplerInfo.addressModeW = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+  samplerInfo.maxLod = (float)HIZ_MAX_LEVELS;
+  if (vkCreateSampler(m->device, &samplerInfo, nullptr, &c->sampler) !=
+      VK_SUCCESS) {
+    printf("ERROR: could not create hi-z sampler!\n");
+  }
+  MY_VK_TRACK(m, VK_OBJECT_TYPE_SAMPLER, c->sampler);
+
+  VkDescriptorSetLayoutBinding bindings[2]{};
+  bindings[0].binding = 0;
+  bindings[0].descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+  bindings[0].descriptorCount = 1;
+  bindings[0].stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+  bindings[1].binding = 1;
+  bindings[1].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE;
+  bindings[1].descriptorCount = 1;
+  bindings[1].stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+  VkDescriptorSetLayoutCreateInfo setInfo{};
+  setInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+  setInfo.bindingCount = 2;
+  setInfo.pBindings = bindings;
+  if (vkCreateDescriptorSetLayout(m->device, &setInfo, nullptr,
+                                  &c->hiz_set_layout) != VK_SUCCESS) {
+    printf("ERROR: could not create hi-z descriptor set layout!\n");
+  }
+  MY_VK_TRACK(m, VK_OBJECT_TYPE_DESCRIPTOR_SET_LAYOUT, c->hiz_set_layout);
+
+  VkPushConstantRange pushRange{};
+  pushRange.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+  pushRange.offset = 0;
+  pushRange.size = 4 * sizeof(int32_t); // src and dst size
+  VkPipelineLayoutCreateInfo layoutInfo{};
+  layoutInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+  layoutInfo.setLayoutCount = 1;
+  layoutInfo.pSetLayouts = &c->hiz_set_layout;
+  layoutInfo.pushConstantRangeCount = 1;
+  layoutInfo.pPushConstantRanges = &pushRange;
+  if (vkCreatePipelineLayout(m->device, &layoutInfo, nullptr,
+                             &c->hiz_layout) != VK_SUCCESS) {
+    printf("ERROR: failed to create hi-z pipeline layout!\n");
+  }
+  MY_VK_TRACK(m, VK_OBJECT_TYPE_PIPELINE_LAYOUT, c->hiz_layout);
+
+  VkShaderModule module =
+      my_vk_load_shader(m, "hiz_build.comp.spv");
+  c->hiz_pipeline = my_vk_build_compute_pipeline(m, module, c->hiz_layout);
+  MY_VK_TRACK(m, VK_OBJECT_TYPE_PIPELINE, c->hiz_pipeline);
+  vkDestroyShaderModule(m->device, module, nullptr);
+
+  VkDescriptorPoolSize poolSizes[2]{};
+  poolSizes[0].type = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+  poolSizes[0].descriptorCount = HIZ_MAX_LEVELS;
+  poolSizes[1].type = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE;
+  poolSizes[1].descriptorCount = HIZ_MAX_LEVELS;
+  VkDescriptorPoolCreateInfo poolInfo{};
+  poolInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+  poolInfo.maxSets = HIZ_MAX_LEVELS;
+  poolInfo.poolSizeCount = 2;
+  poolInfo.pPoolSizes = poolSizes;
+  if (vkCreateDescriptorPool(m->device, &poolInfo, nullptr,
+                             &c->descriptor_pool) != VK_SUCCESS) {
+    printf("ERROR: could not create hi-z descriptor pool!\n");
+  }
+  MY_VK_TRACK(m, VK_OBJECT_TYPE_DESCRIPTOR_POOL, c->descriptor_pool);
+  VkDescriptorSetLayout layouts[HIZ_MAX_LEVELS];
+  for (uint32_t i = 0; i < HIZ_MAX_LEVELS; ++i) {
+    layouts[i] = c->hiz_set_layout;
+  }
+  VkDescriptorSetAllocateInfo allocInfo{};
+  allocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+  allocInfo.descriptorPool = c->descriptor_pool;
+  allocInfo.descriptorSetCount = HIZ_MAX_LEVELS;
+  allocInfo.pSetLayouts = layouts;
+  if (vkAllocateDescriptorSets(m->device, &allocInfo, c->hiz_sets) !=
+      VK_SUCCESS) {
+    printf("ERROR: could not allocate hi-z descriptor sets!\n");
+  }
+
+  if (m->features.pipelineStatisticsQuery) {
+    VkQueryPoolCreateInfo queryInfo{};
+    queryInfo.sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO;
+    queryInfo.queryType = VK_QUERY_TYPE_PIPELINE_STATISTICS;
+    queryInfo.queryCount = 1;
+    queryInfo.pipelineStatistics =
+        VK_QUERY_PIPELINE_STATISTIC_VERTEX_SHADER_INVOCATIONS_BIT |
+        VK_QUERY_PIPELINE_STATISTIC_FRAGMENT_SHADER_INVOCATIONS_BIT;
+    for (uint32_t i = 0; i < MAX_FRAMES_IN_FLIGHT; ++i) {
+      if (vkCreateQueryPool(m->device, &queryInfo, nullptr,
+                            &c->invocation_pools[i]) != VK_SUCCESS) {
+        printf("ERROR: could not create pipeline statistics query pool!\n");
+      }
+      MY_VK_TRACK(m, VK_OBJECT_TYPE_QUERY_POOL, c->invocation_pools[i]);
+    }
+  }
+}
+
+// the pre-pass sets sample the pyramid, which changes with the swapchain
+void my_vk_write_hiz_descriptors(MyVk *m) {
+  if (m->inst.descriptor_pool == VK_NULL_HANDLE) {
+    return; // not created yet, my_vk_create_instances calls this again
+  }
+  VkDescriptorImageInfo imageInfo{m->cull.sampler, m->cull.hiz_view,
+                                  VK_IMAGE_LAYOUT_GENERAL};
+  VkWriteDescriptorSet writes[MAX_FRAMES_IN_FLIGHT]{};
+  for (uint32_t i = 0; i < MAX_FRAMES_IN_FLIGHT; ++i) {
+    writes[i].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+    writes[i].dstSet = m->inst.prepass_sets[i];
+    writes[i].dstBinding = 4;
+    writes[i].descriptorCount = 1;
+    writes[i].descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+    writes[i].pImageInfo = &imageInfo;
+  }
+  vkUpdateDescriptorSets(m->device, MAX_FRAMES_IN_FLIGHT, writes, 0, nullptr);
+}
+
+// hi-z pyramid, sized like the swapchain. The depth buffer it is built from
+// is a transient of the render graph.
+void my_vk_create_depth_targets(MyVk *m) {
+  MyVkCulling *c = &m->cull;
+  if (!my_vk_has_hiz(m)) {
+    return;
+  }
+  VkImageCreateInfo imageInfo{};
+  imageInfo.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
+  imageInfo.imageType = VK_IMAGE_TYPE_2D;
+  imageInfo.arrayLayers = 1;
+  imageInfo.samples = VK_SAMPLE_COUNT_1_BIT;
+  imageInfo.tiling = VK_IMAGE_TILING_OPTIMAL;
+  imageInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+  imageInfo.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+
+  // level 0 is half the depth buffer, rounded down
+  c->hiz_extent = VkExtent2D{std::max(m->extent.width / 2, 1u),
+                             std::max(m->extent.height / 2, 1u)};
+  c->hiz_levels = 1;
+  while (c->hiz_levels < HIZ_MAX_LEVELS &&
+         (std::max(c->hiz_extent.width, c->hiz_extent.height) >>
+          c->hiz_levels) > 0) {
+    ++c->hiz_levels;
+  }
+  imageInfo.format = VK_FORMAT_R32_SFLOAT;
+  imageInfo.extent = VkExtent3D{c->hiz_extent.width, c->hiz_extent.height, 1};
+  imageInfo.mipLevels = c->hiz_levels;
+  imageInfo.usage = VK_IMAGE_USAGE_STORAGE_BIT | VK_IMAGE_USAGE_SAMPLED_BIT;
+  // built on the graphics queue and sampled by an async compute pre-pass
+  // every frame, sharing it is cheaper than two ownership transfers a frame
+  uint32_t hiz_families[] = {(uint32_t)m->queue_graphics_idx,
+                             (uint32_t)m->queue_compute_idx};
+  if (m->queue_compute_idx != m->queue_graphics_idx) {
+    imageInfo.sharingMode = VK_SHARING_MODE_CONCURRENT;
+    imageInfo.queueFamilyIndexCount = 2;
+    imageInfo.pQueueFamilyIndices = hiz_families;
+  }
+  if (vkCreateImage(m->device, &imageInfo, nullptr, &c->hiz) != VK_SUCCESS) {
+    printf("ERROR: could not create hi-z image!\n");
+  }
+  MY_VK_TRACK(m, VK_OBJECT_TYPE_IMAGE, c->hiz);
+  VkMemoryRequirements reqs;
+  vkGetImageMemoryRequirements(m->device, c->hiz, &reqs);
+  c->hiz_alloc =
+      my_vk_alloc(m, reqs, false, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+  vkBindImageMemory(m->device, c->hiz, c->hiz_alloc.memory,
+                    c->hiz_alloc.offset);
+
+  VkImageViewCreateInfo viewInfo{};
+  viewInfo.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
+  viewInfo.image = c->hiz;
+  viewInfo.viewType = VK_IMAGE_VIEW_TYPE_2D;
+  viewInfo.format = VK_FORMAT_R32_SFLOAT;
+  viewInfo.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+  viewInfo.subresourceRange.layerCount = 1;
+  viewInfo.subresourceRange.levelCount = c->hiz_levels;
+  if (vkCreateImageView(m->device, &viewInfo, nullptr, &c->hiz_view) !=
+      VK_SUCCESS) {
+    printf("ERROR: could not create hi-z image view!\n");
+  }
+  MY_VK_TRACK(m, VK_OBJECT_TYPE_IMAGE_VIEW, c->hiz_view);
+  viewInfo.subresourceRange.levelCount = 1;
+  for (uint32_t i = 0; i < c->hiz_levels; ++i) {
+    viewInfo.subresourceRange.baseMipLevel = i;
+    if (vkCreateImageView(m->device, &viewInfo, nullptr,
+                          &c->hiz_level_views[i]) != VK_SUCCESS) {
+      printf("ERROR: could not create hi-z level view!\n");
+    }
+    MY_VK_TRACK(m, VK_OBJECT_TYPE_IMAGE_VIEW, c->hiz_level_views[i]);
+  }
+  my_vk_write_hiz_descriptors(m);
+  c->hiz_valid = false;
+  c->hiz_undefined = true;
+}
+
+// once the depth buffer exists too
+void my_vk_write_hiz_build_descriptors(MyVk *m) {
+  MyVkCulling *c = &m->cull;
+  // level i is built from level i - 1, level 0 from the depth buffer. The
+  // pyramid stays in GENERAL, it is written and sampled every frame.
+  VkDescriptorImageInfo imageInfos[2 * HIZ_MAX_LEVELS];
+  VkWriteDescriptorSet writes[2 * HIZ_MAX_LEVELS]{};
+  for (uint32_t i = 0; i < c->hiz_levels; ++i) {
+    imageInfos[2 * i] = VkDescriptorImageInfo{
+        c->sampler, i == 0 ? c->depth_view : c->hiz_level_views[i - 1],
+        i == 0 ? VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL
+               : VK_IMAGE_LAYOUT_GENERAL};
+    imageInfos[2 * i + 1] = VkDescriptorImageInfo{
+        VK_NULL_HANDLE, c->hiz_level_views[i], VK_IMAGE_LAYOUT_GENERAL};
+    for (uint32_t b = 0; b < 2; ++b) {
+      VkWriteDescriptorSet *w = &writes[2 * i + b];
+      w->sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+      w->dstSet = c->hiz_sets[i];
+      w->dstBinding = b;
+      w->descriptorCount = 1;
+      w->descriptorType = b == 0 ? VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER
+                                 : VK_DESCRIPTOR_TYPE_STORAGE_IMAGE;
+      w->pImageInfo = &imageInfos[2 * i + b];
+    }
+  }
+  vkUpdateDescriptorSets(m->device, 2 * c->hiz_levels, writes, 0, nullptr);
+}
+
+void my_vk_destroy_depth_targets(MyVk *m) {
+  MyVkCulling *c = &m->cull;
+  if (!my_vk_has_hiz(m)) {
+    return;
+  }
+  for (uint32_t i = 0; i < c->hiz_levels; ++i) {
+    my_vk_destroy_object(m, VK_OBJECT_TYPE_IMAGE_VIEW,
+                         (uint64_t)c->hiz_level_views[i]);
+  }
+  my_vk_destroy_object(m, VK_OBJECT_TYPE_IMAGE_VIEW, (uint64_t)c->hiz_view);
+  my_vk_destroy_object(m, VK_OBJECT_TYPE_IMAGE, (uint64_t)c->hiz);
+  my_vk_free(m, &c->hiz_alloc);
+}
+
+void my_vk_destroy_culling(MyVk *m) {
+  MyVkCulling *c = &m->cull;
+  if (!my_vk_has_hiz(m)) {
+    return;
+  }
+  for (uint32_t i = 0; i < MAX_FRAMES_IN_FLIGHT; ++i) {
+    if (c->invocation_pools[i] != VK_NULL_HANDLE) {
+      my_vk_destroy_object(m, VK_OBJECT_TYPE_QUERY_POOL,
+                           (uint64_t)c->invocation_pools[i]);
+    }
+  }
+  my_vk_destroy_object(m, VK_OBJECT_TYPE_DESCRIPTOR_POOL,
+                       (uint64_t)c->descriptor_pool);
+  my_vk_destroy_object(m, VK_OBJECT_TYPE_PIPELINE, (uint64_t)c->hiz_pipeline);
+  my_vk_destroy_object(m, VK_OBJECT_TYPE_PIPELINE_LAYOUT,
+                       (uint64_t)c->hiz_layout);
+  my_vk_destroy_object(m, VK_OBJECT_TYPE_DESCRIPTOR_SET_LAYOUT,
+                       (uint64_t)c->hiz_set_layout);
+  my_vk_destroy_object(m, VK_OBJECT_TYPE_SAMPLER, (uint64_t)c->sampler);
+}
+
+// moves a new pyramid to GENERAL, which it stays in, before the first frame
+// that uses it. Nothing reads it until it was built once.
+void my_vk_record_hiz_init(MyVk *m, VkCommandBuffer cmd) {
+  MyVkCulling *c = &m->cull;
+  VkImageMemoryBarrier2 barrier{};
+  barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER_2;
+  barrier.srcStageMask = VK_PIPELINE_STAGE_2_NONE;
+  barrier.srcAccessMask = VK_ACCESS_2_NONE;
+  barrier.dstStageMask = VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT;
+  barrier.dstAccessMask =
+      VK_ACCESS_2_SHADER_READ_BIT | VK_ACCESS_2_SHADER_WRITE_BIT;
+  barrier.oldLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+  barrier.newLayout = VK_IMAGE_LAYOUT_GENERAL;
+  barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+  barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+  barrier.image = c->hiz;
+  barrier.subresourceRange = VkImageSubresourceRange{
+      VK_IMAGE_ASPECT_COLOR_BIT, 0, c->hiz_levels, 0, 1};
+  VkDependencyInfo dependency{};
+  dependency.sType = VK_STRUCTURE_TYPE_DEPENDENCY_INFO;
+  dependency.imageMemoryBarrierCount = 1;
+  dependency.pImageMemoryBarriers = &barrier;
+  vkCmdPipelineBarrier2(cmd, &dependency);
+  c->hiz_undefined = false;
+}
+
+// after the main pass: reduce its depth into the pyramid the next frame's
+// pre-pass tests against. The render graph transitions the pyramid first.
+void my_vk_record_hiz_build(MyVk *m, VkCommandBuffer cmd) {
+  MyVkCulling *c = &m->cull;
+  vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, c->hiz_pipeline);
+  int32_t src_w = (int32_t)m->extent.width, src_h = (int32_t)m->extent.height;
+  for (uint32_t i = 0; i < c->hiz_levels; ++i) {
+    int32_t sizes[4] = {src_w, src_h,
+                        std::max((int32_t)c->hiz_extent.width >> i, 1),
+                        std::max((int32_t)c->hiz_extent.height >> i, 1)};
+    vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, c->hiz_layout,
+                            0, 1, &c->hiz_sets[i], 0, nullptr);
+    vkCmdPushConstants(cmd, c->hiz_layout, VK_SHADER_STAGE_COMPUTE_BIT, 0,
+                       sizeof(sizes), sizes);
+    vkCmdDispatch(cmd, (sizes[2] + 7) / 8, (sizes[3] + 7) / 8, 1);
+
+    // the next level reads this one, the graph orders the last one before the
+    // next frame's pre-pass
+    if (i + 1 < c->hiz_levels) {
+      VkMemoryBarrier barrier{};
+      barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+      barrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+      barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+      vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                           VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 1,
+                           &barrier, 0, nullptr, 0, nullptr);
+    }
+    src_w = sizes[2];
+    src_h = sizes[3];
+  }
+  c->hiz_valid = true;
+  c->prev_view = c->view;
+}
+
+// counters of the frame that last used currentFrame's slot, after its fence
+void my_vk_collect_cull_stats(MyVk *m) {
+  MyVkCulling *c = &m->cull;
+  uint32_t frame = m->currentFrame;
+  if (c->stats_pending[frame]) {
+    c->stats_pending[frame] = false;
+    c->last = *(CullStats *)c->stats[frame].alloc.mapped;
+  }
+  if (c->invocations_pending[frame]) {
+    c->invocations_pending[frame] = false;
+    uint64_t invocations[2];
+    if (vkGetQueryPoolResults(m->device, c->invocation_pools[frame], 0, 1,
+                              sizeof(invocations), invocations,
+                              sizeof(invocations),
+                              VK_QUERY_RESULT_64_BIT) == VK_SUCCESS) {
+      c->last_invocations[0] = invocations[0];
+      c->last_invocations[1] = invocations[1];
+    }
+  }
+}
+
+void my_vk_print_cull_stats(MyVk *m) {
+  MyVkCulling *c = &m->cull;
+  printf("instances: %u visible, %u frustum culled, %u occlusion culled",
+         c->last.visible, c->last.frustum_culled, c->last.occlusion_culled);
+  if (c->invocation_pools[0] != VK_NULL_HANDLE) {
+    printf(", %llu vertex / %llu fragment invocations",
+           (unsigned long long)c->last_invocations[0],
+           (unsigned long long)c->last_invocations[1]);
+  }
+  printf("\n");
+}
+
+// slowly pans and zooms over the instance grid so that the culling has work
+void my_vk_update_view(MyVk *m) {
+  float t = (float)my_vk_time();
+  m->cull.view = glm::vec4(0.4f * sin(t * 0.4f), 0.4f * cos(t * 0.3f),
+                           1.5f + 0.5f * sin(t * 0.25f), 0.0f);
+}
+
+// set and pipeline layouts plus the pre-pass pipeline. Runs before
+// my_vk_create_render_pipeline, which also builds the instanced draw pipeline.
+void my_vk_create_instancing_pipelines(MyVk *m) {
+  MyVkInstancing *in = &m->inst;
+  if (m->opts.instances == 0) {
+    return;
+  }
+  // instances, visible, args, cull stats, hi-z
+  VkDescriptorSetLayoutBinding bindings[5]{};
+  for (uint32_t i = 0; i < 5; ++i) {
+    bindings[i].binding = i;
+    bindings[i].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+    bindings[i].descriptorCount = 1;
+    bindings[i].stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+  }
+  bindings[4].descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+  VkDescriptorSetLayoutCreateInfo setInfo{};
+  setInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+  setInfo.bindingCount = 5;
+  setInfo.pBindings = bindings;
+  if (vkCreateDescriptorSetLayout(m->device, &setInfo, nullptr,
+                                  &in->prepass_set_layout) != VK_SUCCESS) {
+    printf("ERROR: could not create pre-pass descriptor set layout!\n");
+  }
+  MY_VK_TRACK(m, VK_OBJECT_TYPE_DESCRIPTOR_SET_LAYOUT, in->prepass_set_layout);
+  bindings[0].stageFlags = VK_SHADER_STAGE_VERTEX_BIT;
+  setInfo.bindingCount = 1;
+  if (vkCreateDescriptorSetLayout(m->device, &setInfo, nullptr,
+                                  &in->draw_set_layout) != VK_SUCCESS) {
+    printf("ERROR: could not create instance descriptor set layout!\n");
+  }
+  MY_VK_TRACK(m, VK_OBJECT_TYPE_DESCRIPTOR_SET_LAYOUT, in->draw_set_layout);
+
+  VkPushConstantRange pushRange{};
+  pushRange.stageFlags = VK_SHADER_STAGE_VERTEX_BIT;
+  pushRange.offset = 0;
+  pushRange.size = sizeof(glm::vec4); // view
+  VkPipelineLayoutCreateInfo layoutInfo{};
+  layoutInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+  layoutInfo.setLayoutCount = 1;
+  layoutInfo.pSetLayouts = &in->draw_set_layout;
+  layoutInfo.pushConstantRangeCount = 1;
+  layoutInfo.pPushConstantRanges = &pushRange;
+  if (vkCreatePipelineLayout(m->device, &layoutInfo, nullptr,
+                             &in->draw_layout) != VK_SUCCESS) {
+    printf("ERROR: failed to create instanced pipeline layout!\n");
+  }
+  MY_VK_TRACK(m, VK_OBJECT_TYPE_PIPELINE_LAYOUT, in->draw_layout);
+  pushRange.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+  pushRange.size = sizeof(CullPush);
+  layoutInfo.pSetLayouts = &in->prepass_set_layout;
+  if (vkCreatePipelineLayout(m->device, &layoutInfo, nullptr,
+                             &in->prepass_layout) != VK_SUCCESS) {
+    printf("ERROR: failed to create pre-pass pipeline layout!\n");
+  }
+  MY_VK_TRACK(m, VK_OBJECT_TYPE_PIPELINE_LAYOUT, in->prepass_layout);
+
+  VkShaderModule module =
+      my_vk_load_shader(m, "instance_prepass.comp.spv");
+  in->prepass_pipeline =
+      my_vk_build_compute_pipeline(m, module, in->prepass_layout);
+  MY_VK_TRACK(m, VK_OBJECT_TYPE_PIPELINE, in->prepass_pipeline);
+  vkDestroyShaderModule(m->device, module, nullptr);
+
+  my_vk_create_culling_pipelines(m);
+}
+
+// count instances in a square grid over the screen, each the mesh scaled down
+// to fit its cell, at random depths. Every 64th one is a big occluder in front
+// so the hi-z culling has something to do.
+void my_vk_fill_instances(MyVk *m, uint32_t count) {
+  MyVkInstancing *in = &m->inst;
+  count = std::min(count, in->capacity);
+  GpuInstance *instances =
+      (GpuInstance *)malloc(sizeof(GpuInstance) * count);
+  uint32_t side = (uint32_t)ceil(sqrt((double)count));
+  float cell = 2.0f / side;
+  for (uint32_t i = 0; i < count; ++i) {
+    uint32_t x = i % side, y = i / side;
+    // cheap hash so neighbours get different tints
+    uint32_t h = i * 2654435761u;
+    bool occluder = i % 64 == 0;
+    instances[i].sphere =
+        glm::vec4(-1.0f + cell * (x + 0.5f), -1.0f + cell * (y + 0.5f),
+                  occluder ? 0.05f : 0.2f + 0.7f * ((h >> 24) / 255.0f),
+                  occluder ? cell * 4.0f : cell * 0.5f);
+    instances[i].color =
+        glm::vec4(0.5f + (h & 0xff) / 510.0f, 0.5f + ((h >> 8) & 0xff) / 510.0f,
+                  0.5f + ((h >> 16) & 0xff) / 510.0f, 1.0f);
+  }
+  my_vk_upload(m, &in->instances, 0, instances, sizeof(GpuInstance) * count);
+  my_vk_flush_uploads(m);
+  free(instances);
+  in->count = count;
+}
+
+// the queue family that reads the instances: the pre-pass's, or graphics
+// for naive draws, whose vertex shader reads them
+uint32_t my_vk_instances_owner(MyVk *m) {
+  MyVkInstancing *in = &m->inst;
+  return (uint32_t)(m->async.enabled && !in->naive ? m->queue_compute_idx
+                                                   : m->queue_graphics_idx);
+}
+
+// uploads the instances again when the family that reads them changed, to
+// release them to it. A release the old family hasn't acquired yet is
+// acquired first, so none is left unmatched. Only with the frames drained.
+void my_vk_hand_over_instances(MyVk *m) {
+  MyVkInstancing *in = &m->inst;
+  uint32_t owner = my_vk_instances_owner(m);
+  if (in->instances.owner == owner) {
+    return;
+  }
+  if (in->instances.owner == (uint32_t)m->queue_compute_idx) {
+    my_vk_submit_acquires(m, m->computeQueue,
+                          m->async.cmds[m->currentFrame],
+                          in->instances.owner);
+  } else {
+    my_vk_submit_acquires(m, m->graphicsQueue,
+                          m->commandBuffers[m->currentFrame],
+                          in->instances.owner);
+  }
+  in->instances.owner = owner;
+  my_vk_fill_instances(m, in->count);
+}
+
+void my_vk_create_instances(MyVk *m) {
+  MyVkInstancing *in = &m->inst;
+  if (m->opts.instances == 0) {
+    return;
+  }
+  in->capacity = m->opts.instances;
+  if (m->opts.bench_instances) {
+    in->capacity = std::max(in->capacity, 100000u);
+  }
+  in->naive = m->opts.naive_instances;
+  VkDeviceSize size = sizeof(GpuInstance) * in->capacity;
+  in->instances = my_vk_create_buffer(
+      m, size,
+      VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+      VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+  in->instances.owner = my_vk_instances_owner(m);
+  for (uint32_t i = 0; i < MAX_FRAMES_IN_FLIGHT; ++i) {
+    in->visible[i] = my_vk_create_buffer(m, size,
+                                         VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+                                         VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+    in->args[i] = my_vk_create_buffer(
+        m, sizeof(DrawArgs),
+        VK_BUFFER_USAGE_STORAGE_BUFFER_BIT |
+            VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT |
+            VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+        VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+    m->cull.stats[i] = my_vk_create_buffer(
+        m, sizeof(CullStats),
+        VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+        VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
+            VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
+  }
+  my_vk_fill_instances(m, m->opts.instances);
+
+  // one naive set, and per frame a draw set and a pre-pass set
+  VkDescriptorPoolSize poolSizes[2]{};
+  poolSizes[0].type = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+  poolSizes[0].descriptorCount = 1 + 5 * MAX_FRAMES_IN_FLIGHT;
+  poolSizes[1].type = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+  poolSizes[1].descriptorCount = MAX_FRAMES_IN_FLIGHT;
+  VkDescriptorPoolCreateInfo poolInfo{};
+  poolInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+  poolInfo.maxSets = 1 + 2 * MAX_FRAMES_IN_FLIGHT;
+  poolInfo.poolSizeCount = 2;
+  poolInfo.pPoolSizes = poolSizes;
+  if (vkCreateDescriptorPool(m->device, &poolInfo, nullptr,
+                             &in->descriptor_pool) != VK_SUCCESS) {
+    printf("ERROR: could not create instancing descriptor pool!\n");
+  }
+  MY_VK_TRACK(m, VK_OBJECT_TYPE_DESCRIPTOR_POOL, in->descriptor_pool);
+  VkDescriptorSetLayout layouts[1 + 2 * MAX_FRAMES_IN_FLIGHT];
+  VkDescriptorSet sets[1 + 2 * MAX_FRAMES_IN_FLIGHT];
+  layouts[0] = in->draw_set_layout;
+  for (uint32_t i = 0; i < MAX_FRAMES_IN_FLIGHT; ++i) {
+    layouts[1 + i] = in->draw_set_layout;
+    layouts[1 + MAX_FRAMES_IN_FLIGHT + i] = in->prepass_set_layout;
+  }
+  VkDescriptorSetAllocateInfo allocInfo{};
+  allocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+  allocInfo.descriptorPool = in->descriptor_pool;
+  allocInfo.descriptorSetCount = 1 + 2 * MAX_FRAMES_IN_FLIGHT;
+  allocInfo.pSetLayouts = layouts;
+  if (vkAllocateDescriptorSets(m->device, &allocInfo, sets) != VK_SUCCESS) {
+    printf("ERROR: could not allocate instancing descriptor sets!\n");
+  }
+  in->naive_set = sets[0];
+  for (uint32_t i = 0; i < MAX_FRAMES_IN_FLIGHT; ++i) {
+    in->draw_sets[i] = sets[1 + i];
+    in->prepass_sets[i] = sets[1 + MAX_FRAMES_IN_FLIGHT + i];
+  }
+
+  VkDescriptorBufferInfo bufferInfos[1 + 5 * MAX_FRAMES_IN_FLIGHT];
+  VkWriteDescriptorSet writes[1 + 5 * MAX_FRAMES_IN_FLIGHT]{};
+  uint32_t write_count = 0;
+  auto write = [&](VkDescriptorSet set, uint32_t binding, MyBuffer *b) {
+    bufferInfos[write_count] = VkDescriptorBufferInfo{b->buffer, 0, b->size};
+    VkWriteDescriptorSet *w = &writes[write_count];
+    w->sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+    w->dstSet = set;
+    w->dstBinding = binding;
+    w->descriptorCount = 1;
+    w->descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+    w->pBufferInfo = &bufferInfos[write_count];
+    ++write_count;
+  };
+  write(in->naive_set, 0, &in->instances);
+  for (uint32_t i = 0; i < MAX_FRAMES_IN_FLIGHT; ++i) {
+    write(in->draw_sets[i], 0, &in->visible[i]);
+    write(in->prepass_sets[i], 0, &in->instances);
+    write(in->prepass_sets[i], 1, &in->visible[i]);
+    write(in->prepass_sets[i], 2, &in->args[i]);
+    write(in->prepass_sets[i], 3, &m->cull.stats[i]);
+  }
+  vkUpdateDescriptorSets(m->device, write_count, writes, 0, nullptr);
+  my_vk_write_hiz_descriptors(m);
+  printf("drawing %u instances (%s)\n", in->count,
+         in->naive ? "naive" : "indirect");
+}
+
+void my_vk_destroy_instancing(MyVk *m) {
+  MyVkInstancing *in = &m->inst;
+  if (m->opts.instances == 0) {
+    return;
+  }
+  my_vk_destroy_object(m, VK_OBJECT_TYPE_DESCRIPTOR_POOL,
+                       (uint64_t)in->descriptor_pool);
+  my_vk_destroy_buffer(m, &in->instances);
+  for (uint32_t i = 0; i < MAX_FRAMES_IN_FLIGHT; ++i) {
+    my_vk_destroy_buffer(m, &in->visible[i]);
+    my_vk_destroy_buffer(m, &in->args[i]);
+    my_vk_destroy_buffer(m, &m->cull.stats[i]);
+  }
+  my_vk_destroy_object(m, VK_OBJECT_TYPE_PIPELINE,
+                       (uint64_t)in->prepass_pipeline);
+  my_vk_destroy_object(m, VK_OBJECT_TYPE_PIPELINE, (uint64_t)in->draw_pipeline);
+  my_vk_destroy_object(m, VK_OBJECT_TYPE_PIPELINE_LAYOUT,
+                       (uint64_t)in->prepass_layout);
+  my_vk_destroy_object(m, VK_OBJECT_TYPE_PIPELINE_LAYOUT,
+                       (uint64_t)in->draw_layout);
+  my_vk_destroy_object(m, VK_OBJECT_TYPE_DESCRIPTOR_SET_LAYOUT,
+                       (uint64_t)in->prepass_set_layout);
+  my_vk_destroy_object(m, VK_OBJECT_TYPE_DESCRIPTOR_SET_LAYOUT,
+                       (uint64_t)in->draw_set_layout);
+}
+
+void my_vk_create_scene(MyVk *m) {
+  MyVkScene *sc = &m->scene;
+  if (m->opts.scene_nodes == 0) {
+    return;
+  }
+  if (!scene_create(&sc->nodes, m->opts.scene_nodes, m->opts.scene_threads,
+                    1)) {
+    return;
+  }
+  VkDeviceSize size = sizeof(glm::mat4) * sc->nodes.count;
+  sc->transforms = my_vk_create_buffer(
+      m, size,
+      VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+      VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+  for (uint32_t i = 0; i < MAX_FRAMES_IN_FLIGHT; ++i) {
+    sc->upload[i] = my_vk_create_buffer(
+        m, size, VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
+        VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
+            VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
+  }
+  printf("scene of %u nodes, %u deep, %s kernel on %u threads\n",
+         sc->nodes.count, sc->nodes.level_count,
+         scene_kernel_name(sc->nodes.kernel), sc->nodes.workers.count);
+}
+
+void my_vk_destroy_scene(MyVk *m) {
+  MyVkScene *sc = &m->scene;
+  if (m->opts.scene_nodes == 0) {
+    return;
+  }
+  scene_destroy(&sc->nodes);
+  my_vk_destroy_buffer(m, &sc->transforms);
+  for (uint32_t i = 0; i < MAX_FRAMES_IN_FLIGHT; ++i) {
+    my_vk_destroy_buffer(m, &sc->upload[i]);
+  }
+}
+
+// Spins the roots a bit, which dirties every node, the worst case, and
+// updates the scene into this frame's upload buffer
+void my_vk_update_scene(MyVk *m) {
+  MyVkScene *sc = &m->scene;
+  Scene *s = &sc->nodes;
+  const float step = 0.01f;
+  glm::mat4 spin(1.0f);
+  spin[0] = glm::vec4(cosf(step), sinf(step), 0.0f, 0.0f);
+  spin[1] = glm::vec4(-sinf(step), cosf(step), 0.0f, 0.0f);
+  for (uint32_t i = 0; i < s->level_start[1]; ++i) {
+    scene_set_local(s, i, spin * s->local[i]);
+  }
+  s->upload = (glm::mat4 *)sc->upload[m->currentFrame].alloc.mapped;
+  scene_update(s);
+  sc->copy_begin = s->changed_begin;
+  sc->copy_end = s->changed_end;
+}
+
+// what the update changed, from the upload buffer into transforms
+void my_vk_record_scene_upload(MyVk *m, VkCommandBuffer cmd) {
+  MyVkScene *sc = &m->scene;
+  VkBufferCopy region{};
+  region.srcOffset = sizeof(glm::mat4) * (VkDeviceSize)sc->copy_begin;
+  region.dstOffset = region.srcOffset;
+  region.size = sizeof(glm::mat4) * (VkDeviceSize)(sc->copy_end -
+                                                   sc->copy_begin);
+  vkCmdCopyBuffer(cmd, sc->upload[m->currentFrame].buffer,
+                  sc->transforms.buffer, 1, &region);
+}
+
+// the stages that read the pre-pass outputs on the graphics queue
+#define PREPASS_CONSUMER_STAGES                                               \
+  (VK_PIPELINE_STAGE_2_DRAW_INDIRECT_BIT |                                     \
+   VK_PIPELINE_STAGE_2_VERTEX_SHADER_BIT)
+
+// outside the render pass: reset this frame's draw and let the pre-pass fill
+// it and the visible buffer. The render graph makes them visible to the draw,
+// and releases them to graphics when this runs on the compute queue.
+void my_vk_record_instance_prepass(MyVk *m, VkCommandBuffer cmd) {
+  MyVkInstancing *in = &m->inst;
+  uint32_t frame = m->currentFrame;
+  DrawArgs args{};
+  args.draw.indexCount = m->index_count;
+  vkCmdUpdateBuffer(cmd, in->args[frame].buffer, 0, sizeof(DrawArgs), &args);
+  vkCmdFillBuffer(cmd, m->cull.stats[frame].buffer, 0, sizeof(CullStats), 0);
+
+  VkMemoryBarrier barrier{};
+  barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+  barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+  barrier.dstAccessMask =
+      VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+  vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_TRANSFER_BIT,
+                       VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 1, &barrier, 0,
+                       nullptr, 0, nullptr);
+
+  vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, in->prepass_pipeline);
+  vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_COMPUTE,
+                          in->prepass_layout, 0, 1, &in->prepass_sets[frame],
+                          0, nullptr);
+  CullPush push{};
+  push.view = m->cull.view;
+  push.prev_view = m->cull.prev_view;
+  push.depth_size =
+      glm::vec2((float)m->extent.width, (float)m->extent.height);
+  push.count = in->count;
+  push.flags = m->opts.cull_flags;
+  // nothing to test against until a pyramid has been built
+  if (!m->cull.hiz_valid) {
+    push.flags &= ~CULL_OCCLUSION;
+  }
+  vkCmdPushConstants(cmd, in->prepass_layout, VK_SHADER_STAGE_COMPUTE_BIT, 0,
+                     sizeof(CullPush), &push);
+  vkCmdDispatch(cmd, (in->count + 63) / 64, 1, 1);
+  m->cull.stats_pending[frame] = true;
+}
+
+void my_vk_create_async_compute(MyVk *m) {
+  MyVkAsyncCompute *a = &m->async;
+  a->enabled = false;
+  if (m->queue_compute_idx == m->queue_graphics_idx) {
+    if (m->opts.async_compute || m->opts.bench_async) {
+      printf("no dedicated compute queue family, the pre-pass stays on the "
+             "graphics queue\n");
+    }
+    return;
+  }
+  VkCommandPoolCreateInfo poolInfo{};
+  poolInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+  poolInfo.flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT;
+  poolInfo.queueFamilyIndex = m->queue_compute_idx;
+  if (vkCreateCommandPool(m->device, &poolInfo, nullptr, &a->pool) !=
+      VK_SUCCESS) {
+    printf("ERROR: could not create compute command pool\n");
+  }
+  MY_VK_TRACK(m, VK_OBJECT_TYPE_COMMAND_POOL, a->pool);
+  VkCommandBufferAllocateInfo allocInfo{};
+  allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+  allocInfo.commandPool = a->pool;
+  allocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+  allocInfo.commandBufferCount = MAX_FRAMES_IN_FLIGHT;
+  if (vkAllocateCommandBuffers(m->device, &allocInfo, a->cmds) != VK_SUCCESS) {
+    printf("ERROR: failed to allocate compute command buffers\n");
+  }
+  VkSemaphoreTypeCreateInfo typeInfo{};
+  typeInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_TYPE_CREATE_INFO;
+  typeInfo.semaphoreType = VK_SEMAPHORE_TYPE_TIMELINE;
+  typeInfo.initialValue = 0;
+  VkSemaphoreCreateInfo semaphoreInfo{};
+  semaphoreInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
+  semaphoreInfo.pNext = &typeInfo;
+  if (vkCreateSemaphore(m->device, &semaphoreInfo, nullptr, &a->timeline) !=
+      VK_SUCCESS) {
+    printf("ERROR: could not create compute timeline semaphore!\n");
+  }
+  MY_VK_TRACK(m, VK_OBJECT_TYPE_SEMAPHORE, a->timeline);
+  a->enabled = m->opts.async_compute;
+}
+
+void my_vk_destroy_async_compute(MyVk *m) {
+  MyVkAsyncCompute *a = &m->async;
+  if (m->queue_compute_idx == m->queue_graphics_idx) {
+    return;
+  }
+  my_vk_destroy_object(m, VK_OBJECT_TYPE_SEMAPHORE, (uint64_t)a->timeline);
+  my_vk_destroy_object(m, VK_OBJECT_TYPE_COMMAND_POOL, (uint64_t)a->pool);
+}
+
+// inside the render pass
+void my_vk_record_instanced(MyVk *m, VkCommandBuffer cmd) {
+  MyVkInstancing *in = &m->inst;
+  uint32_t frame = m->currentFrame;
+  vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, in->draw_pipeline);
+  vkCmdSetViewport(cmd, 0, 1, &m->viewport);
+  vkCmdSetScissor(cmd, 0, 1, &m->scissor);
+  VkDeviceSize vertexOffset = 0;
+  vkCmdBindVertexBuffers(cmd, 0, 1, &m->vertexBuffer.buffer, &vertexOffset);
+  vkCmdBindIndexBuffer(cmd, m->indexBuffer.buffer, 0, VK_INDEX_TYPE_UINT32);
+  vkCmdPushConstants(cmd, in->draw_layout, VK_SHADER_STAGE_VERTEX_BIT, 0,
+                     sizeof(glm::vec4), &m->cull.view);
+
+  if (in->naive) {
+    vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS,
+                            in->draw_layout, 0, 1, &in->naive_set, 0, nullptr);
+    for (uint32_t i = 0; i < in->count; ++i) {
+      vkCmdDrawIndexed(cmd, m->index_count, 1, 0, 0, i);
+    }
+    return;
+  }
+  vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS,
+                          in->draw_layout, 0, 1, &in->draw_sets[frame], 0,
+                          nullptr);
+  if (m->features12.drawIndirectCount) {
+    vkCmdDrawIndexedIndirectCount(cmd, in->args[frame].buffer, 0,
+                                  in->args[frame].buffer,
+                                  offsetof(DrawArgs, draw_count), 1,
+                                  sizeof(DrawArgs));
+  } else {
+    vkCmdDrawIndexedIndirect(cmd, in->args[frame].buffer, 0, 1,
+                             sizeof(DrawArgs));
+  }
+}
+
+void my_vk_create_semaphores(MyVk *m) {
+  // reuse these create info structs
+  VkSemaphoreCreateInfo semaphoreInfo{};
+  semaphoreInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
+
+  for (uint32_t i = 0; i < MAX_FRAMES_IN_FLIGHT; ++i) {
+    if (vkCreateSemaphore(m->device, &semaphoreInfo, nullptr,
+                          &m->imageAvailableSemaphores[i]) != VK_SUCCESS ||
+        vkCreateSemaphore(m->device, &semaphoreInfo, nullptr,
+                          &m->renderFinishedSemaphores[i]) != VK_SUCCESS) {
+      printf("ERROR: could not create semaphores!\n");
+    }
+    MY_VK_TRACK(m, VK_OBJECT_TYPE_SEMAPHORE, m->imageAvailableSemaphores[i]);
+    MY_VK_TRACK(m, VK_OBJECT_TYPE_SEMAPHORE, m->renderFinishedSemaphores[i]);
+    m->slot_frame_number[i] = 0; // the timeline starts out at 0, no wait
+    m->input_time_us[i] = -1.0;
+  }
+
+  // one timeline replaces a fence per frame slot
+  VkSemaphoreTypeCreateInfo typeInfo{};
+  typeInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_TYPE_CREATE_INFO;
+  typeInfo.semaphoreType = VK_SEMAPHORE_TYPE_TIMELINE;
+  typeInfo.initialValue = 0;
+  semaphoreInfo.pNext = &typeInfo;
+  if (vkCreateSemaphore(m->device, &semaphoreInfo, nullptr,
+                        &m->frameTimeline) != VK_SUCCESS) {
+    printf("ERROR: could not create frame timeline semaphore!\n");
+  }
+  MY_VK_TRACK(m, VK_OBJECT_TYPE_SEMAPHORE, m->frameTimeline);
+  m->frame_number = 0;
+  m->frames_in_flight = m->opts.frames_in_flight;
+}
+
+// blocks until the frame that last used the slot has finished on the gpu
+void my_vk_wait_frame_slot(MyVk *m, uint32_t slot) {
+  VkSemaphoreWaitInfo waitInfo{};
+  waitInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_WAIT_INFO;
+  waitInfo.semaphoreCount = 1;
+  waitInfo.pSemaphores = &m->frameTimeline;
+  waitInfo.pValues = &m->slot_frame_number[slot];
+  if (vkWaitSemaphores(m->device, &waitInfo, UINT64_MAX) != VK_SUCCESS) {
+    printf("ERROR: failed waiting on the frame timeline!\n");
+  }
+}
+
+uint32_t my_vk_profiler_scope(MyVk *m, const char *name, bool gpu) {
+  MyVkProfiler *p = &m->profiler;
+  for (uint32_t i = 0; i < p->scope_count; ++i) {
+    if (p->scopes[i].gpu == gpu && strcmp(p->scopes[i].name, name) == 0) {
+      return i;
+    }
+  }
+  if (p->scope_count == PROFILER_MAX_SCOPES) {
+    printf("ERROR: too many profiler scopes, dropping `%s`\n", name);
+    return UINT32_MAX;
+  }
+  ProfilerScope *scope = &p->scopes[p->scope_count];
+  scope->name = name;
+  scope->gpu = gpu;
+  scope->sample_count = 0;
+  scope->next_sample = 0;
+  return p->scope_count++;
+}
+
+void my_vk_profiler_add_sample(MyVk *m, uint32_t scope_idx, double start_us,
+                               double dur_us) {
+  MyVkProfiler *p = &m->profiler;
+  if (scope_idx == UINT32_MAX) {
+    return;
+  }
+  ProfilerScope *scope = &p->scopes[scope_idx];
+  scope->samples[scope->next_sample] = dur_us * 1e-3;
+  scope->next_sample = (scope->next_sample + 1) % PROFILER_WINDOW;
+  if (scope->sample_count < PROFILER_WINDOW) {
+    ++scope->sample_count;
+  }
+  if (p->trace != NULL && p->trace_count < PROFILER_MAX_TRACE_EVENTS) {
+    p->trace[p->trace_count++] =
+        TraceEvent{scope->name, start_us, dur_us, scope->gpu};
+  }
+}
+
+// cpu scopes are measured by the caller: start = my_vk_time() before the work
+void my_vk_profiler_cpu(MyVk *m, const char *name, double start) {
+  double end = my_vk_time();
+  my_vk_profiler_add_sample(m, my_vk_profiler_scope(m, name, false),
+                            start * 1e6, (end - start) * 1e6);
+}
+
+void my_vk_profiler_init(MyVk *m) {
+  MyVkProfiler *p = &m->profiler;
+  p->scope_count = 0;
+  p->open_count = 0;
+  p->gpu_offset_set = false;
+  p->trace = NULL;
+  p->trace_count = 0;
+  if (m->opts.trace_path != NULL) {
+    p->trace = (TraceEvent *)malloc(sizeof(TraceEvent) *
+                                    PROFILER_MAX_TRACE_EVENTS);
+  }
+  for (uint32_t i = 0; i < MAX_FRAMES_IN_FLIGHT; ++i) {
+    p->query_count[i] = 0;
+  }
+
+  // timestamps are only usable if the graphics queue family supports them
+  uint32_t queueFamilyCount = 0;
+  vkGetPhysicalDeviceQueueFamilyProperties(m->phys_device, &queueFamilyCount,
+                                           nullptr);
+  VkQueueFamilyProperties *queueFamilies = (VkQueueFamilyProperties *)alloca(
+      sizeof(VkQueueFamilyProperties) * queueFamilyCount);
+  vkGetPhysicalDeviceQueueFamilyProperties(m->phys_device, &queueFamilyCount,
+                                           queueFamilies);
+  uint32_t valid_bits = queueFamilies[m->queue_graphics_idx].timestampValidBits;
+  p->gpu_supported =
+      valid_bits > 0 && m->phys_props.limits.timestampPeriod > 0.f;
+  if (!p->gpu_supported) {
+    printf("graphics queue has no timestamps, gpu times unavailable\n");
+    return;
+  }
+  p->timestamp_mask = valid_bits >= 64 ? UINT64_MAX : (1ull << valid_bits) - 1;
+  p->ns_per_tick = m->phys_props.limits.timestampPeriod;
+
+  VkQueryPoolCreateInfo poolInfo{};
+  poolInfo.sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO;
+  poolInfo.queryType = VK_QUERY_TYPE_TIMESTAMP;
+  poolInfo.queryCount = 2 * PROFILER_MAX_GPU_SCOPES_PER_FRAME;
+  for (uint32_t i = 0; i < MAX_FRAMES_IN_FLIGHT; ++i) {
+    if (vkCreateQueryPool(m->device, &poolInfo, nullptr, &p->pools[i]) !=
+        VK_SUCCESS) {
+      printf("ERROR: could not create timestamp query pool!\n");
+      p->gpu_supported = false;
+    }
+    MY_VK_TRACK(m, VK_OBJECT_TYPE_QUERY_POOL, p->pools[i]);
+  }
+}
+
+void my_vk_profiler_deinit(MyVk *m) {
+  MyVkProfiler *p = &m->profiler;
+  if (p->gpu_supported) {
+    for (uint32_t i = 0; i < MAX_FRAMES_IN_FLIGHT; ++i) {
+      my_vk_destroy_object(m, VK_OBJECT_TYPE_QUERY_POOL, (uint64_t)p->pools[i]);
+    }
+  }
+  free(p->trace);
+}
+
+// call at the start of a frame's command buffer, outside any render pass
+void my_vk_profiler_begin_frame(MyVk *m, VkCommandBuffer cmd) {
+  MyVkProfiler *p = &m->profiler;
+  p->query_count[m->currentFrame] = 0;
+  p->open_count = 0;
+  if (p->gpu_supported) {
+    vkCmdResetQueryPool(cmd, p->pools[m->currentFrame], 0,
+                        2 * PROFILER_MAX_GPU_SCOPES_PER_FRAME);
+  }
+}
+
+void my_vk_profiler_gpu_begin(MyVk *m, VkCommandBuffer cmd, const char *name) {
+  MyVkProfiler *p = &m->profiler;
+  uint32_t *count = &p->query_count[m->currentFrame];
+  if (!p->gpu_supported || *count == PROFILER_MAX_GPU_SCOPES_PER_FRAME) {
+    return;
+  }
+  p->query_scope[m->currentFrame][*count] = my_vk_profiler_scope(m, name, true);
+  vkCmdWriteTimestamp(cmd, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT,
+                      p->pools[m->currentFrame], 2 * *count);
+  p->open_queries[p->open_count++] = *count;
+  ++*count;
+}
+
+// ends the innermost open gpu scope
+void my_vk_profiler_gpu_end(MyVk *m, VkCommandBuffer cmd) {
+  MyVkProfiler *p = &m->profiler;
+  if (!p->gpu_supported || p->open_count == 0) {
+    return;
+  }
+  uint32_t query = p->open_queries[--p->open_count];
+  vkCmdWriteTimestamp(cmd, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT,
+                      p->pools[m->currentFrame], 2 * query + 1);
+}
+
+// remember when the frame was handed to the queue, to place it on the timeline
+void my_vk_profiler_submitted(MyVk *m) {
+  m->profiler.submit_time_us[m->currentFrame] = my_vk_time() * 1e6;
+}
+
+// read back the scopes of the frame that last used currentFrame's slot.
+// Only call after its timeline value is reached, then the results are all
+// available and this never stalls.
+void my_vk_profiler_collect(MyVk *m) {
+  MyVkProfiler *p = &m->profiler;
+  uint32_t count = p->query_count[m->currentFrame];
+  if (!p->gpu_supported || count == 0) {
+    return;
+  }
+  uint64_t *ticks = (uint64_t *)alloca(sizeof(uint64_t) * 2 * count);
+  if (vkGetQueryPoolResults(m->device, p->pools[m->currentFrame], 0, 2 * count,
+                            sizeof(uint64_t) * 2 * count, ticks,
+                            sizeof(uint64_t),
+                            VK_QUERY_RESULT_64_BIT) != VK_SUCCESS) {
+    return;
+  }
+  p->query_count[m->currentFrame] = 0;
+
+  double first_us = (double)(ticks[0] & p->timestamp_mask) * p->ns_per_tick *
+                    1e-3;
+  double submit_us = p->submit_time_us[m->currentFrame];
+  if (!p->gpu_offset_set || first_us + p->gpu_offset_us < submit_us) {
+    p->gpu_offset_us = submit_us - first_us;
+    p->gpu_offset_set = true;
+  }
+  for (uint32_t i = 0; i < count; ++i) {
+    uint64_t begin = ticks[2 * i] & p->timestamp_mask;
+    uint64_t end = ticks[2 * i + 1] & p->timestamp_mask;
+    double dur_us =
+        (double)((end - begin) & p->timestamp_mask) * p->ns_per_tick * 1e-3;
+    double start_us =
+        (double)begin * p->ns_per_tick * 1e-3 + p->gpu_offset_us;
+    uint32_t scope = p->query_scope[m->currentFrame][i];
+    my_vk_profiler_add_sample(m, scope, start_us, dur_us);
+    if (i == 0) {
+      m->last_gpu_ms = dur_us * 1e-3; // first scope spans the whole frame
+      m->last_gpu_end_us = start_us + dur_us;
+    }
+  }
+}
+
+ProfilerStats my_vk_profiler_stats(MyVk *m, uint32_t scope_idx) {
+  ProfilerScope *scope = &m->profiler.scopes[scope_idx];
+  ProfilerStats stats{};
+  stats.samples = scope->sample_count;
+  if (scope->sample_count == 0) {
+    return stats;
+  }
+  double sorted[PROFILER_WINDOW];
+  double sum = 0.0;
+  for (uint32_t i = 0; i < scope->sample_count; ++i) {
+    sorted[i] = scope->samples[i];
+    sum += sorted[i];
+  }
+  std::sort(sorted, sorted + scope->sample_count);
+  stats.mean = sum / scope->sample_count;
+  stats.p95 = percentile_sorted(sorted, scope->sample_count, 95.0);
+  stats.p99 = percentile_sorted(sorted, scope->sample_count, 99.0);
+  return stats;
+}
+
+void my_vk_profiler_print(MyVk *m) {
+  printf("%-4s %-24s %9s %9s %9s\n", "", "scope", "mean ms", "p95 ms",
+         "p99 ms");
+  for (uint32_t i = 0; i < m->profiler.scope_count; ++i) {
+    ProfilerStats st = my_vk_profiler_stats(m, i);
+    printf("%-4s %-24s %9.3f %9.3f %9.3f\n",
+           m->profiler.scopes[i].gpu ? "gpu" : "cpu",
+           m->profiler.scopes[i].name, st.mean, st.p95, st.p99);
+  }
+}
+
+// per scope stats as the members of a json object, for the benchmark output
+void my_vk_profiler_write_json(MyVk *m, FILE *f) {
+  for (uint32_t i = 0; i < m->profiler.scope_count; ++i) {
+    ProfilerStats st = my_vk_profiler_stats(m, i);
+    fprintf(f,
+            "%s    \"%s %s\": {\"samples\": %u, \"mean\": %.4f, \"p95\": %.4f, "
+            "\"p99\": %.4f}",
+            i == 0 ? "" : ",\n", m->profiler.scopes[i].gpu ? "gpu" : "cpu",
+            m->profiler.scopes[i].name, st.samples, st.mean, st.p95, st.p99);
+  }
+}
+
+// chrome://tracing / perfetto format, cpu and gpu as two threads
+void my_vk_profiler_write_trace(MyVk *m, const char *path) {
+  MyVkProfiler *p = &m->profiler;
+  FILE *f = fopen(path, "w");
+  if (f == NULL) {
+    printf("ERROR: could not open %s for writing!\n", path);
+    return;
+  }
+  fprintf(f, "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [\n");
+  fprintf(f, "{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 0, "
+             "\"tid\": 0, \"args\": {\"name\": \"cpu\"}},\n");
+  fprintf(f, "{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 0, "
+             "\"tid\": 1, \"args\": {\"name\": \"gpu\"}}");
+  for (uint32_t i = 0; i < p->trace_count; ++i) {
+    TraceEvent *e = &p->trace[i];
+    fprintf(f,
+            ",\n{\"name\": \"%s\", \"ph\": \"X\", \"pid\": 0, \"tid\": %d, "
+            "\"ts\": %.3f, \"dur\": %.3f}",
+            e->name, e->gpu ? 1 : 0, e->start_us, e->dur_us);
+  }
+  fprintf(f, "\n]}\n");
+  fclose(f);
+  printf("wrote %u trace events to %s\n", p->trace_count, path);
+  if (p->trace_count == PROFILER_MAX_TRACE_EVENTS) {
+    printf("trace buffer was full, later events are missing\n");
+  }
+}
+
+// Starts the main pass into swapchain image idx. Without a render pass the
+// transitions its attachment descriptions and subpass dependencies did are
+// the render graph's barriers around the pass.
+void my_vk_begin_main_pass(MyVk *m, VkCommandBuffer cmd, uint32_t idx,
+                           bool secondary) {
+  VkClearValue clearValues[2]{};
+  const glm::vec4 &clear = m->frame_data.clear;
+  clearValues[0].color = {{clear.x, clear.y, clear.z, clear.w}};
+  clearValues[1].depthStencil = {1.0f, 0};
+
+  if (!m->dynamic_rendering) {
+    VkRenderPassBeginInfo renderPassInfo{};
+    renderPassInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
+    renderPassInfo.renderPass = m->renderPass;
+    renderPassInfo.framebuffer = m->swapchainFramebuffers[idx];
+    renderPassInfo.renderArea.offset = {0, 0};
+    renderPassInfo.renderArea.extent = m->extent;
+    renderPassInfo.clearValueCount = my_vk_has_depth(m) ? 2 : 1;
+    renderPassInfo.pClearValues = clearValues;
+    vkCmdBeginRenderPass(cmd, &renderPassInfo,
+                         secondary
+                             ? VK_SUBPASS_CONTENTS_SECONDARY_COMMAND_BUFFERS
+                             : VK_SUBPASS_CONTENTS_INLINE);
+    return;
+  }
+
+  // multisampled targets are resolved at the end and never stored, the
+  // depth only is when the hi-z build samples it
+  const MyVkAttachments *at = &m->attach;
+  bool msaa = at->samples > VK_SAMPLE_COUNT_1_BIT;
+  VkRenderingAttachmentInfo color{};
+  color.sType = VK_STRUCTURE_TYPE_RENDERING_ATTACHMENT_INFO;
+  color.imageView = msaa ? at->color_view : m->image_views[idx];
+  color.imageLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
+  color.loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
+  color.storeOp =
+      msaa ? VK_ATTACHMENT_STORE_OP_DONT_CARE : VK_ATTACHMENT_STORE_OP_STORE;
+  color.clearValue = clearValues[0];
+  if (msaa) {
+    color.resolveMode = VK_RESOLVE_MODE_AVERAGE_BIT;
+    color.resolveImageView = m->image_views[idx];
+    color.resolveImageLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
+  }
+  VkRenderingAttachmentInfo depth{};
+  depth.sType = VK_STRUCTURE_TYPE_RENDERING_ATTACHMENT_INFO;
+  depth.imageView = at->depth_view;
+  depth.imageLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
+  depth.loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
+  depth.storeOp = my_vk_has_hiz(m) && !msaa
+                      ? VK_ATTACHMENT_STORE_OP_STORE
+                      : VK_ATTACHMENT_STORE_OP_DONT_CARE;
+  depth.clearValue = clearValues[1];
+  if (at->depth_resolve != VK_RESOLVE_MODE_NONE) {
+    depth.resolveMode = at->depth_resolve;
+    depth.resolveImageView = at->depth_resolve_view;
+    depth.resolveImageLayout =
+        VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
+  }
+  VkRenderingInfo renderingInfo{};
+  renderingInfo.sType = VK_STRUCTURE_TYPE_RENDERING_INFO;
+  renderingInfo.flags =
+      secondary ? VK_RENDERING_CONTENTS_SECONDARY_COMMAND_BUFFERS_BIT : 0;
+  renderingInfo.renderArea.offset = {0, 0};
+  renderingInfo.renderArea.extent = m->extent;
+  renderingInfo.layerCount = 1;
+  renderingInfo.colorAttachmentCount = 1;
+  renderingInfo.pColorAttachments = &color;
+  renderingInfo.pDepthAttachment = my_vk_has_depth(m) ? &depth : nullptr;
+  vkCmdBeginRendering(cmd, &renderingInfo);
+}
+
+void my_vk_end_main_pass(MyVk *m, VkCommandBuffer cmd) {
+  if (!m->dynamic_rendering) {
+    vkCmdEndRenderPass(cmd);
+    return;
+  }
+  vkCmdEndRendering(cmd);
+}
+
+// records draws [first, first + count) of the m->opts.draws the mesh is split
+// into. Binds everything itself, secondary buffers inherit no state.
+void my_vk_record_draws(MyVk *m, VkCommandBuffer cmd, uint32_t first,
+                        uint32_t count) {
+  bool bindless = m->bindless.enabled;
+  VkPipelineLayout layout = bindless ? m->bindless.layout : m->pipelineLayout;
+  vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS,
+                    bindless ? m->bindless.pipeline : m->graphicsPipeline);
+  vkCmdSetViewport(cmd, 0, 1, &m->viewport);
+  vkCmdSetScissor(cmd, 0, 1, &m->scissor);
+  // the frame's uniforms are where this frame put them in its arena
+  vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, layout, 0, 1,
+                          &m->frame_arenas[m->currentFrame].set, 1,
+                          &m->frame_data_offset);
+  MeshPush mesh{glm::vec4(0.0f, 0.0f, 1.0f, 0.0f)};
+  vkCmdPushConstants(cmd, layout, VK_SHADER_STAGE_VERTEX_BIT, 0, sizeof(mesh),
+                     &mesh);
+  if (bindless) {
+    // everything any draw reads, the draws only push indices into it
+    vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS,
+                            m->bindless.layout, 1, 1, &m->bindless.set, 0,
+                            nullptr);
+  }
+
+  VkDeviceSize vertexOffset = 0;
+  vkCmdBindVertexBuffers(cmd, 0, 1, &m->vertexBuffer.buffer, &vertexOffset);
+  vkCmdBindIndexBuffer(cmd, m->indexBuffer.buffer, 0, VK_INDEX_TYPE_UINT32);
+
+  // draws cover consecutive triangles, the last one takes the remainder. With
+  // more draws than triangles they wrap around and overdraw.
+  uint32_t draws = m->opts.draws;
+  uint32_t triangles = m->index_count / 3;
+  uint32_t per_draw = std::max(triangles / draws, 1u);
+  for (uint32_t i = first; i < first + count; ++i) {
+    if (m->tex.count > 0) {
+      // draw i samples texture i % count and uses object i % count
+      MyTexture *t = &m->tex.textures[i % m->tex.count];
+      uint32_t object = i % m->objects.count;
+      if (t->view == VK_NULL_HANDLE) {
+        continue;
+      }
+      if (bindless) {
+        BindlessPush push{t->slot, m->objects.slots[object]};
+        vkCmdPushConstants(cmd, m->bindless.layout,
+                           VK_SHADER_STAGE_FRAGMENT_BIT, sizeof(MeshPush),
+                           sizeof(push), &push);
+      } else {
+        VkDescriptorSet sets[2] = {t->sets[m->currentFrame],
+                                   m->objects.sets[object]};
+        vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS,
+                                m->pipelineLayout, 1, 2, sets, 0, nullptr);
+      }
+    }
+    uint32_t first_triangle = (i * per_draw) % triangles;
+    uint32_t triangle_count = per_draw;
+    if (i == draws - 1 && draws <= triangles) {
+      triangle_count = triangles - first_triangle;
+    }
+    vkCmdDrawIndexed(cmd, 3 * triangle_count, 1, 3 * first_triangle, 0, 0);
+  }
+}
+
+// worker idx records its share of the draws into its secondary buffer
+void my_vk_record_secondary(MyVk *m, uint32_t idx) {
+  MyVkJobs *j = &m->jobs;
+  RecordWorker *w = &j->workers[idx];
+  VkCommandBuffer cmd = w->cmds[j->frame];
+  vkResetCommandPool(m->device, w->pools[j->frame], 0);
+
+  VkCommandBufferInheritanceRenderingInfo rendering{};
+  rendering.sType =
+      VK_STRUCTURE_TYPE_COMMAND_BUFFER_INHERITANCE_RENDERING_INFO;
+  rendering.colorAttachmentCount = 1;
+  rendering.pColorAttachmentFormats = &m->format.format;
+  rendering.depthAttachmentFormat = m->attach.depth_format;
+  rendering.rasterizationSamples = m->attach.samples;
+  VkCommandBufferInheritanceInfo inheritance{};
+  inheritance.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_INHERITANCE_INFO;
+  if (m->dynamic_rendering) {
+    inheritance.pNext = &rendering;
+  } else {
+    inheritance.renderPass = m->renderPass;
+    inheritance.subpass = 0;
+    inheritance.framebuffer = j->framebuffer;
+  }
+  VkCommandBufferBeginInfo beginInfo{};
+  beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+  beginInfo.flags = VK_COMMAND_BUFFER_USAGE_RENDER_PASS_CONTINUE_BIT |
+                    VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+  beginInfo.pInheritanceInfo = &inheritance;
+  if (vkBeginCommandBuffer(cmd, &beginInfo) != VK_SUCCESS) {
+    printf("ERROR: could not begin secondary command buffer\n");
+  }
+  uint32_t first = (uint32_t)((uint64_t)m->opts.draws * idx / j->active);
+  uint32_t end = (uint32_t)((uint64_t)m->opts.draws * (idx + 1) / j->active);
+  my_vk_record_draws(m, cmd, first, end - first);
+  if (vkEndCommandBuffer(cmd) != VK_SUCCESS) {
+    printf("ERROR: failed to end secondary command buffer!\n");
+  }
+}
+
+void my_vk_record_worker(MyVk *m, uint32_t idx) {
+  MyVkJobs *j = &m->jobs;
+  uint64_t seen = 0;
+  for (;;) {
+    {
+      std::unique_lock<std::mutex> lock(j->mutex);
+      j->start_cv.wait(lock,
+                       [&] { return j->quit || j->generation != seen; });
+      if (j->quit) {
+        return;
+      }
+      seen = j->generation;
+    }
+    if (idx < j->active) {
+      my_vk_record_secondary(m, idx);
+    }
+    std::lock_guard<std::mutex> lock(j->mutex);
+    if (--j->remaining == 0) {
+      j->done_cv.notify_one();
+    }
+  }
+}
+
+void my_vk_create_record_jobs(MyVk *m) {
+  MyVkJobs *j = &m->jobs;
+  uint32_t count = m->opts.record_threads;
+  if (m->opts.bench_scaling && count == 0) {
+    count = std::thread::hardware_concurrency();
+  }
+  if (count == 0) {
+    return; // inline recording
+  }
+  count = std::min(count, (uint32_t)MAX_RECORD_THREADS);
+  j->worker_count = count;
+  j->active = count;
+  j->generation = 0;
+  j->quit = false;
+  for (uint32_t i = 0; i < count; ++i) {
+    RecordWorker *w = &j->workers[i];
+    VkCommandPoolCreateInfo poolInfo{};
+    poolInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+    // buffers are rerecorded every frame, reset as a whole pool
+    poolInfo.flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT;
+    poolInfo.queueFamilyIndex = m->queue_graphics_idx;
+    for (uint32_t f = 0; f < MAX_FRAMES_IN_FLIGHT; ++f) {
+      if (vkCreateCommandPool(m->device, &poolInfo, nullptr, &w->pools[f]) !=
+          VK_SUCCESS) {
+        printf("ERROR: could not create record command pool\n");
+      }
+      MY_VK_TRACK(m, VK_OBJECT_TYPE_COMMAND_POOL, w->pools[f]);
+      VkCommandBufferAllocateInfo allocInfo{};
+      allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+      allocInfo.commandPool = w->pools[f];
+      allocInfo.level = VK_COMMAND_BUFFER_LEVEL_SECONDARY;
+      allocInfo.commandBufferCount = 1;
+      if (vkAllocateCommandBuffers(m->device, &allocInfo, &w->cmds[f]) !=
+          VK_SUCCESS) {
+        printf("ERROR: failed to allocate secondary command buffer\n");
+      }
+    }
+    if (i > 0) {
+      w->thread = std::thread(my_vk_record_worker, m, i);
+    }
+  }
+  printf("recording %u draws on %u threads\n", m->opts.draws, count);
+}
+
+void my_vk_destroy_record_jobs(MyVk *m) {
+  MyVkJobs *j = &m->jobs;
+  {
+    std::lock_guard<std::mutex> lock(j->mutex);
+    j->quit = true;
+  }
+  j->start_cv.notify_all();
+  for (uint32_t i = 0; i < j->worker_count; ++i) {
+    RecordWorker *w = &j->workers[i];
+    if (w->thread.joinable()) {
+      w->thread.join();
+    }
+    for (uint32_t f = 0; f < MAX_FRAMES_IN_FLIGHT; ++f) {
+      my_vk_destroy_object(m, VK_OBJECT_TYPE_COMMAND_POOL,
+                           (uint64_t)w->pools[f]);
+    }
+  }
+  j->worker_count = 0;
+}
+
+// records the draws on all active workers, the main thread being worker 0, and
+// executes their secondary buffers in the current render pass
+void my_vk_record_parallel(MyVk *m, VkCommandBuffer primary,
+                           VkFramebuffer framebuffer) {
+  MyVkJobs *j = &m->jobs;
+  {
+    std::lock_guard<std::mutex> lock(j->mutex);
+    j->frame = m->currentFrame;
+    j->framebuffer = framebuffer;
+    j->remaining = j->worker_count - 1;
+    ++j->generation;
+  }
+  j->start_cv.notify_all();
+  my_vk_record_secondary(m, 0);
+  {
+    std::unique_lock<std::mutex> lock(j->mutex);
+    j->done_cv.wait(lock, [&] { return j->remaining == 0; });
+  }
+  VkCommandBuffer cmds[MAX_RECORD_THREADS];
+  for (uint32_t i = 0; i < j->active; ++i) {
+    cmds[i] = j->workers[i].cmds[m->currentFrame];
+  }
+  vkCmdExecuteCommands(primary, j->active, cmds);
+}
+
+#ifdef HOT_RELOAD
+// compiles a glsl file from the source dir, the stage is taken from its
+// extension. Prints the compiler's log and returns VK_NULL_HANDLE on errors.
+VkShaderModule my_vk_compile_shader(MyVk *m, const char *name) {
+  char path[4096];
+  snprintf(path, sizeof(path), "%s/%s", SHADER_SOURCE_DIR, name);
+  long size;
+  char *src = read_whole_file(path, &size);
+  if (src == NULL) {
+    return VK_NULL_HANDLE;
+  }
+  const char *ext = strrchr(name, '.');
+  glslang_input_t input{};
+  input.language = GLSLANG_SOURCE_GLSL;
+  input.stage = strcmp(ext, ".vert") == 0   ? GLSLANG_STAGE_VERTEX
+                : strcmp(ext, ".frag") == 0 ? GLSLANG_STAGE_FRAGMENT
+                                            : GLSLANG_STAGE_COMPUTE;
+  // same target as compile_shaders.sh
+  input.client = GLSLANG_CLIENT_VULKAN;
+  input.client_version = GLSLANG_TARGET_VULKAN_1_3;
+  input.target_language = GLSLANG_TARGET_SPV;
+  input.target_language_version = GLSLANG_TARGET_SPV_1_6;
+  input.code = src;
+  input.default_version = 450;
+  input.default_profile = GLSLANG_NO_PROFILE;
+  input.messages = (glslang_messages_t)(GLSLANG_MSG_SPV_RULES_BIT |
+                                        GLSLANG_MSG_VULKAN_RULES_BIT);
+  input.resource = glslang_default_resource();
+
+  VkShaderModule module = VK_NULL_HANDLE;
+  glslang_shader_t *shader = glslang_shader_create(&input);
+  glslang_program_t *program = glslang_program_create();
+  if (!glslang_shader_preprocess(shader, &input) ||
+      !glslang_shader_parse(shader, &input)) {
+    printf("ERROR: %s does not compile:\n%s\n", name,
+           glslang_shader_get_info_log(shader));
+  } else {
+    glslang_program_add_shader(program, shader);
+    if (!glslang_program_link(program, input.messages)) {
+      printf("ERROR: %s does not link:\n%s\n", name,
+             glslang_program_get_info_log(program));
+    } else {
+      glslang_program_SPIRV_generate(program, input.stage);
+      VkShaderModuleCreateInfo createInfo{};
+      createInfo.sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO;
+      createInfo.codeSize =
+          glslang_program_SPIRV_get_size(program) * sizeof(uint32_t);
+      createInfo.pCode = glslang_program_SPIRV_get_ptr(program);
+      if (vkCreateShaderModule(m->device, &createInfo, nullptr, &module) !=
+          VK_SUCCESS) {
+        printf("ERROR: could not create %s shader module!\n", name);
+        module = VK_NULL_HANDLE;
+      }
+    }
+  }
+  glslang_program_delete(program);
+  glslang_shader_delete(shader);
+  free(src);
+  return module;
+}
+
+// compiles the pipeline's shaders and builds it, then leaves it for the
+// render loop to swap in. On errors the old pipeline just stays.
+void my_vk_rebuild_pipeline(MyVk *m, ReloadPipeline *rp) {
+  double start = my_vk_time();
+  VkShaderModule modules[2] = {VK_NULL_HANDLE, VK_NULL_HANDLE};
+  bool ok = true;
+  for (uint32_t i = 0; i < 2 && rp->shaders[i] != NULL; ++i) {
+    modules[i] = my_vk_compile_shader(m, rp->shaders[i]);
+    ok = ok && modules[i] != VK_NULL_HANDLE;
+  }
+  double compiled = my_vk_time();
+  VkPipeline pipeline = VK_NULL_HANDLE;
+  if (ok && rp->shaders[1] != NULL) {
+    pipeline = my_vk_build_graphics_pipeline(m, modules[0], modules[1],
+                                             rp->layout, rp->instanced);
+  } else if (ok) {
+    pipeline = my_vk_build_compute_pipeline(m, modules[0], rp->layout);
+  }
+  for (uint32_t i = 0; i < 2; ++i) {
+    if (modules[i] != VK_NULL_HANDLE) {
+      vkDestroyShaderModule(m->device, modules[i], nullptr);
+    }
+  }
+  if (pipeline == VK_NULL_HANDLE) {
+    printf("keeping the old %s pipeline\n", rp->shaders[0]);
+    return;
+  }
+  printf("rebuilt the %s pipeline: %.1f ms compiling, %.1f ms building\n",
+         rp->shaders[0], (compiled - start) * 1000.0,
+         (my_vk_time() - compiled) * 1000.0);
+
+  std::lock_guard<std::mutex> lock(m->reload.mutex);
+  if (rp->pending != VK_NULL_HANDLE) {
+    // never handed to a frame, so it was never tracked either
+    vkDestroyPipeline(m->device, rp->pending, nullptr);
+  }
+  rp->pending = pipeline;
+}
+
+// waits for the shader sources to be written and rebuilds every pipeline that
+// uses a changed one
+void my_vk_hot_reload_thread(MyVk *m) {
+  MyVkHotReload *r = &m->reload;
+  glslang_initialize_process();
+  alignas(inotify_event) char buf[4096];
+  for (;;) {
+    {
+      std::lock_guard<std::mutex> lock(r->mutex);
+      if (r->quit) {
+        break;
+      }
+    }
+    // wakes up now and then to see if it should quit
+    pollfd pfd{r->inotify_fd, POLLIN, 0};
+    if (poll(&pfd, 1, 100) <= 0) {
+      continue;
+    }
+    // editors tend to save in several steps, let them finish first
+    std::this_thread::sleep_for(std::chrono::milliseconds(20));
+    bool dirty[MAX_RELOAD_PIPELINES] = {};
+    ssize_t len;
+    while ((len = read(r->inotify_fd, buf, sizeof(buf))) > 0) {
+      for (char *p = buf; p < buf + len;) {
+        inotify_event *e = (inotify_event *)p;
+        for (uint32_t i = 0; i < r->pipeline_count && e->len > 0; ++i) {
+          for (uint32_t s = 0; s < 2; ++s) {
+            const char *shader = r->pipelines[i].shaders[s];
+            if (shader != NULL && strcmp(e->name, shader) == 0) {
+              dirty[i] = true;
+            }
+          }
+        }
+        p += sizeof(inotify_event) + e->len;
+      }
+    }
+    for (uint32_t i = 0; i < r->pipeline_count; ++i) {
+      if (dirty[i]) {
+        my_vk_rebuild_pipeline(m, &r->pipelines[i]);
+      }
+    }
+  }
+  glslang_finalize_process();
+}
+#endif
+
+void my_vk_create_hot_reload(MyVk *m) {
+  MyVkHotReload *r = &m->reload;
+  r->enabled = false;
+  if (!m->opts.hot_reload) {
+    return;
+  }
+#ifndef HOT_RELOAD
+  printf("ERROR: built without the glslang library, no shader hot reload\n");
+#else
+  r->inotify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+  if (r->inotify_fd < 0 ||
+      inotify_add_watch(r->inotify_fd, SHADER_SOURCE_DIR,
+                        IN_CLOSE_WRITE | IN_MOVED_TO) < 0) {
+    printf("ERROR: could not watch %s for shader changes!\n",
+           SHADER_SOURCE_DIR);
+    if (r->inotify_fd >= 0) {
+      close(r->inotify_fd);
+    }
+    return;
+  }
+  r->pipeline_count = 0;
+  if (m->tex.count > 0) {
+    r->pipelines[r->pipeline_count++] =
+        ReloadPipeline{{"textured.vert", "textured.frag"}, m->pipelineLayout,
+                       false, &m->graphicsPipeline, VK_NULL_HANDLE};
+  } else {
+    r->pipelines[r->pipeline_count++] =
+        ReloadPipeline{{"shader.vert", "shader.frag"}, m->pipelineLayout,
+                       false, &m->graphicsPipeline, VK_NULL_HANDLE};
+  }
+  if (m->bindless.pipeline != VK_NULL_HANDLE) {
+    r->pipelines[r->pipeline_count++] =
+        ReloadPipeline{{"textured.vert", "bindless.frag"}, m->bindless.layout,
+                       false, &m->bindless.pipeline, VK_NULL_HANDLE};
+  }
+  if (m->inst.draw_pipeline != VK_NULL_HANDLE) {
+    r->pipelines[r->pipeline_count++] =
+        ReloadPipeline{{"instanced.vert", "shader.frag"}, m->inst.draw_layout,
+                       true, &m->inst.draw_pipeline, VK_NULL_HANDLE};
+  }
+  if (m->inst.prepass_pipeline != VK_NULL_HANDLE) {
+    r->pipelines[r->pipeline_count++] =
+        ReloadPipeline{{"instance_prepass.comp", NULL}, m->inst.prepass_layout,
+                       false, &m->inst.prepass_pipeline, VK_NULL_HANDLE};
+  }
+  if (m->cull.hiz_pipeline != VK_NULL_HANDLE) {
+    r->pipelines[r->pipeline_count++] =
+        ReloadPipeline{{"hiz_build.comp", NULL}, m->cull.hiz_layout, false,
+                       &m->cull.hiz_pipeline, VK_NULL_HANDLE};
+  }
+  r->quit = false;
+  r->reloads = 0;
+  r->enabled = true;
+  r->thread = std::thread(my_vk_hot_reload_thread, m);
+  printf("watching %s for shader changes\n", SHADER_SOURCE_DIR);
+#endif
+}
+
+void my_vk_destroy_hot_reload(MyVk *m) {
+  MyVkHotReload *r = &m->reload;
+  if (!r->enabled) {
+    return;
+  }
+  {
+    std::lock_guard<std::mutex> lock(r->mutex);
+    r->quit = true;
+  }
+  r->thread.join();
+  close(r->inotify_fd);
+  for (uint32_t i = 0; i < r->pipeline_count; ++i) {
+    if (r->pipelines[i].pending != VK_NULL_HANDLE) {
+      vkDestroyPipeline(m->device, r->pipelines[i].pending, nullptr);
+    }
+  }
+  r->enabled = false;
+}
+
+// called at a frame boundary: everything recorded from here on uses the new
+// pipelines, the frames in flight finish with the old ones. Never waits, if
+// the reload thread is busy publishing the swap happens next frame.
+void my_vk_hot_reload_swap(MyVk *m) {
+  MyVkHotReload *r = &m->reload;
+  if (!r->enabled) {
+    return;
+  }
+  std::unique_lock<std::mutex> lock(r->mutex, std::try_to_lock);
+  if (!lock.owns_lock()) {
+    return;
+  }
+  for (uint32_t i = 0; i < r->pipeline_count; ++i) {
+    ReloadPipeline *rp = &r->pipelines[i];
+    if (rp->pending == VK_NULL_HANDLE) {
+      continue;
+    }
+    my_vk_defer_destroy(m, VK_OBJECT_TYPE_PIPELINE, (uint64_t)*rp->live, NULL,
+                        NULL);
+    *rp->live = rp->pending;
+    MY_VK_TRACK(m, VK_OBJECT_TYPE_PIPELINE, *rp->live);
+    rp->pending = VK_NULL_HANDLE;
+    ++r->reloads;
+  }
+}
+
+uint32_t my_vk_graph_resource(MyVk *m, const char *name) {
+  MyVkRenderGraph *g = &m->graph;
+  if (g->resource_count == GRAPH_MAX_RESOURCES) {
+    printf("ERROR: too many render graph resources, dropping `%s`\n", name);
+    return UINT32_MAX;
+  }
+  GraphResource *r = &g->resources[g->resource_count];
+  *r = GraphResource{};
+  r->name = name;
+  r->levels = 1;
+  r->transient = UINT32_MAX;
+  r->owner = GRAPH_QUEUE_NONE;
+  r->first_use = UINT32_MAX;
+  r->last_use = UINT32_MAX;
+  return g->resource_count++;
+}
+
+// an image made outside the graph, in the initial state at the frame's start
+uint32_t my_vk_graph_image(MyVk *m, const char *name, VkImage image,
+                           VkImageAspectFlags aspect, uint32_t levels,
+                           GraphState initial) {
+  uint32_t idx = my_vk_graph_resource(m, name);
+  if (idx != UINT32_MAX) {
+    GraphResource *r = &m->graph.resources[idx];
+    r->image = image;
+    r->aspect = aspect;
+    r->levels = levels;
+    r->initial = initial;
+  }
+  return idx;
+}
+
+// whose contents before the first pass don't matter
+uint32_t my_vk_graph_buffer(MyVk *m, const char *name, VkBuffer buffer) {
+  uint32_t idx = my_vk_graph_resource(m, name);
+  if (idx != UINT32_MAX) {
+    m->graph.resources[idx].buffer = buffer;
+  }
+  return idx;
+}
+
+// an image the graph makes itself, see my_vk_create_transients
+uint32_t my_vk_graph_transient(MyVk *m, const char *name, VkFormat format,
+                               VkImageUsageFlags usage,
+                               VkImageAspectFlags aspect,
+                               VkSampleCountFlagBits samples) {
+  MyVkRenderGraph *g = &m->graph;
+  uint32_t t = 0;
+  while (t < g->transient_count && strcmp(g->transients[t].name, name) != 0) {
+    ++t;
+  }
+  if (t == g->transient_count) {
+    if (t == GRAPH_MAX_TRANSIENTS) {
+      printf("ERROR: too many transients, dropping `%s`\n", name);
+      return UINT32_MAX;
+    }
+    g->transients[t] = GraphTransient{};
+    g->transients[t].name = name;
+    ++g->transient_count;
+  }
+  GraphTransient *tr = &g->transients[t];
+  tr->format = format;
+  tr->usage = usage;
+  tr->aspect = aspect;
+  tr->samples = samples;
+  uint32_t idx = my_vk_graph_image(m, name, tr->image, aspect, 1,
+                                   GraphState{});
+  if (idx != UINT32_MAX) {
+    g->resources[idx].transient = t;
+  }
+  return idx;
+}
+
+void my_vk_graph_output(MyVk *m, uint32_t resource, GraphState final) {
+  if (resource != UINT32_MAX) {
+    m->graph.resources[resource].output = true;
+    m->graph.resources[resource].final = final;
+  }
+}
+
+uint32_t my_vk_graph_pass(MyVk *m, const char *name, uint32_t queue,
+                          void (*record)(MyVk *m, VkCommandBuffer cmd)) {
+  MyVkRenderGraph *g = &m->graph;
+  if (g->pass_count == GRAPH_MAX_PASSES) {
+    printf("ERROR: too many render graph passes, dropping `%s`\n", name);
+    return UINT32_MAX;
+  }
+  GraphPass *p = &g->passes[g->pass_count];
+  *p = GraphPass{};
+  p->name = name;
+  p->queue = queue;
+  p->record = record;
+  return g->pass_count++;
+}
+
+// layout is ignored for buffers. A use that writes replaces the contents, one
+// that only reads needs what the passes before wrote.
+void my_vk_graph_use(MyVk *m, uint32_t pass, uint32_t resource,
+                     VkPipelineStageFlags2 stage, VkAccessFlags2 access,
+                     VkImageLayout layout, bool write) {
+  if (pass == UINT32_MAX || resource == UINT32_MAX) {
+    return;
+  }
+  GraphPass *p = &m->graph.passes[pass];
+  if (p->use_count == GRAPH_MAX_USES) {
+    printf("ERROR: too many uses in render graph pass `%s`\n", p->name);
+    return;
+  }
+  p->uses[p->use_count++] =
+      GraphUse{resource, GraphState{stage, access, layout}, write};
+}
+
+uint32_t my_vk_graph_family(MyVk *m, uint32_t queue) {
+  return (uint32_t)(queue == GRAPH_ASYNC_COMPUTE ? m->queue_compute_idx
+                                                 : m->queue_graphics_idx);
+}
+
+void my_vk_graph_barrier(MyVkRenderGraph *g, uint32_t resource, uint32_t pass,
+                         bool after, GraphState src, GraphState dst,
+                         uint32_t src_queue, uint32_t dst_queue) {
+  if (g->barrier_count == GRAPH_MAX_BARRIERS) {
+    printf("ERROR: too many render graph barriers\n");
+    return;
+  }
+  g->barriers[g->barrier_count++] =
+      GraphBarrier{resource, pass, after, src, dst, src_queue, dst_queue};
+}
+
+// Culls, orders and derives the barriers of the declared frame. Per resource
+// it tracks the last write and the stages that read it since, and only puts a
+// barrier where a layout or queue changes, a write follows reads or another
+// write, or a read comes from a stage the last write isn't visible to yet.
+void my_vk_graph_compile(MyVk *m) {
+  MyVkRenderGraph *g = &m->graph;
+  uint32_t R = g->resource_count;
+
+  // walking back from the outputs, a pass lives if a live pass reads what it
+  // writes. A write replaces what was there, so it needs nothing before it.
+  bool needed[GRAPH_MAX_RESOURCES];
+  for (uint32_t r = 0; r < R; ++r) {
+    needed[r] = g->resources[r].output;
+  }
+  uint32_t live = 0;
+  for (uint32_t p = g->pass_count; p-- > 0;) {
+    GraphPass *pass = &g->passes[p];
+    pass->culled = true;
+    for (uint32_t u = 0; u < pass->use_count; ++u) {
+      if (pass->uses[u].write && needed[pass->uses[u].resource]) {
+        pass->culled = false;
+      }
+    }
+    if (pass->culled) {
+      continue;
+    }
+    ++live;
+    for (uint32_t u = 0; u < pass->use_count; ++u) {
+      needed[pass->uses[u].resource] = !pass->uses[u].write;
+    }
+  }
+
+  // a pass runs after the earlier ones it shares a resource with, unless both
+  // only read it. Of the passes that could go next the async compute ones go
+  // first, so the graphics work that doesn't need them overlaps with them.
+  uint32_t deps[GRAPH_MAX_PASSES] = {};
+  for (uint32_t j = 0; j < g->pass_count; ++j) {
+    GraphPass *b = &g->passes[j];
+    for (uint32_t i = 0; i < j && !b->culled; ++i) {
+      GraphPass *a = &g->passes[i];
+      for (uint32_t u = 0; u < a->use_count && !a->culled; ++u) {
+        for (uint32_t v = 0; v < b->use_count; ++v) {
+          if (a->uses[u].resource == b->uses[v].resource &&
+              (a->uses[u].write || b->uses[v].write)) {
+            deps[j] |= 1u << i;
+          }
+        }
+      }
+    }
+  }
+  uint32_t done = 0;
+  g->order_count = 0;
+  while (g->order_count < live) {
+    uint32_t pick = UINT32_MAX;
+    for (uint32_t p = 0; p < g->pass_count; ++p) {
+      if (g->passes[p].culled || (done >> p & 1) || (deps[p] & ~done) != 0) {
+        continue;
+      }
+      if (pick == UINT32_MAX ||
+          (g->passes[p].queue == GRAPH_ASYNC_COMPUTE &&
+           g->passes[pick].queue != GRAPH_ASYNC_COMPUTE)) {
+        pick = p;
+      }
+    }
+    done |= 1u << pick;
+    g->order[g->order_count++] = pick;
+  }
+
+  // lifetimes, an async compute pass may run alongside any graphics one
+  GraphState last[GRAPH_MAX_RESOURCES] = {};
+  for (uint32_t r = 0; r < R; ++r) {
+    g->resources[r].first_use = UINT32_MAX;
+    g->resources[r].last_use = UINT32_MAX;
+  }
+  for (uint32_t i = 0; i < g->order_count; ++i) {
+    GraphPass *pass = &g->passes[g->order[i]];
+    bool async = pass->queue == GRAPH_ASYNC_COMPUTE;
+    for (uint32_t u = 0; u < pass->use_count; ++u) {
+      GraphResource *r = &g->resources[pass->uses[u].resource];
+      uint32_t first = async ? 0 : i, end = async ? g->order_count - 1 : i;
+      r->first_use = std::min(r->first_use, first);
+      r->last_use =
+          r->last_use == UINT32_MAX ? end : std::max(r->last_use, end);
+      last[pass->uses[u].resource] = pass->uses[u].state;
+    }
+  }
+
+  // a transient starts out undefined, once the last passes that used its
+  // memory, in this frame or the one before, are done with it
+  for (uint32_t r = 0; r < R; ++r) {
+    if (g->resources[r].transient == UINT32_MAX) {
+      continue;
+    }
+    GraphTransient *t = &g->transients[g->resources[r].transient];
+    GraphState *initial = &g->resources[r].initial;
+    *initial = GraphState{};
+    for (uint32_t o = 0; o < R; ++o) {
+      if (g->resources[o].transient == UINT32_MAX) {
+        continue;
+      }
+      GraphTransient *other = &g->transients[g->resources[o].transient];
+      if (o == r || (t->offset < other->offset + other->size &&
+                     other->offset < t->offset + t->size)) {
+        initial->stage |= last[o].stage;
+        initial->access |= last[o].access & GRAPH_WRITE_ACCESS;
+      }
+    }
+  }
+
+  GraphState state[GRAPH_MAX_RESOURCES];
+  VkPipelineStageFlags2 readers[GRAPH_MAX_RESOURCES];
+  VkPipelineStageFlags2 visible_stages[GRAPH_MAX_RESOURCES];
+  VkAccessFlags2 visible_access[GRAPH_MAX_RESOURCES];
+  uint32_t queue[GRAPH_MAX_RESOURCES], last_pass[GRAPH_MAX_RESOURCES];
+  for (uint32_t r = 0; r < R; ++r) {
+    state[r] = g->resources[r].initial;
+    readers[r] = visible_stages[r] = 0;
+    visible_access[r] = 0;
+    queue[r] = g->resources[r].owner;
+    last_pass[r] = UINT32_MAX;
+  }
+  g->barrier_count = 0;
+  for (uint32_t i = 0; i < g->order_count; ++i) {
+    uint32_t p = g->order[i];
+    GraphPass *pass = &g->passes[p];
+    for (uint32_t u = 0; u < pass->use_count; ++u) {
+      GraphUse *use = &pass->uses[u];
+      uint32_t r = use->resource;
+      GraphResource *res = &g->resources[r];
+      GraphState *s = &state[r];
+      bool image = res->aspect != 0;
+      GraphState src{s->stage | readers[r], s->access, s->layout};
+      GraphState dst = use->state;
+      if (!image) {
+        src.layout = dst.layout = VK_IMAGE_LAYOUT_UNDEFINED;
+      }
+      bool transfer = !res->concurrent && queue[r] != GRAPH_QUEUE_NONE &&
+                      queue[r] != pass->queue &&
+                      my_vk_graph_family(m, queue[r]) !=
+                          my_vk_graph_family(m, pass->queue);
+      if (image && pass->own_layouts) {
+        // the render pass does it
+      } else if (transfer) {
+        // released after the last pass on the old queue, acquired here
+        my_vk_graph_barrier(g, r, last_pass[r], true, src,
+                            GraphState{0, 0, dst.layout}, queue[r],
+                            pass->queue);
+        my_vk_graph_barrier(g, r, p, false, GraphState{0, 0, src.layout}, dst,
+                            queue[r], pass->queue);
+      } else if (src.layout != dst.layout) {
+        my_vk_graph_barrier(g, r, p, false, src, dst, pass->queue,
+                            pass->queue);
+      } else if (use->write) {
+        if (readers[r] != 0) {
+          // only has to wait for the reads, nothing to make visible
+          src.stage = readers[r];
+          src.access = 0;
+          my_vk_graph_barrier(g, r, p, false, src, dst, pass->queue,
+                              pass->queue);
+        } else if (s->access != 0) {
+          my_vk_graph_barrier(g, r, p, false, src, dst, pass->queue,
+                              pass->queue);
+        }
+      } else if (s->access != 0 &&
+                 ((dst.stage & ~visible_stages[r]) != 0 ||
+                  (dst.access & ~visible_access[r]) != 0)) {
+        my_vk_graph_barrier(g, r, p, false, src, dst, pass->queue,
+                            pass->queue);
+      }
+
+      if (use->write) {
+        *s = dst;
+        s->access &= GRAPH_WRITE_ACCESS;
+        readers[r] = visible_stages[r] = 0;
+        visible_access[r] = 0;
+        if (image && pass->own_layouts) {
+          // its subpass dependencies make the writes visible to what follows
+          s->access = 0;
+          readers[r] = dst.stage;
+        }
+      } else {
+        readers[r] |= dst.stage;
+        visible_stages[r] |= dst.stage;
+        visible_access[r] |= dst.access;
+        s->layout = dst.layout;
+      }
+      queue[r] = pass->queue;
+      last_pass[r] = p;
+    }
+  }
+
+  // outputs end up in their final state after the last pass that used them
+  for (uint32_t r = 0; r < R; ++r) {
+    GraphResource *res = &g->resources[r];
+    if (!res->output || last_pass[r] == UINT32_MAX) {
+      continue;
+    }
+    GraphState *s = &state[r];
+    GraphState *f = &res->final;
+    bool relayout = res->aspect != 0 &&
+                    f->layout != VK_IMAGE_LAYOUT_UNDEFINED &&
+                    f->layout != s->layout;
+    bool visible = f->access == 0 || s->access == 0 ||
+                   ((f->stage & ~visible_stages[r]) == 0 &&
+                    (f->access & ~visible_access[r]) == 0);
+    if (relayout || !visible) {
+      GraphState src{s->stage | readers[r], s->access, s->layout};
+      GraphState dst{f->stage, f->access, relayout ? f->layout : s->layout};
+      if (res->aspect == 0) {
+        src.layout = dst.layout = VK_IMAGE_LAYOUT_UNDEFINED;
+      }
+      my_vk_graph_barrier(g, r, last_pass[r], true, src, dst, queue[r],
+                          queue[r]);
+    }
+  }
+}
+
+// the compiled barriers before or after a pass, as one dependency
+void my_vk_graph_record_barriers(MyVk *m, VkCommandBuffer cmd, uint32_t pass,
+                                 bool after) {
+  MyVkRenderGraph *g = &m->graph;
+  VkImageMemoryBarrier2 images[GRAPH_MAX_RESOURCES];
+  VkBufferMemoryBarrier2 buffers[GRAPH_MAX_RESOURCES];
+  uint32_t image_count = 0, buffer_count = 0;
+  for (uint32_t i = 0; i < g->barrier_count; ++i) {
+    GraphBarrier *b = &g->barriers[i];
+    if (b->pass != pass || b->after != after) {
+      continue;
+    }
+    GraphResource *r = &g->resources[b->resource];
+    uint32_t src_family = VK_QUEUE_FAMILY_IGNORED;
+    uint32_t dst_family = VK_QUEUE_FAMILY_IGNORED;
+    if (b->src_queue != b->dst_queue) {
+      src_family = my_vk_graph_family(m, b->src_queue);
+      dst_family = my_vk_graph_family(m, b->dst_queue);
+    }
+    if (r->aspect != 0) {
+      VkImageMemoryBarrier2 *ib = &images[image_count++];
+      *ib = VkImageMemoryBarrier2{};
+      ib->sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER_2;
+      ib->srcStageMask = b->src.stage;
+      ib->srcAccessMask = b->src.access;
+      ib->dstStageMask = b->dst.stage;
+      ib->dstAccessMask = b->dst.access;
+      ib->oldLayout = b->src.layout;
+      ib->newLayout = b->dst.layout;
+      ib->srcQueueFamilyIndex = src_family;
+      ib->dstQueueFamilyIndex = dst_family;
+      ib->image = r->image;
+      ib->subresourceRange = {r->aspect, 0, r->levels, 0, 1};
+    } else {
+      VkBufferMemoryBarrier2 *bb = &buffers[buffer_count++];
+      *bb = VkBufferMemoryBarrier2{};
+      bb->sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER_2;
+      bb->srcStageMask = b->src.stage;
+      bb->srcAccessMask = b->src.access;
+      bb->dstStageMask = b->dst.stage;
+      bb->dstAccessMask = b->dst.access;
+      bb->srcQueueFamilyIndex = src_family;
+      bb->dstQueueFamilyIndex = dst_family;
+      bb->buffer = r->buffer;
+      bb->offset = 0;
+      bb->size = VK_WHOLE_SIZE;
+    }
+  }
+  if (image_count + buffer_count == 0) {
+    return;
+  }
+  VkDependencyInfo dependency{};
+  dependency.sType = VK_STRUCTURE_TYPE_DEPENDENCY_INFO;
+  dependency.imageMemoryBarrierCount = image_count;
+  dependency.pImageMemoryBarriers = images;
+  dependency.bufferMemoryBarrierCount = buffer_count;
+  dependency.pBufferMemoryBarriers = buffers;
+  vkCmdPipelineBarrier2(cmd, &dependency);
+}
+
+// records the compiled passes of one queue, each in a gpu scope of its name.
+// Waiting for the other queue is up to the submits.
+void my_vk_graph_execute(MyVk *m, VkCommandBuffer cmd, uint32_t queue) {
+  MyVkRenderGraph *g = &m->graph;
+  for (uint32_t i = 0; i < g->order_count; ++i) {
+    uint32_t p = g->order[i];
+    GraphPass *pass = &g->passes[p];
+    if (pass->queue != queue) {
+      continue;
+    }
+    // no timestamps on the compute queue
+    if (queue == GRAPH_GRAPHICS) {
+      my_vk_profiler_gpu_begin(m, cmd, pass->name);
+    }
+    my_vk_graph_record_barriers(m, cmd, p, false);
+    pass->record(m, cmd);
+    my_vk_graph_record_barriers(m, cmd, p, true);
+    if (queue == GRAPH_GRAPHICS) {
+      my_vk_profiler_gpu_end(m, cmd);
+    }
+  }
+}
+
+const char *my_vk_graph_queue_name(uint32_t queue) {
+  return queue == GRAPH_ASYNC_COMPUTE ? "async compute" : "graphics";
+}
+
+const char *my_vk_layout_name(VkImageLayout layout) {
+  switch (layout) {
+  case VK_IMAGE_LAYOUT_UNDEFINED:
+    return "undefined";
+  case VK_IMAGE_LAYOUT_GENERAL:
+    return "general";
+  case VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL:
+    return "color attachment";
+  case VK_IMAGE_LAYOUT_DEPTH_ATTACHMENT_OPTIMAL:
+  case VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL:
+    return "depth attachment";
+  case VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL:
+    return "shader read only";
+  case VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL:
+    return "transfer src";
+  case VK_IMAGE_LAYOUT_PRESENT_SRC_KHR:
+    return "present src";
+  default:
+    return "other";
+  }
+}
+
+void my_vk_graph_dump_barriers(MyVk *m, uint32_t pass, bool after) {
+  MyVkRenderGraph *g = &m->graph;
+  for (uint32_t i = 0; i < g->barrier_count; ++i) {
+    GraphBarrier *b = &g->barriers[i];
+    if (b->pass != pass || b->after != after) {
+      continue;
+    }
+    GraphResource *r = &g->resources[b->resource];
+    printf("      %s %-9s stages 0x%llx -> 0x%llx", after ? "after " : "before",
+           r->name, (unsigned long long)b->src.stage,
+           (unsigned long long)b->dst.stage);
+    if (r->aspect != 0 && b->src.layout != b->dst.layout) {
+      printf(", %s -> %s", my_vk_layout_name(b->src.layout),
+             my_vk_layout_name(b->dst.layout));
+    }
+    if (b->src_queue != b->dst_queue) {
+      printf(", %s from %s to %s", after ? "released" : "acquired",
+             my_vk_graph_queue_name(b->src_queue),
+             my_vk_graph_queue_name(b->dst_queue));
+    }
+    printf("\n");
+  }
+}
+
+// --dump-graph: the compiled frame and what its transients take
+void my_vk_graph_dump(MyVk *m) {
+  MyVkRenderGraph *g = &m->graph;
+  printf("render graph: %u passes, %u culled, %u barriers\n", g->order_count,
+         g->pass_count - g->order_count, g->barrier_count);
+  for (uint32_t i = 0; i < g->order_count; ++i) {
+    uint32_t p = g->order[i];
+    printf("  %u %-18s on %s\n", i, g->passes[p].name,
+           my_vk_graph_queue_name(g->passes[p].queue));
+    my_vk_graph_dump_barriers(m, p, false);
+    my_vk_graph_dump_barriers(m, p, true);
+  }
+  for (uint32_t p = 0; p < g->pass_count; ++p) {
+    if (g->passes[p].culled) {
+      printf("  culled %s, nothing reads what it writes\n", g->passes[p].name);
+    }
+  }
+  for (uint32_t t = 0; t < g->transient_count; ++t) {
+    GraphTransient *tr = &g->transients[t];
+    if (tr->image == VK_NULL_HANDLE) {
+      continue;
+    }
+    if (tr->lazy_alloc.memory != VK_NULL_HANDLE) {
+      printf("  transient %-10s %8.2f MiB lazily allocated, %ux, pass %u\n",
+             tr->name, tr->size / (1024.0 * 1024.0), (uint32_t)tr->samples,
+             tr->first_use);
+      continue;
+    }
+    printf("  transient %-10s %8.2f MiB at %8.2f MiB, %ux, passes %u..%u\n",
+           tr->name, tr->size / (1024.0 * 1024.0),
+           tr->offset / (1024.0 * 1024.0), (uint32_t)tr->samples,
+           tr->first_use, tr->last_use);
+  }
+  printf("  transient memory: %.2f MiB peak, %.2f MiB without aliasing, "
+         "%.2f MiB lazily allocated\n",
+         g->transient_peak / (1024.0 * 1024.0),
+         g->transient_total / (1024.0 * 1024.0),
+         m->attach.lazy_bytes / (1024.0 * 1024.0));
+}
+
+// the main pass into the frame's swapchain image, inline or on the workers
+void my_vk_record_main_pass(MyVk *m, VkCommandBuffer cmd) {
+  uint32_t idx = m->graph.image_index;
+  VkQueryPool invocations = m->cull.invocation_pools[m->currentFrame];
+  if (invocations != VK_NULL_HANDLE) {
+    vkCmdBeginQuery(cmd, invocations, 0, 0);
+    m->cull.invocations_pending[m->currentFrame] = true;
+  }
+  if (m->jobs.worker_count > 0) {
+    my_vk_begin_main_pass(m, cmd, idx, true);
+    my_vk_record_parallel(m, cmd,
+                          m->dynamic_rendering
+                              ? VK_NULL_HANDLE
+                              : m->swapchainFramebuffers[idx]);
+  } else {
+    my_vk_begin_main_pass(m, cmd, idx, false);
+    if (m->inst.count > 0) {
+      my_vk_record_instanced(m, cmd);
+    } else {
+      my_vk_record_draws(m, cmd, 0, m->opts.draws);
+    }
+  }
+  my_vk_end_main_pass(m, cmd);
+  if (invocations != VK_NULL_HANDLE) {
+    vkCmdEndQuery(cmd, invocations, 0);
+  }
+}
+
+// the consumer of --readback: appends the frame's pixels to the file or pipe
+void my_vk_write_readback(MyVk *m, const ReadbackFrame *frame) {
+  MyVkReadback *r = &m->readback;
+  if (r->out == NULL) {
+    return;
+  }
+  size_t size = (size_t)frame->width * frame->height * 4;
+  if (fwrite(frame->pixels, 1, size, r->out) != size) {
+    // most likely the reader of the pipe went away
+    printf("ERROR: could not write readback frame to %s, stopping\n",
+           m->opts.readback_path);
+    fclose(r->out);
+    r->out = NULL;
+  }
+}
+
+// the consumer of --bench-readback without a path: reads every pixel once,
+// the least any real consumer does
+void my_vk_checksum_readback(MyVk *m, const ReadbackFrame *frame) {
+  const uint64_t *words = (const uint64_t *)frame->pixels;
+  size_t count = (size_t)frame->width * frame->height / 2;
+  uint64_t sum = 0;
+  for (size_t i = 0; i < count; ++i) {
+    sum += words[i];
+  }
+  m->readback.checksum += sum;
+}
+
+void my_vk_readback_thread(MyVk *m) {
+  MyVkReadback *r = &m->readback;
+  // a fifo only opens once it has a reader, until then frames are dropped
+  if (m->opts.readback_path != NULL) {
+    r->out = fopen(m->opts.readback_path, "wb");
+    if (r->out == NULL) {
+      printf("ERROR: could not open %s for readback!\n",
+             m->opts.readback_path);
+    }
+  }
+  uint32_t next = 0;
+  std::unique_lock<std::mutex> lock(r->mutex);
+  while (true) {
+    ReadbackSlot *slot = &r->slots[next];
+    r->cv.wait(lock, [&] {
+      return r->quit || slot->state == READBACK_CONSUMING;
+    });
+    if (slot->state != READBACK_CONSUMING) {
+      break; // quit with nothing left to consume
+    }
+    ReadbackFrame frame{slot->buffer.alloc.mapped, slot->width, slot->height,
+                        m->format.format, slot->number};
+    lock.unlock();
+    r->consume(m, &frame);
+    double now = my_vk_time();
+    lock.lock();
+
+    double latency_ms = (now - slot->record_s) * 1000.0;
+    ++r->frames;
+    r->bytes += (uint64_t)slot->width * slot->height * 4;
+    r->latency_frames_sum += slot->latency_frames;
+    r->latency_ms_sum += latency_ms;
+    r->last_s = now;
+    if (r->sample_count < r->sample_capacity) {
+      r->latency_frames[r->sample_count] = slot->latency_frames;
+      r->latency_ms[r->sample_count++] = latency_ms;
+    }
+    slot->state = READBACK_FREE;
+    next = (next + 1) % READBACK_SLOTS;
+    r->cv.notify_all();
+  }
+  if (r->out != NULL) {
+    fclose(r->out);
+    r->out = NULL;
+  }
+}
+
+// Starts the consumer thread. The slot buffers are created the first time
+// a frame is copied into them, and again when the extent outgrows them.
+void my_vk_create_readback(MyVk *m) {
+  MyVkReadback *r = &m->readback;
+  r->current = UINT32_MAX;
+  r->enabled = false;
+  if (m->opts.readback_path == NULL && !m->opts.bench_readback) {
+    return;
+  }
+  if (!m->opts.headless && !(m->capabilites.supportedUsageFlags &
+                             VK_IMAGE_USAGE_TRANSFER_SRC_BIT)) {
+    printf("ERROR: swapchain images can't be copied from, no readback\n");
+    return;
+  }
+  // the copies are tightly packed 4 byte pixels
+  switch (m->format.format) {
+  case VK_FORMAT_B8G8R8A8_SRGB:
+  case VK_FORMAT_B8G8R8A8_UNORM:
+  case VK_FORMAT_R8G8B8A8_SRGB:
+  case VK_FORMAT_R8G8B8A8_UNORM:
+  case VK_FORMAT_A2R10G10B10_UNORM_PACK32:
+  case VK_FORMAT_A2B10G10R10_UNORM_PACK32:
+    break;
+  default:
+    printf("ERROR: no readback of swapchain format %d\n", m->format.format);
+    return;
+  }
+  r->consume = my_vk_checksum_readback;
+  if (m->opts.readback_path != NULL) {
+    // a reader that goes away should end the writes, not the process
+    signal(SIGPIPE, SIG_IGN);
+    r->consume = my_vk_write_readback;
+  }
+  r->next = 0;
+  r->copied = 0;
+  r->quit = false;
+  r->reset_s = my_vk_time();
+  r->last_s = r->reset_s;
+  r->enabled = true;
+  r->thread = std::thread(my_vk_readback_thread, m);
+  printf("reading back frames into %d slots%s%s\n", READBACK_SLOTS,
+         m->opts.readback_path != NULL ? ", writing them to " : "",
+         m->opts.readback_path != NULL ? m->opts.readback_path : "");
+}
+
+// Hands the slots whose frames the gpu has finished to the consumer thread,
+// oldest first. Never waits.
+void my_vk_collect_readbacks(MyVk *m) {
+  MyVkReadback *r = &m->readback;
+  if (!r->enabled) {
+    return;
+  }
+  uint64_t done = 0;
+  vkGetSemaphoreCounterValue(m->device, m->frameTimeline, &done);
+  bool handed = false;
+  std::lock_guard<std::mutex> lock(r->mutex);
+  while (r->slots[r->copied].state == READBACK_COPYING &&
+         r->slots[r->copied].number <= done) {
+    ReadbackSlot *slot = &r->slots[r->copied];
+    const MyAllocation *a = &slot->buffer.alloc;
+    VkMemoryPropertyFlags flags =
+        m->mem_props.memoryTypes[a->type].propertyFlags;
+    if (!(flags & VK_MEMORY_PROPERTY_HOST_COHERENT_BIT)) {
+      // cached memory often isn't coherent, the copy has to be invalidated
+      // into the host's caches. Blocks are split into powers of two, so
+      // rounding to the atom stays inside the buddy.
+      VkDeviceSize atom = m->phys_props.limits.nonCoherentAtomSize;
+      VkMappedMemoryRange range{};
+      range.sType = VK_STRUCTURE_TYPE_MAPPED_MEMORY_RANGE;
+      range.memory = a->memory;
+      range.offset = a->offset / atom * atom;
+      range.size = a->block == UINT32_MAX
+                       ? VK_WHOLE_SIZE
+                       : (a->offset + a->size + atom - 1) / atom * atom -
+                             range.offset;
+      vkInvalidateMappedMemoryRanges(m->device, 1, &range);
+    }
+    slot->latency_frames = (double)(m->frame_number - slot->number);
+    slot->state = READBACK_CONSUMING;
+    r->copied = (r->copied + 1) % READBACK_SLOTS;
+    handed = true;
+  }
+  if (handed) {
+    r->cv.notify_all();
+  }
+}
+
+// Picks the slot this frame is copied into, or drops the frame when the
+// next one is still busy.
+void my_vk_begin_readback(MyVk *m) {
+  MyVkReadback *r = &m->readback;
+  r->current = UINT32_MAX;
+  if (!r->enabled) {
+    return;
+  }
+  ReadbackSlot *slot = &r->slots[r->next];
+  {
+    std::lock_guard<std::mutex> lock(r->mutex);
+    if (slot->state != READBACK_FREE) {
+      ++r->dropped;
+      return;
+    }
+  }
+  VkDeviceSize size = (VkDeviceSize)m->extent.width * m->extent.height * 4;
+  if (slot->buffer.size < size) {
+    if (slot->buffer.buffer != VK_NULL_HANDLE) {
+      my_vk_retire_buffer(m, &slot->buffer);
+    }
+    // read on the cpu, so cached rather than write combined
+    slot->buffer = my_vk_create_buffer(m, size,
+                                       VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+                                       VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT,
+                                       VK_MEMORY_PROPERTY_HOST_CACHED_BIT);
+  }
+  slot->width = m->extent.width;
+  slot->height = m->extent.height;
+  slot->number = m->frame_number + 1; // what this frame's submit signals
+  slot->record_s = my_vk_time();
+  {
+    std::lock_guard<std::mutex> lock(r->mutex);
+    slot->state = READBACK_COPYING;
+  }
+  r->current = r->next;
+  r->next = (r->next + 1) % READBACK_SLOTS;
+}
+
+// copies the frame's swapchain image into its slot
+void my_vk_record_readback(MyVk *m, VkCommandBuffer cmd) {
+  ReadbackSlot *slot = &m->readback.slots[m->readback.current];
+  VkBufferImageCopy region{};
+  region.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+  region.imageSubresource.layerCount = 1;
+  region.imageExtent = VkExtent3D{slot->width, slot->height, 1};
+  vkCmdCopyImageToBuffer(cmd, m->swapchain_images[m->graph.image_index],
+                         VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+                         slot->buffer.buffer, 1, &region);
+}
+
+// waits until everything submitted so far was consumed, only for the end of
+// a run, with the device idle
+void my_vk_drain_readback(MyVk *m) {
+  MyVkReadback *r = &m->readback;
+  if (!r->enabled) {
+    return;
+  }
+  my_vk_collect_readbacks(m);
+  std::unique_lock<std::mutex> lock(r->mutex);
+  r->cv.wait(lock, [&] {
+    for (uint32_t i = 0; i < READBACK_SLOTS; ++i) {
+      if (r->slots[i].state == READBACK_CONSUMING) {
+        return false;
+      }
+    }
+    return true;
+  });
+}
+
+// starts the stats over, keeping up to samples latencies for a benchmark
+void my_vk_reset_readback(MyVk *m, uint32_t samples) {
+  MyVkReadback *r = &m->readback;
+  std::lock_guard<std::mutex> lock(r->mutex);
+  free(r->latency_frames);
+  free(r->latency_ms);
+  r->latency_frames = NULL;
+  r->latency_ms = NULL;
+  if (samples > 0) {
+    r->latency_frames = (double *)malloc(sizeof(double) * samples);
+    r->latency_ms = (double *)malloc(sizeof(double) * samples);
+  }
+  r->sample_count = 0;
+  r->sample_capacity = samples;
+  r->frames = 0;
+  r->dropped = 0;
+  r->bytes = 0;
+  r->latency_frames_sum = 0.0;
+  r->latency_ms_sum = 0.0;
+  r->reset_s = my_vk_time();
+  r->last_s = r->reset_s;
+}
+
+// sustained over the time from the reset to the last frame consumed
+double my_vk_readback_mb_per_s(const MyVkReadback *r) {
+  double seconds = r->last_s - r->reset_s;
+  return seconds > 0.0 ? r->bytes / seconds / 1e6 : 0.0;
+}
+
+void my_vk_print_readback(MyVk *m) {
+  MyVkReadback *r = &m->readback;
+  std::lock_guard<std::mutex> lock(r->mutex);
+  double frames = r->frames > 0 ? (double)r->frames : 1.0;
+  printf("readback: %llu frames, %llu dropped, %.1f MB/s, latency %.2f "
+         "frames (%.3f ms)\n",
+         (unsigned long long)r->frames, (unsigned long long)r->dropped,
+         my_vk_readback_mb_per_s(r), r->latency_frames_sum / frames,
+         r->latency_ms_sum / frames);
+}
+
+// with the device idle: consumes what is left, then stops the thread
+void my_vk_destroy_readback(MyVk *m) {
+  MyVkReadback *r = &m->readback;
+  if (!r->enabled) {
+    return;
+  }
+  my_vk_collect_readbacks(m);
+  {
+    std::lock_guard<std::mutex> lock(r->mutex);
+    r->quit = true;
+  }
+  r->cv.notify_all();
+  r->thread.join();
+  my_vk_print_readback(m);
+  for (uint32_t i = 0; i < READBACK_SLOTS; ++i) {
+    my_vk_destroy_buffer(m, &r->slots[i].buffer);
+  }
+  free(r->latency_frames);
+  free(r->latency_ms);
+  r->enabled = false;
+}
+
+// Declares this frame: the scene upload, the instance pre-pass, the main
+// pass, the hi-z build and the readback, with the resources they pass
+// along. The hi-z build is declared whenever there are instances and culled
+// when nothing samples the pyramid.
+void my_vk_build_frame_graph(MyVk *m, uint32_t image_index) {
+  MyVkRenderGraph *g = &m->graph;
+  MyVkCulling *c = &m->cull;
+  uint32_t frame = m->currentFrame;
+  bool dynamic = m->dynamic_rendering;
+  g->pass_count = 0;
+  g->resource_count = 0;
+  g->image_index = image_index;
+
+  // the render finished semaphore is signaled at color attachment output
+  GraphState present{VK_PIPELINE_STAGE_2_COLOR_ATTACHMENT_OUTPUT_BIT,
+                     VK_ACCESS_2_NONE,
+                     m->opts.headless ? VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL
+                                      : VK_IMAGE_LAYOUT_PRESENT_SRC_KHR};
+  // and the acquire semaphore waited for there
+  uint32_t color = my_vk_graph_image(
+      m, "swapchain", m->swapchain_images[image_index],
+      VK_IMAGE_ASPECT_COLOR_BIT, 1,
+      GraphState{VK_PIPELINE_STAGE_2_COLOR_ATTACHMENT_OUTPUT_BIT,
+                 VK_ACCESS_2_NONE, VK_IMAGE_LAYOUT_UNDEFINED});
+  my_vk_graph_output(m, color, present);
+
+  // read by vertex shaders, in the frame before and after this one
+  if (m->scene.copy_begin < m->scene.copy_end) {
+    GraphState read{VK_PIPELINE_STAGE_2_VERTEX_SHADER_BIT,
+                    VK_ACCESS_2_SHADER_READ_BIT, VK_IMAGE_LAYOUT_UNDEFINED};
+    uint32_t transforms =
+        my_vk_graph_buffer(m, "transforms", m->scene.transforms.buffer);
+    if (transforms != UINT32_MAX) {
+      g->resources[transforms].initial = read;
+    }
+    my_vk_graph_output(m, transforms, read);
+    uint32_t p = my_vk_graph_pass(m, "scene upload", GRAPH_GRAPHICS,
+                                  my_vk_record_scene_upload);
+    my_vk_graph_use(m, p, transforms, VK_PIPELINE_STAGE_2_TRANSFER_BIT,
+                    VK_ACCESS_2_TRANSFER_WRITE_BIT, VK_IMAGE_LAYOUT_UNDEFINED,
+                    true);
+  }
+
+  bool prepass = m->inst.count > 0 && !m->inst.naive;
+  bool occlusion = prepass && (m->opts.cull_flags & CULL_OCCLUSION);
+  const MyVkAttachments *at = &m->attach;
+  bool msaa = at->samples > VK_SAMPLE_COUNT_1_BIT;
+  uint32_t target = UINT32_MAX, depth = UINT32_MAX, sampled = UINT32_MAX;
+  uint32_t hiz = UINT32_MAX, visible = UINT32_MAX, args = UINT32_MAX;
+  if (msaa) {
+    target = my_vk_graph_transient(m, "msaa color", m->format.format,
+                                   VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT,
+                                   VK_IMAGE_ASPECT_COLOR_BIT, at->samples);
+  }
+  if (my_vk_has_depth(m)) {
+    // the hi-z build samples a single sampled depth, with multisampling
+    // the one the pass resolves its depth into
+    VkImageUsageFlags usage = VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT;
+    VkImageAspectFlags aspect = my_vk_depth_aspect(at->depth_format);
+    if (my_vk_has_hiz(m)) {
+      sampled = my_vk_graph_transient(m, "depth", at->depth_format,
+                                      usage | VK_IMAGE_USAGE_SAMPLED_BIT,
+                                      aspect, VK_SAMPLE_COUNT_1_BIT);
+    }
+    if (msaa) {
+      depth = my_vk_graph_transient(m, "msaa depth", at->depth_format, usage,
+                                    aspect, at->samples);
+    } else if (sampled != UINT32_MAX) {
+      depth = sampled;
+    } else {
+      depth = my_vk_graph_transient(m, "depth", at->depth_format, usage,
+                                    aspect, VK_SAMPLE_COUNT_1_BIT);
+    }
+  }
+  if (my_vk_has_hiz(m)) {
+    // kept from the frame before, the next one's pre-pass samples it. A new
+    // one was moved to GENERAL by my_vk_record_hiz_init.
+    hiz = my_vk_graph_image(
+        m, "hi-z", c->hiz, VK_IMAGE_ASPECT_COLOR_BIT, c->hiz_levels,
+        c->hiz_valid
+            ? GraphState{VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT,
+                         VK_ACCESS_2_SHADER_WRITE_BIT,
+                         VK_IMAGE_LAYOUT_GENERAL}
+            : GraphState{VK_PIPELINE_STAGE_2_NONE, VK_ACCESS_2_NONE,
+                         VK_IMAGE_LAYOUT_GENERAL});
+    if (hiz != UINT32_MAX) {
+      g->resources[hiz].concurrent =
+          m->queue_compute_idx != m->queue_graphics_idx;
+    }
+    if (occlusion) {
+      my_vk_graph_output(m, hiz, GraphState{});
+    }
+  }
+
+  if (prepass) {
+    visible = my_vk_graph_buffer(m, "visible", m->inst.visible[frame].buffer);
+    args = my_vk_graph_buffer(m, "args", m->inst.args[frame].buffer);
+    // read on the host once the frame's timeline value is reached
+    uint32_t stats = my_vk_graph_buffer(m, "stats", c->stats[frame].buffer);
+    my_vk_graph_output(m, stats,
+                       GraphState{VK_PIPELINE_STAGE_2_HOST_BIT,
+                                  VK_ACCESS_2_HOST_READ_BIT,
+                                  VK_IMAGE_LAYOUT_UNDEFINED});
+    uint32_t p = my_vk_graph_pass(
+        m, "instance prepass",
+        m->async.enabled ? GRAPH_ASYNC_COMPUTE : GRAPH_GRAPHICS,
+        my_vk_record_instance_prepass);
+    // cleared with a transfer, then counted into by the shader
+    VkPipelineStageFlags2 stages = VK_PIPELINE_STAGE_2_TRANSFER_BIT |
+                                   VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT;
+    VkAccessFlags2 counters = VK_ACCESS_2_TRANSFER_WRITE_BIT |
+                              VK_ACCESS_2_SHADER_READ_BIT |
+                              VK_ACCESS_2_SHADER_WRITE_BIT;
+    my_vk_graph_use(m, p, visible, VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT,
+                    VK_ACCESS_2_SHADER_WRITE_BIT, VK_IMAGE_LAYOUT_UNDEFINED,
+                    true);
+    my_vk_graph_use(m, p, args, stages, counters, VK_IMAGE_LAYOUT_UNDEFINED,
+                    true);
+    my_vk_graph_use(m, p, stats, stages, counters, VK_IMAGE_LAYOUT_UNDEFINED,
+                    true);
+    if (occlusion) {
+      my_vk_graph_use(m, p, hiz, VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT,
+                      VK_ACCESS_2_SHADER_SAMPLED_READ_BIT,
+                      VK_IMAGE_LAYOUT_GENERAL, false);
+    }
+  }
+
+  // with a render pass the attachments are used in the layouts it ends in
+  uint32_t p = my_vk_graph_pass(m, "main pass", GRAPH_GRAPHICS,
+                                my_vk_record_main_pass);
+  if (p != UINT32_MAX) {
+    g->passes[p].own_layouts = !dynamic;
+  }
+  my_vk_graph_use(m, p, color, VK_PIPELINE_STAGE_2_COLOR_ATTACHMENT_OUTPUT_BIT,
+                  VK_ACCESS_2_COLOR_ATTACHMENT_WRITE_BIT,
+                  dynamic ? VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL
+                          : present.layout,
+                  true);
+  my_vk_graph_use(m, p, target,
+                  VK_PIPELINE_STAGE_2_COLOR_ATTACHMENT_OUTPUT_BIT,
+                  VK_ACCESS_2_COLOR_ATTACHMENT_WRITE_BIT,
+                  VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL, true);
+  // the render pass leaves the depth the hi-z build samples ready for it
+  VkImageLayout sampled_layout =
+      dynamic ? VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL
+              : VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+  my_vk_graph_use(m, p, depth,
+                  VK_PIPELINE_STAGE_2_EARLY_FRAGMENT_TESTS_BIT |
+                      VK_PIPELINE_STAGE_2_LATE_FRAGMENT_TESTS_BIT,
+                  VK_ACCESS_2_DEPTH_STENCIL_ATTACHMENT_READ_BIT |
+                      VK_ACCESS_2_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT,
+                  depth == sampled
+                      ? sampled_layout
+                      : VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL,
+                  true);
+  if (msaa) {
+    // resolves count as color attachment output, depth resolves included
+    my_vk_graph_use(m, p, sampled,
+                    VK_PIPELINE_STAGE_2_LATE_FRAGMENT_TESTS_BIT |
+                        VK_PIPELINE_STAGE_2_COLOR_ATTACHMENT_OUTPUT_BIT,
+                    VK_ACCESS_2_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT |
+                        VK_ACCESS_2_COLOR_ATTACHMENT_WRITE_BIT,
+                    sampled_layout, true);
+  }
+  my_vk_graph_use(m, p, visible, VK_PIPELINE_STAGE_2_VERTEX_SHADER_BIT,
+                  VK_ACCESS_2_SHADER_READ_BIT, VK_IMAGE_LAYOUT_UNDEFINED,
+                  false);
+  my_vk_graph_use(m, p, args, VK_PIPELINE_STAGE_2_DRAW_INDIRECT_BIT,
+                  VK_ACCESS_2_INDIRECT_COMMAND_READ_BIT,
+                  VK_IMAGE_LAYOUT_UNDEFINED, false);
+
+  if (my_vk_has_hiz(m)) {
+    p = my_vk_graph_pass(m, "hi-z build", GRAPH_GRAPHICS,
+                         my_vk_record_hiz_build);
+    my_vk_graph_use(m, p, sampled, VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT,
+                    VK_ACCESS_2_SHADER_SAMPLED_READ_BIT,
+                    VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, false);
+    my_vk_graph_use(m, p, hiz, VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT,
+                    VK_ACCESS_2_SHADER_READ_BIT |
+                        VK_ACCESS_2_SHADER_WRITE_BIT,
+                    VK_IMAGE_LAYOUT_GENERAL, true);
+  }
+
+  if (m->readback.current != UINT32_MAX) {
+    // read on the host once the frame's timeline value is reached
+    uint32_t dst = my_vk_graph_buffer(
+        m, "readback", m->readback.slots[m->readback.current].buffer.buffer);
+    my_vk_graph_output(m, dst,
+                       GraphState{VK_PIPELINE_STAGE_2_HOST_BIT,
+                                  VK_ACCESS_2_HOST_READ_BIT,
+                                  VK_IMAGE_LAYOUT_UNDEFINED});
+    p = my_vk_graph_pass(m, "readback", GRAPH_GRAPHICS,
+                         my_vk_record_readback);
+    my_vk_graph_use(m, p, color, VK_PIPELINE_STAGE_2_COPY_BIT,
+                    VK_ACCESS_2_TRANSFER_READ_BIT,
+                    VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, false);
+    my_vk_graph_use(m, p, dst, VK_PIPELINE_STAGE_2_COPY_BIT,
+                    VK_ACCESS_2_TRANSFER_WRITE_BIT, VK_IMAGE_LAYOUT_UNDEFINED,
+                    true);
+  }
+}
+
+// Creates the transients the frame uses, in one allocation: largest first,
+// each goes to the lowest offset that no transient whose lifetime overlaps
+// its own occupies. Attachments that only one pass uses get lazily allocated
+// memory of their own instead, where the device has it. Placed for the graph
+// as it is declared now, recreated with the swapchain.
+void my_vk_create_transients(MyVk *m) {
+  MyVkRenderGraph *g = &m->graph;
+  MyVkAttachments *at = &m->attach;
+  my_vk_build_frame_graph(m, 0);
+  my_vk_graph_compile(m);
+
+  const VkImageUsageFlags attachment_usage =
+      VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT |
+      VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT |
+      VK_IMAGE_USAGE_INPUT_ATTACHMENT_BIT;
+  uint32_t live[GRAPH_MAX_TRANSIENTS], placed[GRAPH_MAX_TRANSIENTS];
+  uint32_t live_count = 0, count = 0;
+  VkDeviceSize alignments[GRAPH_MAX_TRANSIENTS];
+  VkMemoryRequirements reqs{0, 1, UINT32_MAX};
+  g->transient_total = 0;
+  at->bytes = 0;
+  at->lazy_bytes = 0;
+  for (uint32_t r = 0; r < g->resource_count; ++r) {
+    GraphResource *res = &g->resources[r];
+    if (res->transient == UINT32_MAX || res->first_use == UINT32_MAX) {
+      continue;
+    }
+    GraphTransient *t = &g->transients[res->transient];
+    // written and read only by the pass that renders into it, it never has
+    // to be backed by memory on a tiler
+    bool lazy = at->lazy_memory && (t->usage & ~attachment_usage) == 0 &&
+                res->first_use == res->last_use;
+    VkImageCreateInfo imageInfo{};
+    imageInfo.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
+    imageInfo.imageType = VK_IMAGE_TYPE_2D;
+    imageInfo.format = t->format;
+    imageInfo.extent = VkExtent3D{m->extent.width, m->extent.height, 1};
+    imageInfo.mipLevels = 1;
+    imageInfo.arrayLayers = 1;
+    imageInfo.samples = t->samples;
+    imageInfo.tiling = VK_IMAGE_TILING_OPTIMAL;
+    imageInfo.usage =
+        t->usage | (lazy ? VK_IMAGE_USAGE_TRANSIENT_ATTACHMENT_BIT : 0);
+    imageInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+    imageInfo.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+    if (vkCreateImage(m->device, &imageInfo, nullptr, &t->image) !=
+        VK_SUCCESS) {
+      printf("ERROR: could not create transient image `%s`!\n", t->name);
+    }
+    MY_VK_TRACK(m, VK_OBJECT_TYPE_IMAGE, t->image);
+    VkMemoryRequirements imageReqs;
+    vkGetImageMemoryRequirements(m->device, t->image, &imageReqs);
+    t->size = imageReqs.size;
+    t->offset = 0;
+    t->first_use = res->first_use;
+    t->last_use = res->last_use;
+    at->bytes += t->size;
+    live[live_count++] = res->transient;
+    t->lazy_alloc = MyAllocation{};
+    if (lazy) {
+      // memory type bits may leave out the lazy types, then it is aliased
+      t->lazy_alloc = my_vk_alloc(m, imageReqs, false,
+                                  VK_MEMORY_PROPERTY_LAZILY_ALLOCATED_BIT);
+    }
+    if (t->lazy_alloc.memory != VK_NULL_HANDLE) {
+      vkBindImageMemory(m->device, t->image, t->lazy_alloc.memory,
+                        t->lazy_alloc.offset);
+      at->lazy_bytes += t->size;
+      continue;
+    }
+    alignments[res->transient] = imageReqs.alignment;
+    reqs.alignment = std::max(reqs.alignment, imageReqs.alignment);
+    reqs.memoryTypeBits &= imageReqs.memoryTypeBits;
+    g->transient_total += t->size;
+    placed[count++] = res->transient;
+  }
+  std::sort(placed, placed + count, [&](uint32_t a, uint32_t b) {
+    return g->transients[a].size > g->transients[b].size;
+  });
+  for (uint32_t i = 0; i < count; ++i) {
+    GraphTransient *t = &g->transients[placed[i]];
+    t->offset = 0;
+    for (uint32_t j = 0; j < i; ++j) {
+      GraphTransient *o = &g->transients[placed[j]];
+      bool alive = t->first_use <= o->last_use && o->first_use <= t->last_use;
+      if (alive && t->offset < o->offset + o->size &&
+          o->offset < t->offset + t->size) {
+        VkDeviceSize a = alignments[placed[i]];
+        t->offset = (o->offset + o->size + a - 1) / a * a;
+        j = UINT32_MAX; // look at all of them again from the new offset
+      }
+    }
+    reqs.size = std::max(reqs.size, t->offset + t->size);
+  }
+  g->transient_peak = reqs.size;
+  if (count > 0) {
+    g->transient_alloc =
+        my_vk_alloc(m, reqs, false, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+    if (g->transient_alloc.memory == VK_NULL_HANDLE) {
+      printf("ERROR: could not allocate %llu bytes for the transients!\n",
+             (unsigned long long)reqs.size);
+    }
+  }
+  for (uint32_t i = 0; i < count; ++i) {
+    GraphTransient *t = &g->transients[placed[i]];
+    vkBindImageMemory(m->device, t->image, g->transient_alloc.memory,
+                      g->transient_alloc.offset + t->offset);
+  }
+
+  for (uint32_t i = 0; i < live_count; ++i) {
+    GraphTransient *t = &g->transients[live[i]];
+    VkImageViewCreateInfo viewInfo{};
+    viewInfo.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
+    viewInfo.image = t->image;
+    viewInfo.viewType = VK_IMAGE_VIEW_TYPE_2D;
+    viewInfo.format = t->format;
+    viewInfo.subresourceRange = {t->aspect, 0, 1, 0, 1};
+    if (vkCreateImageView(m->device, &viewInfo, nullptr, &t->view) !=
+        VK_SUCCESS) {
+      printf("ERROR: could not create transient view `%s`!\n", t->name);
+    }
+    MY_VK_TRACK(m, VK_OBJECT_TYPE_IMAGE_VIEW, t->view);
+    // a sampled view may only have one aspect
+    t->sampled_view = t->view;
+    if ((t->usage & VK_IMAGE_USAGE_SAMPLED_BIT) &&
+        t->aspect != VK_IMAGE_ASPECT_COLOR_BIT &&
+        t->aspect != VK_IMAGE_ASPECT_DEPTH_BIT) {
+      viewInfo.subresourceRange.aspectMask = VK_IMAGE_ASPECT_DEPTH_BIT;
+      if (vkCreateImageView(m->device, &viewInfo, nullptr,
+                            &t->sampled_view) != VK_SUCCESS) {
+        printf("ERROR: could not create transient view `%s`!\n", t->name);
+      }
+      MY_VK_TRACK(m, VK_OBJECT_TYPE_IMAGE_VIEW, t->sampled_view);
+    }
+
+    if (strcmp(t->name, "msaa color") == 0) {
+      at->color_view = t->view;
+    } else if (strcmp(t->name, "msaa depth") == 0) {
+      at->depth_view = t->view;
+    } else if (strcmp(t->name, "depth") == 0) {
+      if (at->samples > VK_SAMPLE_COUNT_1_BIT) {
+        at->depth_resolve_view = t->view;
+      } else {
+        at->depth_view = t->view;
+      }
+      if (my_vk_has_hiz(m)) {
+        m->cull.depth = t->image;
+        m->cull.depth_view = t->sampled_view;
+        my_vk_write_hiz_build_descriptors(m);
+      }
+    }
+  }
+  if (m->swapchain_recreations == 0) {
+    printf("attachments: %ux msaa, %s depth, %.2f MiB, %.2f MiB of it "
+           "lazily allocated\n",
+           (uint32_t)at->samples, my_vk_depth_format_name(at->depth_format),
+           at->bytes / (1024.0 * 1024.0), at->lazy_bytes / (1024.0 * 1024.0));
+  }
+}
+
+void my_vk_destroy_transients(MyVk *m) {
+  MyVkRenderGraph *g = &m->graph;
+  for (uint32_t t = 0; t < g->transient_count; ++t) {
+    GraphTransient *tr = &g->transients[t];
+    if (tr->sampled_view != tr->view) {
+      my_vk_destroy_object(m, VK_OBJECT_TYPE_IMAGE_VIEW,
+                           (uint64_t)tr->sampled_view);
+    }
+    my_vk_destroy_object(m, VK_OBJECT_TYPE_IMAGE_VIEW, (uint64_t)tr->view);
+    my_vk_destroy_object(m, VK_OBJECT_TYPE_IMAGE, (uint64_t)tr->image);
+    my_vk_free(m, &tr->lazy_alloc);
+    tr->sampled_view = VK_NULL_HANDLE;
+    tr->view = VK_NULL_HANDLE;
+    tr->image = VK_NULL_HANDLE;
+  }
+  my_vk_free(m, &g->transient_alloc);
+  m->cull.depth = VK_NULL_HANDLE;
+  m->cull.depth_view = VK_NULL_HANDLE;
+  m->attach.color_view = VK_NULL_HANDLE;
+  m->attach.depth_view = VK_NULL_HANDLE;
+  m->attach.depth_resolve_view = VK_NULL_HANDLE;
+}
+
+// records and submits this frame's pre-pass on the compute queue. It signals
+// the frame number the graphics submit of this frame is about to get.
+void my_vk_submit_async_prepass(MyVk *m) {
+  MyVkAsyncCompute *a = &m->async;
+  VkCommandBuffer cmd = a->cmds[m->currentFrame];
+  vkResetCommandBuffer(cmd, 0);
+  VkCommandBufferBeginInfo beginInfo{};
+  beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+  beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+  if (vkBeginCommandBuffer(cmd, &beginInfo) != VK_SUCCESS) {
+    printf("ERROR: could not begin compute command buffer\n");
+  }
+  uint64_t uploads =
+      my_vk_acquire_uploads(m, cmd, (uint32_t)m->queue_compute_idx);
+  my_vk_graph_execute(m, cmd, GRAPH_ASYNC_COMPUTE);
+  if (vkEndCommandBuffer(cmd) != VK_SUCCESS) {
+    printf("ERROR: failed to end compute command buffer!\n");
+  }
+
+  VkSemaphoreSubmitInfo waitInfos[2]{};
+  uint32_t wait_count = 0;
+  if (uploads > 0) {
+    waitInfos[wait_count++] =
+        my_vk_upload_wait(m, (uint32_t)m->queue_compute_idx, uploads);
+  }
+  // occlusion culling samples the hi-z the previous frame builds last
+  if ((m->opts.cull_flags & CULL_OCCLUSION) && m->cull.hiz_valid) {
+    VkSemaphoreSubmitInfo *w = &waitInfos[wait_count++];
+    w->sType = VK_STRUCTURE_TYPE_SEMAPHORE_SUBMIT_INFO;
+    w->semaphore = m->frameTimeline;
+    w->value = m->frame_number;
+    w->stageMask = VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT;
+  }
+  VkSemaphoreSubmitInfo signalInfo{};
+  signalInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_SUBMIT_INFO;
+  signalInfo.semaphore = a->timeline;
+  signalInfo.value = m->frame_number + 1;
+  signalInfo.stageMask = VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT;
+  VkCommandBufferSubmitInfo cmdInfo{};
+  cmdInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_SUBMIT_INFO;
+  cmdInfo.commandBuffer = cmd;
+  VkSubmitInfo2 submitInfo{};
+  submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO_2;
+  submitInfo.waitSemaphoreInfoCount = wait_count;
+  submitInfo.pWaitSemaphoreInfos = waitInfos;
+  submitInfo.commandBufferInfoCount = 1;
+  submitInfo.pCommandBufferInfos = &cmdInfo;
+  submitInfo.signalSemaphoreInfoCount = 1;
+  submitInfo.pSignalSemaphoreInfos = &signalInfo;
+  if (vkQueueSubmit2(m->computeQueue, 1, &submitInfo, VK_NULL_HANDLE) !=
+      VK_SUCCESS) {
+    printf("ERROR: could not submit the pre-pass to the compute queue!\n");
+  }
+}
+
+void my_vk_deinit_swapchain(MyVk *m) {
+  for (uint32_t i = 0; m->swapchainFramebuffers != NULL &&
+                       i < m->swapchain_images_count;
+       ++i) {
+    my_vk_destroy_object(m, VK_OBJECT_TYPE_FRAMEBUFFER,
+                         (uint64_t)m->swapchainFramebuffers[i]);
+  }
+
+  for (uint32_t i = 0; i < m->swapchain_images_count; ++i) {
+    my_vk_destroy_object(m, VK_OBJECT_TYPE_IMAGE_VIEW,
+                         (uint64_t)m->image_views[i]);
+  }
+  my_vk_destroy_depth_targets(m);
+  my_vk_destroy_transients(m);
+  if (m->opts.headless) {
+    for (uint32_t i = 0; i < m->swapchain_images_count; ++i) {
+      my_vk_destroy_object(m, VK_OBJECT_TYPE_IMAGE,
+                           (uint64_t)m->swapchain_images[i]);
+      my_vk_free(m, &m->offscreen_allocs[i]);
+    }
+  } else {
+    my_vk_destroy_object(m, VK_OBJECT_TYPE_SWAPCHAIN_KHR,
+                         (uint64_t)m->swapchain);
+  }
+  free(m->swapchain_images);
+  free(m->swapchainFramebuffers);
+  free(m->image_views);
+}
+
+// swaps in a swapchain for the current window size without waiting for the
+// device: frames in flight finish on the old one, whose destruction is deferred
+void my_vk_recreate_swapchain(MyVk *m) {
+
+  int width = 0, height = 0;
+  glfwGetFramebufferSize(m->window, &width, &height);
+  while (width == 0 || height == 0) { // handle minimization
+    glfwGetFramebufferSize(m->window, &width, &height);
+    glfwWaitEvents();
+  }
+
+  // frames in flight still use the old swapchain, queue it behind them
+  for (uint32_t i = 0; i < m->swapchain_images_count; ++i) {
+    if (m->swapchainFramebuffers != NULL) {
+      my_vk_defer_destroy(m, VK_OBJECT_TYPE_FRAMEBUFFER,
+                          (uint64_t)m->swapchainFramebuffers[i], NULL, NULL);
+    }
+    my_vk_defer_destroy(m, VK_OBJECT_TYPE_IMAGE_VIEW,
+                        (uint64_t)m->image_views[i], NULL, NULL);
+  }
+  my_vk_defer_destroy(m, VK_OBJECT_TYPE_SWAPCHAIN_KHR, (uint64_t)m->swapchain,
+                      NULL, m->swapchain_images);
+  my_vk_defer_destroy(m, VK_OBJECT_TYPE_UNKNOWN, 0, NULL,
+                      m->swapchainFramebuffers);
+  my_vk_defer_destroy(m, VK_OBJECT_TYPE_UNKNOWN, 0, NULL, m->image_views);
+
+  if (my_vk_has_hiz(m) || m->graph.transient_count > 0) {
+    // the transients and hi-z are shared by every frame, and the hi-z
+    // descriptors may not be rewritten while a frame uses them, so with
+    // them this still waits for the frames in flight
+    VkSemaphoreWaitInfo waitInfo{};
+    waitInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_WAIT_INFO;
+    waitInfo.semaphoreCount = 1;
+    waitInfo.pSemaphores = &m->frameTimeline;
+    waitInfo.pValues = &m->frame_number;
+    vkWaitSemaphores(m->device, &waitInfo, UINT64_MAX);
+    my_vk_destroy_depth_targets(m);
+    my_vk_destroy_transients(m);
+  }
+
+  my_vk_create_swapchain(m);
+  my_vk_create_image_views(m);
+  my_vk_create_depth_targets(m);
+  my_vk_create_transients(m);
+  my_vk_create_swapchain_framebuffers(m);
+  m->framebuffer_resized = false;
+  ++m->swapchain_recreations;
+  // present ids belong to the swapchain
+  m->pace.present_id = 0;
+  m->pace.shown_id = 0;
+}
+
+// switches to the policy's present mode, with a new swapchain if it changes
+void my_vk_set_present_policy(MyVk *m, uint32_t policy) {
+  m->opts.present_policy = policy;
+  VkPresentModeKHR mode = my_vk_pick_present_mode(m, policy);
+  if (mode == m->present_mode) {
+    return;
+  }
+  m->present_mode = mode;
+  my_vk_recreate_swapchain(m);
+}
+
+// changes how many frames the cpu may be ahead of the gpu. All slots are
+// drained first, so nothing in flight refers to a slot that stops being used.
+void my_vk_set_frames_in_flight(MyVk *m, uint32_t count) {
+  for (uint32_t i = 0; i < m->frames_in_flight; ++i) {
+    my_vk_wait_frame_slot(m, i);
+    // results of the drained frames still have to be read back, or their
+    // queries would stay pending in a slot that may go unused
+    m->currentFrame = i;
+    my_vk_profiler_collect(m);
+    my_vk_collect_cull_stats(m);
+    m->input_time_us[i] = -1.0;
+  }
+  m->frames_in_flight = count;
+  m->currentFrame = 0;
+  m->last_gpu_end_us = -1.0;
+  m->last_latency_ms = -1.0;
+}
+
+// moves the instance pre-pass between the graphics and the compute queue
+void my_vk_set_async_compute(MyVk *m, bool enabled) {
+  if (m->queue_compute_idx == m->queue_graphics_idx) {
+    return;
+  }
+  my_vk_set_frames_in_flight(m, m->frames_in_flight); // drains the slots
+  m->async.enabled = enabled;
+  my_vk_hand_over_instances(m);
+}
+
+// switches between naive and indirect instance draws, which read the
+// instances on different queues with async compute
+void my_vk_set_naive_instances(MyVk *m, bool naive) {
+  m->inst.naive = naive;
+  if (m->inst.instances.owner != my_vk_instances_owner(m)) {
+    my_vk_set_frames_in_flight(m, m->frames_in_flight); // drains the slots
+    my_vk_hand_over_instances(m);
+  }
+}
+
+// input to present latency of the frame whose results were just collected:
+// from when the cpu started on it (where input would be sampled) to when its
+// last gpu work finished, which is when it is handed to the presentation engine
+void my_vk_track_latency(MyVk *m) {
+  double input_us = m->input_time_us[m->currentFrame];
+  if (input_us >= 0.0 && m->last_gpu_end_us >= input_us) {
+    m->last_latency_ms = (m->last_gpu_end_us - input_us) * 1e-3;
+  } else {
+    m->last_latency_ms = -1.0;
+  }
+  m->last_gpu_end_us = -1.0;
+  m->input_time_us[m->currentFrame] = my_vk_time() * 1e6;
+}
+
+// With pacing: waits until the last present is on screen, then puts off the
+// frame's start so that its work, as long as it has been taking, ends
+// PACE_MARGIN_MS before the vblank after that
+void my_vk_pace_frame(MyVk *m) {
+  MyVkPacing *p = &m->pace;
+  if (!p->enabled || p->present_id == p->shown_id) {
+    return;
+  }
+  // a minimized or covered window may never show it
+  VkResult res = p->wait_for_present(m->device, m->swapchain, p->present_id,
+                                     100ull * 1000 * 1000);
+  double now = my_vk_time();
+  if (res != VK_SUCCESS) {
+    p->shown_id = 0;
+    return;
+  }
+  bool consecutive = p->shown_id != 0 && p->shown_id + 1 == p->present_id;
+  p->interval_ms = consecutive ? (now - p->shown_s) * 1000.0 : -1.0;
+  p->display_latency_ms = (now * 1e6 - p->input_us) * 1e-3;
+  // intervals where a vblank was missed are multiples of the period
+  if (p->interval_ms > 0.0 &&
+      (p->period_ms < 0.0 || p->interval_ms < p->period_ms * 1.5)) {
+    p->period_ms = p->period_ms < 0.0
+                       ? p->interval_ms
+                       : p->period_ms * 0.95 + p->interval_ms * 0.05;
+  }
+  p->shown_id = p->present_id;
+  p->shown_s = now;
+
+  // a frame that took longer counts right away, shorter ones slowly
+  if (m->last_latency_ms >= 0.0) {
+    p->work_ms = std::max(m->last_latency_ms,
+                          p->work_ms * 0.95 + m->last_latency_ms * 0.05);
+  }
+  p->sleep_ms = 0.0;
+  if (p->period_ms < 0.0 || p->work_ms < 0.0) {
+    return;
+  }
+  double start_s =
+      p->shown_s + (p->period_ms - p->work_ms - PACE_MARGIN_MS) * 1e-3;
+  if (start_s > now) {
+    p->sleep_ms = (start_s - now) * 1000.0;
+    std::this_thread::sleep_for(
+        std::chrono::duration<double, std::milli>(p->sleep_ms));
+  }
+}
+
+// this frame's uniforms, written straight into its arena. Nothing is
+// allocated, mapped or written to a descriptor, only the offset changes.
+void my_vk_update_frame_data(MyVk *m) {
+  GpuFrameData *f = &m->frame_data;
+  double now = my_vk_time() - m->startup.begin;
+  f->view_proj = glm::mat4(1.0f);
+  f->time = glm::vec4((float)now, (float)(now - f->time.x), 0.0f, 0.0f);
+  f->clear = glm::vec4((float)fabs(sin(now)), 0.0f, 0.0f, 1.0f);
+  m->frame_data_offset = my_vk_frame_uniforms(m, f, sizeof(*f));
+  if (m->frame_data_offset == UINT32_MAX) {
+    m->frame_data_offset = 0; // stale uniforms rather than an invalid offset
+  }
+}
+
+void my_vk_draw(MyVk *m) {
+  // draw
+  // wait for the previous frame to be rendered
+  double t = my_vk_time();
+  my_vk_wait_frame_slot(m, m->currentFrame);
+  my_vk_profiler_cpu(m, "wait frame", t);
+  if (m->pace.enabled) {
+    t = my_vk_time();
+    my_vk_pace_frame(m);
+    my_vk_profiler_cpu(m, "pace", t);
+  }
+  my_vk_profiler_collect(m);
+  my_vk_collect_cull_stats(m);
+  my_vk_collect_readbacks(m);
+  my_vk_track_latency(m);
+  // the gpu is done with everything this slot allocated last time
+  m->frame_arenas[m->currentFrame].head = 0;
+  my_vk_run_deletions(m, false);
+  my_vk_hot_reload_swap(m);
+  if (m->tex.count > 0) {
+    t = my_vk_time();
+    my_vk_stream_textures(m);
+    my_vk_profiler_cpu(m, "stream textures", t);
+  }
+  if (m->scene.nodes.count > 0) {
+    t = my_vk_time();
+    my_vk_update_scene(m);
+    my_vk_profiler_cpu(m, "update scene", t);
+  }
+  my_vk_update_frame_data(m);
+
+  // get image from swapchain
+  uint32_t imageIndex;
+  if (m->opts.headless) {
+    // offscreen images are tied to the frame slot, nothing to acquire
+    imageIndex = m->currentFrame;
+  } else {
+    // until the resizing settles, keep presenting the stretched old size
+    if (m->framebuffer_resized &&
+        my_vk_time() - m->resize_time >= RESIZE_DEBOUNCE_SECONDS) {
+      t = my_vk_time();
+      my_vk_recreate_swapchain(m);
+      my_vk_profiler_cpu(m, "recreate swapchain", t);
+    }
+    t = my_vk_time();
+    VkResult res =
+        vkAcquireNextImageKHR(m->device, m->swapchain, UINT64_MAX,
+                              m->imageAvailableSemaphores[m->currentFrame],
+                              VK_NULL_HANDLE, &imageIndex);
+    my_vk_profiler_cpu(m, "acquire", t);
+    if (res == VK_ERROR_OUT_OF_DATE_KHR) {
+      // nothing can be presented to it anymore, recreate right away
+      my_vk_recreate_swapchain(m);
+      return;
+    } else if (res != VK_SUCCESS && res != VK_SUBOPTIMAL_KHR) {
+      printf("ERROR: Failed to acquire swap chain image!\n");
+    }
+  }
+
+  // record command buffer
+  uint64_t uploads = 0;
+  bool async_prepass = m->async.enabled && m->inst.count > 0 && !m->inst.naive;
+  t = my_vk_time();
+  vkResetCommandBuffer(m->commandBuffers[m->currentFrame], 0);
+  my_vk_begin_readback(m);
+  my_vk_build_frame_graph(m, imageIndex);
+  my_vk_graph_compile(m);
+  if (m->opts.dump_graph && !m->graph.dumped) {
+    my_vk_graph_dump(m);
+    m->graph.dumped = true;
+  }
+  // record to command buffer
+  {
+    VkCommandBufferBeginInfo beginInfo{};
+    beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+    beginInfo.flags = 0;
+    beginInfo.pInheritanceInfo = NULL;
+    if (vkBeginCommandBuffer(m->commandBuffers[m->currentFrame], &beginInfo) !=
+        VK_SUCCESS) {
+      printf("ERROR: could not begin command buffer\n");
+    }
 
-  my_vk_create_window(m);
-  my_vk_create_instance(m);
-  my_vk_create_surface(m);
-  my_vk_create_phys_device(m);
-  my_vk_get_queue_indices(m);
-  my_vk_create_device(m);
-  my_vk_create_swapchain(m);
-  my_vk_create_queues(m);
-  my_vk_create_image_views(m);
-  my_vk_create_shader_modules(m);
-  my_vk_create_dynamic_state(m);
-  my_vk_create_render_pipeline(m);
-  my_vk_create_swapchain_framebuffers(m);
-  my_vk_create_command_pool(m);
-  my_vk_create_command_buffers(m);
-  my_vk_create_semaphores(m);
+    my_vk_profiler_begin_frame(m, m->commandBuffers[m->currentFrame]);
+    // the first scope of a frame spans all of it
+    my_vk_profiler_gpu_begin(m, m->commandBuffers[m->currentFrame], "frame");
+    uploads = my_vk_acquire_uploads(m, m->commandBuffers[m->currentFrame],
+                                    (uint32_t)m->queue_graphics_idx);
+
+    if (m->cull.hiz_undefined) {
+      my_vk_record_hiz_init(m, m->commandBuffers[m->currentFrame]);
+    }
+    VkQueryPool invocations = m->cull.invocation_pools[m->currentFrame];
+    if (invocations != VK_NULL_HANDLE) {
+      vkCmdResetQueryPool(m->commandBuffers[m->currentFrame], invocations, 0,
+                          1);
+    }
+    if (m->inst.count > 0) {
+      my_vk_update_view(m);
+    }
+    if (async_prepass) {
+      // no timestamps on the compute queue, it isn't in the gpu scopes
+      my_vk_submit_async_prepass(m);
+    }
+    my_vk_graph_execute(m, m->commandBuffers[m->currentFrame], GRAPH_GRAPHICS);
 
-  glm::mat4 matrix;
-  glm::vec4 vec;
-  auto test = matrix * vec;
+    my_vk_profiler_gpu_end(m, m->commandBuffers[m->currentFrame]); // frame
 
-  while (!glfwWindowShouldClose(m->window)) {
-    glfwPollEvents();
+    if (vkEndCommandBuffer(m->commandBuffers[m->currentFrame]) != VK_SUCCESS) {
+      printf("ERROR: failed to end comman buffer!\n");
+    }
+  }
+  m->last_record_ms = (my_vk_time() - t) * 1000.0;
+  my_vk_profiler_cpu(m, "record", t);
+  // submit command buffer
+  {
+    VkSemaphoreSubmitInfo waitInfos[3]{};
+    uint32_t wait_count = 0;
+    if (!m->opts.headless) {
+      waitInfos[wait_count].sType = VK_STRUCTURE_TYPE_SEMAPHORE_SUBMIT_INFO;
+      waitInfos[wait_count].semaphore =
+          m->imageAvailableSemaphores[m->currentFrame];
+      waitInfos[wait_count].stageMask =
+          VK_PIPELINE_STAGE_2_COLOR_ATTACHMENT_OUTPUT_BIT;
+      ++wait_count;
+    }
+    if (uploads > 0) {
+      waitInfos[wait_count++] =
+          my_vk_upload_wait(m, (uint32_t)m->queue_graphics_idx, uploads);
+    }
+    if (async_prepass) {
+      waitInfos[wait_count].sType = VK_STRUCTURE_TYPE_SEMAPHORE_SUBMIT_INFO;
+      waitInfos[wait_count].semaphore = m->async.timeline;
+      waitInfos[wait_count].value = m->frame_number + 1;
+      waitInfos[wait_count].stageMask = PREPASS_CONSUMER_STAGES;
+      ++wait_count;
+    }
+
+    // the timeline tells the cpu when the slot is free again, the binary
+    // semaphore tells present when the image is rendered
+    VkSemaphoreSubmitInfo signalInfos[2]{};
+    signalInfos[0].sType = VK_STRUCTURE_TYPE_SEMAPHORE_SUBMIT_INFO;
+    signalInfos[0].semaphore = m->frameTimeline;
+    signalInfos[0].value = m->frame_number + 1;
+    signalInfos[0].stageMask = VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT;
+    signalInfos[1].sType = VK_STRUCTURE_TYPE_SEMAPHORE_SUBMIT_INFO;
+    signalInfos[1].semaphore = m->renderFinishedSemaphores[m->currentFrame];
+    signalInfos[1].stageMask = VK_PIPELINE_STAGE_2_COLOR_ATTACHMENT_OUTPUT_BIT;
+
+    VkCommandBufferSubmitInfo cmdInfo{};
+    cmdInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_SUBMIT_INFO;
+    cmdInfo.commandBuffer = m->commandBuffers[m->currentFrame];
+
+    VkSubmitInfo2 submitInfo{};
+    submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO_2;
+    submitInfo.waitSemaphoreInfoCount = wait_count;
+    submitInfo.pWaitSemaphoreInfos = waitInfos;
+    submitInfo.commandBufferInfoCount = 1;
+    submitInfo.pCommandBufferInfos = &cmdInfo;
+    submitInfo.signalSemaphoreInfoCount = 2;
+    submitInfo.pSignalSemaphoreInfos = signalInfos;
+    if (m->opts.headless) {
+      // no present to signal
+      submitInfo.signalSemaphoreInfoCount = 1;
+    }
+    t = my_vk_time();
+    my_vk_profiler_submitted(m);
+    if (vkQueueSubmit2(m->graphicsQueue, 1, &submitInfo, VK_NULL_HANDLE) !=
+        VK_SUCCESS) {
+      printf("ERROR: Could not submit command buffer to command graphics "
+             "queue!\n");
+    }
+    m->slot_frame_number[m->currentFrame] = ++m->frame_number;
+    my_vk_profiler_cpu(m, "submit", t);
+  }
+  if (m->opts.headless) {
+    m->currentFrame = (m->currentFrame + 1) % m->frames_in_flight;
+    return;
+  }
+
+  VkPresentInfoKHR presentInfo{};
+  {
+    presentInfo.sType = VK_STRUCTURE_TYPE_PRESENT_INFO_KHR;
+    presentInfo.waitSemaphoreCount = 1;
+    presentInfo.pWaitSemaphores = &m->renderFinishedSemaphores[m->currentFrame];
+    presentInfo.swapchainCount = 1;
+    presentInfo.pSwapchains = &m->swapchain;
+    presentInfo.pImageIndices = &imageIndex;
+  }
+  VkPresentIdKHR presentId{};
+  if (m->pace.available) {
+    presentId.sType = VK_STRUCTURE_TYPE_PRESENT_ID_KHR;
+    presentId.swapchainCount = 1;
+    ++m->pace.present_id;
+    presentId.pPresentIds = &m->pace.present_id;
+    presentInfo.pNext = &presentId;
+    m->pace.input_us = m->input_time_us[m->currentFrame];
+  }
+
+  t = my_vk_time();
+  VkResult res = vkQueuePresentKHR(m->presentQueue, &presentInfo);
+  my_vk_profiler_cpu(m, "present", t);
+  if (res == VK_ERROR_OUT_OF_DATE_KHR) {
+    my_vk_recreate_swapchain(m);
+  } else if (res == VK_SUBOPTIMAL_KHR) {
+    // still presentable. A resize that is being debounced already covers it,
+    // otherwise recreate before the next acquire.
+    if (!m->framebuffer_resized) {
+      m->framebuffer_resized = true;
+      m->resize_time = my_vk_time() - RESIZE_DEBOUNCE_SECONDS;
+    }
+  } else if (res != VK_SUCCESS) {
+    printf("ERROR: failed to queue present KHR!\n");
+  }
+
+  m->currentFrame = (m->currentFrame + 1) % m->frames_in_flight;
+}
+
+// adds a stage that runs once the stages in deps are done, returns its bit
+uint32_t my_vk_startup_stage(MyVk *m, const char *name, void (*run)(MyVk *m),
+                             uint32_t deps, bool main_thread = false,
+                             bool (*failed)(MyVk *m) = NULL) {
+  MyVkStartup *s = &m->startup;
+  if (s->count == STARTUP_MAX_STAGES) {
+    printf("ERROR: too many startup stages!\n");
+    return 0;
+  }
+  StartupStage *st = &s->stages[s->count];
+  *st = StartupStage{};
+  st->name = name;
+  st->run = run;
+  st->deps = deps;
+  st->main_thread = main_thread;
+  st->failed = failed;
+  return 1u << s->count++;
+}
+
+// runs ready stages until all of them are done. The main thread is thread 0
+// and takes the stages that must run on it first, so it doesn't hold them up.
+void my_vk_startup_worker(MyVk *m, uint32_t thread) {
+  MyVkStartup *s = &m->startup;
+  uint32_t all =
+      s->count == STARTUP_MAX_STAGES ? UINT32_MAX : (1u << s->count) - 1;
+  std::unique_lock<std::mutex> lock(s->mutex);
+  while (s->done != all) {
+    uint32_t next = UINT32_MAX;
+    for (uint32_t pass = thread == 0 ? 0 : 1; pass < 2; ++pass) {
+      for (uint32_t i = 0; i < s->count && next == UINT32_MAX; ++i) {
+        StartupStage *st = &s->stages[i];
+        bool ready = !st->started && (st->deps & s->done) == st->deps;
+        // pass 0 only looks for main thread stages
+        if (ready && st->main_thread == (pass == 0) &&
+            (!st->main_thread || thread == 0)) {
+          next = i;
+        }
+      }
+    }
+    if (next == UINT32_MAX) {
+      s->cv.wait(lock);
+      continue;
+    }
+    StartupStage *st = &s->stages[next];
+    st->started = true;
+    st->thread = thread;
+    // one that needs a failed stage is done without running
+    bool skip = (st->deps & s->failed) != 0;
+    lock.unlock();
+    st->begin_ms = (my_vk_time() - s->begin) * 1000.0;
+    if (!skip) {
+      st->run(m);
+    }
+    st->end_ms = (my_vk_time() - s->begin) * 1000.0;
+    lock.lock();
+    if (skip || (st->failed != NULL && st->failed(m))) {
+      s->failed |= 1u << next;
+    }
+    s->done |= 1u << next;
+    s->cv.notify_all();
+  }
+}
+
+// runs the stages added so far on opts.startup_threads threads
+void my_vk_run_startup(MyVk *m, double begin) {
+  MyVkStartup *s = &m->startup;
+  uint32_t threads = m->opts.startup_threads;
+  if (threads == 0) {
+    threads = std::min(std::max(std::thread::hardware_concurrency(), 1u),
+                       (uint32_t)STARTUP_MAX_THREADS);
+  }
+  s->thread_count = std::min(threads, (uint32_t)STARTUP_MAX_THREADS);
+  s->begin = begin;
+  s->done = 0;
+  s->failed = 0;
+  std::thread helpers[STARTUP_MAX_THREADS];
+  for (uint32_t i = 1; i < s->thread_count; ++i) {
+    helpers[i] = std::thread(my_vk_startup_worker, m, i);
+  }
+  my_vk_startup_worker(m, 0);
+  for (uint32_t i = 1; i < s->thread_count; ++i) {
+    helpers[i].join();
+  }
+}
+
+// Everything main needs before the first frame. Stages only wait for what
+// they read: shaders load and pipelines compile while glfw makes the window,
+// devices are enumerated before the surface exists. The staging ring and
+// its transfer queue aren't shared, so the stages that upload are chained.
+void my_vk_startup(MyVk *m, double begin) {
+  uint32_t glfw = my_vk_startup_stage(
+      m, "glfw",
+      [](MyVk *m) {
+        if (!m->opts.headless) {
+          glfwInit();
+        }
+      },
+      0, true);
+  uint32_t window = my_vk_startup_stage(
+      m, "window",
+      [](MyVk *m) {
+        if (!m->opts.headless) {
+          my_vk_create_window(m);
+        }
+      },
+      glfw, true);
+  uint32_t instance =
+      my_vk_startup_stage(m, "instance", my_vk_create_instance, glfw);
+  uint32_t bundle = my_vk_startup_stage(
+      m, "bundle",
+      [](MyVk *m) { my_vk_open_bundle(m, m->opts.bundle_path); }, 0);
+  uint32_t surface = my_vk_startup_stage(
+      m, "surface",
+      [](MyVk *m) {
+        if (!m->opts.headless) {
+          my_vk_create_surface(m);
+        }
+      },
+      window | instance);
+  uint32_t enumerate = my_vk_startup_stage(
+      m, "enumerate devices", my_vk_enumerate_phys_devices, instance);
+  // without a device nothing after this can run
+  uint32_t phys = my_vk_startup_stage(
+      m, "physical device", my_vk_create_phys_device, enumerate | surface,
+      false, [](MyVk *m) { return m->phys_device == VK_NULL_HANDLE; });
+  uint32_t device = my_vk_startup_stage(
+      m, "device",
+      [](MyVk *m) {
+        my_vk_get_queue_indices(m);
+        my_vk_create_device(m);
+        my_vk_allocator_init(m);
+        my_vk_pick_attachments(m);
+        my_vk_create_queues(m);
+      },
+      phys);
+  // glfw hands out the framebuffer size on the main thread only
+  uint32_t swapchain = my_vk_startup_stage(
+      m, "swapchain",
+      [](MyVk *m) {
+        my_vk_create_swapchain(m);
+        my_vk_create_image_views(m);
+        my_vk_set_viewport(m);
+      },
+      device, true);
+  uint32_t cache = my_vk_startup_stage(m, "pipeline cache",
+                                       my_vk_create_pipeline_cache, device);
+  uint32_t commands = my_vk_startup_stage(
+      m, "commands",
+      [](MyVk *m) {
+        my_vk_create_command_pool(m);
+        my_vk_create_command_buffers(m);
+        my_vk_create_staging(m);
+        my_vk_create_frame_arenas(m);
+        my_vk_create_semaphores(m);
+        my_vk_profiler_init(m);
+      },
+      device);
+  uint32_t textures = my_vk_startup_stage(m, "open textures",
+                                          my_vk_open_textures, device | bundle);
+  uint32_t bindless = my_vk_startup_stage(m, "bindless", my_vk_create_bindless,
+                                          textures | commands);
+  uint32_t shaders = my_vk_startup_stage(
+      m, "shaders", my_vk_create_shader_modules, textures | bundle);
+  uint32_t compute = my_vk_startup_stage(m, "compute pipelines",
+                                         my_vk_create_instancing_pipelines,
+                                         device | bundle | cache);
+  uint32_t render = my_vk_startup_stage(
+      m, "render pipeline",
+      [](MyVk *m) {
+        my_vk_create_dynamic_state(m);
+        my_vk_create_render_pipeline(m);
+      },
+      shaders | bindless | cache | compute | commands);
+  uint32_t geometry = my_vk_startup_stage(
+      m, "geometry",
+      [](MyVk *m) {
+        my_vk_create_default_mesh(m);
+        my_vk_create_draw_objects(m);
+      },
+      commands | bindless | bundle);
+  uint32_t upload = my_vk_startup_stage(m, "texture upload",
+                                        my_vk_create_textures, geometry);
+  uint32_t depth = my_vk_startup_stage(
+      m, "depth targets", my_vk_create_depth_targets, swapchain | compute);
+  uint32_t instances = my_vk_startup_stage(
+      m, "instances",
+      [](MyVk *m) {
+        my_vk_create_async_compute(m);
+        my_vk_create_instances(m);
+      },
+      upload | depth);
+  uint32_t scene = my_vk_startup_stage(m, "scene", my_vk_create_scene, device);
+  uint32_t readback =
+      my_vk_startup_stage(m, "readback", my_vk_create_readback, swapchain);
+  // the frame graph is built from everything above
+  my_vk_startup_stage(
+      m, "attachments",
+      [](MyVk *m) {
+        my_vk_create_transients(m);
+        my_vk_create_swapchain_framebuffers(m);
+      },
+      instances | scene | render | readback);
+  my_vk_startup_stage(m, "record jobs", my_vk_create_record_jobs, device);
+  my_vk_startup_stage(m, "hot reload", my_vk_create_hot_reload, render);
+  my_vk_run_startup(m, begin);
+}
+
+// when each stage ran, and on which thread
+void my_vk_print_startup(MyVk *m) {
+  MyVkStartup *s = &m->startup;
+  printf("startup on %u threads:\n", s->thread_count);
+  printf("%-20s %6s %10s %10s\n", "stage", "thread", "start ms", "ms");
+  for (uint32_t i = 0; i < s->count; ++i) {
+    StartupStage *st = &s->stages[i];
+    printf("%-20s %6u %10.3f %10.3f\n", st->name, st->thread, st->begin_ms,
+           st->end_ms - st->begin_ms);
+  }
+}
+
+// sorts samples in place and writes them as a json object
+void write_json_stats(FILE *f, const char *name, double *samples,
+                      uint32_t count) {
+  std::sort(samples, samples + count);
+  double sum = 0.0;
+  for (uint32_t i = 0; i < count; ++i) {
+    sum += samples[i];
+  }
+  fprintf(f,
+          "  \"%s\": {\"samples\": %u, \"min\": %.4f, \"median\": %.4f, "
+          "\"p99\": %.4f, \"max\": %.4f, \"mean\": %.4f}",
+          name, count, count ? samples[0] : 0.0,
+          percentile_sorted(samples, count, 50.0),
+          percentile_sorted(samples, count, 99.0),
+          count ? samples[count - 1] : 0.0, count ? sum / count : 0.0);
+}
+
+// render opts.bench_frames frames and write frame time statistics as json
+struct BenchSamples {
+  double *cpu_ms, *gpu_ms, *record_ms, *latency_ms;
+  // paced frames only: cpu start to shown, and between frames shown
+  double *display_ms, *interval_ms;
+  uint32_t frames, gpu_count, latency_count, display_count, interval_count;
+  double total_s;
+};
+
+// warms up, then renders up to `frames` frames and records their times
+BenchSamples my_vk_bench_frames(MyVk *m, uint32_t frames) {
+  BenchSamples b{};
+  b.cpu_ms = (double *)malloc(sizeof(double) * frames);
+  b.gpu_ms = (double *)malloc(sizeof(double) * frames);
+  b.record_ms = (double *)malloc(sizeof(double) * frames);
+  b.latency_ms = (double *)malloc(sizeof(double) * frames);
+  b.display_ms = (double *)malloc(sizeof(double) * frames);
+  b.interval_ms = (double *)malloc(sizeof(double) * frames);
+
+  // let pipelines, caches and clocks settle before measuring
+  for (uint32_t i = 0; i < m->opts.bench_warmup; ++i) {
+    if (!m->opts.headless) {
+      glfwPollEvents();
+    }
+    my_vk_draw(m);
+  }
+
+  double start = my_vk_time();
+  double frame_start = start;
+  for (b.frames = 0; b.frames < frames; ++b.frames) {
+    if (!m->opts.headless) {
+      glfwPollEvents();
+      if (glfwWindowShouldClose(m->window)) {
+        break;
+      }
+    }
+    m->last_gpu_ms = -1.0;
+    my_vk_draw(m);
+    double now = my_vk_time();
+    b.cpu_ms[b.frames] = (now - frame_start) * 1000.0;
+    b.record_ms[b.frames] = m->last_record_ms;
+    frame_start = now;
+    // gpu time arrives frames_in_flight frames late, which is fine for
+    // statistics over the whole run
+    if (m->last_gpu_ms >= 0.0) {
+      b.gpu_ms[b.gpu_count++] = m->last_gpu_ms;
+    }
+    if (m->last_latency_ms >= 0.0) {
+      b.latency_ms[b.latency_count++] = m->last_latency_ms;
+    }
+    // taken, so a frame that didn't wait doesn't count the last one again
+    if (m->pace.display_latency_ms >= 0.0) {
+      b.display_ms[b.display_count++] = m->pace.display_latency_ms;
+      m->pace.display_latency_ms = -1.0;
+    }
+    if (m->pace.interval_ms >= 0.0) {
+      b.interval_ms[b.interval_count++] = m->pace.interval_ms;
+      m->pace.interval_ms = -1.0;
+    }
+  }
+  b.total_s = my_vk_time() - start;
+  vkDeviceWaitIdle(m->device);
+  return b;
+}
+
+// Jitter is the standard deviation of the intervals between frames being
+// shown, or between cpu frames when nothing waited to see them shown.
+// Without a trailing newline, like write_json_stats.
+void my_vk_write_present_json(MyVk *m, FILE *f, BenchSamples *b) {
+  bool shown = b->interval_count > 0;
+  fprintf(f,
+          "  \"present\": {\"policy\": \"%s\", \"mode\": \"%s\", "
+          "\"images\": %u, \"paced\": %s, \"jitter_of\": \"%s\", "
+          "\"jitter_ms\": %.4f}",
+          my_vk_present_policy_name(m->opts.present_policy),
+          my_vk_present_mode_name(m->present_mode), m->swapchain_images_count,
+          m->pace.enabled ? "true" : "false", shown ? "display" : "cpu",
+          shown ? stddev(b->interval_ms, b->interval_count)
+                : stddev(b->cpu_ms, b->frames));
+}
+
+void my_vk_free_bench_samples(BenchSamples *b) {
+  free(b->cpu_ms);
+  free(b->gpu_ms);
+  free(b->record_ms);
+  free(b->latency_ms);
+  free(b->display_ms);
+  free(b->interval_ms);
+}
+
+// the stages of my_vk_print_startup, as json
+void my_vk_write_startup_json(MyVk *m, FILE *f) {
+  MyVkStartup *s = &m->startup;
+  fprintf(f, "  \"startup_threads\": %u,\n", s->thread_count);
+  fprintf(f, "  \"startup_stages\": [\n");
+  for (uint32_t i = 0; i < s->count; ++i) {
+    StartupStage *st = &s->stages[i];
+    fprintf(f,
+            "    {\"name\": \"%s\", \"thread\": %u, \"start_ms\": %.3f, "
+            "\"ms\": %.3f}%s\n",
+            st->name, st->thread, st->begin_ms, st->end_ms - st->begin_ms,
+            i + 1 < s->count ? "," : "");
+  }
+  fprintf(f, "  ],\n");
+}
+
+FILE *my_vk_open_bench_json(MyVk *m) {
+  if (strcmp(m->opts.bench_json_path, "-") == 0) {
+    return stdout;
+  }
+  FILE *f = fopen(m->opts.bench_json_path, "w");
+  if (f == NULL) {
+    printf("ERROR: could not open %s for writing!\n", m->opts.bench_json_path);
+    return stdout;
+  }
+  return f;
+}
+
+void my_vk_close_bench_json(MyVk *m, FILE *f) {
+  if (f != stdout) {
+    fclose(f);
+    printf("wrote benchmark results to %s\n", m->opts.bench_json_path);
+  }
+}
+
+// the same frames once per recording thread count, to see how recording scales
+void my_vk_run_scaling_benchmark(MyVk *m) {
+  MyVkJobs *j = &m->jobs;
+  FILE *f = my_vk_open_bench_json(m);
+  fprintf(f, "{\n");
+  fprintf(f, "  \"device\": \"%s\",\n", m->phys_props.deviceName);
+  fprintf(f, "  \"draws\": %u,\n", m->opts.draws);
+  fprintf(f, "  \"triangles\": %u,\n", m->index_count / 3);
+  fprintf(f, "  \"runs\": [\n");
+  double single_record_ms = 0.0;
+  for (uint32_t threads = 1; threads <= j->worker_count; ++threads) {
+    j->active = threads;
+    BenchSamples b = my_vk_bench_frames(m, m->opts.bench_frames);
+    double fps = b.total_s > 0.0 ? b.frames / b.total_s : 0.0;
+    // write_json_stats sorts, so take the mean first
+    double record_sum = 0.0;
+    for (uint32_t i = 0; i < b.frames; ++i) {
+      record_sum += b.record_ms[i];
+    }
+    double record_mean = b.frames ? record_sum / b.frames : 0.0;
+    if (threads == 1) {
+      single_record_ms = record_mean;
+    }
+    double speedup = record_mean > 0.0 ? single_record_ms / record_mean : 0.0;
+    printf("%2u threads: %8.3f fps, record %.3f ms (%.2fx)\n", threads, fps,
+           record_mean, speedup);
+
+    fprintf(f, "%s  {\n", threads == 1 ? "" : ",\n");
+    fprintf(f, "  \"threads\": %u,\n", threads);
+    fprintf(f, "  \"frames\": %u,\n", b.frames);
+    fprintf(f, "  \"fps\": %.3f,\n", fps);
+    fprintf(f, "  \"record_speedup\": %.3f,\n", speedup);
+    write_json_stats(f, "record_ms", b.record_ms, b.frames);
+    fprintf(f, ",\n");
+    write_json_stats(f, "cpu_frame_ms", b.cpu_ms, b.frames);
+    fprintf(f, ",\n");
+    write_json_stats(f, "gpu_frame_ms", b.gpu_ms, b.gpu_count);
+    fprintf(f, "\n  }");
+    my_vk_free_bench_samples(&b);
+  }
+  fprintf(f, "\n  ]\n}\n");
+  my_vk_close_bench_json(m, f);
+  j->active = j->worker_count;
+}
+
+// cpu cost of recording and submitting a frame, per instance count and mode
+void my_vk_run_instancing_benchmark(MyVk *m) {
+  MyVkInstancing *in = &m->inst;
+  const uint32_t counts[] = {1000, 10000, 100000};
+  FILE *f = my_vk_open_bench_json(m);
+  fprintf(f, "{\n");
+  fprintf(f, "  \"device\": \"%s\",\n", m->phys_props.deviceName);
+  fprintf(f, "  \"draw_indirect_count\": %s,\n",
+          m->features12.drawIndirectCount ? "true" : "false");
+  fprintf(f, "  \"runs\": [\n");
+  bool first = true;
+  for (uint32_t c = 0; c < sizeof(counts) / sizeof(counts[0]); ++c) {
+    my_vk_fill_instances(m, counts[c]);
+    for (int naive = 1; naive >= 0; --naive) {
+      my_vk_set_naive_instances(m, naive);
+      BenchSamples b = my_vk_bench_frames(m, m->opts.bench_frames);
+      double fps = b.total_s > 0.0 ? b.frames / b.total_s : 0.0;
+      double record_sum = 0.0;
+      for (uint32_t i = 0; i < b.frames; ++i) {
+        record_sum += b.record_ms[i];
+      }
+      printf("%6u instances %-8s: %8.3f fps, record %.3f ms\n", in->count,
+             naive ? "naive" : "indirect", fps,
+             b.frames ? record_sum / b.frames : 0.0);
+
+      fprintf(f, "%s  {\n", first ? "" : ",\n");
+      fprintf(f, "  \"instances\": %u,\n", in->count);
+      fprintf(f, "  \"mode\": \"%s\",\n", naive ? "naive" : "indirect");
+      fprintf(f, "  \"frames\": %u,\n", b.frames);
+      fprintf(f, "  \"fps\": %.3f,\n", fps);
+      write_json_stats(f, "record_ms", b.record_ms, b.frames);
+      fprintf(f, ",\n");
+      write_json_stats(f, "cpu_frame_ms", b.cpu_ms, b.frames);
+      fprintf(f, ",\n");
+      write_json_stats(f, "gpu_frame_ms", b.gpu_ms, b.gpu_count);
+      fprintf(f, "\n  }");
+      my_vk_free_bench_samples(&b);
+      first = false;
+    }
+  }
+  fprintf(f, "\n  ]\n}\n");
+  my_vk_close_bench_json(m, f);
+  my_vk_set_naive_instances(m, m->opts.naive_instances);
+}
+
+// throughput against latency for every frames in flight count: more frames
+// let the cpu run further ahead, which hides stalls but delays the input
+void my_vk_run_latency_benchmark(MyVk *m) {
+  FILE *f = my_vk_open_bench_json(m);
+  fprintf(f, "{\n");
+  fprintf(f, "  \"device\": \"%s\",\n", m->phys_props.deviceName);
+  fprintf(f, "  \"headless\": %s,\n", m->opts.headless ? "true" : "false");
+  fprintf(f, "  \"runs\": [\n");
+  for (uint32_t count = 1; count <= MAX_FRAMES_IN_FLIGHT; ++count) {
+    my_vk_set_frames_in_flight(m, count);
+    BenchSamples b = my_vk_bench_frames(m, m->opts.bench_frames);
+    double fps = b.total_s > 0.0 ? b.frames / b.total_s : 0.0;
+    double latency_sum = 0.0;
+    for (uint32_t i = 0; i < b.latency_count; ++i) {
+      latency_sum += b.latency_ms[i];
+    }
+    printf("%u frames in flight: %8.3f fps, latency %.3f ms\n", count, fps,
+           b.latency_count ? latency_sum / b.latency_count : 0.0);
+
+    fprintf(f, "%s  {\n", count == 1 ? "" : ",\n");
+    fprintf(f, "  \"frames_in_flight\": %u,\n", count);
+    fprintf(f, "  \"frames\": %u,\n", b.frames);
+    fprintf(f, "  \"fps\": %.3f,\n", fps);
+    write_json_stats(f, "latency_ms", b.latency_ms, b.latency_count);
+    fprintf(f, ",\n");
+    write_json_stats(f, "cpu_frame_ms", b.cpu_ms, b.frames);
+    fprintf(f, ",\n");
+    write_json_stats(f, "gpu_frame_ms", b.gpu_ms, b.gpu_count);
+    fprintf(f, "\n  }");
+    my_vk_free_bench_samples(&b);
+  }
+  fprintf(f, "\n  ]\n}\n");
+  my_vk_close_bench_json(m, f);
+  my_vk_set_frames_in_flight(m, m->opts.frames_in_flight);
+}
+
+// Every present policy, paced and not where present wait is there: what each
+// costs in throughput against how long frames take to be shown and how
+// evenly. Policies that fall back to a mode already run are skipped.
+void my_vk_run_present_benchmark(MyVk *m) {
+  uint32_t policy = m->opts.present_policy;
+  FILE *f = my_vk_open_bench_json(m);
+  fprintf(f, "{\n");
+  fprintf(f, "  \"device\": \"%s\",\n", m->phys_props.deviceName);
+  fprintf(f, "  \"present_wait\": %s,\n",
+          m->pace.available ? "true" : "false");
+  fprintf(f, "  \"runs\": [\n");
+  VkPresentModeKHR done[PRESENT_POLICY_COUNT];
+  uint32_t done_count = 0;
+  bool first = true;
+  for (uint32_t p = 0; p < PRESENT_POLICY_COUNT; ++p) {
+    VkPresentModeKHR mode = my_vk_pick_present_mode(m, p);
+    if (std::find(done, done + done_count, mode) != done + done_count) {
+      continue;
+    }
+    done[done_count++] = mode;
+    my_vk_set_present_policy(m, p);
+    for (int paced = 0; paced <= (m->pace.available ? 1 : 0); ++paced) {
+      m->pace.enabled = paced;
+      BenchSamples b = my_vk_bench_frames(m, m->opts.bench_frames);
+      double fps = b.total_s > 0.0 ? b.frames / b.total_s : 0.0;
+      // write_json_stats sorts, so take the means first
+      double latency_sum = 0.0, display_sum = 0.0;
+      for (uint32_t i = 0; i < b.latency_count; ++i) {
+        latency_sum += b.latency_ms[i];
+      }
+      for (uint32_t i = 0; i < b.display_count; ++i) {
+        display_sum += b.display_ms[i];
+      }
+      double jitter = b.interval_count ? stddev(b.interval_ms, b.interval_count)
+                                       : stddev(b.cpu_ms, b.frames);
+      printf("%-8s %-10s %-8s: %8.3f fps, latency %.3f ms, shown after "
+             "%.3f ms, jitter %.3f ms\n",
+             my_vk_present_policy_name(p), my_vk_present_mode_name(mode),
+             paced ? "paced" : "unpaced", fps,
+             b.latency_count ? latency_sum / b.latency_count : 0.0,
+             b.display_count ? display_sum / b.display_count : 0.0, jitter);
+
+      fprintf(f, "%s  {\n", first ? "" : ",\n");
+      first = false;
+      my_vk_write_present_json(m, f, &b);
+      fprintf(f, ",\n");
+      fprintf(f, "  \"frames\": %u,\n", b.frames);
+      fprintf(f, "  \"fps\": %.3f,\n", fps);
+      write_json_stats(f, "latency_ms", b.latency_ms, b.latency_count);
+      fprintf(f, ",\n");
+      write_json_stats(f, "display_latency_ms", b.display_ms,
+                       b.display_count);
+      fprintf(f, ",\n");
+      write_json_stats(f, "display_interval_ms", b.interval_ms,
+                       b.interval_count);
+      fprintf(f, ",\n");
+      write_json_stats(f, "cpu_frame_ms", b.cpu_ms, b.frames);
+      fprintf(f, "\n  }");
+      my_vk_free_bench_samples(&b);
+    }
+  }
+  fprintf(f, "\n  ]\n}\n");
+  my_vk_close_bench_json(m, f);
+  m->pace.enabled = m->opts.pace && m->pace.available;
+  my_vk_set_present_policy(m, policy);
+}
+
+// frames with and without the readback, and how fast and how late frames
+// reach the consumer
+void my_vk_run_readback_benchmark(MyVk *m) {
+  MyVkReadback *r = &m->readback;
+  if (!r->enabled) {
+    return;
+  }
+  uint32_t warmup = m->opts.bench_warmup;
+  r->enabled = false;
+  BenchSamples base = my_vk_bench_frames(m, m->opts.bench_frames);
+  double base_fps = base.total_s > 0.0 ? base.frames / base.total_s : 0.0;
+  my_vk_free_bench_samples(&base);
+
+  // warm up with the readback running, then measure from a clean slate
+  r->enabled = true;
+  BenchSamples b = my_vk_bench_frames(m, 0);
+  my_vk_free_bench_samples(&b);
+  my_vk_drain_readback(m);
+  my_vk_reset_readback(m, m->opts.bench_frames);
+  m->opts.bench_warmup = 0;
+  b = my_vk_bench_frames(m, m->opts.bench_frames);
+  m->opts.bench_warmup = warmup;
+  my_vk_drain_readback(m);
+
+  double fps = b.total_s > 0.0 ? b.frames / b.total_s : 0.0;
+  double mb_per_s = my_vk_readback_mb_per_s(r);
+  VkMemoryPropertyFlags flags =
+      m->mem_props.memoryTypes[r->slots[0].buffer.alloc.type].propertyFlags;
+  uint32_t count = r->sample_count;
+  double frames = count > 0 ? (double)count : 1.0;
+  printf("readback %ux%u: %.3f fps (%.3f without), %llu of %u frames read "
+         "back, %.1f MB/s, latency %.2f frames (%.3f ms)\n",
+         m->extent.width, m->extent.height, fps, base_fps,
+         (unsigned long long)r->frames, b.frames, mb_per_s,
+         r->latency_frames_sum / frames, r->latency_ms_sum / frames);
+
+  FILE *f = my_vk_open_bench_json(m);
+  fprintf(f, "{\n");
+  fprintf(f, "  \"device\": \"%s\",\n", m->phys_props.deviceName);
+  fprintf(f, "  \"width\": %u,\n", m->extent.width);
+  fprintf(f, "  \"height\": %u,\n", m->extent.height);
+  fprintf(f, "  \"consumer\": \"%s\",\n",
+          m->opts.readback_path != NULL ? "file" : "checksum");
+  fprintf(f, "  \"host_cached\": %s,\n",
+          flags & VK_MEMORY_PROPERTY_HOST_CACHED_BIT ? "true" : "false");
+  fprintf(f, "  \"host_coherent\": %s,\n",
+          flags & VK_MEMORY_PROPERTY_HOST_COHERENT_BIT ? "true" : "false");
+  fprintf(f, "  \"slots\": %d,\n", READBACK_SLOTS);
+  fprintf(f, "  \"frames\": %u,\n", b.frames);
+  fprintf(f, "  \"fps\": %.3f,\n", fps);
+  fprintf(f, "  \"fps_without_readback\": %.3f,\n", base_fps);
+  fprintf(f, "  \"frames_read_back\": %llu,\n",
+          (unsigned long long)r->frames);
+  fprintf(f, "  \"frames_dropped\": %llu,\n",
+          (unsigned long long)r->dropped);
+  fprintf(f, "  \"mb_per_s\": %.3f,\n", mb_per_s);
+  write_json_stats(f, "latency_frames", r->latency_frames, count);
+  fprintf(f, ",\n");
+  write_json_stats(f, "latency_ms", r->latency_ms, count);
+  fprintf(f, ",\n");
+  write_json_stats(f, "cpu_frame_ms", b.cpu_ms, b.frames);
+  fprintf(f, "\n}\n");
+  my_vk_close_bench_json(m, f);
+  my_vk_free_bench_samples(&b);
+}
+
+// the instance pre-pass on the graphics queue against the compute queue, with
+// and without occlusion culling. The overlap is how much of the pre-pass' gpu
+// time the async run hides behind graphics work, so the run has to be gpu
+// bound (enough instances) to mean anything.
+void my_vk_run_async_benchmark(MyVk *m) {
+  const uint32_t cull_modes[] = {CULL_FRUSTUM, CULL_FRUSTUM | CULL_OCCLUSION};
+  bool have_async = m->queue_compute_idx != m->queue_graphics_idx;
+  FILE *f = my_vk_open_bench_json(m);
+  fprintf(f, "{\n");
+  fprintf(f, "  \"device\": \"%s\",\n", m->phys_props.deviceName);
+  fprintf(f, "  \"instances\": %u,\n", m->inst.count);
+  fprintf(f, "  \"graphics_family\": %ld,\n", m->queue_graphics_idx);
+  fprintf(f, "  \"compute_family\": %ld,\n", m->queue_compute_idx);
+  fprintf(f, "  \"transfer_family\": %ld,\n", m->queue_transfer_idx);
+  fprintf(f, "  \"runs\": [\n");
+  for (uint32_t c = 0; c < sizeof(cull_modes) / sizeof(cull_modes[0]); ++c) {
+    m->opts.cull_flags = cull_modes[c];
+    const char *cull = cull_modes[c] & CULL_OCCLUSION ? "all" : "frustum";
+    double serial_ms = 0.0, prepass_ms = 0.0;
+    for (int async = 0; async <= (have_async ? 1 : 0); ++async) {
+      my_vk_set_async_compute(m, async);
+      BenchSamples b = my_vk_bench_frames(m, m->opts.bench_frames);
+      double frame_ms = b.frames ? b.total_s * 1000.0 / b.frames : 0.0;
+      double fps = b.total_s > 0.0 ? b.frames / b.total_s : 0.0;
+      double overlap = 0.0;
+      if (!async) {
+        serial_ms = frame_ms;
+        prepass_ms = my_vk_profiler_stats(
+                         m, my_vk_profiler_scope(m, "instance prepass", true))
+                         .mean;
+      } else if (prepass_ms > 0.0) {
+        overlap = std::min(std::max((serial_ms - frame_ms) / prepass_ms, 0.0),
+                           1.0);
+      }
+      printf("cull %-7s %-8s: %8.3f fps, pre-pass %.3f ms, overlap %.0f%%\n",
+             cull, async ? "compute" : "graphics", fps, prepass_ms,
+             overlap * 100.0);
+
+      fprintf(f, "%s  {\n", c == 0 && !async ? "" : ",\n");
+      fprintf(f, "  \"cull\": \"%s\",\n", cull);
+      fprintf(f, "  \"prepass_queue\": \"%s\",\n",
+              async ? "compute" : "graphics");
+      fprintf(f, "  \"frames\": %u,\n", b.frames);
+      fprintf(f, "  \"fps\": %.3f,\n", fps);
+      fprintf(f, "  \"prepass_gpu_ms\": %.4f,\n", prepass_ms);
+      if (async) {
+        fprintf(f, "  \"overlap\": %.4f,\n", overlap);
+      }
+      write_json_stats(f, "cpu_frame_ms", b.cpu_ms, b.frames);
+      fprintf(f, ",\n");
+      write_json_stats(f, "gpu_frame_ms", b.gpu_ms, b.gpu_count);
+      fprintf(f, "\n  }");
+      my_vk_free_bench_samples(&b);
+    }
+  }
+  fprintf(f, "\n  ]\n}\n");
+  my_vk_close_bench_json(m, f);
+  m->opts.cull_flags = cull_modes[1];
+  my_vk_set_async_compute(m, m->opts.async_compute);
+}
 
+// resizes the window every few frames and records how long the frames around
+// the resulting swapchain recreations take, the worst one being the hitch
+void my_vk_run_resize_benchmark(MyVk *m) {
+  const int sizes[][2] = {{800, 600}, {1024, 700}, {640, 480}, {1280, 720},
+                          {900, 900}};
+  const uint32_t size_count = sizeof(sizes) / sizeof(sizes[0]);
+  const uint32_t frames_per_resize = 4;
+  uint32_t frames = m->opts.bench_frames;
+  double *cpu_ms = (double *)malloc(sizeof(double) * frames);
+  uint32_t recreations_before = m->swapchain_recreations;
+  uint32_t resizes = 0;
+
+  for (uint32_t i = 0; i < m->opts.bench_warmup; ++i) {
+    glfwPollEvents();
+    my_vk_draw(m);
+  }
+  double start = my_vk_time();
+  double frame_start = start;
+  uint32_t frame = 0;
+  for (; frame < frames && !glfwWindowShouldClose(m->window); ++frame) {
+    if (frame % frames_per_resize == 0) {
+      const int *size = sizes[resizes++ % size_count];
+      glfwSetWindowSize(m->window, size[0], size[1]);
+    }
+    glfwPollEvents();
     my_vk_draw(m);
+    double now = my_vk_time();
+    cpu_ms[frame] = (now - frame_start) * 1000.0;
+    frame_start = now;
+  }
+  double total_s = my_vk_time() - start;
+  vkDeviceWaitIdle(m->device);
+  uint32_t recreations = m->swapchain_recreations - recreations_before;
+
+  FILE *f = my_vk_open_bench_json(m);
+  fprintf(f, "{\n");
+  fprintf(f, "  \"device\": \"%s\",\n", m->phys_props.deviceName);
+  fprintf(f, "  \"frames\": %u,\n", frame);
+  fprintf(f, "  \"fps\": %.3f,\n", total_s > 0.0 ? frame / total_s : 0.0);
+  fprintf(f, "  \"resizes\": %u,\n", resizes);
+  fprintf(f, "  \"recreations\": %u,\n", recreations);
+  fprintf(f, "  \"debounce_ms\": %.1f,\n", RESIZE_DEBOUNCE_SECONDS * 1000.0);
+  write_json_stats(f, "cpu_frame_ms", cpu_ms, frame);
+  fprintf(f, "\n}\n");
+  my_vk_close_bench_json(m, f);
+  // write_json_stats sorted them
+  printf("%u resizes, %u recreations, worst frame %.3f ms\n", resizes,
+         recreations, frame ? cpu_ms[frame - 1] : 0.0);
+  free(cpu_ms);
+}
+
+// cpu cost of recording the draws with a descriptor set bind per draw against
+// one bindless set bind and a push constant per draw
+void my_vk_run_bindless_benchmark(MyVk *m) {
+  MyVkBindless *bl = &m->bindless;
+  if (bl->pipeline == VK_NULL_HANDLE) {
+    printf("ERROR: no bindless pipeline to benchmark\n");
+    return;
+  }
+  FILE *f = my_vk_open_bench_json(m);
+  fprintf(f, "{\n");
+  fprintf(f, "  \"device\": \"%s\",\n", m->phys_props.deviceName);
+  fprintf(f, "  \"draws\": %u,\n", m->opts.draws);
+  fprintf(f, "  \"textures\": %u,\n", m->tex.count);
+  fprintf(f, "  \"objects\": %u,\n", m->objects.count);
+  fprintf(f, "  \"record_threads\": %u,\n", m->jobs.active);
+  fprintf(f, "  \"runs\": [\n");
+  double sets_record_ms = 0.0;
+  for (uint32_t run = 0; run < 2; ++run) {
+    bl->enabled = run == 1;
+    const char *mode = bl->enabled ? "bindless" : "descriptor sets";
+    BenchSamples b = my_vk_bench_frames(m, m->opts.bench_frames);
+    double fps = b.total_s > 0.0 ? b.frames / b.total_s : 0.0;
+    // write_json_stats sorts, so take the mean first
+    double record_sum = 0.0;
+    for (uint32_t i = 0; i < b.frames; ++i) {
+      record_sum += b.record_ms[i];
+    }
+    double record_mean = b.frames ? record_sum / b.frames : 0.0;
+    if (run == 0) {
+      sets_record_ms = record_mean;
+    }
+    double speedup = record_mean > 0.0 ? sets_record_ms / record_mean : 0.0;
+    printf("%-16s %8.3f fps, record %.3f ms (%.2fx)\n", mode, fps,
+           record_mean, speedup);
+
+    fprintf(f, "%s  {\n", run == 0 ? "" : ",\n");
+    fprintf(f, "  \"mode\": \"%s\",\n", mode);
+    fprintf(f, "  \"frames\": %u,\n", b.frames);
+    fprintf(f, "  \"fps\": %.3f,\n", fps);
+    fprintf(f, "  \"record_speedup\": %.3f,\n", speedup);
+    write_json_stats(f, "record_ms", b.record_ms, b.frames);
+    fprintf(f, ",\n");
+    write_json_stats(f, "cpu_frame_ms", b.cpu_ms, b.frames);
+    fprintf(f, ",\n");
+    write_json_stats(f, "gpu_frame_ms", b.gpu_ms, b.gpu_count);
+    fprintf(f, "\n  }");
+    my_vk_free_bench_samples(&b);
+  }
+  fprintf(f, "\n  ]\n}\n");
+  my_vk_close_bench_json(m, f);
+  bl->enabled = m->opts.bindless;
+}
+
+// what an image of the swapchain's size takes, without creating one
+VkDeviceSize my_vk_attachment_size(MyVk *m, VkFormat format,
+                                   VkImageUsageFlags usage,
+                                   VkSampleCountFlagBits samples) {
+  VkImageCreateInfo imageInfo{};
+  imageInfo.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
+  imageInfo.imageType = VK_IMAGE_TYPE_2D;
+  imageInfo.format = format;
+  imageInfo.extent = VkExtent3D{m->extent.width, m->extent.height, 1};
+  imageInfo.mipLevels = 1;
+  imageInfo.arrayLayers = 1;
+  imageInfo.samples = samples;
+  imageInfo.tiling = VK_IMAGE_TILING_OPTIMAL;
+  imageInfo.usage = usage;
+  imageInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+  imageInfo.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+  VkDeviceImageMemoryRequirements info{};
+  info.sType = VK_STRUCTURE_TYPE_DEVICE_IMAGE_MEMORY_REQUIREMENTS;
+  info.pCreateInfo = &imageInfo;
+  VkMemoryRequirements2 reqs{};
+  reqs.sType = VK_STRUCTURE_TYPE_MEMORY_REQUIREMENTS_2;
+  vkGetDeviceImageMemoryRequirements(m->device, &info, &reqs);
+  return reqs.memoryRequirements.size;
+}
+
+// The attachments the main pass would have at every depth format and sample
+// count the device supports, at the current size, beside the swapchain image.
+// Multisampled targets and depth nothing samples only live in the pass, so
+// they can be lazily allocated; the depth the hi-z build samples can't.
+void my_vk_run_attachment_benchmark(MyVk *m) {
+  const VkFormat depths[] = {VK_FORMAT_UNDEFINED, VK_FORMAT_D32_SFLOAT,
+                             VK_FORMAT_D24_UNORM_S8_UINT};
+  const VkImageUsageFlags lazy_usage =
+      VK_IMAGE_USAGE_TRANSIENT_ATTACHMENT_BIT;
+  const VkPhysicalDeviceLimits *limits = &m->phys_props.limits;
+  bool hiz = my_vk_has_hiz(m);
+  FILE *f = my_vk_open_bench_json(m);
+  fprintf(f, "{\n");
+  fprintf(f, "  \"device\": \"%s\",\n", m->phys_props.deviceName);
+  fprintf(f, "  \"width\": %u,\n  \"height\": %u,\n", m->extent.width,
+          m->extent.height);
+  fprintf(f, "  \"hi_z\": %s,\n", hiz ? "true" : "false");
+  fprintf(f, "  \"lazy_memory\": %s,\n",
+          m->attach.lazy_memory ? "true" : "false");
+  fprintf(f, "  \"configs\": [\n");
+  printf("%-6s %7s %10s %10s\n", "depth", "samples", "MiB", "lazy MiB");
+  bool first = true;
+  for (VkFormat depth : depths) {
+    // the hi-z culling needs depth
+    if (depth == VK_FORMAT_UNDEFINED && hiz) {
+      continue;
+    }
+    VkSampleCountFlags counts = limits->framebufferColorSampleCounts;
+    if (depth != VK_FORMAT_UNDEFINED) {
+      VkFormatProperties props;
+      vkGetPhysicalDeviceFormatProperties(m->phys_device, depth, &props);
+      VkFormatFeatureFlags wanted =
+          VK_FORMAT_FEATURE_DEPTH_STENCIL_ATTACHMENT_BIT |
+          (hiz ? VK_FORMAT_FEATURE_SAMPLED_IMAGE_BIT : 0);
+      if ((props.optimalTilingFeatures & wanted) != wanted) {
+        continue;
+      }
+      counts &= limits->framebufferDepthSampleCounts;
+      if (my_vk_has_stencil(depth)) {
+        counts &= limits->framebufferStencilSampleCounts;
+      }
+    }
+    for (uint32_t n = 1; n <= 8; n *= 2) {
+      if (!(counts & n)) {
+        continue;
+      }
+      VkSampleCountFlagBits samples = (VkSampleCountFlagBits)n;
+      VkDeviceSize bytes = 0, lazy = 0;
+      if (n > 1) {
+        lazy += my_vk_attachment_size(
+            m, m->format.format,
+            VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | lazy_usage, samples);
+      }
+      if (depth != VK_FORMAT_UNDEFINED) {
+        VkImageUsageFlags usage = VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT;
+        if (hiz) {
+          // sampled, at one sample, and the target of the resolve if any
+          bytes += my_vk_attachment_size(m, depth,
+                                         usage | VK_IMAGE_USAGE_SAMPLED_BIT,
+                                         VK_SAMPLE_COUNT_1_BIT);
+        }
+        if (!hiz || n > 1) {
+          lazy += my_vk_attachment_size(m, depth, usage | lazy_usage,
+                                        samples);
+        }
+      }
+      if (!m->attach.lazy_memory) {
+        // still only used in the pass, but backed anyway
+        bytes += lazy;
+        lazy = 0;
+      }
+      printf("%-6s %7u %10.2f %10.2f\n", my_vk_depth_format_name(depth), n,
+             (bytes + lazy) / (1024.0 * 1024.0), lazy / (1024.0 * 1024.0));
+      fprintf(f,
+              "%s    {\"depth\": \"%s\", \"samples\": %u, \"bytes\": %llu, "
+              "\"lazy_bytes\": %llu}",
+              first ? "" : ",\n", my_vk_depth_format_name(depth), n,
+              (unsigned long long)(bytes + lazy), (unsigned long long)lazy);
+      first = false;
+    }
+  }
+  fprintf(f, "\n  ]\n}\n");
+  my_vk_close_bench_json(m, f);
+}
+
+// one heap object per node, linked to its first child and next sibling, the
+// way a scene graph is usually first written
+struct NaiveNode {
+  glm::mat4 local, world;
+  NaiveNode *first_child, *next_sibling;
+};
+
+void my_vk_naive_update(NaiveNode *n, const glm::mat4 &parent) {
+  for (; n != NULL; n = n->next_sibling) {
+    n->world = parent * n->local;
+    my_vk_naive_update(n->first_child, n->world);
+  }
+}
+
+// Full updates of the same random hierarchy: recursion over heap nodes with
+// glm, then the scene module with the scalar kernel, the best SIMD kernel,
+// and that on all threads. Every update has all roots dirty. The copy into
+// an upload buffer isn't timed, the naive one has none.
+void my_vk_run_scene_benchmark(MyVk *m) {
+  uint32_t sizes[] = {10000, 100000, 1000000};
+  uint32_t size_count = 3;
+  if (m->opts.scene_nodes > 0) {
+    sizes[0] = m->opts.scene_nodes;
+    size_count = 1;
+  }
+  SceneKernel simd = scene_best_kernel();
+  // mean of as many runs as fit in half a second, after one to warm up
+  auto time_ms = [](auto update) {
+    update();
+    uint32_t runs = 0;
+    double start = my_vk_time(), elapsed = 0.0;
+    while (elapsed < 0.5) {
+      update();
+      ++runs;
+      elapsed = my_vk_time() - start;
+    }
+    return elapsed * 1000.0 / runs;
+  };
+  auto update_all = [](Scene *s) {
+    for (uint32_t r = 0; r < s->level_start[1]; ++r) {
+      scene_set_local(s, r, s->local[r]);
+    }
+    scene_update(s);
+  };
+
+  FILE *f = my_vk_open_bench_json(m);
+  fprintf(f, "{\n");
+  fprintf(f, "  \"kernel\": \"%s\",\n", scene_kernel_name(simd));
+  fprintf(f, "  \"sizes\": [\n");
+  printf("simd kernel: %s\n", scene_kernel_name(simd));
+  printf("%9s %10s %10s %10s %10s %8s\n", "nodes", "naive ms", "scalar ms",
+         "simd ms", "thread ms", "threads");
+  for (uint32_t k = 0; k < size_count; ++k) {
+    uint32_t n = sizes[k];
+    Scene s{};
+    if (!scene_create(&s, n, 1, 1)) {
+      break;
+    }
+    // the same tree, every node allocated on its own
+    NaiveNode **nodes = (NaiveNode **)malloc(sizeof(NaiveNode *) * n);
+    for (uint32_t i = 0; i < n; ++i) {
+      nodes[i] = new NaiveNode{};
+      nodes[i]->local = s.local[i];
+    }
+    uint32_t roots = s.level_start[1];
+    for (uint32_t i = n; i-- > roots;) {
+      NaiveNode *parent = nodes[s.parent[i]];
+      nodes[i]->next_sibling = parent->first_child;
+      parent->first_child = nodes[i];
+    }
+    for (uint32_t i = 0; i + 1 < roots; ++i) {
+      nodes[i]->next_sibling = nodes[i + 1];
+    }
+    glm::mat4 identity(1.0f);
+    double naive_ms =
+        time_ms([&] { my_vk_naive_update(nodes[0], identity); });
+
+    s.kernel = SCENE_KERNEL_SCALAR;
+    double scalar_ms = time_ms([&] { update_all(&s); });
+    s.kernel = simd;
+    double simd_ms = time_ms([&] { update_all(&s); });
+    uint32_t depth = s.level_count;
+    scene_destroy(&s);
+
+    Scene t{};
+    if (!scene_create(&t, n, m->opts.scene_threads, 1)) {
+      break;
+    }
+    t.kernel = simd;
+    double thread_ms = time_ms([&] { update_all(&t); });
+    // the kernels may round differently than glm, not by much
+    float max_error = 0.0f;
+    for (uint32_t i = 0; i < n; ++i) {
+      for (int c = 0; c < 4; ++c) {
+        for (int r = 0; r < 4; ++r) {
+          max_error = std::max(
+              max_error, fabsf(t.world[i][c][r] - nodes[i]->world[c][r]));
+        }
+      }
+    }
+    uint32_t threads = t.workers.count;
+    scene_destroy(&t);
+    for (uint32_t i = 0; i < n; ++i) {
+      delete nodes[i];
+    }
+    free(nodes);
+
+    printf("%9u %10.3f %10.3f %10.3f %10.3f %8u\n", n, naive_ms, scalar_ms,
+           simd_ms, thread_ms, threads);
+    fprintf(f,
+            "%s    {\"nodes\": %u, \"depth\": %u, \"naive_ms\": %.4f, "
+            "\"scalar_ms\": %.4f, \"simd_ms\": %.4f, \"thread_ms\": %.4f, "
+            "\"threads\": %u, \"max_error\": %g}",
+            k == 0 ? "" : ",\n", n, depth, naive_ms, scalar_ms, simd_ms,
+            thread_ms, threads, max_error);
+  }
+  fprintf(f, "\n  ]\n}\n");
+  my_vk_close_bench_json(m, f);
+}
+
+void my_vk_run_benchmark(MyVk *m) {
+  BenchSamples b = my_vk_bench_frames(m, m->opts.bench_frames);
+  uint32_t frames = b.frames;
+  double total_s = b.total_s;
+
+  FILE *f = my_vk_open_bench_json(m);
+  fprintf(f, "{\n");
+  fprintf(f, "  \"device\": \"%s\",\n", m->phys_props.deviceName);
+  fprintf(f, "  \"headless\": %s,\n", m->opts.headless ? "true" : "false");
+  fprintf(f, "  \"width\": %u,\n  \"height\": %u,\n", m->extent.width,
+          m->extent.height);
+  fprintf(f, "  \"pipeline_cache\": \"%s\",\n",
+          m->pipeline_cache_warm ? "warm" : "cold");
+  fprintf(f, "  \"pipeline_create_ms\": %.3f,\n", m->pipeline_create_ms);
+  fprintf(f, "  \"startup_ms\": %.3f,\n", m->startup_ms);
+  fprintf(f, "  \"startup_rss_kb\": %ld,\n", m->startup_rss_kb);
+  my_vk_write_startup_json(m, f);
+  fprintf(f, "  \"draws\": %u,\n", m->opts.draws);
+  fprintf(f, "  \"record_threads\": %u,\n", m->jobs.active);
+  fprintf(f, "  \"frames_in_flight\": %u,\n", m->frames_in_flight);
+  fprintf(f, "  \"frames\": %u,\n", frames);
+  fprintf(f, "  \"fps\": %.3f,\n", total_s > 0.0 ? frames / total_s : 0.0);
+  MyVkAllocatorStats mem = my_vk_allocator_stats(m);
+  fprintf(f,
+          "  \"gpu_memory\": {\"allocations\": %u, \"blocks\": %u, "
+          "\"dedicated\": %u, \"used_bytes\": %llu, \"reserved_bytes\": "
+          "%llu, \"fragmentation\": %.4f},\n",
+          mem.allocations, mem.blocks, mem.dedicated,
+          (unsigned long long)mem.used_bytes,
+          (unsigned long long)mem.reserved_bytes, mem.fragmentation);
+  fprintf(f,
+          "  \"attachments\": {\"samples\": %u, \"depth\": \"%s\", "
+          "\"bytes\": %llu, \"lazy_bytes\": %llu},\n",
+          (uint32_t)m->attach.samples,
+          my_vk_depth_format_name(m->attach.depth_format),
+          (unsigned long long)m->attach.bytes,
+          (unsigned long long)m->attach.lazy_bytes);
+  if (!m->opts.headless) {
+    my_vk_write_present_json(m, f, &b);
+    fprintf(f, ",\n");
+  }
+  if (m->inst.count > 0) {
+    MyVkCulling *c = &m->cull;
+    fprintf(f,
+            "  \"culling\": {\"instances\": %u, \"visible\": %u, "
+            "\"frustum_culled\": %u, \"occlusion_culled\": %u, "
+            "\"vertex_invocations\": %llu, \"fragment_invocations\": "
+            "%llu},\n",
+            m->inst.count, c->last.visible, c->last.frustum_culled,
+            c->last.occlusion_culled,
+            (unsigned long long)c->last_invocations[0],
+            (unsigned long long)c->last_invocations[1]);
+  }
+  write_json_stats(f, "cpu_frame_ms", b.cpu_ms, frames);
+  fprintf(f, ",\n");
+  write_json_stats(f, "gpu_frame_ms", b.gpu_ms, b.gpu_count);
+  fprintf(f, ",\n");
+  write_json_stats(f, "record_ms", b.record_ms, frames);
+  fprintf(f, ",\n");
+  write_json_stats(f, "latency_ms", b.latency_ms, b.latency_count);
+  if (b.display_count > 0) {
+    fprintf(f, ",\n");
+    write_json_stats(f, "display_latency_ms", b.display_ms, b.display_count);
+    fprintf(f, ",\n");
+    write_json_stats(f, "display_interval_ms", b.interval_ms,
+                     b.interval_count);
+  }
+  fprintf(f, ",\n  \"scopes\": {\n");
+  my_vk_profiler_write_json(m, f);
+  fprintf(f, "\n  }\n}\n");
+  my_vk_close_bench_json(m, f);
+  my_vk_free_bench_samples(&b);
+}
+
+void my_vk_print_usage(const char *exe) {
+  printf("usage: %s [options]\n"
+         "  --headless          render offscreen, no window or display\n"
+         "  --size WxH          offscreen resolution (default 800x600)\n"
+         "  --frames N          exit after N frames\n"
+         "  --bench N           benchmark N frames and write json stats\n"
+         "  --bench-warmup N    frames to skip before measuring (default 60)\n"
+         "  --bench-json PATH   benchmark output file, - for stdout\n"
+         "  --no-validation     don't enable validation layers\n"
+         "  --profile           print cpu/gpu scope timings every 2 seconds\n"
+         "  --verbose           list extensions, devices and formats, and "
+         "time every\n"
+         "                      startup stage\n"
+         "  --startup-threads N run startup on N threads (default all "
+         "cores, up to %d)\n"
+         "  --trace PATH        write a chrome://tracing json on exit\n"
+         "  --pipeline-cache P  pipeline cache file (default "
+         "pipeline_cache.bin)\n"
+         "  --no-pipeline-cache start cold and don't write the cache\n"
+         "  --mesh-grid N       draw an NxN grid of quads (2*N*N triangles)\n"
+         "  --mesh PATH         load the mesh from a .mesh file, or the bundle "
+         "entry PATH\n"
+         "  --bundle PATH       asset bundle to load from (default "
+         ASSET_BUNDLE ")\n"
+         "  --no-bundle         load shaders and meshes from loose files\n"
+         "  --write-mesh PATH   save the generated mesh as a .mesh file\n"
+         "  --texture PATH      stream a .ktx2 file or bundle entry, can be\n"
+         "                      repeated, draw i of N samples texture i %% N\n"
+         "  --texture-budget MB device memory for textures (default 256)\n"
+         "  --write-texture P   save a generated checkerboard as a .ktx2 file\n"
+         "  --bindless          index textures and draw data in one bindless\n"
+         "                      set, draws only push constants\n"
+         "  --bench-bindless    compare recording with per draw descriptor\n"
+         "                      sets against bindless\n"
+         "  --draws N           split the mesh into N draw calls\n"
+         "  --record-threads N  record draws into secondary command buffers\n"
+         "                      on N threads (0 = inline, the default)\n"
+         "  --bench-scaling     benchmark 1..record-threads (or all cores)\n"
+         "  --instances N       draw N instances with a gpu-driven indirect "
+         "draw\n"
+         "  --naive-instances   draw them with one vkCmdDrawIndexed each\n"
+         "  --bench-instances   compare both at 1k, 10k and 100k instances\n"
+         "  --cull MODE         instance culling: none, frustum or all "
+         "(default)\n"
+         "  --frames-in-flight N  frames the cpu may be ahead, 1 to %d "
+         "(default 2)\n"
+         "  --bench-latency     benchmark latency at every frames in flight\n"
+         "  --async-compute     run the instance pre-pass on the compute "
+         "queue\n"
+         "  --bench-async       measure how much of the pre-pass overlaps "
+         "graphics\n"
+         "  --bench-resize      resize the window every few frames, report "
+         "the worst frame\n"
+         "  --track-handles     count live vulkan objects, report leaks on "
+         "exit\n"
+         "  --hot-reload        rebuild pipelines when a shader source "
+         "changes\n"
+         "  --render-pass       draw with a render pass and framebuffers "
+         "instead of\n"
+         "                      dynamic rendering\n"
+         "  --dump-graph        print the compiled render graph and its "
+         "transient memory\n"
+         "  --depth FORMAT      give the main pass a d32 or d24s8 depth "
+         "buffer\n"
+         "  --msaa N            render with 2, 4 or 8 samples per pixel\n"
+         "  --bench-attachments report the attachment memory of every "
+         "configuration\n"
+         "  --scene N           update a hierarchy of N transforms every "
+         "frame\n"
+         "  --scene-threads N   threads that update it (default all cores)\n"
+         "  --bench-scene       compare the scene update with naive glm at "
+         "10k, 100k\n"
+         "                      and 1M nodes\n"
+         "  --present POLICY    latency (default), mailbox or fifo\n"
+         "  --pace              start frames just in time for the next "
+         "vblank\n"
+         "  --bench-present     benchmark every present policy, paced and "
+         "not\n"
+         "  --readback PATH     copy every frame back and write its raw "
+         "pixels to a\n"
+         "                      file or pipe\n"
+         "  --bench-readback    report readback throughput and latency\n",
+         exe, STARTUP_MAX_THREADS, MAX_FRAMES_IN_FLIGHT);
+}
+
+bool my_vk_parse_args(MyVkOptions *o, int argc, char **argv) {
+  for (int i = 1; i < argc; ++i) {
+    const char *arg = argv[i];
+    // every option except the flags takes exactly one value
+    const char *val = i + 1 < argc ? argv[i + 1] : NULL;
+    if (strcmp(arg, "--headless") == 0) {
+      o->headless = true;
+    } else if (strcmp(arg, "--no-validation") == 0) {
+      o->validation = false;
+    } else if (strcmp(arg, "--no-pipeline-cache") == 0) {
+      o->pipeline_cache_path = NULL;
+    } else if (strcmp(arg, "--pipeline-cache") == 0 && val) {
+      o->pipeline_cache_path = val;
+      ++i;
+    } else if (strcmp(arg, "--profile") == 0) {
+      o->profile = true;
+    } else if (strcmp(arg, "--verbose") == 0) {
+      o->verbose = true;
+    } else if (strcmp(arg, "--startup-threads") == 0 && val) {
+      o->startup_threads = (uint32_t)strtoul(val, NULL, 10);
+      ++i;
+    } else if (strcmp(arg, "--trace") == 0 && val) {
+      o->trace_path = val;
+      ++i;
+    } else if (strcmp(arg, "--size") == 0 && val) {
+      if (sscanf(val, "%ux%u", &o->width, &o->height) != 2) {
+        printf("ERROR: --size wants WxH, got `%s`\n", val);
+        return false;
+      }
+      ++i;
+    } else if (strcmp(arg, "--frames") == 0 && val) {
+      o->frames = (uint32_t)strtoul(val, NULL, 10);
+      ++i;
+    } else if (strcmp(arg, "--no-bundle") == 0) {
+      o->bundle_path = NULL;
+    } else if (strcmp(arg, "--bundle") == 0 && val) {
+      o->bundle_path = val;
+      ++i;
+    } else if (strcmp(arg, "--write-mesh") == 0 && val) {
+      o->write_mesh_path = val;
+      ++i;
+    } else if (strcmp(arg, "--mesh") == 0 && val) {
+      o->mesh_path = val;
+      ++i;
+    } else if (strcmp(arg, "--texture") == 0 && val) {
+      if (o->texture_count == MAX_TEXTURES) {
+        printf("ERROR: at most %d textures\n", MAX_TEXTURES);
+        return false;
+      }
+      o->texture_paths[o->texture_count++] = val;
+      ++i;
+    } else if (strcmp(arg, "--texture-budget") == 0 && val) {
+      o->texture_budget_mb = (uint32_t)strtoul(val, NULL, 10);
+      ++i;
+    } else if (strcmp(arg, "--write-texture") == 0 && val) {
+      o->write_texture_path = val;
+      ++i;
+    } else if (strcmp(arg, "--bindless") == 0) {
+      o->bindless = true;
+    } else if (strcmp(arg, "--bench-bindless") == 0) {
+      o->bench_bindless = true;
+    } else if (strcmp(arg, "--mesh-grid") == 0 && val) {
+      o->mesh_grid = (uint32_t)strtoul(val, NULL, 10);
+      ++i;
+    } else if (strcmp(arg, "--draws") == 0 && val) {
+      o->draws = (uint32_t)strtoul(val, NULL, 10);
+      ++i;
+    } else if (strcmp(arg, "--record-threads") == 0 && val) {
+      o->record_threads = (uint32_t)strtoul(val, NULL, 10);
+      ++i;
+    } else if (strcmp(arg, "--bench-scaling") == 0) {
+      o->bench_scaling = true;
+    } else if (strcmp(arg, "--instances") == 0 && val) {
+      o->instances = (uint32_t)strtoul(val, NULL, 10);
+      ++i;
+    } else if (strcmp(arg, "--naive-instances") == 0) {
+      o->naive_instances = true;
+    } else if (strcmp(arg, "--bench-instances") == 0) {
+      o->bench_instances = true;
+    } else if (strcmp(arg, "--cull") == 0 && val) {
+      if (strcmp(val, "none") == 0) {
+        o->cull_flags = 0;
+      } else if (strcmp(val, "frustum") == 0) {
+        o->cull_flags = CULL_FRUSTUM;
+      } else if (strcmp(val, "all") == 0) {
+        o->cull_flags = CULL_FRUSTUM | CULL_OCCLUSION;
+      } else {
+        printf("ERROR: --cull wants none, frustum or all, got `%s`\n", val);
+        return false;
+      }
+      ++i;
+    } else if (strcmp(arg, "--frames-in-flight") == 0 && val) {
+      o->frames_in_flight = (uint32_t)strtoul(val, NULL, 10);
+      if (o->frames_in_flight < 1 ||
+          o->frames_in_flight > MAX_FRAMES_IN_FLIGHT) {
+        printf("ERROR: --frames-in-flight wants 1 to %d, got `%s`\n",
+               MAX_FRAMES_IN_FLIGHT, val);
+        return false;
+      }
+      ++i;
+    } else if (strcmp(arg, "--bench-latency") == 0) {
+      o->bench_latency = true;
+    } else if (strcmp(arg, "--async-compute") == 0) {
+      o->async_compute = true;
+    } else if (strcmp(arg, "--bench-async") == 0) {
+      o->bench_async = true;
+    } else if (strcmp(arg, "--bench-resize") == 0) {
+      o->bench_resize = true;
+    } else if (strcmp(arg, "--track-handles") == 0) {
+      o->track_handles = true;
+    } else if (strcmp(arg, "--hot-reload") == 0) {
+      o->hot_reload = true;
+    } else if (strcmp(arg, "--render-pass") == 0) {
+      o->render_pass = true;
+    } else if (strcmp(arg, "--dump-graph") == 0) {
+      o->dump_graph = true;
+    } else if (strcmp(arg, "--depth") == 0 && val) {
+      if (strcmp(val, "d32") == 0) {
+        o->depth_format = VK_FORMAT_D32_SFLOAT;
+      } else if (strcmp(val, "d24s8") == 0) {
+        o->depth_format = VK_FORMAT_D24_UNORM_S8_UINT;
+      } else {
+        printf("ERROR: --depth wants d32 or d24s8, got `%s`\n", val);
+        return false;
+      }
+      ++i;
+    } else if (strcmp(arg, "--msaa") == 0 && val) {
+      o->msaa = (uint32_t)strtoul(val, NULL, 10);
+      if (o->msaa != 1 && o->msaa != 2 && o->msaa != 4 && o->msaa != 8) {
+        printf("ERROR: --msaa wants 1, 2, 4 or 8, got `%s`\n", val);
+        return false;
+      }
+      ++i;
+    } else if (strcmp(arg, "--bench-attachments") == 0) {
+      o->bench_attachments = true;
+    } else if (strcmp(arg, "--scene") == 0 && val) {
+      o->scene_nodes = (uint32_t)strtoul(val, NULL, 10);
+      ++i;
+    } else if (strcmp(arg, "--scene-threads") == 0 && val) {
+      o->scene_threads = (uint32_t)strtoul(val, NULL, 10);
+      ++i;
+    } else if (strcmp(arg, "--bench-scene") == 0) {
+      o->bench_scene = true;
+    } else if (strcmp(arg, "--present") == 0 && val) {
+      if (strcmp(val, "latency") == 0) {
+        o->present_policy = PRESENT_LATENCY;
+      } else if (strcmp(val, "mailbox") == 0) {
+        o->present_policy = PRESENT_MAILBOX;
+      } else if (strcmp(val, "fifo") == 0) {
+        o->present_policy = PRESENT_FIFO;
+      } else {
+        printf("ERROR: --present wants latency, mailbox or fifo, got `%s`\n",
+               val);
+        return false;
+      }
+      ++i;
+    } else if (strcmp(arg, "--pace") == 0) {
+      o->pace = true;
+    } else if (strcmp(arg, "--bench-present") == 0) {
+      o->bench_present = true;
+    } else if (strcmp(arg, "--readback") == 0 && val) {
+      o->readback_path = val;
+      ++i;
+    } else if (strcmp(arg, "--bench-readback") == 0) {
+      o->bench_readback = true;
+    } else if (strcmp(arg, "--bench") == 0 && val) {
+      o->bench_frames = (uint32_t)strtoul(val, NULL, 10);
+      ++i;
+    } else if (strcmp(arg, "--bench-warmup") == 0 && val) {
+      o->bench_warmup = (uint32_t)strtoul(val, NULL, 10);
+      ++i;
+    } else if (strcmp(arg, "--bench-json") == 0 && val) {
+      o->bench_json_path = val;
+      ++i;
+    } else {
+      return false;
+    }
+  }
+  // headless can't be closed by the user
+  if (o->headless && o->frames == 0) {
+    o->frames = 300;
+  }
+  if (o->draws == 0) {
+    o->draws = 1;
+  }
+  // give many draws a grid with at least one triangle each
+  if (o->draws > 1 && o->mesh_grid == 0) {
+    o->mesh_grid = (uint32_t)ceil(sqrt(o->draws / 2.0));
+  }
+  if (o->bench_instances && o->instances == 0) {
+    o->instances = 1000;
+  }
+  if (o->bench_async && o->instances == 0) {
+    o->instances = 100000;
+  }
+  if (o->bench_resize && o->headless) {
+    printf("ERROR: --bench-resize needs a window\n");
+    return false;
+  }
+  if ((o->bench_present || o->pace) && o->headless) {
+    printf("ERROR: headless frames aren't presented\n");
+    return false;
+  }
+  if (o->bench_async && o->naive_instances) {
+    printf("ERROR: naive instances have no pre-pass to move\n");
+    return false;
+  }
+  if ((o->bench_scaling || o->bench_instances || o->bench_latency ||
+       o->bench_async || o->bench_resize || o->bench_bindless ||
+       o->bench_present || o->bench_readback) &&
+      o->bench_frames == 0) {
+    o->bench_frames = 500;
+  }
+  if (o->instances > 0 && (o->record_threads > 0 || o->bench_scaling)) {
+    printf("ERROR: instanced drawing is recorded on the main thread only\n");
+    return false;
+  }
+  if (o->instances > 0 && o->texture_count > 0) {
+    printf("ERROR: instances aren't textured\n");
+    return false;
+  }
+  if ((o->bindless || o->bench_bindless) && o->texture_count == 0) {
+    printf("ERROR: bindless draws are textured, give a --texture\n");
+    return false;
+  }
+  return true;
+}
+
+// the device and what startup made before it, also after a failed startup
+void my_vk_destroy_context(MyVk *m) {
+  my_vk_close_bundle(m);
+  vkDestroyDevice(m->device, nullptr);
+  if (!m->opts.headless) {
+    vkDestroySurfaceKHR(m->instance, m->surface, nullptr);
+  }
+  vkDestroyInstance(m->instance, nullptr);
+  if (!m->opts.headless) {
+    glfwDestroyWindow(m->window);
+    glfwTerminate();
+  }
+}
+
+int main(int argc, char **argv) {
+  double startup_begin = my_vk_time();
+  MyVk my_vk{};
+  MyVk *m = &my_vk;
+
+  if (!my_vk_parse_args(&m->opts, argc, argv)) {
+    my_vk_print_usage(argv[0]);
+    return 1;
+  }
+  m->tracker.enabled = m->opts.track_handles;
+
+  my_vk_startup(m, startup_begin);
+  if (m->startup.failed != 0) {
+    my_vk_destroy_context(m);
+    return 1;
+  }
+  m->startup_ms = (my_vk_time() - startup_begin) * 1000.0;
+  rusage usage;
+  getrusage(RUSAGE_SELF, &usage);
+  m->startup_rss_kb = usage.ru_maxrss; // kilobytes on linux
+  printf("startup took %.3f ms (%s pipeline cache), peak rss %ld KiB\n",
+         m->startup_ms, m->pipeline_cache_warm ? "warm" : "cold",
+         m->startup_rss_kb);
+  if (m->opts.verbose || m->opts.profile) {
+    my_vk_print_startup(m);
+  }
+
+  if (m->opts.bench_scaling) {
+    my_vk_run_scaling_benchmark(m);
+  } else if (m->opts.bench_instances) {
+    my_vk_run_instancing_benchmark(m);
+  } else if (m->opts.bench_latency) {
+    my_vk_run_latency_benchmark(m);
+  } else if (m->opts.bench_async) {
+    my_vk_run_async_benchmark(m);
+  } else if (m->opts.bench_resize) {
+    my_vk_run_resize_benchmark(m);
+  } else if (m->opts.bench_bindless) {
+    my_vk_run_bindless_benchmark(m);
+  } else if (m->opts.bench_attachments) {
+    my_vk_run_attachment_benchmark(m);
+  } else if (m->opts.bench_scene) {
+    my_vk_run_scene_benchmark(m);
+  } else if (m->opts.bench_present) {
+    my_vk_run_present_benchmark(m);
+  } else if (m->opts.bench_readback) {
+    my_vk_run_readback_benchmark(m);
+  } else if (m->opts.bench_frames > 0) {
+    my_vk_run_benchmark(m);
+  } else {
+    uint32_t frame = 0;
+    double last_profile_print = my_vk_time();
+    while (m->opts.headless || !glfwWindowShouldClose(m->window)) {
+      if (m->opts.frames != 0 && frame >= m->opts.frames) {
+        break;
+      }
+      if (!m->opts.headless) {
+        glfwPollEvents();
+      }
+
+      my_vk_draw(m);
+      ++frame;
+
+      if (m->opts.profile && my_vk_time() - last_profile_print > 2.0) {
+        my_vk_profiler_print(m);
+        if (m->inst.count > 0) {
+          my_vk_print_cull_stats(m);
+        }
+        my_vk_print_textures(m);
+        if (m->readback.enabled) {
+          my_vk_print_readback(m);
+        }
+        my_vk_print_handles(m, false);
+        last_profile_print = my_vk_time();
+      }
+    }
   }
   // EXIT
   vkDeviceWaitIdle(m->device);
+  if (m->opts.trace_path != NULL) {
+    my_vk_profiler_write_trace(m, m->opts.trace_path);
+  }
 
+  my_vk_destroy_hot_reload(m);
+  my_vk_destroy_readback(m);
+  my_vk_run_deletions(m, true);
   my_vk_deinit_swapchain(m);
 
   for (uint32_t i = 0; i < MAX_FRAMES_IN_FLIGHT; ++i) {
-    vkDestroySemaphore(m->device, m->imageAvailableSemaphores[i], nullptr);
-    vkDestroySemaphore(m->device, m->renderFinishedSemaphores[i], nullptr);
-    vkDestroyFence(m->device, m->inFlightFences[i], nullptr);
-  }
-  vkDestroyCommandPool(m->device, m->commandPool, nullptr);
-  vkDestroyPipeline(m->device, m->graphicsPipeline, nullptr);
-  vkDestroyRenderPass(m->device, m->renderPass, nullptr);
-  vkDestroyPipelineLayout(m->device, m->pipelineLayout, nullptr);
-  vkDestroyDevice(m->device, nullptr);
-  vkDestroySurfaceKHR(m->instance, m->surface, nullptr);
-  vkDestroyInstance(m->instance, nullptr);
-  glfwDestroyWindow(m->window);
-  glfwTerminate();
+    my_vk_destroy_object(m, VK_OBJECT_TYPE_SEMAPHORE,
+                         (uint64_t)m->imageAvailableSemaphores[i]);
+    my_vk_destroy_object(m, VK_OBJECT_TYPE_SEMAPHORE,
+                         (uint64_t)m->renderFinishedSemaphores[i]);
+  }
+  my_vk_destroy_object(m, VK_OBJECT_TYPE_SEMAPHORE, (uint64_t)m->frameTimeline);
+  my_vk_profiler_deinit(m);
+  my_vk_destroy_record_jobs(m);
+  my_vk_destroy_async_compute(m);
+  my_vk_destroy_instancing(m);
+  my_vk_destroy_scene(m);
+  my_vk_destroy_culling(m);
+  my_vk_destroy_bindless(m);
+  my_vk_destroy_draw_objects(m);
+  my_vk_destroy_textures(m);
+  my_vk_destroy_samplers(m);
+  my_vk_destroy_buffer(m, &m->vertexBuffer);
+  my_vk_destroy_buffer(m, &m->indexBuffer);
+  my_vk_destroy_staging(m);
+  my_vk_destroy_frame_arenas(m);
+  my_vk_save_pipeline_cache(m);
+  my_vk_destroy_object(m, VK_OBJECT_TYPE_PIPELINE_CACHE,
+                       (uint64_t)m->pipelineCache);
+  my_vk_destroy_object(m, VK_OBJECT_TYPE_COMMAND_POOL,
+                       (uint64_t)m->commandPool);
+  my_vk_destroy_object(m, VK_OBJECT_TYPE_PIPELINE,
+                       (uint64_t)m->graphicsPipeline);
+  my_vk_destroy_object(m, VK_OBJECT_TYPE_RENDER_PASS, (uint64_t)m->renderPass);
+  my_vk_destroy_object(m, VK_OBJECT_TYPE_PIPELINE_LAYOUT,
+                       (uint64_t)m->pipelineLayout);
+  if (m->opts.profile) {
+    my_vk_allocator_print(m);
+  }
+  my_vk_allocator_destroy(m);
+  my_vk_print_handles(m, true);
+  free(m->tracker.handles);
+  my_vk_destroy_context(m);
 
   return 0;
 }
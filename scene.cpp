@@ -0,0 +1,387 @@
+#include "scene.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#if defined(__SSE__)
+#define SCENE_HAVE_SSE
+#include <immintrin.h>
+#endif
+#if defined(__AVX2__) && defined(__FMA__)
+#define SCENE_HAVE_AVX2
+#endif
+#if defined(__ARM_NEON) && defined(__aarch64__)
+#define SCENE_HAVE_NEON
+#include <arm_neon.h>
+#endif
+
+// below this many nodes a depth is done on the calling thread, waking the
+// others would take longer
+#define SCENE_MIN_PARALLEL 4096
+
+// The kernels compute out = a * b for column major 4x4 matrices, column j of
+// out is a's columns weighted by column j of b. out never aliases a or b.
+
+static inline void scene_mul_scalar(const float *a, const float *b,
+                                    float *out) {
+  for (int j = 0; j < 4; ++j) {
+    for (int r = 0; r < 4; ++r) {
+      out[4 * j + r] = a[r] * b[4 * j] + a[4 + r] * b[4 * j + 1] +
+                       a[8 + r] * b[4 * j + 2] + a[12 + r] * b[4 * j + 3];
+    }
+  }
+}
+
+#ifdef SCENE_HAVE_SSE
+static inline void scene_mul_sse(const float *a, const float *b, float *out) {
+  __m128 a0 = _mm_load_ps(a);
+  __m128 a1 = _mm_load_ps(a + 4);
+  __m128 a2 = _mm_load_ps(a + 8);
+  __m128 a3 = _mm_load_ps(a + 12);
+  for (int j = 0; j < 4; ++j) {
+    __m128 r = _mm_mul_ps(a0, _mm_set1_ps(b[4 * j]));
+    r = _mm_add_ps(r, _mm_mul_ps(a1, _mm_set1_ps(b[4 * j + 1])));
+    r = _mm_add_ps(r, _mm_mul_ps(a2, _mm_set1_ps(b[4 * j + 2])));
+    r = _mm_add_ps(r, _mm_mul_ps(a3, _mm_set1_ps(b[4 * j + 3])));
+    _mm_store_ps(out + 4 * j, r);
+  }
+}
+#endif
+
+#ifdef SCENE_HAVE_AVX2
+// two columns of out at once: a's columns are repeated in both halves and
+// each half of b's shuffles picks the weights of its own column
+static inline void scene_mul_avx2(const float *a, const float *b,
+                                  float *out) {
+  __m256 a0 = _mm256_broadcast_ps((const __m128 *)a);
+  __m256 a1 = _mm256_broadcast_ps((const __m128 *)(a + 4));
+  __m256 a2 = _mm256_broadcast_ps((const __m128 *)(a + 8));
+  __m256 a3 = _mm256_broadcast_ps((const __m128 *)(a + 12));
+  for (int j = 0; j < 4; j += 2) {
+    __m256 w = _mm256_load_ps(b + 4 * j);
+    __m256 r = _mm256_mul_ps(a0, _mm256_shuffle_ps(w, w, 0x00));
+    r = _mm256_fmadd_ps(a1, _mm256_shuffle_ps(w, w, 0x55), r);
+    r = _mm256_fmadd_ps(a2, _mm256_shuffle_ps(w, w, 0xaa), r);
+    r = _mm256_fmadd_ps(a3, _mm256_shuffle_ps(w, w, 0xff), r);
+    _mm256_store_ps(out + 4 * j, r);
+  }
+}
+#endif
+
+#ifdef SCENE_HAVE_NEON
+static inline void scene_mul_neon(const float *a, const float *b,
+                                  float *out) {
+  float32x4_t a0 = vld1q_f32(a);
+  float32x4_t a1 = vld1q_f32(a + 4);
+  float32x4_t a2 = vld1q_f32(a + 8);
+  float32x4_t a3 = vld1q_f32(a + 12);
+  for (int j = 0; j < 4; ++j) {
+    float32x4_t w = vld1q_f32(b + 4 * j);
+    float32x4_t r = vmulq_laneq_f32(a0, w, 0);
+    r = vfmaq_laneq_f32(r, a1, w, 1);
+    r = vfmaq_laneq_f32(r, a2, w, 2);
+    r = vfmaq_laneq_f32(r, a3, w, 3);
+    vst1q_f32(out + 4 * j, r);
+  }
+}
+#endif
+
+typedef void (*SceneJob)(Scene *s, uint32_t thread, uint32_t begin,
+                         uint32_t end);
+
+// one depth's share of a thread. The parents are a depth up and already
+// done, so a node is dirty if it or its parent is.
+template <void (*MUL)(const float *, const float *, float *)>
+static void scene_propagate(Scene *s, uint32_t thread, uint32_t begin,
+                            uint32_t end) {
+  SceneWorkers *w = &s->workers;
+  uint32_t lo = w->changed_begin[thread], hi = w->changed_end[thread];
+  for (uint32_t i = begin; i < end; ++i) {
+    uint32_t p = s->parent[i];
+    if (p != SCENE_NO_PARENT && s->dirty[p]) {
+      s->dirty[i] = 1;
+    }
+    if (!s->dirty[i]) {
+      continue;
+    }
+    if (p == SCENE_NO_PARENT) {
+      s->world[i] = s->local[i];
+    } else {
+      MUL(&s->world[p][0][0], &s->local[i][0][0], &s->world[i][0][0]);
+    }
+    lo = std::min(lo, i);
+    hi = std::max(hi, i + 1);
+  }
+  w->changed_begin[thread] = lo;
+  w->changed_end[thread] = hi;
+}
+
+static SceneJob scene_propagate_job(SceneKernel kernel) {
+  switch (kernel) {
+#ifdef SCENE_HAVE_SSE
+  case SCENE_KERNEL_SSE:
+    return scene_propagate<scene_mul_sse>;
+#endif
+#ifdef SCENE_HAVE_AVX2
+  case SCENE_KERNEL_AVX2:
+    return scene_propagate<scene_mul_avx2>;
+#endif
+#ifdef SCENE_HAVE_NEON
+  case SCENE_KERNEL_NEON:
+    return scene_propagate<scene_mul_neon>;
+#endif
+  default:
+    return scene_propagate<scene_mul_scalar>;
+  }
+}
+
+// copies what changed to the upload, and clears the dirty flags, which are
+// all inside the changed range
+static void scene_finish(Scene *s, uint32_t thread, uint32_t begin,
+                         uint32_t end) {
+  if (s->upload != NULL && begin < end) {
+    memcpy(s->upload + begin, s->world + begin,
+           sizeof(glm::mat4) * (end - begin));
+  }
+  memset(s->dirty + begin, 0, end - begin);
+}
+
+// a chunk per thread, cut at multiples of 64 nodes counted from the start of
+// the (64 byte aligned) dirty flags, so no two threads write the same cache
+// line of them even when the range itself starts mid line
+static void scene_run_chunk(Scene *s, uint32_t thread) {
+  SceneWorkers *w = &s->workers;
+  uint32_t base = w->begin & ~63u;
+  uint32_t n = w->end - base;
+  uint32_t chunk = ((n + w->count - 1) / w->count + 63) & ~63u;
+  uint32_t begin = std::min(std::max(base + thread * chunk, w->begin), w->end);
+  uint32_t end = std::min(base + (thread + 1) * chunk, w->end);
+  w->job(s, thread, begin, end);
+}
+
+static void scene_worker(Scene *s, uint32_t thread) {
+  SceneWorkers *w = &s->workers;
+  uint64_t seen = 0;
+  for (;;) {
+    {
+      std::unique_lock<std::mutex> lock(w->mutex);
+      w->start_cv.wait(lock,
+                       [&] { return w->quit || w->generation != seen; });
+      if (w->quit) {
+        return;
+      }
+      seen = w->generation;
+    }
+    scene_run_chunk(s, thread);
+    std::lock_guard<std::mutex> lock(w->mutex);
+    if (--w->remaining == 0) {
+      w->done_cv.notify_one();
+    }
+  }
+}
+
+// runs job over begin..end on all threads, and returns when they are done
+static void scene_run(Scene *s, SceneJob job, uint32_t begin, uint32_t end) {
+  SceneWorkers *w = &s->workers;
+  if (w->count == 1 || end - begin < SCENE_MIN_PARALLEL) {
+    job(s, 0, begin, end);
+    return;
+  }
+  {
+    std::lock_guard<std::mutex> lock(w->mutex);
+    w->job = job;
+    w->begin = begin;
+    w->end = end;
+    w->remaining = w->count - 1;
+    ++w->generation;
+  }
+  w->start_cv.notify_all();
+  scene_run_chunk(s, 0);
+  std::unique_lock<std::mutex> lock(w->mutex);
+  w->done_cv.wait(lock, [&] { return w->remaining == 0; });
+}
+
+static void *scene_alloc(size_t size) {
+  // aligned_alloc wants a multiple of the alignment
+  return aligned_alloc(64, (size + 63) & ~(size_t)63);
+}
+
+bool scene_create(Scene *s, uint32_t count, uint32_t threads, uint32_t seed) {
+  s->count = count;
+  s->parent = (uint32_t *)scene_alloc(sizeof(uint32_t) * count);
+  s->local = (glm::mat4 *)scene_alloc(sizeof(glm::mat4) * count);
+  s->world = (glm::mat4 *)scene_alloc(sizeof(glm::mat4) * count);
+  s->dirty = (uint8_t *)scene_alloc(count);
+  if (s->parent == NULL || s->local == NULL || s->world == NULL ||
+      s->dirty == NULL) {
+    printf("ERROR: could not allocate a scene of %u nodes!\n", count);
+    s->workers.count = 1;
+    scene_destroy(s);
+    return false;
+  }
+
+  // the roots, then four times as many nodes at each depth below, the
+  // deepest one takes what is left
+  uint32_t size = std::max(count >> 14, 1u);
+  uint32_t start = 0;
+  s->level_count = 0;
+  while (start < count) {
+    if (s->level_count == SCENE_MAX_DEPTH - 1) {
+      size = count - start;
+    }
+    size = std::min(size, count - start);
+    s->level_start[s->level_count++] = start;
+    start += size;
+    size *= 4;
+  }
+  s->level_start[s->level_count] = count;
+
+  // children spread evenly over the depth above, in the order of their
+  // parents, so a depth reads the one above front to back
+  for (uint32_t i = 0; i < s->level_start[std::min(1u, s->level_count)];
+       ++i) {
+    s->parent[i] = SCENE_NO_PARENT;
+  }
+  for (uint32_t d = 1; d < s->level_count; ++d) {
+    uint32_t above = s->level_start[d - 1];
+    uint32_t above_count = s->level_start[d] - above;
+    uint32_t here_count = s->level_start[d + 1] - s->level_start[d];
+    for (uint32_t i = 0; i < here_count; ++i) {
+      s->parent[s->level_start[d] + i] =
+          above + (uint32_t)((uint64_t)i * above_count / here_count);
+    }
+  }
+
+  // rotated, scaled down and moved in the xy plane
+  uint32_t state = seed;
+  auto next = [&]() {
+    state = state * 1664525u + 1013904223u;
+    return (state >> 8) * (1.0f / 16777216.0f);
+  };
+  for (uint32_t i = 0; i < count; ++i) {
+    float angle = next() * 6.2831853f;
+    float scale = 0.5f + 0.5f * next();
+    float c = cosf(angle) * scale, sn = sinf(angle) * scale;
+    s->local[i] = glm::mat4(1.0f);
+    s->local[i][0] = glm::vec4(c, sn, 0.0f, 0.0f);
+    s->local[i][1] = glm::vec4(-sn, c, 0.0f, 0.0f);
+    s->local[i][3] = glm::vec4(next() * 2.0f - 1.0f, next() * 2.0f - 1.0f,
+                               0.0f, 1.0f);
+  }
+  memset(s->dirty, 1, count);
+  s->kernel = scene_best_kernel();
+  s->upload = NULL;
+  s->changed_begin = 0;
+  s->changed_end = 0;
+
+  SceneWorkers *w = &s->workers;
+  w->count = threads != 0 ? threads : std::thread::hardware_concurrency();
+  w->count = std::min(std::max(w->count, 1u), (uint32_t)SCENE_MAX_THREADS);
+  w->generation = 0;
+  w->quit = false;
+  for (uint32_t i = 1; i < w->count; ++i) {
+    w->threads[i] = std::thread(scene_worker, s, i);
+  }
+  return true;
+}
+
+void scene_destroy(Scene *s) {
+  SceneWorkers *w = &s->workers;
+  {
+    std::lock_guard<std::mutex> lock(w->mutex);
+    w->quit = true;
+  }
+  w->start_cv.notify_all();
+  for (uint32_t i = 1; i < w->count; ++i) {
+    w->threads[i].join();
+  }
+  w->count = 0;
+  free(s->parent);
+  free(s->local);
+  free(s->world);
+  free(s->dirty);
+  s->parent = NULL;
+  s->local = NULL;
+  s->world = NULL;
+  s->dirty = NULL;
+  s->count = 0;
+}
+
+void scene_set_local(Scene *s, uint32_t node, const glm::mat4 &local) {
+  s->local[node] = local;
+  s->dirty[node] = 1;
+}
+
+void scene_update(Scene *s) {
+  SceneWorkers *w = &s->workers;
+  for (uint32_t i = 0; i < w->count; ++i) {
+    w->changed_begin[i] = UINT32_MAX;
+    w->changed_end[i] = 0;
+  }
+  SceneJob job = scene_propagate_job(s->kernel);
+  for (uint32_t d = 0; d < s->level_count; ++d) {
+    scene_run(s, job, s->level_start[d], s->level_start[d + 1]);
+  }
+  s->changed_begin = UINT32_MAX;
+  s->changed_end = 0;
+  for (uint32_t i = 0; i < w->count; ++i) {
+    s->changed_begin = std::min(s->changed_begin, w->changed_begin[i]);
+    s->changed_end = std::max(s->changed_end, w->changed_end[i]);
+  }
+  if (s->changed_begin >= s->changed_end) {
+    s->changed_begin = 0;
+    s->changed_end = 0;
+    return;
+  }
+  scene_run(s, scene_finish, s->changed_begin, s->changed_end);
+}
+
+bool scene_kernel_available(SceneKernel kernel) {
+  switch (kernel) {
+  case SCENE_KERNEL_SCALAR:
+    return true;
+#ifdef SCENE_HAVE_SSE
+  case SCENE_KERNEL_SSE:
+    return true;
+#endif
+#ifdef SCENE_HAVE_AVX2
+  case SCENE_KERNEL_AVX2:
+    return true;
+#endif
+#ifdef SCENE_HAVE_NEON
+  case SCENE_KERNEL_NEON:
+    return true;
+#endif
+  default:
+    return false;
+  }
+}
+
+SceneKernel scene_best_kernel() {
+  const SceneKernel order[] = {SCENE_KERNEL_AVX2, SCENE_KERNEL_SSE,
+                               SCENE_KERNEL_NEON};
+  for (SceneKernel kernel : order) {
+    if (scene_kernel_available(kernel)) {
+      return kernel;
+    }
+  }
+  return SCENE_KERNEL_SCALAR;
+}
+
+const char *scene_kernel_name(SceneKernel kernel) {
+  switch (kernel) {
+  case SCENE_KERNEL_SCALAR:
+    return "scalar";
+  case SCENE_KERNEL_SSE:
+    return "sse";
+  case SCENE_KERNEL_AVX2:
+    return "avx2";
+  case SCENE_KERNEL_NEON:
+    return "neon";
+  default:
+    return "unknown";
+  }
+}
@@ -0,0 +1,79 @@
+// A transform hierarchy as structure of arrays, sorted by depth: every parent
+// comes before its children, the nodes of one depth are a contiguous range
+// and within it they are ordered by parent. An update propagates the
+// local-to-world matrices of dirty nodes, and of everything under them, one
+// depth at a time. Each depth is split across threads and multiplied with
+// the widest SIMD kernel that was compiled in.
+#pragma once
+
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <thread>
+
+#include <glm/mat4x4.hpp>
+
+#define SCENE_MAX_DEPTH 16
+#define SCENE_MAX_THREADS 32
+#define SCENE_NO_PARENT UINT32_MAX
+
+// scalar is always there, the others if the compiler targets them. Build
+// with SCENE_AVX2 in cmake for the avx2 one.
+enum SceneKernel {
+  SCENE_KERNEL_SCALAR,
+  SCENE_KERNEL_SSE,
+  SCENE_KERNEL_AVX2,
+  SCENE_KERNEL_NEON,
+  SCENE_KERNEL_COUNT,
+};
+
+struct Scene;
+
+// thread 0 is the one calling scene_update, the others wait for a range
+struct SceneWorkers {
+  std::thread threads[SCENE_MAX_THREADS];
+  uint32_t count; // including the calling thread
+  std::mutex mutex;
+  std::condition_variable start_cv, done_cv;
+  uint64_t generation; // bumped to hand the helpers a new range
+  uint32_t remaining;  // helpers that haven't finished it
+  bool quit;
+
+  // what the current generation does, thread i gets the i-th chunk
+  void (*job)(Scene *s, uint32_t thread, uint32_t begin, uint32_t end);
+  uint32_t begin, end;
+  // first and last + 1 node whose world matrix each thread changed
+  uint32_t changed_begin[SCENE_MAX_THREADS], changed_end[SCENE_MAX_THREADS];
+};
+
+struct Scene {
+  uint32_t count;
+  uint32_t level_count;
+  // depth d is nodes level_start[d]..level_start[d + 1]
+  uint32_t level_start[SCENE_MAX_DEPTH + 1];
+  uint32_t *parent; // SCENE_NO_PARENT for the roots
+  glm::mat4 *local; // cache line aligned, like world
+  glm::mat4 *world;
+  uint8_t *dirty; // local changed since the last update
+
+  SceneKernel kernel;
+  SceneWorkers workers;
+  // where an update copies the world matrices it changed, at the same
+  // index, or NULL
+  glm::mat4 *upload;
+  // nodes whose world matrix the last update changed, as one range
+  uint32_t changed_begin, changed_end;
+};
+
+// count nodes, roots about every 16k and four children per parent, with
+// random local transforms. Updates run on threads threads, 0 = all cores.
+bool scene_create(Scene *s, uint32_t count, uint32_t threads, uint32_t seed);
+void scene_destroy(Scene *s);
+
+void scene_set_local(Scene *s, uint32_t node, const glm::mat4 &local);
+// recomputes the world matrices of dirty nodes and their descendants
+void scene_update(Scene *s);
+
+bool scene_kernel_available(SceneKernel kernel);
+SceneKernel scene_best_kernel();
+const char *scene_kernel_name(SceneKernel kernel);
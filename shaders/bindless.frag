@@ -0,0 +1,27 @@
+#version 450
+#extension GL_EXT_nonuniform_qualifier : require
+
+layout(location = 0) in vec3 fragColor;
+layout(location = 1) in vec2 fragUv;
+
+// every texture and every object's data, the draw says which ones it uses
+layout(set = 1, binding = 0) uniform sampler2D textures[];
+// matches GpuDrawData in main.cpp
+layout(set = 1, binding = 1) readonly buffer DrawData {
+    vec4 tint;
+} draw_data[];
+
+// matches BindlessPush in main.cpp, the same for the whole draw. The vertex
+// shader's MeshPush comes first.
+layout(push_constant) uniform Push {
+    layout(offset = 16) uint texture_index;
+    uint draw_data_index;
+} push;
+
+layout(location = 0) out vec4 outColor;
+
+void main() {
+    vec3 texel = texture(textures[push.texture_index], fragUv).rgb;
+    vec3 tint = draw_data[push.draw_data_index].tint.rgb;
+    outColor = vec4(fragColor * texel * tint, 1.0);
+}
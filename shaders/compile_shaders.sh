@@ -1,4 +1,10 @@
-
 # glslc segfaults on my machine currently, so...
-glslang -V --target-env vulkan1.3 shader.vert 
-glslang -V --target-env vulkan1.3 shader.frag
+# (cmake does this too, into build/shaders)
+glslang -V --target-env vulkan1.3 shader.vert -o shader.vert.spv
+glslang -V --target-env vulkan1.3 shader.frag -o shader.frag.spv
+glslang -V --target-env vulkan1.3 instanced.vert -o instanced.vert.spv
+glslang -V --target-env vulkan1.3 instance_prepass.comp -o instance_prepass.comp.spv
+glslang -V --target-env vulkan1.3 hiz_build.comp -o hiz_build.comp.spv
+glslang -V --target-env vulkan1.3 textured.vert -o textured.vert.spv
+glslang -V --target-env vulkan1.3 textured.frag -o textured.frag.spv
+glslang -V --target-env vulkan1.3 bindless.frag -o bindless.frag.spv
@@ -0,0 +1,28 @@
+#version 450
+
+layout(location = 0) in vec2 inPosition;
+layout(location = 1) in vec3 inColor;
+
+struct Instance {
+    vec4 sphere; // xyz center, w radius
+    vec4 color;
+};
+
+// either all instances or the ones the pre-pass kept, indexed by the draw
+layout(std430, set = 0, binding = 0) readonly buffer Instances {
+    Instance instances[];
+};
+
+layout(push_constant) uniform PushConstants {
+    vec4 view; // xy offset, z zoom
+} pc;
+
+layout(location = 0) out vec3 fragColor;
+
+void main() {
+    Instance inst = instances[gl_InstanceIndex];
+    vec2 pos = inst.sphere.xy + inPosition * inst.sphere.w;
+    // instances are flat, at the depth of their center
+    gl_Position = vec4((pos - pc.view.xy) * pc.view.z, inst.sphere.z, 1.0);
+    fragColor = inColor * inst.color.rgb;
+}
@@ -1,20 +1,24 @@
 #version 450
 
-layout(location = 0) out vec3 fragColor;
+layout(location = 0) in vec2 inPosition;
+layout(location = 1) in vec3 inColor;
+
+// matches GpuFrameData in main.cpp, at a new offset every frame
+layout(set = 0, binding = 0) uniform Frame {
+    mat4 view_proj;
+    vec4 time;
+    vec4 clear;
+} frame;
 
-vec2 positions[3] = vec2[](
-    vec2(0.0, -0.5),
-    vec2(0.5, 0.5),
-    vec2(-0.5, 0.5)
-);
+// matches MeshPush in main.cpp
+layout(push_constant) uniform Push {
+    vec4 transform; // xy offset, z scale
+} push;
 
-vec3 colors[3] = vec3[](
-    vec3(1.0, 0.0, 0.0),
-    vec3(0.0, 1.0, 0.0),
-    vec3(0.0, 0.0, 1.0)
-);
+layout(location = 0) out vec3 fragColor;
 
 void main() {
-    gl_Position = vec4(positions[gl_VertexIndex], 0.0, 1.0);
-    fragColor = colors[gl_VertexIndex];
+    vec2 pos = inPosition * push.transform.z + push.transform.xy;
+    gl_Position = frame.view_proj * vec4(pos, 0.0, 1.0);
+    fragColor = inColor;
 }
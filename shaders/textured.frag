@@ -0,0 +1,19 @@
+#version 450
+
+layout(location = 0) in vec3 fragColor;
+layout(location = 1) in vec2 fragUv;
+
+// only the resident mips are in the view, sampling clamps to those
+layout(set = 1, binding = 0) uniform sampler2D tex;
+
+// matches GpuDrawData in main.cpp
+layout(set = 2, binding = 0) readonly buffer DrawData {
+    vec4 tint;
+} draw_data;
+
+layout(location = 0) out vec4 outColor;
+
+void main() {
+    vec3 texel = texture(tex, fragUv).rgb;
+    outColor = vec4(fragColor * texel * draw_data.tint.rgb, 1.0);
+}
@@ -0,0 +1,27 @@
+#version 450
+
+layout(location = 0) in vec2 inPosition;
+layout(location = 1) in vec3 inColor;
+
+// matches GpuFrameData in main.cpp, at a new offset every frame
+layout(set = 0, binding = 0) uniform Frame {
+    mat4 view_proj;
+    vec4 time;
+    vec4 clear;
+} frame;
+
+// matches MeshPush in main.cpp
+layout(push_constant) uniform Push {
+    vec4 transform; // xy offset, z scale
+} push;
+
+layout(location = 0) out vec3 fragColor;
+layout(location = 1) out vec2 fragUv;
+
+void main() {
+    vec2 pos = inPosition * push.transform.z + push.transform.xy;
+    gl_Position = frame.view_proj * vec4(pos, 0.0, 1.0);
+    fragColor = inColor;
+    // the mesh has no uvs, the texture is stretched over the screen
+    fragUv = inPosition * 0.5 + 0.5;
+}
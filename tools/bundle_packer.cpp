@@ -0,0 +1,177 @@
+// packs files into an asset bundle, see bundle.h for the format
+//
+// usage: bundle_packer [--lz4] OUT NAME=PATH...
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <unistd.h>
+
+#ifdef HAVE_LZ4
+#include <lz4.h>
+#endif
+
+#include "../bundle.h"
+
+struct PackInput {
+  const char *name;
+  char *data; // what gets written, compressed or not
+  uint64_t size;
+  uint64_t raw_size;
+  uint32_t compression;
+};
+
+char *read_file(const char *path, uint64_t *size) {
+  FILE *file = fopen(path, "rb");
+  if (file == NULL) {
+    printf("ERROR: could not open %s!\n", path);
+    return NULL;
+  }
+  fseek(file, 0L, SEEK_END);
+  long len = ftell(file);
+  rewind(file);
+  char *buf = len >= 0 ? (char *)malloc(len > 0 ? len : 1) : NULL;
+  if (buf == NULL || fread(buf, 1, len, file) != (size_t)len) {
+    printf("ERROR: could not read %s!\n", path);
+    free(buf);
+    fclose(file);
+    return NULL;
+  }
+  fclose(file);
+  *size = len;
+  return buf;
+}
+
+#ifdef HAVE_LZ4
+// compresses chunk by chunk, keeps the input as is if that doesn't save
+// anything
+void compress_lz4(PackInput *in) {
+  uint32_t chunk_count =
+      (uint32_t)((in->raw_size + BUNDLE_CHUNK_SIZE - 1) / BUNDLE_CHUNK_SIZE);
+  size_t capacity = sizeof(uint32_t) * chunk_count +
+                    (size_t)chunk_count * LZ4_compressBound(BUNDLE_CHUNK_SIZE);
+  char *out = (char *)malloc(capacity);
+  uint32_t *chunk_sizes = (uint32_t *)out;
+  char *dst = out + sizeof(uint32_t) * chunk_count;
+  for (uint32_t i = 0; i < chunk_count; ++i) {
+    uint64_t begin = (uint64_t)i * BUNDLE_CHUNK_SIZE;
+    uint64_t raw = in->raw_size - begin < BUNDLE_CHUNK_SIZE
+                       ? in->raw_size - begin
+                       : BUNDLE_CHUNK_SIZE;
+    int packed = LZ4_compress_default(in->data + begin, dst, (int)raw,
+                                      LZ4_compressBound((int)raw));
+    chunk_sizes[i] = (uint32_t)packed;
+    dst += packed;
+  }
+  uint64_t size = dst - out;
+  if (size >= in->raw_size) {
+    free(out);
+    return;
+  }
+  free(in->data);
+  in->data = out;
+  in->size = size;
+  in->compression = BUNDLE_COMPRESSION_LZ4;
+}
+#endif
+
+uint64_t align_up(uint64_t x) {
+  return (x + BUNDLE_ALIGNMENT - 1) / BUNDLE_ALIGNMENT * BUNDLE_ALIGNMENT;
+}
+
+int main(int argc, char **argv) {
+  int arg = 1;
+  bool lz4 = false;
+  if (arg < argc && strcmp(argv[arg], "--lz4") == 0) {
+    lz4 = true;
+    ++arg;
+  }
+  if (argc - arg < 2) {
+    printf("usage: %s [--lz4] OUT NAME=PATH...\n", argv[0]);
+    return 1;
+  }
+#ifndef HAVE_LZ4
+  if (lz4) {
+    printf("built without lz4, storing everything uncompressed\n");
+    lz4 = false;
+  }
+#endif
+  const char *out_path = argv[arg++];
+  uint32_t count = argc - arg;
+  PackInput *inputs = (PackInput *)calloc(count, sizeof(PackInput));
+  for (uint32_t i = 0; i < count; ++i) {
+    char *spec = argv[arg + i];
+    char *eq = strchr(spec, '=');
+    if (eq == NULL || eq - spec >= BUNDLE_NAME_SIZE || eq == spec) {
+      printf("ERROR: `%s` is not NAME=PATH with a name shorter than %d!\n",
+             spec, BUNDLE_NAME_SIZE);
+      return 1;
+    }
+    *eq = '\0';
+    PackInput *in = &inputs[i];
+    in->name = spec;
+    in->data = read_file(eq + 1, &in->raw_size);
+    if (in->data == NULL) {
+      return 1;
+    }
+    in->size = in->raw_size;
+    in->compression = BUNDLE_COMPRESSION_NONE;
+#ifdef HAVE_LZ4
+    if (lz4 && in->raw_size > 0) {
+      compress_lz4(in);
+    }
+#endif
+  }
+
+  BundleHeader header{};
+  header.magic = BUNDLE_MAGIC;
+  header.version = BUNDLE_VERSION;
+  header.entry_count = count;
+  BundleEntry *entries = (BundleEntry *)calloc(count, sizeof(BundleEntry));
+  uint64_t offset =
+      align_up(sizeof(BundleHeader) + sizeof(BundleEntry) * (uint64_t)count);
+  for (uint32_t i = 0; i < count; ++i) {
+    strncpy(entries[i].name, inputs[i].name, BUNDLE_NAME_SIZE - 1);
+    entries[i].offset = offset;
+    entries[i].size = inputs[i].size;
+    entries[i].raw_size = inputs[i].raw_size;
+    entries[i].compression = inputs[i].compression;
+    offset = align_up(offset + inputs[i].size);
+  }
+
+  // written next to it and renamed, a build never leaves half a bundle
+  char tmp_path[4096];
+  snprintf(tmp_path, sizeof(tmp_path), "%s.%d.tmp", out_path, (int)getpid());
+  FILE *file = fopen(tmp_path, "wb");
+  if (file == NULL) {
+    printf("ERROR: could not open %s for writing!\n", tmp_path);
+    return 1;
+  }
+  static const char zeros[BUNDLE_ALIGNMENT] = {};
+  bool ok = fwrite(&header, sizeof(header), 1, file) == 1;
+  ok = ok && fwrite(entries, sizeof(BundleEntry), count, file) == count;
+  for (uint32_t i = 0; ok && i < count; ++i) {
+    long pad = (long)entries[i].offset - ftell(file);
+    ok = fwrite(zeros, 1, pad, file) == (size_t)pad;
+    ok = ok && fwrite(inputs[i].data, 1, inputs[i].size, file) ==
+                   inputs[i].size;
+  }
+  long file_size = ftell(file);
+  ok = fclose(file) == 0 && ok;
+  if (!ok || rename(tmp_path, out_path) != 0) {
+    printf("ERROR: could not write %s!\n", out_path);
+    remove(tmp_path);
+    return 1;
+  }
+
+  uint64_t raw_total = 0;
+  for (uint32_t i = 0; i < count; ++i) {
+    raw_total += inputs[i].raw_size;
+    free(inputs[i].data);
+  }
+  printf("packed %u files, %llu bytes into %ld bytes of %s\n", count,
+         (unsigned long long)raw_total, file_size, out_path);
+  free(inputs);
+  free(entries);
+  return 0;
+}